@@ -0,0 +1,301 @@
+/*
+ * benchmark.cpp
+ *
+ * Created: 18/10/2026 13:31:40
+ * Author : joaob
+ */ 
+
+#include <main.h>
+
+#ifdef BENCHMARK
+
+uint8_t g_ubBenchBuf[BENCHMARK_BUFFER_SIZE];
+volatile uint16_t g_usBenchStamp = 0;
+
+extern uint8_t g_ubSPIFlashOK; // Set by SPI_FLASH::Init() at the start of main(), before runBenchmarks (in init() .init4 would clear the flash state again)
+
+void benchmarkReport(const char* pszName, uint32_t ulTicks, uint32_t ulBytes)
+{
+	uint32_t cycles = ulTicks * TIMER_PRESCALER;
+	uint32_t micros = ulTicks / TIMER_TICKS_PER_US;
+	uint32_t byteRate = (micros >= 100) ? (ulBytes * 10000UL) / (micros / 100) : 0; // Bytes per second
+	
+	DPRINTFLN_CTX("%s: %lu cycles for %lu bytes [%lu.%02lu cycles/byte] [%lu B/s]", pszName, cycles, ulBytes, cycles / ulBytes, ((cycles % ulBytes) * 100) / ulBytes, byteRate);
+}
+
+void benchmarkCRC()
+{
+	for(uint16_t i = 0; i < BENCHMARK_BUFFER_SIZE; i++)
+		g_ubBenchBuf[i] = i * 7 + 3;
+	
+	uint32_t start = TIMER::GetTicks();
+	uint32_t crc32 = CRC32_INIT;
+	
+	for(uint8_t r = 0; r < BENCHMARK_ROUNDS; r++)
+		crc32 = CRC32::Update(crc32, g_ubBenchBuf, BENCHMARK_BUFFER_SIZE);
+	
+	uint32_t ticks32 = TIMER::GetTicks() - start;
+	
+	start = TIMER::GetTicks();
+	uint16_t crc16 = 0;
+	
+	for(uint8_t r = 0; r < BENCHMARK_ROUNDS; r++)
+		for(uint16_t i = 0; i < BENCHMARK_BUFFER_SIZE; i++) // Same loop as calcCRC16/validateConfig
+			crc16 = _crc16_update(crc16, g_ubBenchBuf[i]);
+	
+	uint32_t ticks16 = TIMER::GetTicks() - start;
+	
+	DPRINTFLN_CTX("CRC32 [0x%08lX] CRC16 [0x%04X]", CRC32::Final(crc32), crc16);
+	benchmarkReport("CRC32 table", ticks32, (uint32_t)BENCHMARK_BUFFER_SIZE * BENCHMARK_ROUNDS);
+	benchmarkReport("CRC16 bitwise", ticks16, (uint32_t)BENCHMARK_BUFFER_SIZE * BENCHMARK_ROUNDS);
+}
+
+void benchmarkSPI()
+{
+	// Flash is not selected, only the SPI clock runs, same timing as SPI_FLASH::Read
+	uint32_t start = TIMER::GetTicks();
+	
+	for(uint8_t r = 0; r < BENCHMARK_ROUNDS; r++)
+		for(uint16_t i = 0; i < BENCHMARK_BUFFER_SIZE; i++) // Previous SPI::Transfer loop, one call per byte
+			g_ubBenchBuf[i] = SPI::TransferByte();
+	
+	uint32_t ticksByte = TIMER::GetTicks() - start;
+	
+	start = TIMER::GetTicks();
+	
+	for(uint8_t r = 0; r < BENCHMARK_ROUNDS; r++)
+		SPI::ReadBlock(g_ubBenchBuf, BENCHMARK_BUFFER_SIZE);
+	
+	uint32_t ticksBlock = TIMER::GetTicks() - start;
+	
+	benchmarkReport("SPI per byte", ticksByte, (uint32_t)BENCHMARK_BUFFER_SIZE * BENCHMARK_ROUNDS);
+	benchmarkReport("SPI block", ticksBlock, (uint32_t)BENCHMARK_BUFFER_SIZE * BENCHMARK_ROUNDS);
+}
+
+void benchmarkFlashRead()
+{
+	if(!g_ubSPIFlashOK)
+	{
+		DPRINTFLN_CTX("SPI Flash init NOK, skipping the flash read benchmark");
+		
+		return;
+	}
+	
+#ifdef SPI_USART_MSPIM
+	DPRINTFLN_CTX("Flash bus: USART MSPIM");
+#else
+	DPRINTFLN_CTX("Flash bus: SPI");
+#endif
+	
+	uint32_t size = (FLASH_MAX_ADDRESS < BENCHMARK_FLASH_READ_SIZE) ? FLASH_MAX_ADDRESS + 1 : BENCHMARK_FLASH_READ_SIZE;
+	uint32_t start = TIMER::GetTicks();
+	
+	for(uint32_t address = 0; address < size; address += BENCHMARK_BUFFER_SIZE) // Same chunking as a raw image load
+		SPI_FLASH::Read(address, g_ubBenchBuf, BENCHMARK_BUFFER_SIZE);
+	
+	benchmarkReport("SPI_FLASH::Read", TIMER::GetTicks() - start, size); // Same name on both buses, mbbench.py report lines the builds up
+}
+void benchmarkFlashStream()
+{
+	if(!g_ubSPIFlashOK)
+		return;
+	
+	// Small sequential reads, the pattern of header parsing and the decompressors
+	uint32_t start = TIMER::GetTicks();
+	
+	for(uint16_t i = 0; i < BENCHMARK_BUFFER_SIZE * BENCHMARK_ROUNDS; i += BENCHMARK_SMALL_READ)
+		SPI_FLASH::Read(i, g_ubBenchBuf, BENCHMARK_SMALL_READ);
+	
+	uint32_t ticksRead = TIMER::GetTicks() - start;
+	
+	start = TIMER::GetTicks();
+	
+	SPI_FLASH::StreamOpen(0);
+	
+	for(uint16_t i = 0; i < BENCHMARK_BUFFER_SIZE * BENCHMARK_ROUNDS; i += BENCHMARK_SMALL_READ)
+		SPI_FLASH::StreamRead(g_ubBenchBuf, BENCHMARK_SMALL_READ);
+	
+	SPI_FLASH::StreamClose();
+	
+	uint32_t ticksStream = TIMER::GetTicks() - start;
+	
+	benchmarkReport("SPI_FLASH::Read small", ticksRead, (uint32_t)BENCHMARK_BUFFER_SIZE * BENCHMARK_ROUNDS);
+	benchmarkReport("SPI_FLASH::StreamRead small", ticksStream, (uint32_t)BENCHMARK_BUFFER_SIZE * BENCHMARK_ROUNDS);
+}
+
+uint32_t benchmarkUARTReceive(uint32_t ulQuietTicks, uint16_t* pusReceived, uint16_t* pusWrong)
+{
+	// Reader side of a transfer, what a protocol on the RX FIFO does: take what arrived and look at every byte
+	uint32_t loops = 0;
+	uint32_t last = TIMER::GetTicks();
+	
+	while(*pusReceived < BENCHMARK_UART_BYTES && TIMER::GetTicks() - last < ulQuietTicks)
+	{
+		uint8_t count = DUART::ReadAvailable(g_ubBenchBuf, UART_FIFO_SIZE);
+		
+		if(count)
+			last = TIMER::GetTicks();
+		
+		for(uint8_t i = 0; i < count; i++, (*pusReceived)++)
+			if(g_ubBenchBuf[i] != (uint8_t)(*pusReceived * 7 + 3)) // Pattern sent by tools/mbbench.py
+				(*pusWrong)++;
+		
+		loops++;
+	}
+	
+	return loops;
+}
+void benchmarkUART()
+{
+#ifdef SOFTDEBUG
+	// A real transfer on the debug UART: tools/mbbench.py sends the pattern at the line rate, every byte goes through the RX interrupt
+	// The share of the CPU reception takes is how much slower the reader loop spins than with the line idle
+	uint16_t received = 0;
+	uint16_t wrong = 0;
+	
+	DFLUSH(); // No TX interrupts from here on
+	DUART::Flush();
+	
+	uint32_t start = TIMER::GetTicks();
+	uint32_t idleLoops = benchmarkUARTReceive(BENCHMARK_UART_IDLE_MS * 1000UL * TIMER_TICKS_PER_US, &received, &wrong);
+	uint32_t idleTicks = TIMER::GetTicks() - start;
+	
+	DPRINTFLN_CTX("UART RX: send %u bytes", BENCHMARK_UART_BYTES);
+	DFLUSH();
+	DUART::Flush();
+	
+	uint16_t overflows = DUART::m_usRXOverflows;
+	uint16_t frameErrors = DUART::m_usRXFrameErrors;
+	
+	start = TIMER::GetTicks();
+	
+	while(!DUART::BytesAvailable() && TIMER::GetTicks() - start < BENCHMARK_UART_WAIT_MS * 1000UL * TIMER_TICKS_PER_US);
+	
+	if(!DUART::BytesAvailable())
+	{
+		DPRINTFLN_CTX("UART RX: nothing received, skipped");
+	}
+	else
+	{
+		received = 0;
+		wrong = 0;
+		start = TIMER::GetTicks();
+		
+		uint32_t loops = benchmarkUARTReceive(BENCHMARK_UART_QUIET_MS * 1000UL * TIMER_TICKS_PER_US, &received, &wrong);
+		uint32_t ticks = TIMER::GetTicks() - start;
+		uint32_t idleRate = (idleLoops * 10000UL) / idleTicks; // Loops per 10000 ticks
+		uint32_t busyRate = (loops * 10000UL) / ticks;
+		uint16_t load = (busyRate < idleRate) ? 1000 - (busyRate * 1000UL) / idleRate : 0; // Per mille
+		
+		benchmarkReport("UART RX transfer", ticks, received);
+		DPRINTFLN_CTX("UART RX: %u of %u bytes, %u wrong, %u overflows, %u frame errors, reception took %u.%u%% of the CPU", received, BENCHMARK_UART_BYTES, wrong,
+			DUART::m_usRXOverflows - overflows, DUART::m_usRXFrameErrors - frameErrors, load / 10, load % 10);
+	}
+	
+	// Time spent in the logging call itself, the line fits the TX FIFO and goes out in the background
+	DFLUSH();
+	
+	start = TIMER::GetTicks();
+	
+	DPRINTFLN_CTX("TX FIFO timing line");
+	
+	uint32_t ticks = TIMER::GetTicks() - start;
+	
+	DFLUSH();
+	
+	DPRINTFLN_CTX("Logging call: %lu cycles", ticks * TIMER_PRESCALER);
+#endif
+}
+
+void benchmarkVectors()
+{
+	// Stand-in for a ROM IVT, every vector goes to a handler that stamps TCNT1 (RJMP + NOP keeps the 4 byte stride under relaxation)
+	asm volatile(
+		".balign 256							\n\t"
+		"__benchmark_vectors:					\n\t"
+		".rept %[count]							\n\t"
+		"	rjmp __benchmark_handler			\n\t"
+		"	nop									\n\t"
+		".endr									\n\t"
+		"__benchmark_handler:					\n\t"
+		"	push r24							\n\t"
+		"	lds r24, %[tcntl]					\n\t"
+		"	sts %[stamp], r24					\n\t"
+		"	lds r24, %[tcnth]					\n\t"
+		"	sts %[stamp] + 1, r24				\n\t"
+		"	pop r24								\n\t"
+		"	ret									\n\t"
+		:
+		: [count] "n" (DISPATCH_VECTOR_COUNT), [tcntl] "n" (_SFR_MEM_ADDR(TCNT1L)), [tcnth] "n" (_SFR_MEM_ADDR(TCNT1H)), [stamp] "i" (&g_usBenchStamp)
+	);
+}
+uint16_t benchmarkCall(uint32_t ulAddress)
+{
+	uint16_t start;
+	uint16_t wordAddress = ulAddress >> 1;
+	uint8_t ext = ulAddress >> 17;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// Same stack effect as the hardware entering a vector, the handler returns here
+		asm volatile(
+			"in __tmp_reg__, %[eind]		\n\t"
+			"push __tmp_reg__				\n\t"
+			"out %[eind], %[ext]			\n\t"
+			"mov r30, %A[addr]				\n\t"
+			"mov r31, %B[addr]				\n\t"
+			"lds %A[start], %[tcntl]		\n\t"
+			"lds %B[start], %[tcnth]		\n\t"
+			"eicall							\n\t"
+			"pop __tmp_reg__				\n\t"
+			"out %[eind], __tmp_reg__		\n\t"
+			: [start] "=&r" (start)
+			: [addr] "r" (wordAddress), [ext] "r" (ext), [eind] "I" (_SFR_IO_ADDR(EIND)), [tcntl] "n" (_SFR_MEM_ADDR(TCNT1L)), [tcnth] "n" (_SFR_MEM_ADDR(TCNT1H))
+			: "r30", "r31", "memory"
+		);
+	}
+	
+	return g_usBenchStamp - start;
+}
+void benchmarkDispatch()
+{
+	uint32_t vectors;
+	
+	asm(
+		"ldi %A0, lo8(__benchmark_vectors)	\n\t"
+		"ldi %B0, hi8(__benchmark_vectors)	\n\t"
+		"ldi %C0, hh8(__benchmark_vectors)	\n\t"
+		"ldi %D0, 0							\n\t"
+		: "=d" (vectors)
+	);
+	
+	uint8_t prescaler = TCCR1B;
+	
+	TCCR1B = (1 << CS10); // 1 tick = 1 cycle
+	
+	dispatchSetROM(vectors);
+	
+	uint16_t direct = benchmarkCall(vectors + 4); // Patched IVT, the vector itself is entered directly
+	uint16_t dispatched = benchmarkCall(dispatchStubsAddress() + DISPATCH_STUB_SIZE); // Dispatcher IVT, stub first
+	
+	TCCR1B = prescaler;
+	
+	// Both paths have the JMP at 0x00000, the dispatcher path also has the JMP in the ROM IVT (3 cycles) on top of this
+	DPRINTFLN_CTX("Vector entry: patched IVT %u cycles, dispatcher %u cycles [+%u cycles]", direct, dispatched, dispatched - direct);
+}
+
+void runBenchmarks()
+{
+	DPRINTFLN_CTX("Running benchmarks");
+	
+	benchmarkCRC();
+	benchmarkSPI();
+	benchmarkFlashRead();
+	benchmarkFlashStream();
+	benchmarkUART();
+	benchmarkDispatch();
+	
+	DPRINTFLN_CTX("Benchmarks done");
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+/*
+ * benchmark.h
+ *
+ * Created: 18/10/2026 13:31:40
+ *  Author: joaob
+ */ 
+
+
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <stdint.h>
+
+// Build with BENCHMARK (and SOFTDEBUG for the output) to run these before the boot config is read
+
+#define BENCHMARK_BUFFER_SIZE 256
+#define BENCHMARK_ROUNDS 16
+#define BENCHMARK_SMALL_READ 4 // Bytes per call of the small read benchmark
+#define BENCHMARK_FLASH_READ_SIZE 0x20000UL // 128 KB, less if the part is smaller
+#define BENCHMARK_UART_BYTES 1024 // Sent by tools/mbbench.py run
+#define BENCHMARK_UART_WAIT_MS 5000 // For the first byte
+#define BENCHMARK_UART_QUIET_MS 100 // Line quiet this long ends the transfer early
+#define BENCHMARK_UART_IDLE_MS 100 // Reader loop with nothing arriving
+
+// Functions
+void benchmarkReport(const char* pszName, uint32_t ulTicks, uint32_t ulBytes);
+
+void benchmarkCRC();
+void benchmarkSPI();
+void benchmarkFlashRead();
+void benchmarkFlashStream();
+uint32_t benchmarkUARTReceive(uint32_t ulQuietTicks, uint16_t* pusReceived, uint16_t* pusWrong);
+void benchmarkUART();
+
+void benchmarkVectors() __attribute__ ((naked)) __attribute__ ((used));
+uint16_t benchmarkCall(uint32_t ulAddress);
+void benchmarkDispatch();
+
+void runBenchmarks();
+
+#endif /* BENCHMARK_H_ */
\ No newline at end of file
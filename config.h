@@ -0,0 +1,61 @@
+/*
+ * config.h
+ *
+ * Created: 18/10/2026 16:02:31
+ *  Author: joaob
+ */ 
+
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stdint.h>
+#include <util/crc16.h>
+
+// Boot config shared with the applications, kept in the EEPROM (see journal.h)
+#define MAX_ROMS 5
+#define BOOT_MAGIC 0x5B
+
+#define BOOT_CONFIG_EE_ADDRESS ((void*)0xC00)
+
+// Structs & Enums
+enum boot_mode_t
+{
+	BOOT_MODE_NORMAL = 0,
+	BOOT_MODE_PIN,
+	BOOT_MODE_PIN_RESET,
+};
+enum boot_load_status_t
+{
+	BOOT_LOAD_STATUS_OFF = 0,
+	BOOT_LOAD_STATUS_ON,
+	BOOT_LOAD_STATUS_ERROR, // Staged image failed verification, not retried until the application stages a new one
+};
+
+struct boot_cfg_t
+{
+	uint8_t m_ubMagic;
+	uint8_t m_ubVersion;
+	boot_mode_t m_ubMode;
+	boot_load_status_t m_ubLoadStatus;
+	uint8_t m_ubCurrentROM;
+	uint8_t m_ubNormalROM;
+	uint8_t m_ubPinROM;
+	uint8_t m_ubLoadROM;
+	uint8_t m_ubROMCount;
+	uint32_t m_ulROMAddress[MAX_ROMS];
+	uint32_t m_ulLoadROMFlashAddress;
+	uint32_t m_ulLoadROMSize;
+	uint16_t m_usCRC;
+};
+
+// Functions
+inline void calcCRC16(boot_cfg_t* pConfig)
+{
+	pConfig->m_usCRC = 0;
+	
+	for(uint16_t i = 0; i < sizeof(boot_cfg_t) - sizeof(uint16_t); i++)
+		pConfig->m_usCRC = _crc16_update(pConfig->m_usCRC, ((uint8_t*)pConfig)[i]);
+}
+
+#endif /* CONFIG_H_ */
\ No newline at end of file
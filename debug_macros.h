@@ -8,18 +8,39 @@
 #ifdef SOFTDEBUG
 	#include <UART/UART.h>
 	
-	#define DUART UART1
+	#ifndef DUART_PORT
+		#define DUART_PORT 1
+	#endif
+	
+	#ifndef DUART_TX_OVERFLOW
+		#define DUART_TX_OVERFLOW UART_TX_OVERFLOW_BLOCK // UART_TX_OVERFLOW_DROP/COUNT never stall on a full FIFO, but lose output
+	#endif
+	
+	typedef UART<DUART_PORT, 19200, 1, UART_FIFO_SIZE, UART_TX_FIFO_SIZE, DUART_TX_OVERFLOW> DUART;
 
-	#define DINIT() DUART::Init(19200, 1)
+	#define DINIT() DUART::Init()
+	#define DISR() UART_RX_ISR(DUART_PORT, DUART) UART_TX_ISR(DUART_PORT, DUART)
+	#define DFLUSH() DUART::FlushTX()
 
-	#define DPRINTF_CTX(FORMAT, ...) DUART::Printf("[%s] - " FORMAT, __FUNCTION__, ##__VA_ARGS__)
-	#define DPRINTFLN_CTX(FORMAT, ...) DUART::Printf("[%s] - " FORMAT "\n", __FUNCTION__, ##__VA_ARGS__)
-	#define DPRINTF(FORMAT, ...) DUART::Printf(FORMAT, ##__VA_ARGS__)
-	#define DPRINTFLN(FORMAT, ...) DUART::Printf(FORMAT "\n", ##__VA_ARGS__)
+	#ifdef DLOG_TOKENS // Record ID and binary arguments instead of text, no printf linked, decode with tools/mblog.py (see lib/DLOG/DLOG.h)
+		#include <DLOG/DLOG.h>
+		
+		#define DPRINTF_CTX(FORMAT, ...) DLOG_WRITE(DUART, DLOG_FLAGS_CTX, FORMAT, ##__VA_ARGS__)
+		#define DPRINTFLN_CTX(FORMAT, ...) DLOG_WRITE(DUART, DLOG_FLAGS_CTX_LN, FORMAT, ##__VA_ARGS__)
+		#define DPRINTF(FORMAT, ...) DLOG_WRITE(DUART, DLOG_FLAGS_NONE, FORMAT, ##__VA_ARGS__)
+		#define DPRINTFLN(FORMAT, ...) DLOG_WRITE(DUART, DLOG_FLAGS_LN, FORMAT, ##__VA_ARGS__)
+	#else
+		#define DPRINTF_CTX(FORMAT, ...) DUART::Printf("[%s] - " FORMAT, __FUNCTION__, ##__VA_ARGS__)
+		#define DPRINTFLN_CTX(FORMAT, ...) DUART::Printf("[%s] - " FORMAT "\n", __FUNCTION__, ##__VA_ARGS__)
+		#define DPRINTF(FORMAT, ...) DUART::Printf(FORMAT, ##__VA_ARGS__)
+		#define DPRINTFLN(FORMAT, ...) DUART::Printf(FORMAT "\n", ##__VA_ARGS__)
+	#endif
 #else
 	#define DUART
 
 	#define DINIT()
+	#define DISR()
+	#define DFLUSH()
 
 	#define DPRINTF_CTX(...)
 	#define DPRINTFLN_CTX(...)
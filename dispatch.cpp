@@ -0,0 +1,96 @@
+/*
+ * dispatch.cpp
+ *
+ * Created: 18/10/2026 14:10:26
+ * Author : joaob
+ */ 
+
+#include <main.h>
+
+#if defined(BOOT_IVT_DISPATCH) || defined(BENCHMARK)
+
+void dispatchStubs()
+{
+	// One stub per vector, reached through the JMPs at 0x00000 (IVSEL cleared, application running)
+	// The "rcall ." reserves 3 stack bytes that later receive the word address of the ROM vector, so the dispatcher can
+	// restore every register it used and "ret" straight into the ROM IVT, the vector then runs exactly as if patched
+	// Relaxation never shortens rcall/rjmp, so the stubs keep a fixed DISPATCH_STUB_SIZE
+	asm volatile(
+		"__dispatch_stubs:						\n\t"
+		".set __dispatch_vector, 0				\n\t"
+		".rept %[count]							\n\t"
+		"	rcall .								\n\t"
+		"	push r31							\n\t"
+		"	push r30							\n\t"
+		"	in r30, __SREG__					\n\t"
+		"	push r30							\n\t"
+		"	ldi r30, (__dispatch_vector * 2)	\n\t" // Word offset of the vector in the ROM IVT
+		"	rjmp __dispatch_common				\n\t"
+		"	.set __dispatch_vector, __dispatch_vector + 1	\n\t"
+		".endr									\n\t"
+		"__dispatch_common:						\n\t"
+		"	push r29							\n\t"
+		"	push r28							\n\t"
+		"	in r28, __SP_L__					\n\t" // Y+1 r28, Y+2 r29, Y+3 SREG, Y+4 r30, Y+5 r31, Y+6..8 return address
+		"	in r29, __SP_H__					\n\t"
+		"	in r31, %[lo]						\n\t"
+		"	or r30, r31							\n\t" // ROMs are page aligned, so this never carries
+		"	std Y+8, r30						\n\t"
+		"	in r30, %[hi]						\n\t"
+		"	std Y+7, r30						\n\t"
+		"	in r30, %[ext]						\n\t"
+		"	std Y+6, r30						\n\t"
+		"	pop r28								\n\t"
+		"	pop r29								\n\t"
+		"	pop r30								\n\t"
+		"	out __SREG__, r30					\n\t"
+		"	pop r30								\n\t"
+		"	pop r31								\n\t"
+		"	ret									\n\t"
+		:
+		: [count] "n" (DISPATCH_VECTOR_COUNT), [lo] "I" (_SFR_IO_ADDR(DISPATCH_BASE_LO)), [hi] "I" (_SFR_IO_ADDR(DISPATCH_BASE_HI)), [ext] "I" (_SFR_IO_ADDR(DISPATCH_BASE_EXT))
+	);
+}
+uint32_t dispatchStubsAddress()
+{
+	uint32_t address;
+	
+	// Byte address, function pointers are word addresses and may go through a trampoline
+	asm(
+		"ldi %A0, lo8(__dispatch_stubs)	\n\t"
+		"ldi %B0, hi8(__dispatch_stubs)	\n\t"
+		"ldi %C0, hh8(__dispatch_stubs)	\n\t"
+		"ldi %D0, 0						\n\t"
+		: "=d" (address)
+	);
+	
+	return address;
+}
+
+void dispatchSetROM(uint32_t ulAddress)
+{
+	ulAddress >>= 1; // Word address
+	
+	DISPATCH_BASE_LO = ulAddress & 0xFF;
+	DISPATCH_BASE_HI = (ulAddress >> 8) & 0xFF;
+	DISPATCH_BASE_EXT = (ulAddress >> 16) & 0xFF;
+}
+uint8_t dispatchInstall()
+{
+	uint8_t ivtBuf[_VECTORS_SIZE];
+	uint32_t stubAddress = dispatchStubsAddress();
+	
+	for(uint16_t i = 0; i < _VECTORS_SIZE; i += 4, stubAddress += DISPATCH_STUB_SIZE)
+		encodeJMP(ivtBuf + i, stubAddress);
+	
+	if(flashPageMatches(0x00000, ivtBuf, _VECTORS_SIZE)) // Only ever written once, switching ROMs does not touch the flash
+		return 1;
+	
+	DPRINTFLN_CTX("Installing dispatcher IVT [0x%08lX]", dispatchStubsAddress());
+	
+	flashProgramPage(0x00000, ivtBuf, _VECTORS_SIZE);
+	
+	return flashPageMatches(0x00000, ivtBuf, _VECTORS_SIZE);
+}
+
+#endif
\ No newline at end of file
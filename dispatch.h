@@ -0,0 +1,36 @@
+/*
+ * dispatch.h
+ *
+ * Created: 18/10/2026 14:10:26
+ *  Author: joaob
+ */ 
+
+
+#ifndef DISPATCH_H_
+#define DISPATCH_H_
+
+#include <avr/io.h>
+#include <stdint.h>
+
+// With BOOT_IVT_DISPATCH the IVT at 0x00000 is written once and points every vector to a stub in the bootloader
+// The stub jumps to the same vector of the active ROM, whose word address is kept in the registers below
+// Applications built for this mode must leave these registers untouched, and their ROMs must be page aligned
+#define DISPATCH_BASE_LO	GPIOR1
+#define DISPATCH_BASE_HI	GPIOR2
+#define DISPATCH_BASE_EXT	GPIOR0
+
+#define DISPATCH_VECTOR_COUNT	(_VECTORS_SIZE / 4)
+#define DISPATCH_STUB_SIZE		14 // Bytes of each per vector stub (rcall, 3 push, in, ldi, rjmp)
+
+#if _VECTORS_SIZE > SPM_PAGESIZE
+	#error "The dispatcher IVT must fit in one flash page"
+#endif
+
+// Functions
+void dispatchStubs() __attribute__ ((naked)) __attribute__ ((used));
+uint32_t dispatchStubsAddress();
+
+void dispatchSetROM(uint32_t ulAddress);
+uint8_t dispatchInstall();
+
+#endif /* DISPATCH_H_ */
\ No newline at end of file
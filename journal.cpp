@@ -0,0 +1,54 @@
+/*
+ * journal.cpp
+ *
+ * Created: 18/10/2026 15:02:44
+ * Author : joaob
+ */ 
+
+#include <main.h>
+
+// Functions
+uint8_t journalLoad(boot_cfg_t* pConfig)
+{
+	journal_record_t record;
+	uint8_t valid = 0;
+	uint16_t sequence = 0;
+	
+	eeprom_busy_wait();
+	
+	for(uint8_t i = 0; i < JOURNAL_RECORDS; i++)
+	{
+		eeprom_read_block(&record, JOURNAL_RECORD_ADDRESS(i), sizeof(journal_record_t));
+		
+		if(journalCRC(&record) != record.m_usCRC) // Erased, torn or never written
+			continue;
+		
+		if(valid && (int16_t)(record.m_usSequence - sequence) <= 0) // Serial number arithmetic, the sequence wraps around
+			continue;
+		
+		if(!validateConfig(&record.m_Config)) // Skipped, an older record that still validates is used instead
+			continue;
+		
+		DPRINTFLN_CTX("Journal record [%u] [%u]", i, record.m_usSequence);
+		
+		valid = 1;
+		sequence = record.m_usSequence;
+		
+		memcpy(pConfig, &record.m_Config, sizeof(boot_cfg_t));
+	}
+	
+	return valid;
+}
+uint8_t journalSave(boot_cfg_t* pConfig)
+{
+	if(!journalAppend(pConfig)) // Goes after the newest record, even one journalLoad skipped
+	{
+		DPRINTFLN_CTX("Boot config unchanged, nothing to append");
+		
+		return 1;
+	}
+	
+	DPRINTFLN_CTX("Appended journal record");
+	
+	return 1;
+}
\ No newline at end of file
@@ -0,0 +1,120 @@
+/*
+ * journal.h
+ *
+ * Created: 18/10/2026 15:02:44
+ *  Author: joaob
+ */ 
+
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include <stdint.h>
+#include <string.h>
+#include <config.h>
+
+// The boot config is kept as a ring of JOURNAL_RECORDS records in the EEPROM, the valid record with the highest sequence is the current one
+// An update appends one record to the next slot, its CRC is written last so a power loss mid-update leaves the previous record current
+// Applications include this header too (with config.h), journalStage and journalAppend write the config the same way the bootloader does
+// The legacy config at BOOT_CONFIG_EE_ADDRESS is only read while the journal is empty, writing it has no effect after the first boot
+#ifndef JOURNAL_EE_ADDRESS
+#define JOURNAL_EE_ADDRESS 0xC40 // Right after the legacy boot config (BOOT_CONFIG_EE_ADDRESS), still read once if the journal is empty
+#endif
+#ifndef JOURNAL_RECORDS
+#define JOURNAL_RECORDS 8 // Each record takes sizeof(journal_record_t) bytes and spreads the wear by this factor
+#endif
+
+#define JOURNAL_NO_SLOT 0xFF
+#define JOURNAL_RECORD_ADDRESS(SLOT) ((void*)(JOURNAL_EE_ADDRESS + (SLOT) * sizeof(journal_record_t)))
+
+struct journal_record_t
+{
+	uint16_t m_usSequence;
+	boot_cfg_t m_Config;
+	uint16_t m_usCRC; // CRC16 of the sequence and the config
+};
+
+#if JOURNAL_RECORDS < 2
+	#error "The journal needs at least 2 records to keep the previous one while appending"
+#endif
+
+// Functions, header only so the applications get them without linking anything of the bootloader
+inline uint16_t journalCRC(journal_record_t* pRecord)
+{
+	uint16_t crc = 0;
+	
+	for(uint16_t i = 0; i < sizeof(journal_record_t) - sizeof(uint16_t); i++)
+		crc = _crc16_update(crc, ((uint8_t*)pRecord)[i]);
+	
+	return crc;
+}
+inline uint8_t journalNewest(journal_record_t* pRecord) // Slot of the record with the highest sequence and a valid CRC, JOURNAL_NO_SLOT if none
+{
+	journal_record_t record;
+	uint8_t newest = JOURNAL_NO_SLOT;
+	
+	eeprom_busy_wait();
+	
+	for(uint8_t i = 0; i < JOURNAL_RECORDS; i++)
+	{
+		eeprom_read_block(&record, JOURNAL_RECORD_ADDRESS(i), sizeof(journal_record_t));
+		
+		if(journalCRC(&record) != record.m_usCRC) // Erased, torn or never written
+			continue;
+		
+		if(newest != JOURNAL_NO_SLOT && (int16_t)(record.m_usSequence - pRecord->m_usSequence) <= 0) // Serial number arithmetic, the sequence wraps around
+			continue;
+		
+		newest = i;
+		
+		memcpy(pRecord, &record, sizeof(journal_record_t));
+	}
+	
+	return newest;
+}
+inline uint8_t journalAppend(boot_cfg_t* pConfig) // Sets the config CRC, returns 0 if the newest record already holds this config
+{
+	journal_record_t record;
+	uint8_t slot = journalNewest(&record);
+	
+	calcCRC16(pConfig);
+	
+	if(slot != JOURNAL_NO_SLOT && !memcmp(&record.m_Config, pConfig, sizeof(boot_cfg_t)))
+		return 0;
+	
+	record.m_usSequence = (slot != JOURNAL_NO_SLOT) ? record.m_usSequence + 1 : 0;
+	memcpy(&record.m_Config, pConfig, sizeof(boot_cfg_t));
+	record.m_usCRC = journalCRC(&record);
+	
+	uint8_t *eeAddress = (uint8_t*)JOURNAL_RECORD_ADDRESS((slot != JOURNAL_NO_SLOT) ? (slot + 1) % JOURNAL_RECORDS : 0);
+	
+	eeprom_update_block(&record, eeAddress, sizeof(journal_record_t) - sizeof(uint16_t));
+	eeprom_update_word((uint16_t*)(eeAddress + sizeof(journal_record_t) - sizeof(uint16_t)), record.m_usCRC); // Commits the record
+	eeprom_busy_wait();
+	
+	return 1;
+}
+inline uint8_t journalStage(uint8_t ubROM, uint32_t ulFlashAddress, uint32_t ulSize) // Application side, the bootloader loads the image into ROM ubROM on the next reset
+{
+	journal_record_t record;
+	
+	if(journalNewest(&record) == JOURNAL_NO_SLOT || ubROM >= record.m_Config.m_ubROMCount)
+		return 0;
+	
+	record.m_Config.m_ubLoadStatus = BOOT_LOAD_STATUS_ON;
+	record.m_Config.m_ubLoadROM = ubROM;
+	record.m_Config.m_ulLoadROMFlashAddress = ulFlashAddress;
+	record.m_Config.m_ulLoadROMSize = ulSize;
+	
+	journalAppend(&record.m_Config);
+	
+	return 1;
+}
+
+// Bootloader only (journal.cpp)
+uint8_t journalLoad(boot_cfg_t* pConfig);
+uint8_t journalSave(boot_cfg_t* pConfig);
+
+#endif /* JOURNAL_H_ */
\ No newline at end of file
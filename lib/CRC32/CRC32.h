@@ -0,0 +1,31 @@
+/*
+ * CRC32.h
+ *
+ * Created: 18/10/2026 13:05:18
+ * Author : joaob
+ */ 
+
+
+#ifndef CRC32_H_
+#define CRC32_H_
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+// Standard CRC-32 (poly 0xEDB88320 reflected, same as zlib), table driven from PROGMEM
+#define CRC32_INIT 0xFFFFFFFFUL
+
+namespace CRC32
+{
+	extern uint32_t Update(uint32_t ulCRC, const uint8_t* pubData, uint16_t usCount);
+	inline uint32_t Final(uint32_t ulCRC)
+	{
+		return ~ulCRC;
+	}
+	inline uint32_t Calc(const uint8_t* pubData, uint16_t usCount)
+	{
+		return Final(Update(CRC32_INIT, pubData, usCount));
+	}
+}
+
+#endif /* CRC32_H_ */
\ No newline at end of file
@@ -0,0 +1,147 @@
+/*
+ * DELTA.cpp
+ *
+ * Created: 18/10/2026 12:20:51
+ * Author: joaob
+ */ 
+
+#include "DELTA.h"
+
+static uint8_t (*m_pfnReadByte)() = 0;
+static uint8_t (*m_pfnReadSource)(uint32_t ulOffset) = 0;
+static uint32_t m_ulInputLeft = 0;
+static uint32_t m_ulSourceSize = 0;
+static uint32_t m_ulSourceOffset = 0;
+static uint16_t m_usLength = 0;
+static uint8_t m_ubRunValue = 0;
+static delta_state_t m_ubState = DELTA_STATE_OP;
+
+static inline uint8_t DELTA_ReadInput()
+{
+	m_ulInputLeft--;
+	
+	return m_pfnReadByte();
+}
+
+void DELTA::Init(uint32_t ulInputSize, uint8_t (*pfnReadByte)(), uint8_t (*pfnReadSource)(uint32_t ulOffset), uint32_t ulSourceSize)
+{
+	m_pfnReadByte = pfnReadByte;
+	m_pfnReadSource = pfnReadSource;
+	m_ulInputLeft = ulInputSize;
+	m_ulSourceSize = ulSourceSize;
+	m_ulSourceOffset = 0;
+	m_usLength = 0;
+	m_ubRunValue = 0;
+	m_ubState = DELTA_STATE_OP;
+}
+
+uint8_t DELTA::Decode(uint8_t* pubDest, uint16_t usCount)
+{
+	if(!m_pfnReadByte || !m_pfnReadSource)
+		return 0;
+	
+	while(usCount)
+	{
+		switch(m_ubState)
+		{
+			case DELTA_STATE_OP:
+			{
+				if(!m_ulInputLeft)
+					return 0;
+				
+				uint8_t op = DELTA_ReadInput();
+				
+				m_usLength = (op & DELTA_OP_LENGTH_MASK) + 1;
+				
+				if((op & DELTA_OP_LENGTH_MASK) == DELTA_LENGTH_EXTENDED)
+				{
+					if(m_ulInputLeft < 2)
+						return 0;
+					
+					m_usLength = DELTA_ReadInput();
+					m_usLength |= (uint16_t)DELTA_ReadInput() << 8;
+					
+					if(!m_usLength)
+						return 0;
+				}
+				
+				switch(op & DELTA_OP_TYPE_MASK)
+				{
+					case DELTA_OP_COPY:
+					{
+						if(m_ulInputLeft < 3)
+							return 0;
+						
+						m_ulSourceOffset = DELTA_ReadInput();
+						m_ulSourceOffset |= (uint32_t)DELTA_ReadInput() << 8;
+						m_ulSourceOffset |= (uint32_t)DELTA_ReadInput() << 16;
+						
+						if(m_ulSourceOffset + m_usLength > m_ulSourceSize) // Copy from outside of the source
+							return 0;
+						
+						m_ubState = DELTA_STATE_COPY;
+					}
+					break;
+					case DELTA_OP_ADD:
+					{
+						m_ubState = DELTA_STATE_ADD;
+					}
+					break;
+					case DELTA_OP_RUN:
+					{
+						if(!m_ulInputLeft)
+							return 0;
+						
+						m_ubRunValue = DELTA_ReadInput();
+						m_ubState = DELTA_STATE_RUN;
+					}
+					break;
+					default:
+						return 0;
+				}
+			}
+			break;
+			case DELTA_STATE_COPY:
+			{
+				while(m_usLength && usCount)
+				{
+					*(pubDest++) = m_pfnReadSource(m_ulSourceOffset++);
+					
+					m_usLength--;
+					usCount--;
+				}
+			}
+			break;
+			case DELTA_STATE_ADD:
+			{
+				while(m_usLength && usCount)
+				{
+					if(!m_ulInputLeft)
+						return 0;
+					
+					*(pubDest++) = DELTA_ReadInput();
+					
+					m_usLength--;
+					usCount--;
+				}
+			}
+			break;
+			case DELTA_STATE_RUN:
+			{
+				while(m_usLength && usCount)
+				{
+					*(pubDest++) = m_ubRunValue;
+					
+					m_usLength--;
+					usCount--;
+				}
+			}
+			break;
+		}
+		
+		if(m_ubState != DELTA_STATE_OP && !m_usLength)
+			m_ubState = DELTA_STATE_OP;
+	}
+	
+	return 1;
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+/*
+ * DELTA.h
+ *
+ * Created: 18/10/2026 12:20:51
+ * Author : joaob
+ */ 
+
+
+#ifndef DELTA_H_
+#define DELTA_H_
+
+#include <stdint.h>
+
+// Op stream: one op byte (type in bits 7-6, length - 1 in bits 5-0) followed by its arguments
+// A length field of DELTA_LENGTH_EXTENDED means the real length follows as a 16-bit little endian value
+// COPY: 3-byte little endian offset into the source | ADD: length literal bytes | RUN: 1 byte value
+#define DELTA_OP_TYPE_MASK 0xC0
+#define DELTA_OP_LENGTH_MASK 0x3F
+#define DELTA_LENGTH_EXTENDED 0x3F
+
+enum delta_op_t
+{
+	DELTA_OP_COPY = 0x00,
+	DELTA_OP_ADD = 0x40,
+	DELTA_OP_RUN = 0x80,
+};
+enum delta_state_t
+{
+	DELTA_STATE_OP = 0,
+	DELTA_STATE_COPY,
+	DELTA_STATE_ADD,
+	DELTA_STATE_RUN,
+};
+
+namespace DELTA
+{
+	extern void Init(uint32_t ulInputSize, uint8_t (*pfnReadByte)(), uint8_t (*pfnReadSource)(uint32_t ulOffset), uint32_t ulSourceSize);
+	extern uint8_t Decode(uint8_t* pubDest, uint16_t usCount);
+}
+
+#endif /* DELTA_H_ */
\ No newline at end of file
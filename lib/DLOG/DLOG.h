@@ -0,0 +1,199 @@
+/*
+ * DLOG.h
+ *
+ * Created: 18/10/2026 23:12:40
+ * Author : joaob
+ */ 
+
+
+#ifndef DLOG_H_
+#define DLOG_H_
+
+#include <stdint.h>
+
+// Tokenized log output, a log call sends its record ID and its arguments in binary, tools/mblog.py rebuilds the text from the ELF
+// Frame: DLOG_SYNC, record ID (2), 2 bit size code of each argument (4 per byte, only with arguments), the arguments (little endian, strings NUL terminated)
+// Records ("<flags><file>:<line>\0<format>") live in DLOG_SECTION, their offset in it is the ID and the function comes from the record symbol
+// DLOG.ld must be passed to the linker (the project does), it keeps .dlog out of the flash image at address 0, without it the records become an orphan section in flash
+#define DLOG_SYNC 0x1E // ASCII record separator, bytes outside frames are passed through by the decoder
+#define DLOG_SECTION __attribute__ ((section(".dlog")))
+
+#define DLOG_FLAGS_NONE "0"
+#define DLOG_FLAGS_CTX "1" // "[function] - " prefix
+#define DLOG_FLAGS_LN "2" // Line break appended
+#define DLOG_FLAGS_CTX_LN "3"
+
+#define DLOG_STR(X) DLOG_STR_(X)
+#define DLOG_STR_(X) #X
+
+// Declares the record of the call site and sends a frame, the format is still checked against the arguments like a printf
+// Not for inline or template functions in headers, their statics are COMDAT and GCC reports a section type conflict
+#define DLOG_WRITE(SINK, FLAGS, FORMAT, ...) \
+	do \
+	{ \
+		static const char dlogRecord[] DLOG_SECTION = FLAGS __FILE__ ":" DLOG_STR(__LINE__) "\0" FORMAT; \
+		\
+		if(0) \
+			DLOG<SINK>::Check(FORMAT, ##__VA_ARGS__); \
+		\
+		DLOG<SINK>::Write(dlogRecord, ##__VA_ARGS__); \
+	} while(0)
+
+enum dlog_arg_code_t
+{
+	DLOG_ARG_8 = 0,
+	DLOG_ARG_16,
+	DLOG_ARG_32,
+	DLOG_ARG_STRING,
+};
+
+// Arguments go out in their own size (char, int and enum 1 or 2 bytes, long 4), the format decides how the decoder prints them
+template<class T> struct dlog_arg_t
+{
+	static const uint8_t m_ubCode = (sizeof(T) == 1) ? DLOG_ARG_8 : ((sizeof(T) == 2) ? DLOG_ARG_16 : DLOG_ARG_32);
+};
+template<> struct dlog_arg_t<char*>
+{
+	static const uint8_t m_ubCode = DLOG_ARG_STRING;
+};
+template<> struct dlog_arg_t<const char*>
+{
+	static const uint8_t m_ubCode = DLOG_ARG_STRING;
+};
+
+#define DLOG_CODE(T, N) (dlog_arg_t<T>::m_ubCode << ((N) * 2))
+
+template<class SINK>
+struct DLOG
+{
+	__attribute__ ((format (printf, 1, 2))) static void Check(const char* pszFormat, ...) // Never called
+	{
+	}
+	
+	static void Begin(const char* pRecord)
+	{
+		uint16_t id = (uint16_t)(uintptr_t)pRecord;
+		
+		SINK::WriteByte(DLOG_SYNC);
+		SINK::WriteByte(id & 0xFF);
+		SINK::WriteByte(id >> 8);
+	}
+	
+	template<class T> static void Arg(T tValue)
+	{
+		SINK::Write((uint8_t*)&tValue, 1 << dlog_arg_t<T>::m_ubCode);
+	}
+	static void Arg(const char* pszValue)
+	{
+		do
+			SINK::WriteByte(*pszValue);
+		while(*(pszValue++));
+	}
+	static void Arg(char* pszValue)
+	{
+		Arg((const char*)pszValue);
+	}
+	
+	static void Write(const char* pRecord)
+	{
+		Begin(pRecord);
+	}
+	template<class A> static void Write(const char* pRecord, A a)
+	{
+		Begin(pRecord);
+		
+		SINK::WriteByte(DLOG_CODE(A, 0));
+		
+		Arg(a);
+	}
+	template<class A, class B> static void Write(const char* pRecord, A a, B b)
+	{
+		Begin(pRecord);
+		
+		SINK::WriteByte(DLOG_CODE(A, 0) | DLOG_CODE(B, 1));
+		
+		Arg(a);
+		Arg(b);
+	}
+	template<class A, class B, class C> static void Write(const char* pRecord, A a, B b, C c)
+	{
+		Begin(pRecord);
+		
+		SINK::WriteByte(DLOG_CODE(A, 0) | DLOG_CODE(B, 1) | DLOG_CODE(C, 2));
+		
+		Arg(a);
+		Arg(b);
+		Arg(c);
+	}
+	template<class A, class B, class C, class D> static void Write(const char* pRecord, A a, B b, C c, D d)
+	{
+		Begin(pRecord);
+		
+		SINK::WriteByte(DLOG_CODE(A, 0) | DLOG_CODE(B, 1) | DLOG_CODE(C, 2) | DLOG_CODE(D, 3));
+		
+		Arg(a);
+		Arg(b);
+		Arg(c);
+		Arg(d);
+	}
+	template<class A, class B, class C, class D, class E> static void Write(const char* pRecord, A a, B b, C c, D d, E e)
+	{
+		Begin(pRecord);
+		
+		SINK::WriteByte(DLOG_CODE(A, 0) | DLOG_CODE(B, 1) | DLOG_CODE(C, 2) | DLOG_CODE(D, 3));
+		SINK::WriteByte(DLOG_CODE(E, 0));
+		
+		Arg(a);
+		Arg(b);
+		Arg(c);
+		Arg(d);
+		Arg(e);
+	}
+	template<class A, class B, class C, class D, class E, class F> static void Write(const char* pRecord, A a, B b, C c, D d, E e, F f)
+	{
+		Begin(pRecord);
+		
+		SINK::WriteByte(DLOG_CODE(A, 0) | DLOG_CODE(B, 1) | DLOG_CODE(C, 2) | DLOG_CODE(D, 3));
+		SINK::WriteByte(DLOG_CODE(E, 0) | DLOG_CODE(F, 1));
+		
+		Arg(a);
+		Arg(b);
+		Arg(c);
+		Arg(d);
+		Arg(e);
+		Arg(f);
+	}
+	template<class A, class B, class C, class D, class E, class F, class G> static void Write(const char* pRecord, A a, B b, C c, D d, E e, F f, G g)
+	{
+		Begin(pRecord);
+		
+		SINK::WriteByte(DLOG_CODE(A, 0) | DLOG_CODE(B, 1) | DLOG_CODE(C, 2) | DLOG_CODE(D, 3));
+		SINK::WriteByte(DLOG_CODE(E, 0) | DLOG_CODE(F, 1) | DLOG_CODE(G, 2));
+		
+		Arg(a);
+		Arg(b);
+		Arg(c);
+		Arg(d);
+		Arg(e);
+		Arg(f);
+		Arg(g);
+	}
+	template<class A, class B, class C, class D, class E, class F, class G, class H> static void Write(const char* pRecord, A a, B b, C c, D d, E e, F f, G g, H h)
+	{
+		Begin(pRecord);
+		
+		SINK::WriteByte(DLOG_CODE(A, 0) | DLOG_CODE(B, 1) | DLOG_CODE(C, 2) | DLOG_CODE(D, 3));
+		SINK::WriteByte(DLOG_CODE(E, 0) | DLOG_CODE(F, 1) | DLOG_CODE(G, 2) | DLOG_CODE(H, 3));
+		
+		Arg(a);
+		Arg(b);
+		Arg(c);
+		Arg(d);
+		Arg(e);
+		Arg(f);
+		Arg(g);
+		Arg(h);
+	}
+};
+
+#endif /* DLOG_H_ */
\ No newline at end of file
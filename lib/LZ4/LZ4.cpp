@@ -0,0 +1,144 @@
+/*
+ * LZ4.cpp
+ *
+ * Created: 18/10/2026 11:02:37
+ * Author: joaob
+ */ 
+
+#include "LZ4.h"
+
+static uint8_t (*m_pfnReadByte)() = 0;
+static uint32_t m_ulInputLeft = 0;
+static uint32_t m_ulOutputSize = 0;
+static uint32_t m_ulLength = 0; // Literal or match bytes left, depending on the state
+static uint16_t m_usMatchOffset = 0;
+static uint16_t m_usWindowPos = 0;
+static uint8_t m_ubMatchNibble = 0;
+static lz4_state_t m_ubState = LZ4_STATE_TOKEN;
+static uint8_t m_ubWindow[LZ4_WINDOW_SIZE];
+
+static inline uint8_t LZ4_ReadInput()
+{
+	m_ulInputLeft--;
+	
+	return m_pfnReadByte();
+}
+static uint8_t LZ4_ReadLength(uint32_t* pulLength)
+{
+	uint8_t b;
+	
+	do
+	{
+		if(!m_ulInputLeft)
+			return 0;
+		
+		b = LZ4_ReadInput();
+		
+		*pulLength += b;
+	} while(b == 0xFF);
+	
+	return 1;
+}
+static inline void LZ4_Output(uint8_t** ppubDest, uint8_t ubData)
+{
+	*((*ppubDest)++) = ubData;
+	
+	m_ubWindow[m_usWindowPos] = ubData;
+	m_usWindowPos = (m_usWindowPos + 1) & (LZ4_WINDOW_SIZE - 1);
+	
+	m_ulOutputSize++;
+}
+
+void LZ4::Init(uint32_t ulInputSize, uint8_t (*pfnReadByte)())
+{
+	m_pfnReadByte = pfnReadByte;
+	m_ulInputLeft = ulInputSize;
+	m_ulOutputSize = 0;
+	m_ulLength = 0;
+	m_usMatchOffset = 0;
+	m_usWindowPos = 0;
+	m_ubMatchNibble = 0;
+	m_ubState = LZ4_STATE_TOKEN;
+}
+
+uint8_t LZ4::Decode(uint8_t* pubDest, uint16_t usCount)
+{
+	if(!m_pfnReadByte)
+		return 0;
+	
+	while(usCount)
+	{
+		switch(m_ubState)
+		{
+			case LZ4_STATE_TOKEN:
+			{
+				if(!m_ulInputLeft)
+					return 0;
+				
+				uint8_t token = LZ4_ReadInput();
+				
+				m_ulLength = token >> 4;
+				m_ubMatchNibble = token & 0x0F;
+				
+				if(m_ulLength == 0x0F && !LZ4_ReadLength(&m_ulLength))
+					return 0;
+				
+				m_ubState = m_ulLength ? LZ4_STATE_LITERALS : LZ4_STATE_OFFSET;
+			}
+			break;
+			case LZ4_STATE_LITERALS:
+			{
+				while(m_ulLength && usCount)
+				{
+					if(!m_ulInputLeft)
+						return 0;
+					
+					LZ4_Output(&pubDest, LZ4_ReadInput());
+					
+					m_ulLength--;
+					usCount--;
+				}
+				
+				if(!m_ulLength)
+					m_ubState = LZ4_STATE_OFFSET;
+			}
+			break;
+			case LZ4_STATE_OFFSET:
+			{
+				if(m_ulInputLeft < 2) // The last sequence of a block only has literals, so the stream ended early
+					return 0;
+				
+				m_usMatchOffset = LZ4_ReadInput();
+				m_usMatchOffset |= (uint16_t)LZ4_ReadInput() << 8;
+				
+				if(!m_usMatchOffset || m_usMatchOffset > LZ4_WINDOW_SIZE || m_usMatchOffset > m_ulOutputSize) // Reference outside of the window
+					return 0;
+				
+				m_ulLength = m_ubMatchNibble;
+				
+				if(m_ulLength == 0x0F && !LZ4_ReadLength(&m_ulLength))
+					return 0;
+				
+				m_ulLength += LZ4_MIN_MATCH;
+				m_ubState = LZ4_STATE_MATCH;
+			}
+			break;
+			case LZ4_STATE_MATCH:
+			{
+				while(m_ulLength && usCount)
+				{
+					LZ4_Output(&pubDest, m_ubWindow[(m_usWindowPos - m_usMatchOffset) & (LZ4_WINDOW_SIZE - 1)]);
+					
+					m_ulLength--;
+					usCount--;
+				}
+				
+				if(!m_ulLength)
+					m_ubState = LZ4_STATE_TOKEN;
+			}
+			break;
+		}
+	}
+	
+	return 1;
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+/*
+ * LZ4.h
+ *
+ * Created: 18/10/2026 11:02:37
+ * Author : joaob
+ */ 
+
+
+#ifndef LZ4_H_
+#define LZ4_H_
+
+#include <stdint.h>
+#include <string.h>
+
+// Streaming decoder for the LZ4 block format with a bounded history window
+// The packer (tools/mbpack.py) must not emit match offsets larger than LZ4_WINDOW_SIZE
+#ifndef LZ4_WINDOW_SIZE
+#define LZ4_WINDOW_SIZE 1024 // Must be a power of 2
+#endif
+
+#define LZ4_MIN_MATCH 4
+
+enum lz4_state_t
+{
+	LZ4_STATE_TOKEN = 0,
+	LZ4_STATE_LITERALS,
+	LZ4_STATE_OFFSET,
+	LZ4_STATE_MATCH,
+};
+
+namespace LZ4
+{
+	extern void Init(uint32_t ulInputSize, uint8_t (*pfnReadByte)());
+	extern uint8_t Decode(uint8_t* pubDest, uint16_t usCount);
+}
+
+#endif /* LZ4_H_ */
\ No newline at end of file
@@ -0,0 +1,183 @@
+/*
+ * RELOC.cpp
+ *
+ * Created: 18/10/2026 14:05:17
+ * Author: joaob
+ */ 
+
+#include "RELOC.h"
+
+static uint8_t (*m_pfnRead)(uint8_t* pubBuf, uint16_t usSize) = 0;
+static uint16_t m_usEntriesLeft = 0;
+static uint32_t m_ulBase = 0;
+static uint32_t m_ulImageSize = 0;
+static uint32_t m_ulEntryOffset = 0;
+static uint32_t m_ulSiteEnd = 0;
+static uint8_t m_ubPending = 0;
+static uint8_t m_ubSiteSize = 0;
+static uint8_t m_ubPatch[RELOC_SITE_MAX_SIZE]; // New value of the address bits of the site
+static uint8_t m_ubKeep[RELOC_SITE_MAX_SIZE]; // Bits of the original bytes that are kept (opcode, register)
+static uint8_t m_ubCheckMask[RELOC_SITE_MAX_SIZE];
+static uint8_t m_ubCheckValue[RELOC_SITE_MAX_SIZE]; // Opcode the original bytes must hold, catches a table that does not match the image
+
+static uint8_t RELOC_Prepare(reloc_type_t ubType, uint32_t ulAddress)
+{
+	for(uint8_t i = 0; i < RELOC_SITE_MAX_SIZE; i++)
+	{
+		m_ubPatch[i] = 0;
+		m_ubKeep[i] = 0;
+		m_ubCheckMask[i] = 0;
+		m_ubCheckValue[i] = 0;
+	}
+	
+	switch(ubType)
+	{
+		case RELOC_TYPE_CALL:
+		{
+			// 1001 010k kkkk 11ck kkkk kkkk kkkk kkkk (k is the word address), c selects between JMP and CALL
+			m_ubPatch[0] = ((ulAddress & 0x780000) >> 15) | ((ulAddress & 0x040000) >> 18);
+			m_ubPatch[1] = (ulAddress & 0x020000) >> 17;
+			m_ubPatch[2] = (ulAddress & 0x0001FE) >> 1;
+			m_ubPatch[3] = (ulAddress & 0x01FE00) >> 9;
+			m_ubKeep[0] = 0x0E;
+			m_ubKeep[1] = 0xFE;
+			m_ubCheckMask[0] = 0x0C;
+			m_ubCheckValue[0] = 0x0C;
+			m_ubCheckMask[1] = 0xFE;
+			m_ubCheckValue[1] = 0x94;
+			m_ubSiteSize = 4;
+		}
+		break;
+		case RELOC_TYPE_LDI_LO8:
+		case RELOC_TYPE_LDI_HI8:
+		case RELOC_TYPE_LDI_HH8:
+		case RELOC_TYPE_LDI_PM_LO8:
+		case RELOC_TYPE_LDI_PM_HI8:
+		case RELOC_TYPE_LDI_PM_HH8:
+		{
+			// 1110 KKKK dddd KKKK
+			uint8_t shift = (ubType >= RELOC_TYPE_LDI_PM_LO8) ? 1 + (ubType - RELOC_TYPE_LDI_PM_LO8) * 8 : (ubType - RELOC_TYPE_LDI_LO8) * 8;
+			uint8_t value = ulAddress >> shift;
+			
+			m_ubPatch[0] = value & 0x0F;
+			m_ubPatch[1] = value >> 4;
+			m_ubKeep[0] = 0xF0;
+			m_ubKeep[1] = 0xF0;
+			m_ubCheckMask[1] = 0xF0;
+			m_ubCheckValue[1] = 0xE0;
+			m_ubSiteSize = 2;
+		}
+		break;
+		case RELOC_TYPE_WORD:
+		case RELOC_TYPE_WORD_PM:
+		{
+			if(ubType == RELOC_TYPE_WORD_PM)
+				ulAddress >>= 1;
+			
+			if(ulAddress > 0xFFFF) // Does not fit the pointer anymore at this base
+				return 0;
+			
+			m_ubPatch[0] = ulAddress;
+			m_ubPatch[1] = ulAddress >> 8;
+			m_ubSiteSize = 2;
+		}
+		break;
+		default:
+			return 0;
+	}
+	
+	return 1;
+}
+static uint8_t RELOC_Next()
+{
+	while(m_usEntriesLeft)
+	{
+		reloc_entry_t entry;
+		
+		if(!m_pfnRead((uint8_t*)&entry, sizeof(reloc_entry_t)))
+			return 0;
+		
+		m_usEntriesLeft--;
+		m_ulEntryOffset += entry.m_usOffsetDelta;
+		
+		if(entry.m_ubType == RELOC_TYPE_NONE)
+			continue;
+		
+		if(m_ulEntryOffset < m_ulSiteEnd) // Overlaps the previous site, the table is not sorted
+			return 0;
+		
+		uint32_t address = entry.m_ubAddress[0] | ((uint32_t)entry.m_ubAddress[1] << 8) | ((uint32_t)entry.m_ubAddress[2] << 16);
+		
+		if(!RELOC_Prepare(entry.m_ubType, address + m_ulBase))
+			return 0;
+		
+		m_ulSiteEnd = m_ulEntryOffset + m_ubSiteSize;
+		
+		if(m_ulSiteEnd > m_ulImageSize)
+			return 0;
+		
+		m_ubPending = 1;
+		
+		return 1;
+	}
+	
+	m_ubPending = 0;
+	
+	return 1;
+}
+
+uint8_t RELOC::Init(uint16_t usCount, uint8_t (*pfnRead)(uint8_t* pubBuf, uint16_t usSize), uint32_t ulBase, uint32_t ulImageSize)
+{
+	m_pfnRead = pfnRead;
+	m_usEntriesLeft = usCount;
+	m_ulBase = ulBase;
+	m_ulImageSize = ulImageSize;
+	m_ulEntryOffset = 0;
+	m_ulSiteEnd = 0;
+	m_ubPending = 0;
+	
+	if(!usCount)
+		return 1;
+	
+	if(!m_pfnRead)
+		return 0;
+	
+	return RELOC_Next();
+}
+
+uint8_t RELOC::Apply(uint32_t ulOffset, uint8_t* pubBuf, uint16_t usSize)
+{
+	uint32_t end = ulOffset + usSize;
+	
+	// Pages must be passed in order, a site split between two pages is patched one part at a time
+	while(m_ubPending && m_ulEntryOffset < end)
+	{
+		for(uint8_t i = 0; i < m_ubSiteSize; i++)
+		{
+			uint32_t position = m_ulEntryOffset + i;
+			
+			if(position < ulOffset || position >= end)
+				continue;
+			
+			uint8_t *pubSite = pubBuf + (position - ulOffset);
+			
+			if((*pubSite & m_ubCheckMask[i]) != m_ubCheckValue[i])
+				return 0;
+			
+			*pubSite = (*pubSite & m_ubKeep[i]) | m_ubPatch[i];
+		}
+		
+		if(m_ulSiteEnd > end) // Rest of the site is in the next page
+			break;
+		
+		if(!RELOC_Next())
+			return 0;
+	}
+	
+	return 1;
+}
+
+uint8_t RELOC::Done()
+{
+	return !m_ubPending && !m_usEntriesLeft;
+}
\ No newline at end of file
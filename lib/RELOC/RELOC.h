@@ -0,0 +1,49 @@
+/*
+ * RELOC.h
+ *
+ * Created: 18/10/2026 14:05:17
+ * Author : joaob
+ */ 
+
+
+#ifndef RELOC_H_
+#define RELOC_H_
+
+#include <stdint.h>
+
+// Load-time relocation of an image linked at address 0x00000
+// The table is sorted by offset, each entry is reloc_entry_t (6 bytes) and names one absolute flash reference in the image:
+// the site offset (relative to the previous entry), the kind of site and the address it holds as linked
+// RELOC_TYPE_NONE entries patch nothing, they only bridge gaps larger than 0xFFFF bytes between two sites
+#define RELOC_SITE_MAX_SIZE 4
+
+enum reloc_type_t
+{
+	RELOC_TYPE_NONE = 0,
+	RELOC_TYPE_CALL, // JMP/CALL k (2 words)
+	RELOC_TYPE_LDI_LO8, // LDI Rd, lo8(address)
+	RELOC_TYPE_LDI_HI8, // LDI Rd, hi8(address)
+	RELOC_TYPE_LDI_HH8, // LDI Rd, hh8(address)
+	RELOC_TYPE_LDI_PM_LO8, // LDI Rd, pm_lo8(address)
+	RELOC_TYPE_LDI_PM_HI8, // LDI Rd, pm_hi8(address)
+	RELOC_TYPE_LDI_PM_HH8, // LDI Rd, pm_hh8(address)
+	RELOC_TYPE_WORD, // 16-bit byte address (e.g. a PROGMEM pointer in .data)
+	RELOC_TYPE_WORD_PM, // 16-bit word address (e.g. a function pointer in .data)
+	RELOC_TYPE_COUNT,
+};
+
+struct reloc_entry_t
+{
+	uint16_t m_usOffsetDelta; // Offset of the site minus the offset of the previous entry
+	reloc_type_t m_ubType;
+	uint8_t m_ubAddress[3]; // Little endian byte address the site refers to, as linked
+};
+
+namespace RELOC
+{
+	extern uint8_t Init(uint16_t usCount, uint8_t (*pfnRead)(uint8_t* pubBuf, uint16_t usSize), uint32_t ulBase, uint32_t ulImageSize);
+	extern uint8_t Apply(uint32_t ulOffset, uint8_t* pubBuf, uint16_t usSize);
+	extern uint8_t Done();
+}
+
+#endif /* RELOC_H_ */
\ No newline at end of file
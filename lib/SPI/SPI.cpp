@@ -7,6 +7,8 @@
 
 #include "SPI.h"
 
+#ifndef SPI_USART_MSPIM
+
 void SPI::Init(uint8_t ubLSBFirst, uint8_t ubMode, uint8_t ubPrescaler, uint8_t ubDoubleSpeed)
 {
 	DDRB |= (1 << DDB0) | (1 << DDB1) | (1 << DDB2);	
@@ -16,6 +18,8 @@ void SPI::Init(uint8_t ubLSBFirst, uint8_t ubMode, uint8_t ubPrescaler, uint8_t
 	SPCR = (1 << SPE) | ((ubLSBFirst & 0x01) << DORD) | (1 << MSTR) | ((ubMode & 0x03) << CPHA) | ((ubPrescaler & 0x03) << SPR0);
 
 	SPSR = ((ubDoubleSpeed & 0x01) << SPI2X);
+	
+	SPI::m_ubActiveDevice = SPI_NO_DEVICE; // The next Select sets up its device again
 }
 
 uint8_t SPI::TransferByte(uint8_t ubData)
@@ -25,4 +29,95 @@ uint8_t SPI::TransferByte(uint8_t ubData)
 	while(!(SPSR & (1 << SPIF)));
 
 	return SPDR;
-}
\ No newline at end of file
+}
+
+void SPI::ReadBlock(uint8_t* pubDest, uint16_t usCount)
+{
+	if(!usCount)
+		return;
+	
+	uint8_t data;
+	
+	asm volatile(
+		"	out %[spdr], __zero_reg__	\n\t" // Start the first byte
+		"1:	sbiw %[count], 1			\n\t"
+		"	breq 3f						\n\t"
+		"2:	in %[data], %[spsr]			\n\t"
+		"	sbrs %[data], %[spif]		\n\t"
+		"	rjmp 2b						\n\t"
+		"	out %[spdr], __zero_reg__	\n\t" // Start the next byte first, the received one stays in the read buffer
+		"	in %[data], %[spdr]			\n\t"
+		"	st %a[dest]+, %[data]		\n\t"
+		"	rjmp 1b						\n\t"
+		"3:	in %[data], %[spsr]			\n\t"
+		"	sbrs %[data], %[spif]		\n\t"
+		"	rjmp 3b						\n\t"
+		"	in %[data], %[spdr]			\n\t"
+		"	st %a[dest]+, %[data]		\n\t"
+		: [dest] "+e" (pubDest), [count] "+w" (usCount), [data] "=&r" (data)
+		: [spdr] "I" (_SFR_IO_ADDR(SPDR)), [spsr] "I" (_SFR_IO_ADDR(SPSR)), [spif] "I" (SPIF)
+		: "memory"
+	);
+}
+void SPI::WriteBlock(uint8_t* pubSrc, uint16_t usCount)
+{
+	if(!usCount)
+		return;
+	
+	uint8_t data;
+	uint8_t status;
+	
+	asm volatile(
+		"	ld %[data], %a[src]+		\n\t"
+		"	out %[spdr], %[data]		\n\t"
+		"1:	sbiw %[count], 1			\n\t"
+		"	breq 3f						\n\t"
+		"	ld %[data], %a[src]+		\n\t" // Fetch the next byte while the current one shifts out
+		"2:	in %[status], %[spsr]		\n\t"
+		"	sbrs %[status], %[spif]		\n\t"
+		"	rjmp 2b						\n\t"
+		"	out %[spdr], %[data]		\n\t" // Also clears SPIF
+		"	rjmp 1b						\n\t"
+		"3:	in %[status], %[spsr]		\n\t"
+		"	sbrs %[status], %[spif]		\n\t"
+		"	rjmp 3b						\n\t"
+		"	in %[status], %[spdr]		\n\t" // Clear SPIF
+		: [src] "+e" (pubSrc), [count] "+w" (usCount), [data] "=&r" (data), [status] "=&r" (status)
+		: [spdr] "I" (_SFR_IO_ADDR(SPDR)), [spsr] "I" (_SFR_IO_ADDR(SPSR)), [spif] "I" (SPIF)
+		: "memory"
+	);
+}
+void SPI::ExchangeBlock(uint8_t* pubSrc, uint8_t* pubDest, uint16_t usCount)
+{
+	if(!usCount)
+		return;
+	
+	uint8_t data;
+	uint8_t status;
+	
+	// pubSrc may equal pubDest, each source byte is fetched before the byte received in its place is stored
+	asm volatile(
+		"	ld %[data], %a[src]+		\n\t"
+		"	out %[spdr], %[data]		\n\t"
+		"1:	sbiw %[count], 1			\n\t"
+		"	breq 3f						\n\t"
+		"	ld %[data], %a[src]+		\n\t"
+		"2:	in %[status], %[spsr]		\n\t"
+		"	sbrs %[status], %[spif]		\n\t"
+		"	rjmp 2b						\n\t"
+		"	out %[spdr], %[data]		\n\t"
+		"	in %[status], %[spdr]		\n\t"
+		"	st %a[dest]+, %[status]		\n\t"
+		"	rjmp 1b						\n\t"
+		"3:	in %[status], %[spsr]		\n\t"
+		"	sbrs %[status], %[spif]		\n\t"
+		"	rjmp 3b						\n\t"
+		"	in %[status], %[spdr]		\n\t"
+		"	st %a[dest]+, %[status]		\n\t"
+		: [src] "+e" (pubSrc), [dest] "+e" (pubDest), [count] "+w" (usCount), [data] "=&r" (data), [status] "=&r" (status)
+		: [spdr] "I" (_SFR_IO_ADDR(SPDR)), [spsr] "I" (_SFR_IO_ADDR(SPSR)), [spif] "I" (SPIF)
+		: "memory"
+	);
+}
+
+#endif
\ No newline at end of file
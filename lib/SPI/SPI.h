@@ -12,32 +12,69 @@
 #include <avr/io.h>
 #include <stdint.h>
 
+// Build with SPI_USART_MSPIM to run the SPI namespace on USART0 in Master SPI Mode instead of the SPI peripheral
+// The double buffered transmitter keeps the bus busy back to back, the flash then goes on XCK0 (PE2), TXD0 (PE1) and RXD0 (PE0)
+#ifdef SPI_USART_MSPIM
+	#define SPI_MSPIM_UDR		UDR0
+	#define SPI_MSPIM_UBRR		UBRR0
+	#define SPI_MSPIM_UCSRA		UCSR0A
+	#define SPI_MSPIM_UCSRB		UCSR0B
+	#define SPI_MSPIM_UCSRC		UCSR0C
+	#define SPI_MSPIM_XCK_DDR	DDRE
+	#define SPI_MSPIM_XCK_BIT	DDE2
+	#define SPI_MSPIM_TXD_BIT	DDE1
+#endif
+
+// Bus manager (SPI_BUS.cpp), each device keeps its own CS pin, mode, bit order and clock
+// The registers are only rewritten when Select switches to a different device than the last one
+// Select fails while another device is selected, or while an interrupt driven client (SPIE) is running on another device
+#ifndef SPI_MAX_DEVICES
+	#define SPI_MAX_DEVICES	4
+#endif
+#define SPI_NO_DEVICE		0xFF
+
+struct spi_device_t
+{
+	volatile uint8_t* m_pubCSPort; // PORTx, DDRx is the register right below it
+	uint8_t m_ubCSMask;
+#ifdef SPI_USART_MSPIM
+	uint8_t m_ubControl; // UCSRnC
+	uint16_t m_usBaud; // UBRRn
+#else
+	uint8_t m_ubControl; // SPCR
+	uint8_t m_ubStatus; // SPSR (SPI2X)
+#endif
+};
+
 namespace SPI
 {
+	extern uint8_t m_ubActiveDevice; // Device the registers are set up for, SPI_NO_DEVICE after Init
+	extern volatile uint8_t m_ubSelectedDevice; // Device with its CS asserted, SPI_NO_DEVICE if none
+	
 	extern void Init(uint8_t ubLSBFirst = 0, uint8_t ubMode = 0, uint8_t ubPrescaler = 0, uint8_t ubDoubleSpeed = 1);
 	
+	extern uint8_t AddDevice(volatile uint8_t* pubCSPort, uint8_t ubCSBit, uint8_t ubLSBFirst, uint8_t ubMode, uint32_t ulMaxClock); // Returns the device, SPI_NO_DEVICE if full
+	extern uint8_t Select(uint8_t ubDevice); // 0 if the bus belongs to another device
+	extern void Deselect(uint8_t ubDevice);
+	
 	extern uint8_t TransferByte(uint8_t ubData = 0x00);
+	// Bulk transfers, the next byte is written to SPDR right at the SPIF edge and the buffer handling overlaps the shift
+	// Reads must run with interrupts off, the received byte is only picked up after the next one started
+	extern void ReadBlock(uint8_t* pubDest, uint16_t usCount);
+	extern void WriteBlock(uint8_t* pubSrc, uint16_t usCount);
+	extern void ExchangeBlock(uint8_t* pubSrc, uint8_t* pubDest, uint16_t usCount);
 	inline void Transfer(uint8_t* pubSrc, uint16_t usCount, uint8_t* pubDest = 0)
 	{
-		if(pubSrc)
-		{
-			for(uint16_t i = 0; i < usCount; i++)
-			{
-				if(pubDest)
-					*(pubDest + i) = TransferByte(*(pubSrc + i));
-				else
-					TransferByte(*(pubSrc + i));
-			}
-		}
+		if(pubSrc && pubDest)
+			ExchangeBlock(pubSrc, pubDest, usCount);
+		else if(pubSrc)
+			WriteBlock(pubSrc, usCount);
 		else if(pubDest)
-		{
-			for(uint16_t i = 0; i < usCount; i++)
-				*(pubDest + i) = TransferByte();
-		}
+			ReadBlock(pubDest, usCount);
 	}
 	inline void Read(uint8_t* pubDest, uint16_t usCount)
 	{
-		Transfer(0, usCount, pubDest);
+		ReadBlock(pubDest, usCount);
 	}
 }
 
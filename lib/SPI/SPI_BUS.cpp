@@ -0,0 +1,101 @@
+/*
+ * SPI_BUS.cpp
+ *
+ * Created: 18/10/2026 19:48:20
+ * Author: joaob
+ */ 
+
+#include "SPI.h"
+#include <util/atomic.h>
+
+uint8_t SPI::m_ubActiveDevice = SPI_NO_DEVICE;
+volatile uint8_t SPI::m_ubSelectedDevice = SPI_NO_DEVICE;
+
+static spi_device_t m_Devices[SPI_MAX_DEVICES];
+static uint8_t m_ubDeviceCount = 0;
+
+uint8_t SPI::AddDevice(volatile uint8_t* pubCSPort, uint8_t ubCSBit, uint8_t ubLSBFirst, uint8_t ubMode, uint32_t ulMaxClock)
+{
+	if(m_ubDeviceCount >= SPI_MAX_DEVICES)
+		return SPI_NO_DEVICE;
+	
+	spi_device_t* pDevice = &m_Devices[m_ubDeviceCount];
+	
+	pDevice->m_pubCSPort = pubCSPort;
+	pDevice->m_ubCSMask = 1 << ubCSBit;
+
+#ifdef SPI_USART_MSPIM
+	// SCK = F_CPU / (2 * (UBRR + 1)), any divider is possible so the clock is the closest one at or below the limit
+	uint32_t baud = (F_CPU + 2 * ulMaxClock - 1) / (2 * ulMaxClock);
+	
+	if(baud > 4096)
+		baud = 4096;
+	
+	pDevice->m_ubControl = (1 << UMSEL01) | (1 << UMSEL00) | ((ubLSBFirst & 0x01) << UCSZ01) | ((ubMode & 0x01) << UCSZ00) | (((ubMode >> 1) & 0x01) << UCPOL0);
+	pDevice->m_usBaud = baud ? baud - 1 : 0;
+#else
+	// Fastest of F_CPU / 2, 4, ... 128 that the device takes, odd powers of two use SPI2X
+	uint8_t shift = 1;
+	
+	while(shift < 7 && (F_CPU >> shift) > ulMaxClock)
+		shift++;
+	
+	uint8_t doubleSpeed = (shift & 0x01) && shift < 7;
+	
+	pDevice->m_ubControl = (1 << SPE) | ((ubLSBFirst & 0x01) << DORD) | (1 << MSTR) | ((ubMode & 0x03) << CPHA) | ((((shift + 1) >> 1) - 1) << SPR0);
+	pDevice->m_ubStatus = doubleSpeed << SPI2X;
+#endif
+
+	*pubCSPort |= pDevice->m_ubCSMask; // Deselected before it becomes an output
+	*(pubCSPort - 1) |= pDevice->m_ubCSMask;
+	
+	return m_ubDeviceCount++;
+}
+uint8_t SPI::Select(uint8_t ubDevice)
+{
+	if(ubDevice >= m_ubDeviceCount)
+		return 0;
+	
+	spi_device_t* pDevice = &m_Devices[ubDevice];
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) // Devices are selected from interrupts too
+	{
+		if(SPI::m_ubSelectedDevice != SPI_NO_DEVICE && SPI::m_ubSelectedDevice != ubDevice)
+			return 0;
+		
+		if(ubDevice != SPI::m_ubActiveDevice)
+		{
+#ifdef SPI_USART_MSPIM
+			SPI_MSPIM_UCSRC = pDevice->m_ubControl;
+			SPI_MSPIM_UBRR = pDevice->m_usBaud;
+#else
+			if(SPCR & (1 << SPIE)) // An interrupt driven client owns the bus between its transfers too
+				return 0;
+			
+			SPCR = pDevice->m_ubControl;
+			SPSR = pDevice->m_ubStatus;
+#endif
+
+			SPI::m_ubActiveDevice = ubDevice;
+		}
+		
+		SPI::m_ubSelectedDevice = ubDevice;
+		
+		*pDevice->m_pubCSPort &= ~pDevice->m_ubCSMask;
+	}
+	
+	return 1;
+}
+void SPI::Deselect(uint8_t ubDevice)
+{
+	if(ubDevice >= m_ubDeviceCount)
+		return;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*m_Devices[ubDevice].m_pubCSPort |= m_Devices[ubDevice].m_ubCSMask;
+		
+		if(SPI::m_ubSelectedDevice == ubDevice)
+			SPI::m_ubSelectedDevice = SPI_NO_DEVICE;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,164 @@
+/*
+ * SPI_MSPIM.cpp
+ *
+ * Created: 18/10/2026 16:22:30
+ * Author: joaob
+ */ 
+
+#include "SPI.h"
+
+#ifdef SPI_USART_MSPIM
+
+void SPI::Init(uint8_t ubLSBFirst, uint8_t ubMode, uint8_t ubPrescaler, uint8_t ubDoubleSpeed)
+{
+	// Same SCK as the SPI peripheral would give for these settings, SCK = F_CPU / (2 * (UBRR + 1))
+	uint8_t divider = (ubPrescaler & 0x03) == 0x03 ? 128 : (4 << (2 * (ubPrescaler & 0x03)));
+	
+	if(ubDoubleSpeed & 0x01)
+		divider >>= 1;
+	
+	SPI_MSPIM_UBRR = 0; // Must be 0 while the transmitter is enabled, so XCK starts right away
+	
+	SPI_MSPIM_XCK_DDR |= (1 << SPI_MSPIM_XCK_BIT) | (1 << SPI_MSPIM_TXD_BIT);
+	
+	// UMSEL = 3 (MSPIM), UDORD in the UCSZ1 position, UCPHA in the UCSZ0 position, UCPOL in the UCPOL position
+	SPI_MSPIM_UCSRC = (1 << UMSEL01) | (1 << UMSEL00) | ((ubLSBFirst & 0x01) << UCSZ01) | ((ubMode & 0x01) << UCSZ00) | (((ubMode >> 1) & 0x01) << UCPOL0);
+	SPI_MSPIM_UCSRB = (1 << RXEN0) | (1 << TXEN0);
+	
+	SPI_MSPIM_UBRR = divider / 2 - 1;
+	
+	SPI::m_ubActiveDevice = SPI_NO_DEVICE; // The next Select sets up its device again
+}
+
+uint8_t SPI::TransferByte(uint8_t ubData)
+{
+	while(!(SPI_MSPIM_UCSRA & (1 << UDRE0)));
+	
+	SPI_MSPIM_UDR = ubData;
+	
+	while(!(SPI_MSPIM_UCSRA & (1 << RXC0)));
+	
+	return SPI_MSPIM_UDR;
+}
+
+void SPI::ReadBlock(uint8_t* pubDest, uint16_t usCount)
+{
+	if(!usCount)
+		return;
+	
+	// Two bytes in flight (shift register + transmit buffer), the receiver FIFO is two deep as well
+	uint8_t inFlight = (usCount > 1) ? 2 : 1;
+	uint16_t refills = usCount - inFlight;
+	
+	for(uint8_t i = 0; i < inFlight; i++)
+	{
+		while(!(SPI_MSPIM_UCSRA & (1 << UDRE0)));
+		
+		SPI_MSPIM_UDR = 0x00;
+	}
+	
+	if(refills)
+	{
+		uint8_t data;
+		uint8_t status;
+		
+		// Each received byte frees the transmit buffer, refill it first so the next byte follows without a gap (15 cycles per byte, SCK takes 16)
+		// Both RXC and UDRE are waited for, the transmit buffer must never be overwritten or a byte would not be clocked
+		asm volatile(
+			"1:	lds %[status], %[ucsra]		\n\t"
+			"	andi %[status], %[ready]	\n\t"
+			"	cpi %[status], %[ready]		\n\t"
+			"	brne 1b						\n\t"
+			"	sts %[udr], __zero_reg__	\n\t"
+			"	lds %[data], %[udr]			\n\t"
+			"	st %a[dest]+, %[data]		\n\t"
+			"	sbiw %[count], 1			\n\t"
+			"	brne 1b						\n\t"
+			: [dest] "+e" (pubDest), [count] "+w" (refills), [data] "=&r" (data), [status] "=&d" (status)
+			: [udr] "n" (_SFR_MEM_ADDR(SPI_MSPIM_UDR)), [ucsra] "n" (_SFR_MEM_ADDR(SPI_MSPIM_UCSRA)), [ready] "M" ((1 << RXC0) | (1 << UDRE0))
+			: "memory"
+		);
+	}
+	
+	while(inFlight--)
+	{
+		while(!(SPI_MSPIM_UCSRA & (1 << RXC0)));
+		
+		*(pubDest++) = SPI_MSPIM_UDR;
+	}
+}
+void SPI::WriteBlock(uint8_t* pubSrc, uint16_t usCount)
+{
+	if(!usCount)
+		return;
+	
+	uint8_t data;
+	uint8_t status;
+	
+	SPI_MSPIM_UCSRA = (1 << TXC0); // Clear, set again once the last byte is out
+	
+	asm volatile(
+		"1:	ld %[data], %a[src]+		\n\t"
+		"2:	lds %[status], %[ucsra]		\n\t"
+		"	sbrs %[status], %[udre]		\n\t"
+		"	rjmp 2b						\n\t"
+		"	sts %[udr], %[data]			\n\t"
+		"	sbiw %[count], 1			\n\t"
+		"	brne 1b						\n\t"
+		: [src] "+e" (pubSrc), [count] "+w" (usCount), [data] "=&r" (data), [status] "=&r" (status)
+		: [udr] "n" (_SFR_MEM_ADDR(SPI_MSPIM_UDR)), [ucsra] "n" (_SFR_MEM_ADDR(SPI_MSPIM_UCSRA)), [udre] "I" (UDRE0)
+		: "memory"
+	);
+	
+	while(!(SPI_MSPIM_UCSRA & (1 << TXC0)));
+	
+	while(SPI_MSPIM_UCSRA & (1 << RXC0)) // Drop what was received meanwhile, so the next read starts clean
+		data = SPI_MSPIM_UDR;
+}
+void SPI::ExchangeBlock(uint8_t* pubSrc, uint8_t* pubDest, uint16_t usCount)
+{
+	if(!usCount)
+		return;
+	
+	uint8_t inFlight = (usCount > 1) ? 2 : 1;
+	uint16_t refills = usCount - inFlight;
+	
+	for(uint8_t i = 0; i < inFlight; i++)
+	{
+		while(!(SPI_MSPIM_UCSRA & (1 << UDRE0)));
+		
+		SPI_MSPIM_UDR = *(pubSrc++);
+	}
+	
+	if(refills)
+	{
+		uint8_t data;
+		uint8_t status;
+		
+		// pubSrc may equal pubDest, the source runs two bytes ahead of the destination
+		asm volatile(
+			"1:	ld %[data], %a[src]+		\n\t"
+			"2:	lds %[status], %[ucsra]		\n\t"
+			"	andi %[status], %[ready]	\n\t"
+			"	cpi %[status], %[ready]		\n\t"
+			"	brne 2b						\n\t"
+			"	sts %[udr], %[data]			\n\t"
+			"	lds %[data], %[udr]			\n\t"
+			"	st %a[dest]+, %[data]		\n\t"
+			"	sbiw %[count], 1			\n\t"
+			"	brne 1b						\n\t"
+			: [src] "+e" (pubSrc), [dest] "+e" (pubDest), [count] "+w" (refills), [data] "=&r" (data), [status] "=&d" (status)
+			: [udr] "n" (_SFR_MEM_ADDR(SPI_MSPIM_UDR)), [ucsra] "n" (_SFR_MEM_ADDR(SPI_MSPIM_UCSRA)), [ready] "M" ((1 << RXC0) | (1 << UDRE0))
+			: "memory"
+		);
+	}
+	
+	while(inFlight--)
+	{
+		while(!(SPI_MSPIM_UCSRA & (1 << RXC0)));
+		
+		*(pubDest++) = SPI_MSPIM_UDR;
+	}
+}
+
+#endif
\ No newline at end of file
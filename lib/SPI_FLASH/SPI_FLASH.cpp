@@ -6,258 +6,1365 @@
  */ 
 
 #include "SPI_FLASH.h"
+#include <stddef.h>
+#include <util/crc16.h>
+
+flash_desc_t SPI_FLASH::m_Desc = {
+	FLASH_JEDEC_SST, 0x00, 0x49, // No JEDEC ID, 0xAB IDs
+	FLASH_SECTOR_SIZE * 32, 3,
+	FLASH_PROGRAM_AAI_BYTE, 1,
+	FLASH_CMD_SECTOR_ERASE, FLASH_CMD_BLOCK_ERASE, FLASH_BLOCK_SIZE,
+	1,
+	FLASH_PROGRAM_TIMEOUT, FLASH_SECTOR_ERASE_TIME * FLASH_TIMEOUT_FACTOR, FLASH_PAGE_ERASE_TIME * FLASH_TIMEOUT_FACTOR, FLASH_CHIP_ERASE_TIME * FLASH_TIMEOUT_FACTOR
+};
+
+uint8_t SPI_FLASH::m_ubDevice = SPI_NO_DEVICE;
+
+static flash_op_stats_t m_Stats[FLASH_OP_COUNT];
+static uint8_t m_ubScratchNext = 0; // Modify scratch sector used next, Init picks up after the newest log record
+#ifdef FLASH_MODIFY_LOG
+static uint16_t m_usScratchLogNext = 0; // Log slot tried next, 0 while the log sector holds no header
+#endif
+static uint8_t m_ubAAIOpen = 0; // AAI sequence (or SO busy output) not closed yet, the chip takes nothing else until it is
+
+static uint32_t m_ulStreamAddress = 0; // Next address clocked out of the chip
+static uint8_t m_ubStreamState = FLASH_STREAM_CLOSED;
+#if FLASH_STREAM_CACHE_SIZE > 0
+static uint8_t m_ubStreamCache[FLASH_STREAM_CACHE_SIZE];
+static uint8_t m_ubStreamCachePos = 0;
+static uint8_t m_ubStreamCacheLen = 0;
+#endif
+
+#ifdef FLASH_ASYNC
+struct flash_bus_owner_t // Holds the bus for the async engine while in scope, nests
+{
+	flash_bus_owner_t()
+	{
+		SPI_FLASH::AsyncAcquire();
+	}
+	~flash_bus_owner_t()
+	{
+		SPI_FLASH::AsyncRelease();
+	}
+};
+
+#define FLASH_OWN_BUS() flash_bus_owner_t busOwner
+#else
+#define FLASH_OWN_BUS()
+#endif
+
+static void FLASH_StreamSuspend()
+{
+	if(m_ubStreamState != FLASH_STREAM_ACTIVE)
+		return;
+	
+	FLASH_UNSELECT();
+	
+	m_ubStreamState = FLASH_STREAM_SUSPENDED;
+}
+static void FLASH_StreamInvalidate()
+{
+	FLASH_StreamSuspend();
+
+#if FLASH_STREAM_CACHE_SIZE > 0
+	m_ulStreamAddress -= m_ubStreamCacheLen - m_ubStreamCachePos; // The flash is about to change, what was read ahead is read again
+	m_ubStreamCachePos = 0;
+	m_ubStreamCacheLen = 0;
+#endif
+}
+
+static void FLASH_SendAddress(uint8_t ubCommand, uint32_t ulAddress)
+{
+	SPI::TransferByte(ubCommand);
+	
+	if(SPI_FLASH::m_Desc.m_ubAddressBytes == 4)
+		SPI::TransferByte((ulAddress >> 24) & 0xFF);
+	
+	SPI::TransferByte((ulAddress >> 16) & 0xFF);
+	SPI::TransferByte((ulAddress >> 8) & 0xFF);
+	SPI::TransferByte(ulAddress & 0xFF);
+}
+static uint8_t FLASH_Command(uint8_t ubCommand)
+{
+	FLASH_StreamSuspend();
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(!FLASH_SELECT()) // Another device holds the bus, nothing is clocked out
+			return 0;
+		
+		SPI::TransferByte(ubCommand);
+		
+		FLASH_UNSELECT();
+	}
+	
+	return 1;
+}
+static uint8_t FLASH_AddressCommand(uint8_t ubCommand, uint32_t ulAddress)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(!FLASH_SELECT())
+			return 0;
+		
+		FLASH_SendAddress(ubCommand, ulAddress);
+		
+		FLASH_UNSELECT();
+	}
+	
+	return 1;
+}
+static uint8_t FLASH_ReadSFDP(uint32_t ulAddress, uint8_t* pubDest, uint16_t usCount)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(!FLASH_SELECT())
+			return 0;
+		
+		SPI::TransferByte(FLASH_CMD_READ_SFDP); // Always 3 address bytes and 8 dummy clocks
+		SPI::TransferByte((ulAddress >> 16) & 0xFF);
+		SPI::TransferByte((ulAddress >> 8) & 0xFF);
+		SPI::TransferByte(ulAddress & 0xFF);
+		SPI::TransferByte();
+		
+		SPI::Read(pubDest, usCount);
+		
+		FLASH_UNSELECT();
+	}
+	
+	return 1;
+}
+static uint32_t FLASH_SFDPTime(uint8_t ubCount, uint8_t ubUnits, const uint16_t* pusUnits)
+{
+	uint32_t ms = (uint32_t)(ubCount + 1) * pusUnits[ubUnits];
+	
+	if(ms > 0xFFFFFFFF / 1000)
+		return 0xFFFFFFFF;
+	
+	return ms * 1000; // us
+}
+static uint8_t FLASH_ParseSFDP(flash_desc_t* pDesc) // 0 if the part has no usable SFDP, 0xFF if the bus was taken
+{
+	static const uint16_t eraseUnits[] = {1, 16, 128, 1000}; // ms
+	static const uint16_t chipEraseUnits[] = {16, 256, 4000, 64000}; // ms
+	uint8_t header[16];
+	uint32_t bfpt[FLASH_SFDP_BFPT_DWORDS];
+	
+	if(!FLASH_ReadSFDP(0, header, 16))
+		return 0xFF;
+	
+	if(*(uint32_t*)header != FLASH_SFDP_SIGNATURE)
+		return 0;
+	
+	// The first parameter header always points to the JEDEC Basic Flash Parameter Table
+	uint8_t length = header[11]; // DWORDs
+	uint32_t pointer = header[12] | ((uint32_t)header[13] << 8) | ((uint32_t)header[14] << 16);
+	
+	if(header[8] != 0x00 || length < 9)
+		return 0;
+	
+	if(length > FLASH_SFDP_BFPT_DWORDS)
+		length = FLASH_SFDP_BFPT_DWORDS;
+	
+	memset(bfpt, 0, sizeof(bfpt));
+	
+	if(!FLASH_ReadSFDP(pointer, (uint8_t*)bfpt, length * 4))
+		return 0xFF;
+	
+	if((bfpt[0] & 0x03) != 0x01) // No 4 KB erase, Modify and the sector layout need it
+		return 0;
+	
+	// Density is in bits, either N - 1 or 2^N
+	if(bfpt[1] & 0x80000000)
+	{
+		uint8_t exponent = bfpt[1] & 0x7F;
+		
+		if(exponent < 3 || exponent > 34) // 4 GB and above can not be addressed
+			return 0;
+		
+		pDesc->m_ulSize = (uint32_t)1 << (exponent - 3);
+	}
+	else
+	{
+		pDesc->m_ulSize = (bfpt[1] >> 3) + 1;
+	}
+	
+	switch((bfpt[0] >> 17) & 0x03)
+	{
+		case 0x00: // 3 byte only
+			pDesc->m_ubAddressBytes = 3;
+			
+			if(pDesc->m_ulSize > 0x1000000)
+				pDesc->m_ulSize = 0x1000000;
+			break;
+		case 0x01: // 3 byte, 4 byte after FLASH_CMD_ENTER_4BYTE
+			pDesc->m_ubAddressBytes = (pDesc->m_ulSize > 0x1000000) ? 4 : 3;
+			break;
+		default: // 4 byte only
+			pDesc->m_ubAddressBytes = 4;
+			break;
+	}
+	
+	pDesc->m_ubProgramMode = FLASH_PROGRAM_PAGE;
+	pDesc->m_usPageSize = (bfpt[0] & 0x04) ? 256 : 1; // Write granularity, refined by DWORD 11 below
+	pDesc->m_ubSectorEraseCmd = (bfpt[0] >> 8) & 0xFF;
+	pDesc->m_ubBlockEraseCmd = 0;
+	pDesc->m_ulBlockSize = 0;
+	pDesc->m_ubFastRead = 1; // 1-1-1 FAST_READ is mandatory on SFDP parts
+	pDesc->m_ulProgramTimeout = FLASH_PAGE_PROGRAM_TIMEOUT;
+	pDesc->m_ulSectorEraseTimeout = FLASH_4K_ERASE_TIMEOUT;
+	pDesc->m_ulBlockEraseTimeout = FLASH_64K_ERASE_TIMEOUT;
+	pDesc->m_ulChipEraseTimeout = (pDesc->m_ulSize >> 17) * FLASH_CHIP_ERASE_TIMEOUT_MBIT + FLASH_CHIP_ERASE_TIMEOUT_MBIT;
+	
+	// DWORDs 8 and 9, four erase types, the largest one up to 64 KB is used as the block erase
+	uint8_t sectorType = 0xFF;
+	uint8_t blockType = 0xFF;
+	
+	for(uint8_t i = 0; i < 4; i++)
+	{
+		uint16_t type = (bfpt[7 + (i >> 1)] >> ((i & 1) * 16)) & 0xFFFF;
+		uint8_t exponent = type & 0xFF;
+		
+		if(!exponent || exponent > 16)
+			continue;
+		
+		uint32_t size = (uint32_t)1 << exponent;
+		
+		if(size == FLASH_SECTOR_SIZE && sectorType == 0xFF)
+		{
+			pDesc->m_ubSectorEraseCmd = type >> 8;
+			sectorType = i;
+		}
+		
+		if(size > FLASH_SECTOR_SIZE && size > pDesc->m_ulBlockSize)
+		{
+			pDesc->m_ubBlockEraseCmd = type >> 8;
+			pDesc->m_ulBlockSize = size;
+			blockType = i;
+		}
+	}
+	
+	if(!pDesc->m_ulBlockSize) // Only 4 KB erase, blocks are erased as one sector
+	{
+		pDesc->m_ubBlockEraseCmd = pDesc->m_ubSectorEraseCmd;
+		pDesc->m_ulBlockSize = FLASH_SECTOR_SIZE;
+	}
+	
+	if(length >= 11) // JESD216A timing, typical times scaled by the maximum multipliers (erase in DWORD10, program in DWORD11)
+	{
+		uint8_t multiplier = 2 * ((bfpt[9] & 0x0F) + 1);
+		uint8_t programMultiplier = 2 * ((bfpt[10] & 0x0F) + 1);
+		
+		if(sectorType != 0xFF)
+			pDesc->m_ulSectorEraseTimeout = FLASH_SFDPTime((bfpt[9] >> (4 + 7 * sectorType)) & 0x1F, (bfpt[9] >> (9 + 7 * sectorType)) & 0x03, eraseUnits) * multiplier;
+		
+		if(blockType != 0xFF)
+			pDesc->m_ulBlockEraseTimeout = FLASH_SFDPTime((bfpt[9] >> (4 + 7 * blockType)) & 0x1F, (bfpt[9] >> (9 + 7 * blockType)) & 0x03, eraseUnits) * multiplier;
+		else
+			pDesc->m_ulBlockEraseTimeout = pDesc->m_ulSectorEraseTimeout;
+		
+		uint32_t chipErase = FLASH_SFDPTime((bfpt[10] >> 24) & 0x1F, (bfpt[10] >> 29) & 0x03, chipEraseUnits);
+		
+		pDesc->m_ulChipEraseTimeout = (chipErase > 0xFFFFFFFF / multiplier) ? 0xFFFFFFFF : chipErase * multiplier;
+		pDesc->m_ulProgramTimeout = (uint32_t)(((bfpt[10] >> 8) & 0x1F) + 1) * ((bfpt[10] & (1UL << 13)) ? 64 : 8) * programMultiplier;
+		
+		if(pDesc->m_usPageSize > 1)
+			pDesc->m_usPageSize = 1 << ((bfpt[10] >> 4) & 0x0F);
+	}
+	
+	return 1;
+}
+static uint8_t FLASH_Probe(flash_desc_t* pDesc)
+{
+	uint8_t id[3];
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(!FLASH_SELECT())
+			return 0;
+		
+		SPI::TransferByte(FLASH_CMD_READ_JEDEC_ID);
+		SPI::Read(id, 3);
+		
+		FLASH_UNSELECT();
+	}
+	
+	if((id[0] == 0x00 || id[0] == 0xFF) && id[1] == id[0]) // No JEDEC ID, SST25VF010A and friends
+		return SPI_FLASH::ReadDeviceID() == 0x49 && SPI_FLASH::ReadManufacturerID() == FLASH_JEDEC_SST;
+	
+	pDesc->m_ubManufacturerID = id[0];
+	pDesc->m_ubMemoryType = id[1];
+	pDesc->m_ubCapacity = id[2];
+	
+	if(id[0] == FLASH_JEDEC_SST && id[1] == FLASH_JEDEC_SST25) // SST25VF, no SFDP on most of them
+	{
+		static const uint8_t sizes[] = {0x8C, 0x8D, 0x8E, 0x41, 0x4A, 0x4B}; // 2 Mbit to 64 Mbit
+		uint8_t i;
+		
+		for(i = 0; i < sizeof(sizes); i++)
+			if(sizes[i] == id[2])
+				break;
+		
+		if(i == sizeof(sizes))
+			return 0;
+		
+		pDesc->m_ulSize = (uint32_t)0x40000 << i;
+		pDesc->m_ubAddressBytes = 3;
+		pDesc->m_ubProgramMode = (id[2] == 0x4B) ? FLASH_PROGRAM_PAGE : FLASH_PROGRAM_AAI_WORD; // The B series has word AAI, the 064C page program
+		pDesc->m_usPageSize = (id[2] == 0x4B) ? 256 : 1;
+		pDesc->m_ubSectorEraseCmd = FLASH_CMD_SECTOR_ERASE;
+		pDesc->m_ubBlockEraseCmd = FLASH_CMD_BLOCK_ERASE;
+		pDesc->m_ulBlockSize = FLASH_BLOCK_SIZE;
+		pDesc->m_ubFastRead = 1;
+		pDesc->m_ulProgramTimeout = FLASH_PROGRAM_TIMEOUT;
+		pDesc->m_ulSectorEraseTimeout = FLASH_SECTOR_ERASE_TIME * FLASH_TIMEOUT_FACTOR;
+		pDesc->m_ulBlockEraseTimeout = FLASH_PAGE_ERASE_TIME * FLASH_TIMEOUT_FACTOR;
+		pDesc->m_ulChipEraseTimeout = FLASH_CHIP_ERASE_TIME * FLASH_TIMEOUT_FACTOR;
+		
+		return 1;
+	}
+	
+	uint8_t sfdp = FLASH_ParseSFDP(pDesc);
+	
+	if(sfdp == 0xFF)
+		return 0;
+	
+	if(!sfdp)
+	{
+		if(id[2] < 17 || id[2] > 24) // No SFDP, the usual 2^N capacity code with page program, 4 KB and 64 KB erases
+			return 0;
+		
+		pDesc->m_ulSize = (uint32_t)1 << id[2];
+		pDesc->m_ubAddressBytes = 3;
+		pDesc->m_ubProgramMode = FLASH_PROGRAM_PAGE;
+		pDesc->m_usPageSize = 256;
+		pDesc->m_ubSectorEraseCmd = FLASH_CMD_SECTOR_ERASE;
+		pDesc->m_ubBlockEraseCmd = FLASH_CMD_BLOCK_ERASE_64K;
+		pDesc->m_ulBlockSize = 0x10000;
+		pDesc->m_ubFastRead = 1;
+		pDesc->m_ulProgramTimeout = FLASH_PAGE_PROGRAM_TIMEOUT;
+		pDesc->m_ulSectorEraseTimeout = FLASH_4K_ERASE_TIMEOUT;
+		pDesc->m_ulBlockEraseTimeout = FLASH_64K_ERASE_TIMEOUT;
+		pDesc->m_ulChipEraseTimeout = (pDesc->m_ulSize >> 17) * FLASH_CHIP_ERASE_TIMEOUT_MBIT + FLASH_CHIP_ERASE_TIMEOUT_MBIT;
+	}
+	
+	if(pDesc->m_ulSize < FLASH_SECTOR_SIZE * 32) // The sector layout needs at least 1 Mbit
+		return 0;
+	
+	if(id[0] == FLASH_JEDEC_SST && id[1] == FLASH_JEDEC_SST26)
+		if(!SPI_FLASH::WriteEnable() || !FLASH_Command(FLASH_CMD_GLOBAL_UNLOCK))
+			return 0;
+	
+	if(pDesc->m_ubAddressBytes == 4)
+	{
+		if(!SPI_FLASH::WriteEnable() || !FLASH_Command(FLASH_CMD_ENTER_4BYTE)) // Some parts want WEL set for EN4B
+			return 0;
+		
+		SPI_FLASH::WriteDisable();
+	}
+	
+	return 1;
+}
+
+static uint8_t FLASH_ReadStatus()
+{
+	uint8_t status;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(!FLASH_SELECT()) // Reads as busy, BusyWait polls again until the bus is back or it times out
+			return 0xFF;
+		
+		SPI::TransferByte(FLASH_CMD_READ_STATUS);
+		status = SPI::TransferByte();
+		
+		FLASH_UNSELECT();
+	}
+	
+	return status;
+}
+static uint32_t FLASH_Timeout(flash_op_t ubOp)
+{
+	switch(ubOp)
+	{
+		case FLASH_OP_PROGRAM:
+			return SPI_FLASH::m_Desc.m_ulProgramTimeout;
+		case FLASH_OP_SECTOR_ERASE:
+			return SPI_FLASH::m_Desc.m_ulSectorEraseTimeout;
+		case FLASH_OP_BLOCK_ERASE:
+			return SPI_FLASH::m_Desc.m_ulBlockEraseTimeout;
+		default: // Chip erase, or whatever may still be running from before
+			return SPI_FLASH::m_Desc.m_ulChipEraseTimeout;
+	}
+}
+static void FLASH_Record(flash_op_t ubOp, uint32_t ulTime)
+{
+	if(ubOp >= FLASH_OP_COUNT)
+		return;
+	
+	flash_op_stats_t* pStats = &m_Stats[ubOp];
+	
+	if(!pStats->m_usCount || ulTime < pStats->m_ulMinTime)
+		pStats->m_ulMinTime = ulTime;
+	
+	if(ulTime > pStats->m_ulMaxTime)
+		pStats->m_ulMaxTime = ulTime;
+	
+	if(pStats->m_usCount < 0xFFFF)
+	{
+		pStats->m_usCount++;
+		pStats->m_ulTotalTime += ulTime;
+	}
+}
+static uint8_t FLASH_WaitSO()
+{
+	uint32_t start = TIMER::GetMicros();
+	uint8_t ready;
+	
+	if(!FLASH_SELECT())
+	{
+		DPRINTFLN_CTX("SPI bus taken [%u]", SPI::m_ubSelectedDevice);
+		
+		return 0;
+	}
+	
+	while(!(ready = FLASH_SO_READY()) && TIMER::GetMicros() - start <= SPI_FLASH::m_Desc.m_ulProgramTimeout); // SO goes high at the end of the word program
+	
+	FLASH_UNSELECT();
+	
+	if(ready)
+		FLASH_Record(FLASH_OP_PROGRAM, TIMER::GetMicros() - start);
+	else
+		DPRINTFLN_CTX("Flash SO busy timeout");
+	
+	return ready;
+}
+static uint8_t FLASH_ProgramByte(uint32_t ulAddress, uint8_t ubData)
+{
+	uint8_t ret = 0;
+	
+	if(!SPI_FLASH::WriteEnable())
+		return 0;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(FLASH_SELECT())
+		{
+			FLASH_SendAddress(FLASH_CMD_WRITE_BYTE, ulAddress);
+			SPI::TransferByte(ubData);
+			
+			FLASH_UNSELECT();
+			
+			ret = 1;
+		}
+	}
+	
+	if(ret)
+		ret = SPI_FLASH::BusyWait(FLASH_OP_PROGRAM);
+	
+	SPI_FLASH::WriteDisable();
+	
+	return ret;
+}
+static uint8_t FLASH_WritePages(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount)
+{
+	while(usCount)
+	{
+		uint16_t pageSize = SPI_FLASH::m_Desc.m_usPageSize;
+		uint16_t count = pageSize - (ulAddress & (pageSize - 1)); // A page program wraps around inside its page
+		
+		if(count > usCount)
+			count = usCount;
+		
+		uint8_t sent = 0;
+		
+		if(!SPI_FLASH::WriteEnable())
+			return 0;
+		
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			if(FLASH_SELECT())
+			{
+				FLASH_SendAddress(FLASH_CMD_WRITE_BYTE, ulAddress);
+				SPI::Transfer(pubSrc, count);
+				
+				FLASH_UNSELECT();
+				
+				sent = 1;
+			}
+		}
+		
+		if(!sent || !SPI_FLASH::BusyWait(FLASH_OP_PROGRAM))
+		{
+			SPI_FLASH::WriteDisable();
+			
+			return 0;
+		}
+		
+		ulAddress += count;
+		pubSrc += count;
+		usCount -= count;
+	}
+	
+	return 1;
+}
+static uint8_t FLASH_AAICommand(uint8_t ubCommand, uint8_t ubFirst, uint32_t ulAddress, uint8_t* pubData, uint8_t ubCount) // Only the first command of a sequence carries the address
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(!FLASH_SELECT())
+			return 0;
+		
+		if(ubFirst)
+			FLASH_SendAddress(ubCommand, ulAddress);
+		else
+			SPI::TransferByte(ubCommand);
+		
+		for(uint8_t i = 0; i < ubCount; i++)
+			SPI::TransferByte(pubData[i]);
+		
+		FLASH_UNSELECT();
+	}
+	
+	return 1;
+}
+static uint8_t FLASH_AAIEnd() // Leaves AAI mode once the last program is done, waits for the bus a program time as the chip is unusable until then
+{
+	uint32_t start = TIMER::GetMicros();
+	
+	while((FLASH_ReadStatus() & FLASH_STATUS_BUSY) || !SPI_FLASH::WriteDisable() || (SPI_FLASH::m_Desc.m_ubProgramMode == FLASH_PROGRAM_AAI_WORD && !FLASH_Command(FLASH_CMD_DISABLE_SO_BUSY)))
+	{
+		if(TIMER::GetMicros() - start > SPI_FLASH::m_Desc.m_ulProgramTimeout) // Left open, BusyWait closes it before the next operation
+		{
+			DPRINTFLN_CTX("SPI bus taken, AAI left open [%u]", SPI::m_ubSelectedDevice);
+			
+			return 0;
+		}
+	}
+	
+	m_ubAAIOpen = 0;
+	
+	return 1;
+}
+static uint8_t FLASH_WriteAAIWord(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount)
+{
+	if(ulAddress & 1) // Word AAI starts on an even address, the odd byte before it is programmed alone
+	{
+		if(!FLASH_ProgramByte(ulAddress++, *(pubSrc++)))
+			return 0;
+		
+		usCount--;
+	}
+	
+	uint16_t words = usCount / 2;
+	uint8_t ret = 1;
+	
+	if(words)
+	{
+		if(!FLASH_Command(FLASH_CMD_ENABLE_SO_BUSY))
+			return 0;
+		
+		m_ubAAIOpen = 1;
+		
+		ret = SPI_FLASH::WriteEnable();
+		
+		// Interrupts only stay off for each command, not the whole sequence, so Timer1 does not miss overflows on long writes
+		for(uint16_t i = 0; i < words && ret; i++)
+		{
+			if(!FLASH_AAICommand(FLASH_CMD_WRITE_AAI_WORD, i == 0, ulAddress, pubSrc, 2) || !FLASH_WaitSO())
+			{
+				ret = 0;
+				
+				break;
+			}
+			
+			pubSrc += 2;
+		}
+		
+		if(!FLASH_AAIEnd() || !ret)
+			return 0;
+		
+		ulAddress += (uint32_t)words * 2;
+		usCount -= words * 2;
+	}
+	
+	if(usCount) // Odd byte left at the end
+		return FLASH_ProgramByte(ulAddress, *pubSrc);
+	
+	return 1;
+}
+static uint8_t FLASH_WriteAAIByte(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount)
+{
+	if(usCount == 1)
+		return FLASH_ProgramByte(ulAddress, *pubSrc);
+	
+	uint8_t ret = SPI_FLASH::WriteEnable();
+	
+	m_ubAAIOpen = ret;
+	
+	for(uint16_t i = 0; i < usCount && ret; i++) // Interrupts only stay off for each command, as in FLASH_WriteAAIWord
+	{
+		if(!FLASH_AAICommand(FLASH_CMD_WRITE_CONTINUOUS, i == 0, ulAddress, pubSrc + i, 1) || !SPI_FLASH::BusyWait(FLASH_OP_PROGRAM)) // Usually done well before the FLASH_BYTE_WRITE_TIME worst case
+		{
+			ret = 0;
+			
+			break;
+		}
+	}
+	
+	if(m_ubAAIOpen && !FLASH_AAIEnd())
+		return 0;
+	
+	return ret;
+}
+static uint8_t FLASH_Compare(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount)
+{
+	uint8_t buf[FLASH_MODIFY_CHUNK];
+	uint8_t ret = FLASH_COMPARE_EQUAL;
+	
+	while(usCount)
+	{
+		uint16_t count = (usCount > FLASH_MODIFY_CHUNK) ? FLASH_MODIFY_CHUNK : usCount;
+		
+		if(!SPI_FLASH::Read(ulAddress, buf, count))
+			return FLASH_COMPARE_FAILED;
+		
+		for(uint16_t i = 0; i < count; i++)
+		{
+			if(buf[i] == pubSrc[i])
+				continue;
+			
+			if((buf[i] & pubSrc[i]) != pubSrc[i]) // A bit goes from 0 to 1
+				return FLASH_COMPARE_ERASE;
+			
+			ret = FLASH_COMPARE_PROGRAM;
+		}
+		
+		ulAddress += count;
+		pubSrc += count;
+		usCount -= count;
+	}
+	
+	return ret;
+}
+static uint8_t FLASH_CopySector(uint32_t ulSrc, uint32_t ulDest, uint16_t usOffset, uint8_t* pubData, uint16_t usCount)
+{
+	uint8_t buf[FLASH_MODIFY_CHUNK];
+	
+	if(!SPI_FLASH::SectorErase(ulDest))
+		return 0;
+	
+	for(uint16_t i = 0; i < FLASH_SECTOR_SIZE; i += FLASH_MODIFY_CHUNK)
+	{
+		if(!SPI_FLASH::Read(ulSrc + i, buf, FLASH_MODIFY_CHUNK))
+			return 0;
+		
+		if(usCount && usOffset < i + FLASH_MODIFY_CHUNK && usOffset + usCount > i) // Merge the new data that falls in this chunk
+		{
+			uint16_t start = (usOffset > i) ? usOffset : i;
+			uint16_t end = (usOffset + usCount < i + FLASH_MODIFY_CHUNK) ? usOffset + usCount : i + FLASH_MODIFY_CHUNK;
+			
+			memcpy(buf + (start - i), pubData + (start - usOffset), end - start);
+		}
+		
+		uint8_t blank = 1;
+		
+		for(uint8_t j = 0; j < FLASH_MODIFY_CHUNK && blank; j++)
+			blank = (buf[j] == 0xFF);
+		
+		if(!blank && !SPI_FLASH::Write(ulDest + i, buf, FLASH_MODIFY_CHUNK)) // Erased chunks are left alone
+			return 0;
+	}
+	
+	return 1;
+}
+static uint8_t FLASH_IsScratch(uint32_t ulSector)
+{
+	return ulSector >= FLASH_SCRATCH_BOTTOM && ulSector <= FLASH_SECTOR_23;
+}
+#ifdef FLASH_MODIFY_LOG
+static uint16_t FLASH_ScratchCRC(flash_scratch_tag_t* pTag)
+{
+	uint16_t crc = 0xFFFF;
+	
+	for(uint8_t i = 0; i < sizeof(uint32_t); i++)
+		crc = _crc_ccitt_update(crc, ((uint8_t*)&pTag->m_ulSector)[i]);
+	
+	return _crc_ccitt_update(crc, pTag->m_ubScratch);
+}
+static uint8_t FLASH_ScratchTagValid(flash_scratch_tag_t* pTag)
+{
+	if(pTag->m_usCRC != FLASH_ScratchCRC(pTag) || pTag->m_ubScratch >= FLASH_SCRATCH_SECTORS)
+		return 0;
+	
+	return !(pTag->m_ulSector & (FLASH_SECTOR_SIZE - 1)) && pTag->m_ulSector <= FLASH_MAX_ADDRESS && !FLASH_IsScratch(pTag->m_ulSector);
+}
+static uint32_t FLASH_ScratchAddress(uint16_t usRecord)
+{
+	return FLASH_SCRATCH_LOG + usRecord * sizeof(flash_scratch_tag_t);
+}
+static void FLASH_ScratchHeader(flash_scratch_tag_t* pTag)
+{
+	pTag->m_ulSector = FLASH_SCRATCH_MAGIC;
+	pTag->m_ubScratch = FLASH_SCRATCH_SECTORS; // Records of another scratch layout point at the wrong sectors
+	pTag->m_usCRC = FLASH_ScratchCRC(pTag);
+	pTag->m_ubDone = FLASH_SCRATCH_DONE;
+}
+static uint8_t FLASH_ScratchRead(uint16_t usRecord, flash_scratch_tag_t* pTag) // 1 if the slot is erased, 0xFF if the flash does not respond
+{
+	if(!SPI_FLASH::Read(FLASH_ScratchAddress(usRecord), (uint8_t*)pTag, sizeof(flash_scratch_tag_t)))
+		return 0xFF;
+	
+	for(uint8_t i = 0; i < sizeof(flash_scratch_tag_t); i++)
+		if(((uint8_t*)pTag)[i] != 0xFF)
+			return 0;
+	
+	return 1;
+}
+static uint8_t FLASH_ScratchLog(flash_scratch_tag_t* pTag, uint16_t* pusRecord)
+{
+	while(1)
+	{
+		if(!m_usScratchLogNext || m_usScratchLogNext >= FLASH_SCRATCH_LOG_RECORDS) // Full, or not a log yet
+		{
+			uint8_t blank = m_usScratchLogNext ? 0 : SPI_FLASH::IsBlank(FLASH_SCRATCH_LOG, FLASH_SECTOR_SIZE);
+			flash_scratch_tag_t header;
+			
+			if(blank == 0xFF || (!blank && !SPI_FLASH::SectorErase(FLASH_SCRATCH_LOG)))
+				return 0;
+			
+			FLASH_ScratchHeader(&header);
+			
+			if(!SPI_FLASH::Write(FLASH_ScratchAddress(0), (uint8_t*)&header, sizeof(flash_scratch_tag_t)))
+				return 0;
+			
+			m_usScratchLogNext = 1;
+		}
+		
+		flash_scratch_tag_t slot;
+		uint16_t record = m_usScratchLogNext++;
+		uint8_t blank = FLASH_ScratchRead(record, &slot);
+		
+		if(blank == 0xFF)
+			return 0;
+		
+		if(!blank) // Torn by a reset, or whatever the sector held before
+			continue;
+		
+		*pusRecord = record;
+		
+		return SPI_FLASH::Write(FLASH_ScratchAddress(record), (uint8_t*)pTag, sizeof(flash_scratch_tag_t));
+	}
+}
+static uint8_t FLASH_ScratchCommit(flash_scratch_tag_t* pTag, uint16_t usRecord)
+{
+	uint8_t done = FLASH_SCRATCH_DONE;
+	
+	if(!FLASH_CopySector(FLASH_SCRATCH_FIRST + FLASH_SECTOR_SIZE * pTag->m_ubScratch, pTag->m_ulSector, 0, 0, 0))
+		return 0;
+	
+	return SPI_FLASH::Write(FLASH_ScratchAddress(usRecord) + offsetof(flash_scratch_tag_t, m_ubDone), &done, 1);
+}
+static uint8_t FLASH_ScratchRecover()
+{
+	flash_scratch_tag_t tag;
+	flash_scratch_tag_t header;
+	uint16_t low = 1;
+	uint16_t high = FLASH_SCRATCH_LOG_RECORDS;
+	
+	m_usScratchLogNext = 0;
+	m_ubScratchNext = 0;
+	
+	if(FLASH_ScratchRead(0, &tag) == 0xFF)
+		return 0;
+	
+	FLASH_ScratchHeader(&header);
+	
+	if(memcmp(&tag, &header, sizeof(flash_scratch_tag_t))) // Application data, or a log of another layout, none of it is replayed
+	{
+		DPRINTFLN_CTX("No Modify log at [0x%08lX], it is set up by the first rewrite", (uint32_t)FLASH_SCRATCH_LOG);
+		
+		return 1;
+	}
+	
+	while(low < high) // Records are appended front to back, find the first erased slot
+	{
+		uint16_t mid = (low + high) / 2;
+		uint8_t blank = FLASH_ScratchRead(mid, &tag);
+		
+		if(blank == 0xFF)
+			return 0;
+		
+		if(blank)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	
+	m_usScratchLogNext = low;
+	
+	while(--low) // Only the newest complete record can still be pending, a torn one never got to erase its sector
+	{
+		if(FLASH_ScratchRead(low, &tag) == 0xFF)
+			return 0;
+		
+		if(!FLASH_ScratchTagValid(&tag))
+			continue;
+		
+		m_ubScratchNext = (tag.m_ubScratch + 1) % FLASH_SCRATCH_SECTORS;
+		
+		if(tag.m_ubDone == FLASH_SCRATCH_DONE)
+			return 1;
+		
+		DPRINTFLN_CTX("Finishing interrupted rewrite [0x%08lX] [%u]", tag.m_ulSector, tag.m_ubScratch);
+		
+		return FLASH_ScratchCommit(&tag, low);
+	}
+	
+	return 1;
+}
+#endif
+static uint32_t FLASH_EraseEstimate(flash_op_t ubOp)
+{
+	// Measured averages are only compared with measured averages, a fast chip would otherwise always look cheaper per sector
+	if(m_Stats[FLASH_OP_SECTOR_ERASE].m_usCount && m_Stats[FLASH_OP_BLOCK_ERASE].m_usCount)
+		return m_Stats[ubOp].m_ulTotalTime / m_Stats[ubOp].m_usCount;
+	
+	return FLASH_Timeout(ubOp) / FLASH_TIMEOUT_FACTOR;
+}
+static uint8_t FLASH_StreamResume()
+{
+	if(m_ubStreamState == FLASH_STREAM_ACTIVE)
+		return 1;
+	
+	if(m_ubStreamState == FLASH_STREAM_CLOSED || !SPI_FLASH::BusyWait())
+		return 0;
+	
+	if(!FLASH_SELECT()) // Still suspended, the next StreamRead tries again
+		return 0;
+	
+	if(SPI_FLASH::m_Desc.m_ubFastRead)
+	{
+		FLASH_SendAddress(FLASH_CMD_READ_FAST, m_ulStreamAddress);
+		SPI::TransferByte(); // Dummy byte
+	}
+	else
+	{
+		FLASH_SendAddress(FLASH_CMD_READ, m_ulStreamAddress);
+	}
+	
+	m_ubStreamState = FLASH_STREAM_ACTIVE;
+	
+	return 1;
+}
+static uint8_t FLASH_StreamBus(uint8_t* pubDest, uint16_t usCount)
+{
+	if(!FLASH_StreamResume())
+		return 0;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) // An interrupt between starting a byte and reading the previous one would lose it
+	{
+		SPI::Read(pubDest, usCount);
+	}
+	
+	m_ulStreamAddress += usCount;
+	
+	return 1;
+}
 
 uint8_t SPI_FLASH::Init()
 {
-	PORTC |= (1 << PC3);
-	DDRC |= (1 << DDC3);
+	FLASH_OWN_BUS();
+	
+	if(SPI_FLASH::m_ubDevice == SPI_NO_DEVICE)
+		SPI_FLASH::m_ubDevice = SPI::AddDevice(&FLASH_CS_PORT, FLASH_CS_BIT, 0, 0, FLASH_SPI_CLOCK); // MSB first, mode 0
+	
+	if(SPI_FLASH::m_ubDevice == SPI_NO_DEVICE)
+		return 0;
 	
 	_delay_us(FLASH_CHIP_ERASE_TIME);
 	
-	if(SPI_FLASH::ReadDeviceID() == 0x49 && SPI_FLASH::ReadManufacturerID() == 0xBF)
-		return 1;
+	flash_desc_t desc = SPI_FLASH::m_Desc;
+	
+	if(!FLASH_Probe(&desc))
+	{
+		DPRINTFLN_CTX("Flash not supported [0x%02X 0x%02X 0x%02X]", desc.m_ubManufacturerID, desc.m_ubMemoryType, desc.m_ubCapacity);
+		
+		return 0;
+	}
+	
+	SPI_FLASH::m_Desc = desc;
+	
+	DPRINTFLN_CTX("Flash [0x%02X 0x%02X 0x%02X] [%lu KB] [%u byte address] [program %u, %u byte pages]", desc.m_ubManufacturerID, desc.m_ubMemoryType, desc.m_ubCapacity, desc.m_ulSize >> 10, desc.m_ubAddressBytes, desc.m_ubProgramMode, desc.m_usPageSize);
+	
+#ifdef FLASH_MODIFY_LOG
+	if(!FLASH_ScratchRecover())
+	{
+		DPRINTFLN_CTX("Modify log unreadable");
+		
+		return 0;
+	}
+#endif
 	
-	return 0;
+	return 1;
 }
 
-void SPI_FLASH::Read(uint32_t ulAddress, uint8_t* pubDest, uint16_t usCount)
+uint8_t SPI_FLASH::Read(uint32_t ulAddress, uint8_t* pubDest, uint16_t usCount)
 {
+	FLASH_OWN_BUS();
+	
 	if(!usCount)
-		return;
+		return 1;
 	
 	ulAddress &= FLASH_MAX_ADDRESS;
 	
-	SPI_FLASH::BusyWait();
+	if(!SPI_FLASH::BusyWait())
+		return 0;
 	
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		FLASH_SELECT();
+		if(!FLASH_SELECT()) // Another device took the bus since BusyWait
+			return 0;
 		
-		SPI::TransferByte(FLASH_CMD_READ);
-		SPI::TransferByte((ulAddress >> 16) & 0xFF);
-		SPI::TransferByte((ulAddress >> 8) & 0xFF);
-		SPI::TransferByte(ulAddress & 0xFF);
+		FLASH_SendAddress(FLASH_CMD_READ, ulAddress);
 		
 		SPI::Read(pubDest, usCount);
 		
 		FLASH_UNSELECT();
 	}
+	
+	return 1;
 }
-void SPI_FLASH::Write(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount)
+uint8_t SPI_FLASH::StreamOpen(uint32_t ulAddress)
 {
-	if(!usCount)
-		return;
-	
-	ulAddress &= FLASH_MAX_ADDRESS;
-	
-	SPI_FLASH::BusyWait();
-	SPI_FLASH::WriteEnable();
+	SPI_FLASH::StreamClose();
+
+#ifdef FLASH_ASYNC
+	SPI_FLASH::AsyncAcquire(); // Until StreamClose, the engine does not know the chip may still be selected
+#endif
+
+	m_ulStreamAddress = ulAddress & FLASH_MAX_ADDRESS;
+	m_ubStreamState = FLASH_STREAM_SUSPENDED;
 	
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	return FLASH_StreamResume();
+}
+uint8_t SPI_FLASH::StreamRead(uint8_t* pubDest, uint16_t usCount)
+{
+#if FLASH_STREAM_CACHE_SIZE > 0
+	while(usCount)
 	{
-		FLASH_SELECT();
-		
-		if(usCount == 1)
-			SPI::TransferByte(FLASH_CMD_WRITE_BYTE);
-		else
-			SPI::TransferByte(FLASH_CMD_WRITE_CONTINUOUS);
-		
-		SPI::TransferByte((ulAddress >> 16) & 0xFF);
-		SPI::TransferByte((ulAddress >> 8) & 0xFF);
-		SPI::TransferByte(ulAddress & 0xFF);
-				
-		for(uint16_t i = 0; i < usCount; i++)
-		{			
-			if(i > 0)
-			{				
-				FLASH_SELECT();
-				
-				SPI::TransferByte(FLASH_CMD_WRITE_CONTINUOUS);
-			}
+		if(m_ubStreamCachePos < m_ubStreamCacheLen)
+		{
+			uint8_t count = m_ubStreamCacheLen - m_ubStreamCachePos;
 			
-			SPI::TransferByte(pubSrc[i]);
-						
-			FLASH_UNSELECT();
+			if(count > usCount)
+				count = usCount;
+			
+			memcpy(pubDest, m_ubStreamCache + m_ubStreamCachePos, count);
 			
-			_delay_us(FLASH_BYTE_WRITE_TIME);
+			m_ubStreamCachePos += count;
+			pubDest += count;
+			usCount -= count;
+			
+			continue;
 		}
+		
+		if(usCount >= FLASH_STREAM_CACHE_SIZE) // Big enough to go straight into the caller's buffer
+			return FLASH_StreamBus(pubDest, usCount);
+		
+		if(!FLASH_StreamBus(m_ubStreamCache, FLASH_STREAM_CACHE_SIZE))
+			return 0;
+		
+		m_ubStreamCachePos = 0;
+		m_ubStreamCacheLen = FLASH_STREAM_CACHE_SIZE;
 	}
 	
-	SPI_FLASH::BusyWait();
-	SPI_FLASH::WriteDisable();
+	return 1;
+#else
+	return FLASH_StreamBus(pubDest, usCount);
+#endif
 }
-void SPI_FLASH::Modify(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount)
+void SPI_FLASH::StreamClose()
 {
-	if(!usCount)
+	if(m_ubStreamState == FLASH_STREAM_CLOSED)
 		return;
 	
+	FLASH_StreamSuspend();
+	
+	m_ubStreamState = FLASH_STREAM_CLOSED;
+
+#ifdef FLASH_ASYNC
+	SPI_FLASH::AsyncRelease();
+#endif
+
+#if FLASH_STREAM_CACHE_SIZE > 0
+	m_ubStreamCachePos = 0;
+	m_ubStreamCacheLen = 0;
+#endif
+}
+uint8_t SPI_FLASH::Write(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount)
+{
+	FLASH_OWN_BUS();
+	
+	if(!usCount)
+		return 1;
+	
 	ulAddress &= FLASH_MAX_ADDRESS;
 	
-	uint8_t buf[128];
-	uint32_t sector = ulAddress & FLASH_SECTOR_MASK;
-	uint16_t offset = ulAddress & ~FLASH_SECTOR_MASK;
+	FLASH_StreamInvalidate();
 	
-	if(sector != ((ulAddress + usCount) & FLASH_SECTOR_MASK))
-		return;
+	if(!SPI_FLASH::BusyWait())
+		return 0;
 	
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	switch(SPI_FLASH::m_Desc.m_ubProgramMode)
 	{
-		SPI_FLASH::SectorErase(FLASH_SECTOR_23);
-		
-		for(uint16_t i = 0; i < FLASH_SECTOR_SIZE; i += 128)
-		{
-			SPI_FLASH::Read(sector + i, buf, 128);
-			
-			if(i <= offset && i + 128 > offset)
-				memcpy(buf + (offset % 128), pubSrc, usCount);
-				
-			SPI_FLASH::Write(FLASH_SECTOR_23 + i, buf, 128);
-		}
-		
-		SPI_FLASH::SectorErase(sector);
-		
-		for(uint16_t i = 0; i < FLASH_SECTOR_SIZE; i += 128)
-		{
-			SPI_FLASH::Read(FLASH_SECTOR_23 + i, buf, 128);
-			SPI_FLASH::Write(sector + i, buf, 128);
-		}
+		case FLASH_PROGRAM_AAI_WORD:
+			return FLASH_WriteAAIWord(ulAddress, pubSrc, usCount);
+		case FLASH_PROGRAM_AAI_BYTE:
+			return FLASH_WriteAAIByte(ulAddress, pubSrc, usCount);
+		default:
+			return FLASH_WritePages(ulAddress, pubSrc, usCount);
 	}
 }
-void SPI_FLASH::BusyWait()
+uint8_t SPI_FLASH::Modify(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount)
 {
-	uint8_t buf[] = {FLASH_CMD_READ_STATUS, 0x00};
-		
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	FLASH_OWN_BUS();
+	
+	if(!usCount)
+		return 1;
+	
+	ulAddress &= FLASH_MAX_ADDRESS;
+	
+	uint32_t sector = ulAddress & FLASH_SECTOR_MASK;
+	
+	if(sector != ((ulAddress + usCount - 1) & FLASH_SECTOR_MASK))
+		return 0;
+	
+	uint8_t result = FLASH_Compare(ulAddress, pubSrc, usCount);
+	
+	if(result == FLASH_COMPARE_FAILED)
+		return 0;
+	
+	if(result == FLASH_COMPARE_EQUAL)
+		return 1;
+	
+	if(result == FLASH_COMPARE_PROGRAM) // Only clears bits, no erase needed
+		return SPI_FLASH::Write(ulAddress, pubSrc, usCount);
+	
+	if(FLASH_IsScratch(sector)) // Would be its own scratch or log
+		return 0;
+	
+	// The scratch gets the merged sector, the log records it, then the sector is erased and the scratch copied back
+	uint32_t scratch = FLASH_SCRATCH_FIRST + FLASH_SECTOR_SIZE * m_ubScratchNext;
+	
+#ifdef FLASH_MODIFY_LOG
+	flash_scratch_tag_t tag;
+	uint16_t record;
+	
+	tag.m_ulSector = sector;
+	tag.m_ubScratch = m_ubScratchNext;
+	tag.m_usCRC = FLASH_ScratchCRC(&tag);
+	tag.m_ubDone = 0xFF;
+#endif
+	
+	if(++m_ubScratchNext >= FLASH_SCRATCH_SECTORS)
+		m_ubScratchNext = 0;
+	
+	if(!FLASH_CopySector(sector, scratch, ulAddress - sector, pubSrc, usCount))
+		return 0;
+	
+#ifdef FLASH_MODIFY_LOG
+	if(!FLASH_ScratchLog(&tag, &record)) // From here on a reset is finished by Init
+		return 0;
+	
+	return FLASH_ScratchCommit(&tag, record);
+#else
+	return FLASH_CopySector(scratch, sector, 0, 0, 0); // Nothing finishes this after a reset, the sector may be left half erased
+#endif
+}
+uint8_t SPI_FLASH::BusyWait(flash_op_t ubOp)
+{
+	FLASH_OWN_BUS();
+
+#ifdef FLASH_ASYNC
+	if(!SPI_FLASH::AsyncWait()) // The engine owns the bus until its running request is done, nothing else starts while we hold it
+		return 0;
+#endif
+
+	uint32_t start = TIMER::GetMicros();
+	uint32_t timeout = FLASH_Timeout(ubOp);
+	
+	FLASH_StreamSuspend();
+	
+	if(!FLASH_SELECT()) // Another device was left selected
 	{
-		FLASH_SELECT();	
-		
-		SPI::Transfer(buf, 2, buf);
+		DPRINTFLN_CTX("SPI bus taken [%u]", SPI::m_ubSelectedDevice);
 		
-		FLASH_UNSELECT();
+		return 0;
 	}
 	
-	while(buf[1] & 1)
+	FLASH_UNSELECT();
+	
+	// Programs are polled back to back, erases take milliseconds so the bus is left alone between polls
+	while(FLASH_ReadStatus() & FLASH_STATUS_BUSY)
 	{
-		_delay_ms(1);
+		uint32_t elapsed = TIMER::GetMicros() - start;
 		
-		buf[0] = FLASH_CMD_READ_STATUS;
-		
-		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		if(elapsed > timeout)
 		{
-			FLASH_SELECT();
+			DPRINTFLN_CTX("Flash busy timeout [%u] [%lu us]", ubOp, elapsed);
 			
-			SPI::Transfer(buf, 2, buf);
-			
-			FLASH_UNSELECT();
+			return 0;
 		}
+		
+		if(ubOp == FLASH_OP_SECTOR_ERASE || ubOp == FLASH_OP_BLOCK_ERASE || ubOp == FLASH_OP_CHIP_ERASE)
+			_delay_us(FLASH_ERASE_POLL_INTERVAL);
 	}
+	
+	FLASH_Record(ubOp, TIMER::GetMicros() - start);
+	
+	if(m_ubAAIOpen && ubOp == FLASH_OP_NONE) // A write cut short by another device, not from inside its own sequence
+		return FLASH_AAIEnd();
+	
+	return 1;
 }
-void SPI_FLASH::WriteEnable()
+void SPI_FLASH::GetStats(flash_op_t ubOp, flash_op_stats_t* pStats)
 {
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-	{
-		FLASH_SELECT();
-		
-		SPI::TransferByte(FLASH_CMD_WRITE_ENABLE);
-		
-		FLASH_UNSELECT();
-	}
+	if(ubOp >= FLASH_OP_COUNT)
+		return;
+	
+	memcpy(pStats, &m_Stats[ubOp], sizeof(flash_op_stats_t));
 }
-void SPI_FLASH::WriteStatusEnable()
+void SPI_FLASH::ResetStats()
 {
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-	{
-		FLASH_SELECT();
-		
-		SPI::TransferByte(FLASH_CMD_WRITE_ENABLE_STATUS);
-		
-		FLASH_UNSELECT();
-	}
+	memset(m_Stats, 0, sizeof(m_Stats));
 }
-void SPI_FLASH::WriteDisable()
+uint8_t SPI_FLASH::WriteEnable()
 {
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-	{
-		FLASH_SELECT();
-		
-		SPI::TransferByte(FLASH_CMD_WRITE_DISABLE);
-		
-		FLASH_UNSELECT();
-	}
+	FLASH_OWN_BUS();
+	
+	return FLASH_Command(FLASH_CMD_WRITE_ENABLE);
+}
+uint8_t SPI_FLASH::WriteStatusEnable()
+{
+	FLASH_OWN_BUS();
+	
+	return FLASH_Command(FLASH_CMD_WRITE_ENABLE_STATUS);
 }
-void SPI_FLASH::BlockErase(uint32_t ulAddress)
+uint8_t SPI_FLASH::WriteDisable()
 {
+	FLASH_OWN_BUS();
+	
+	return FLASH_Command(FLASH_CMD_WRITE_DISABLE);
+}
+uint8_t SPI_FLASH::BlockErase(uint32_t ulAddress)
+{
+	FLASH_OWN_BUS();
+	
 	ulAddress &= FLASH_MAX_ADDRESS;
 	
-	SPI_FLASH::BusyWait();
-	SPI_FLASH::WriteEnable();
+	FLASH_StreamInvalidate();
+	
+	if(!SPI_FLASH::BusyWait())
+		return 0;
+	
+	if(!SPI_FLASH::WriteEnable())
+		return 0;
+	
+	uint8_t ret = FLASH_AddressCommand(SPI_FLASH::m_Desc.m_ubBlockEraseCmd, ulAddress) && SPI_FLASH::BusyWait(FLASH_OP_BLOCK_ERASE);
 	
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-	{
-		FLASH_SELECT();
-		
-		SPI::TransferByte(FLASH_CMD_BLOCK_ERASE);
-		SPI::TransferByte((ulAddress >> 16) & 0xFF);
-		SPI::TransferByte((ulAddress >> 8) & 0xFF);
-		SPI::TransferByte(ulAddress & 0xFF);
-		
-		FLASH_UNSELECT();
-	}
-
-	SPI_FLASH::BusyWait();
 	SPI_FLASH::WriteDisable();
+	
+	return ret;
 }
-void SPI_FLASH::SectorErase(uint32_t ulAddress)
+uint8_t SPI_FLASH::SectorErase(uint32_t ulAddress)
 {	
+	FLASH_OWN_BUS();
+	
 	ulAddress &= FLASH_MAX_ADDRESS;
 	
-	SPI_FLASH::BusyWait();
-	SPI_FLASH::WriteEnable();
+	FLASH_StreamInvalidate();
 	
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	if(!SPI_FLASH::BusyWait())
+		return 0;
+	
+	if(!SPI_FLASH::WriteEnable())
+		return 0;
+	
+	uint8_t ret = FLASH_AddressCommand(SPI_FLASH::m_Desc.m_ubSectorEraseCmd, ulAddress) && SPI_FLASH::BusyWait(FLASH_OP_SECTOR_ERASE);
+	
+	SPI_FLASH::WriteDisable();
+	
+	return ret;
+}
+uint8_t SPI_FLASH::ChipErase()
+{
+	FLASH_OWN_BUS();
+	
+	FLASH_StreamInvalidate();
+	
+	if(!SPI_FLASH::BusyWait())
+		return 0;
+	
+	if(!SPI_FLASH::WriteEnable())
+		return 0;
+	
+	uint8_t ret = FLASH_Command(FLASH_CMD_CHIP_ERASE) && SPI_FLASH::BusyWait(FLASH_OP_CHIP_ERASE);
+	
+	SPI_FLASH::WriteDisable();
+	
+	return ret;
+}
+uint8_t SPI_FLASH::EraseRange(uint32_t ulAddress, uint32_t ulLength, flash_erase_report_t* pReport)
+{
+	FLASH_OWN_BUS();
+	
+	flash_erase_report_t report;
+	uint32_t start = TIMER::GetMicros();
+	
+	memset(&report, 0, sizeof(flash_erase_report_t));
+	
+	if((ulAddress | ulLength) & (FLASH_SECTOR_SIZE - 1)) // Erasing more than asked for would take data with it
+		return 0;
+	
+	if(ulAddress > FLASH_MAX_ADDRESS || ulLength > FLASH_MAX_ADDRESS + 1 - ulAddress)
+		return 0;
+	
+	uint32_t blockSize = SPI_FLASH::m_Desc.m_ulBlockSize;
+	uint32_t sectorTime = FLASH_EraseEstimate(FLASH_OP_SECTOR_ERASE);
+	uint32_t blockTime = FLASH_EraseEstimate(FLASH_OP_BLOCK_ERASE);
+	
+	while(ulLength)
 	{
-		FLASH_SELECT();
-		
-		SPI::TransferByte(FLASH_CMD_SECTOR_ERASE);
-		SPI::TransferByte((ulAddress >> 16) & 0xFF);
-		SPI::TransferByte((ulAddress >> 8) & 0xFF);
-		SPI::TransferByte(ulAddress & 0xFF);
-		
-		FLASH_UNSELECT();
+		if(blockSize > FLASH_SECTOR_SIZE && !(ulAddress & (blockSize - 1)) && ulLength >= blockSize)
+		{
+			// Whole block, only the sectors holding data count, the cheaper of one block erase or erasing just those is used
+			uint16_t dirty = 0;
+			uint8_t dirtyCount = 0;
+			uint8_t sectors = blockSize / FLASH_SECTOR_SIZE;
+			
+			for(uint8_t i = 0; i < sectors; i++)
+			{
+				uint8_t blank = SPI_FLASH::IsBlank(ulAddress + FLASH_SECTOR_SIZE * i, FLASH_SECTOR_SIZE);
+				
+				if(blank == 0xFF)
+					return 0;
+				
+				if(!blank)
+				{
+					dirty |= 1 << i;
+					dirtyCount++;
+				}
+			}
+			
+			report.m_usBlankSectors += sectors - dirtyCount;
+			
+			if(dirtyCount && dirtyCount * sectorTime >= blockTime)
+			{
+				if(!SPI_FLASH::BlockErase(ulAddress))
+					return 0;
+				
+				report.m_usBlockErases++;
+				report.m_ulEstimatedTime += blockTime;
+			}
+			else
+			{
+				for(uint8_t i = 0; i < sectors; i++)
+				{
+					if(!(dirty & (1 << i)))
+						continue;
+					
+					if(!SPI_FLASH::SectorErase(ulAddress + FLASH_SECTOR_SIZE * i))
+						return 0;
+					
+					report.m_usSectorErases++;
+					report.m_ulEstimatedTime += sectorTime;
+				}
+			}
+			
+			ulAddress += blockSize;
+			ulLength -= blockSize;
+		}
+		else
+		{
+			uint8_t blank = SPI_FLASH::IsBlank(ulAddress, FLASH_SECTOR_SIZE);
+			
+			if(blank == 0xFF)
+				return 0;
+			
+			if(blank)
+			{
+				report.m_usBlankSectors++;
+			}
+			else
+			{
+				if(!SPI_FLASH::SectorErase(ulAddress))
+					return 0;
+				
+				report.m_usSectorErases++;
+				report.m_ulEstimatedTime += sectorTime;
+			}
+			
+			ulAddress += FLASH_SECTOR_SIZE;
+			ulLength -= FLASH_SECTOR_SIZE;
+		}
 	}
-
-	SPI_FLASH::BusyWait();
-	SPI_FLASH::WriteDisable();
+	
+	report.m_ulActualTime = TIMER::GetMicros() - start;
+	
+	DPRINTFLN_CTX("Erased [%u blocks] [%u sectors] [%u blank sectors] [%lu us estimated] [%lu us]", report.m_usBlockErases, report.m_usSectorErases, report.m_usBlankSectors, report.m_ulEstimatedTime, report.m_ulActualTime);
+	
+	if(pReport)
+		memcpy(pReport, &report, sizeof(flash_erase_report_t));
+	
+	return 1;
 }
-void SPI_FLASH::ChipErase()
+uint8_t SPI_FLASH::IsBlank(uint32_t ulAddress, uint32_t ulLength)
 {
-	SPI_FLASH::BusyWait();
-	SPI_FLASH::WriteEnable();
+	FLASH_OWN_BUS();
 	
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	uint8_t buf[FLASH_BLANK_CHUNK];
+	uint8_t ret = 1;
+	
+	if(!SPI_FLASH::StreamOpen(ulAddress))
+		return 0xFF;
+	
+	while(ulLength && ret)
 	{
-		FLASH_SELECT();
+		uint16_t count = (ulLength > FLASH_BLANK_CHUNK) ? FLASH_BLANK_CHUNK : ulLength;
+		
+		if(!SPI_FLASH::StreamRead(buf, count))
+		{
+			ret = 0xFF;
+			
+			break;
+		}
 		
-		SPI::TransferByte(FLASH_CMD_CHIP_ERASE);
+		for(uint16_t i = 0; i < count && ret; i++)
+			ret = (buf[i] == 0xFF);
 		
-		FLASH_UNSELECT();
+		ulLength -= count;
 	}
-
-	SPI_FLASH::BusyWait();
-	SPI_FLASH::WriteDisable();
+	
+	SPI_FLASH::StreamClose();
+	
+	return ret;
 }
 uint8_t SPI_FLASH::ReadDeviceID()
 {
+	FLASH_OWN_BUS();
+	
 	uint8_t buf[] = {FLASH_CMD_READ_ID, 0x00, 0x00, 0x01, 0x00};
 	
 	SPI_FLASH::BusyWait();
 	
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		FLASH_SELECT();
+		if(!FLASH_SELECT())
+			return 0xFF; // Reads like no chip
 		
 		SPI::Transfer(buf, 5, buf);
-			
+		
 		FLASH_UNSELECT();
 	}
 	
@@ -265,13 +1372,16 @@ uint8_t SPI_FLASH::ReadDeviceID()
 }
 uint8_t SPI_FLASH::ReadManufacturerID()
 {
+	FLASH_OWN_BUS();
+	
 	uint8_t buf[] = {FLASH_CMD_READ_ID, 0x00, 0x00, 0x00, 0x00};
 	
 	SPI_FLASH::BusyWait();
 	
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		FLASH_SELECT();
+		if(!FLASH_SELECT())
+			return 0xFF; // Reads like no chip
 		
 		SPI::Transfer(buf, 5, buf);
 		
@@ -280,19 +1390,24 @@ uint8_t SPI_FLASH::ReadManufacturerID()
 	
 	return buf[4];
 }
-void SPI_FLASH::ProtectSectors(uint8_t ubProtect)
+uint8_t SPI_FLASH::ProtectSectors(uint8_t ubProtect)
 {
-	SPI_FLASH::BusyWait();
-	SPI_FLASH::WriteStatusEnable();
+	FLASH_OWN_BUS();
+	
+	if(!SPI_FLASH::BusyWait() || !SPI_FLASH::WriteStatusEnable())
+		return 0;
 	
 	uint8_t buf[] = {FLASH_CMD_WRITE_STATUS, (uint8_t)((ubProtect & 0x03) << 2)};
 	
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		FLASH_SELECT();
+		if(!FLASH_SELECT())
+			return 0;
 		
 		SPI::Transfer(buf, 2, 0);
 		
 		FLASH_UNSELECT();
 	}
+	
+	return 1;
 }
\ No newline at end of file
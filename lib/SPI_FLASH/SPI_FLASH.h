@@ -16,6 +16,7 @@
 #include <string.h>
 #include <debug_macros.h>
 #include <SPI/SPI.h>
+#include <TIMER/TIMER.h>
 
 #define FLASH_CMD_READ					0x03
 #define FLASH_CMD_READ_FAST				0x0B
@@ -30,6 +31,21 @@
 #define FLASH_CMD_BLOCK_ERASE			0x52
 #define FLASH_CMD_CHIP_ERASE			0xC7
 #define FLASH_CMD_READ_ID				0xAB
+#define FLASH_CMD_WRITE_AAI_WORD		0xAD // Word AAI program, SST25VF016B and later
+#define FLASH_CMD_ENABLE_SO_BUSY		0x70 // EBSY, SO outputs RY/BY# while CE# is low during AAI
+#define FLASH_CMD_DISABLE_SO_BUSY		0x80 // DBSY
+#define FLASH_CMD_READ_JEDEC_ID			0x9F
+#define FLASH_CMD_READ_SFDP				0x5A
+#define FLASH_CMD_ENTER_4BYTE			0xB7
+#define FLASH_CMD_GLOBAL_UNLOCK			0x98 // ULBPR, SST26 parts power up with every block write protected
+#define FLASH_CMD_BLOCK_ERASE_64K		0xD8
+
+#define FLASH_JEDEC_SST					0xBF
+#define FLASH_JEDEC_SST25				0x25
+#define FLASH_JEDEC_SST26				0x26
+
+#define FLASH_SFDP_SIGNATURE			0x50444653 // "SFDP"
+#define FLASH_SFDP_BFPT_DWORDS			11 // JESD216A, the later DWORDs are not used
 
 #define FLASH_PROTECTION_NONE			0x0
 #define FLASH_PROTECTION_LOWER_1_4		0x1
@@ -41,6 +57,25 @@
 #define FLASH_PAGE_ERASE_TIME			25000
 #define FLASH_CHIP_ERASE_TIME			100000
 
+// BusyWait timeouts (us), Timer1 must be running (TIMER::Init)
+#define FLASH_PROGRAM_TIMEOUT			1000
+#define FLASH_PAGE_PROGRAM_TIMEOUT		5000 // Parts without SFDP timing
+#define FLASH_4K_ERASE_TIMEOUT			400000
+#define FLASH_64K_ERASE_TIMEOUT			2000000
+#define FLASH_CHIP_ERASE_TIMEOUT_MBIT	2000000 // Per Mbit
+#define FLASH_TIMEOUT_FACTOR			4 // Erases time out after this many times their nominal time
+#define FLASH_ERASE_POLL_INTERVAL		250 // Status polling period during erases
+
+#define FLASH_STATUS_BUSY				0x01
+
+#ifndef FLASH_STREAM_CACHE_SIZE
+	#define FLASH_STREAM_CACHE_SIZE		32 // Read-ahead of the stream reader (up to 255 bytes), 0 reads straight from the bus
+#endif
+
+#define FLASH_STREAM_CLOSED				0
+#define FLASH_STREAM_SUSPENDED			1 // Deselected by another command, resumed at the same address by the next StreamRead
+#define FLASH_STREAM_ACTIVE				2 // Chip selected in the middle of a read, the next byte is clocked out directly
+
 #define FLASH_SECTOR_SIZE	((uint32_t)0x1000) // 4 KB
 #define FLASH_BLOCK_SIZE	((uint32_t)0x8000) // 32 KB
 
@@ -72,7 +107,7 @@
 #define FLASH_SECTOR_20		(FLASH_SECTOR_SIZE * 20) // Block 2, Sector 4
 #define FLASH_SECTOR_21		(FLASH_SECTOR_SIZE * 21) // Block 2, Sector 5
 #define FLASH_SECTOR_22		(FLASH_SECTOR_SIZE * 22) // Block 2, Sector 6
-#define FLASH_SECTOR_23		(FLASH_SECTOR_SIZE * 23) // Block 2, Sector 7 - Sector buffer
+#define FLASH_SECTOR_23		(FLASH_SECTOR_SIZE * 23) // Block 2, Sector 7 - Sector buffer (Modify scratch)
 #define FLASH_SECTOR_24		(FLASH_SECTOR_SIZE * 24) // Block 3, Sector 0 - Update firmware
 #define FLASH_SECTOR_25		(FLASH_SECTOR_SIZE * 25) // Block 3, Sector 1 - Update firmware
 #define FLASH_SECTOR_26		(FLASH_SECTOR_SIZE * 26) // Block 3, Sector 2 - Update firmware
@@ -82,20 +117,169 @@
 #define FLASH_SECTOR_30		(FLASH_SECTOR_SIZE * 30) // Block 3, Sector 6 - Update firmware
 #define FLASH_SECTOR_31		(FLASH_SECTOR_SIZE * 31) // Block 3, Sector 7 - Update firmware
 
-#define FLASH_MAX_ADDRESS	(FLASH_SECTOR_SIZE * 32 - 1) // 0x1FFFF for 1 Mbit
+// The layout above is the SST25VF010A one and holds for any part of 1 Mbit or more, the real geometry is in SPI_FLASH::m_Desc after Init
+#define FLASH_MAX_ADDRESS	(SPI_FLASH::m_Desc.m_ulSize - 1) // 0x1FFFF for 1 Mbit
 #define FLASH_SECTOR_MASK	(FLASH_MAX_ADDRESS & ~(FLASH_SECTOR_SIZE - 1))
-#define FLASH_BLOCK_MASK	(FLASH_MAX_ADDRESS & ~(FLASH_BLOCK_SIZE - 1))
+#define FLASH_BLOCK_MASK	(FLASH_MAX_ADDRESS & ~(SPI_FLASH::m_Desc.m_ulBlockSize - 1))
+
+// Modify rewrites rotate through FLASH_SCRATCH_SECTORS sectors ending at FLASH_SECTOR_23 (sector 23, 22, ...), only sector 23 by default
+// Build with FLASH_MODIFY_LOG to log each rewrite in the sector right below them once its scratch copy is complete, Init then finishes one a reset cut short
+// Both take sectors the default layout leaves to the application, the first Modify erases them (the log only if it does not hold a log of this layout yet)
+#ifndef FLASH_SCRATCH_SECTORS
+	#define FLASH_SCRATCH_SECTORS	1
+#endif
+#define FLASH_SCRATCH_FIRST	(FLASH_SECTOR_23 - FLASH_SECTOR_SIZE * (FLASH_SCRATCH_SECTORS - 1))
+#ifdef FLASH_MODIFY_LOG
+	#define FLASH_SCRATCH_LOG	(FLASH_SCRATCH_FIRST - FLASH_SECTOR_SIZE)
+	#define FLASH_SCRATCH_LOG_RECORDS	(FLASH_SECTOR_SIZE / sizeof(flash_scratch_tag_t)) // Slot 0 is the header, the log is erased once full (every record in it is done by then)
+	#define FLASH_SCRATCH_MAGIC	0x474C424DUL // "MBLG" in the sector field of the header, whose scratch field holds FLASH_SCRATCH_SECTORS
+	#define FLASH_SCRATCH_BOTTOM	FLASH_SCRATCH_LOG
+#else
+	#define FLASH_SCRATCH_BOTTOM	FLASH_SCRATCH_FIRST
+#endif
+#define FLASH_SCRATCH_DONE	0x00
+#define FLASH_MODIFY_CHUNK	128 // Bytes compared/copied per step, on the stack
+
+#define FLASH_BLANK_CHUNK	64 // Bytes per blank check read, on the stack
+
+#define FLASH_COMPARE_EQUAL		0
+#define FLASH_COMPARE_PROGRAM	1 // Only clears bits, programmed in place
+#define FLASH_COMPARE_ERASE		2 // Sets some bit, the sector has to be rewritten
+#define FLASH_COMPARE_FAILED	3
+
+#if FLASH_SCRATCH_SECTORS < 1 || FLASH_SCRATCH_SECTORS > 23
+	#error "The Modify scratch area must be between 1 and 23 sectors, its log (FLASH_MODIFY_LOG) takes the one below"
+#endif
+
+// One device of the SPI bus manager, registered by Init
+#ifndef FLASH_CS_PORT
+	#define FLASH_CS_PORT	PORTC
+#endif
+#ifndef FLASH_CS_BIT
+	#define FLASH_CS_BIT	PC3
+#endif
+#ifndef FLASH_SPI_CLOCK
+	#define FLASH_SPI_CLOCK	(F_CPU / 2) // Hz, the SST25VF010A takes up to 33 MHz
+#endif
+
+#define FLASH_SELECT() SPI::Select(SPI_FLASH::m_ubDevice)
+#define FLASH_UNSELECT() SPI::Deselect(SPI_FLASH::m_ubDevice)
+
+// Word AAI chips report the end of each word program on SO, the SST25VF010A only has byte AAI (status is polled then)
+#ifdef SPI_USART_MSPIM
+	#define FLASH_SO_READY() (PINE & (1 << PE0))
+#else
+	#define FLASH_SO_READY() (PINB & (1 << PB3))
+#endif
+
+enum flash_op_t
+{
+	FLASH_OP_PROGRAM = 0,
+	FLASH_OP_SECTOR_ERASE,
+	FLASH_OP_BLOCK_ERASE,
+	FLASH_OP_CHIP_ERASE,
+	FLASH_OP_COUNT,
+	FLASH_OP_NONE = FLASH_OP_COUNT, // Waiting for whatever may still be running, not recorded
+};
+
+enum flash_program_t
+{
+	FLASH_PROGRAM_PAGE = 0, // 0x02 with up to m_usPageSize bytes, JEDEC parts
+	FLASH_PROGRAM_AAI_BYTE, // 0xAF, SST25VF010A/020/040
+	FLASH_PROGRAM_AAI_WORD, // 0xAD with the SO busy output, SST25VF016B and later
+};
+
+// Filled by Init from the JEDEC ID and SFDP, starts as the SST25VF010A so nothing changes for the original board
+struct flash_desc_t
+{
+	uint8_t m_ubManufacturerID;
+	uint8_t m_ubMemoryType;
+	uint8_t m_ubCapacity;
+	uint32_t m_ulSize; // Bytes, power of two
+	uint8_t m_ubAddressBytes; // 3 or 4
+	flash_program_t m_ubProgramMode;
+	uint16_t m_usPageSize; // Power of two, programs never cross a page
+	uint8_t m_ubSectorEraseCmd; // FLASH_SECTOR_SIZE erase, required
+	uint8_t m_ubBlockEraseCmd;
+	uint32_t m_ulBlockSize;
+	uint8_t m_ubFastRead; // FLASH_CMD_READ_FAST (one dummy byte) supported
+	uint32_t m_ulProgramTimeout; // us, per program command
+	uint32_t m_ulSectorEraseTimeout; // us
+	uint32_t m_ulBlockEraseTimeout; // us
+	uint32_t m_ulChipEraseTimeout; // us
+};
+
+struct flash_op_stats_t
+{
+	uint16_t m_usCount;
+	uint32_t m_ulMinTime; // us
+	uint32_t m_ulMaxTime; // us
+	uint32_t m_ulTotalTime; // us, divide by m_usCount for the average
+};
+
+struct flash_scratch_tag_t // Modify log record (FLASH_MODIFY_LOG), written whole to an erased slot
+{
+	uint32_t m_ulSector; // Sector being rewritten
+	uint16_t m_usCRC; // CRC-CCITT of m_ulSector and m_ubScratch, a torn record does not match
+	uint8_t m_ubScratch; // Scratch sector holding its new contents
+	uint8_t m_ubDone; // FLASH_SCRATCH_DONE once copied back, still erased otherwise
+};
 
-#define FLASH_SELECT() PORTC &= ~(1 << PC3)
-#define FLASH_UNSELECT() PORTC |= (1 << PC3)
+#ifdef FLASH_ASYNC
+// Interrupt driven engine (SPI_FLASH_ASYNC.cpp), owns SPI_STC_vect and TIMER1_COMPB_vect (status poll pacing, Timer1 must be running)
+// Requests are queued and run in order, the caller keeps each request and its buffer untouched until it is done
+#ifdef SPI_USART_MSPIM
+	#error "FLASH_ASYNC runs on the SPI peripheral interrupt, it can't be used with SPI_USART_MSPIM"
+#endif
+
+#define FLASH_ASYNC_PROGRAM_POLL_INTERVAL	20 // us between status polls while programming
+
+enum flash_async_op_t
+{
+	FLASH_ASYNC_READ = 0,
+	FLASH_ASYNC_WRITE, // Page program, one byte per program on AAI chips
+	FLASH_ASYNC_SECTOR_ERASE,
+	FLASH_ASYNC_BLOCK_ERASE,
+};
+
+enum flash_async_status_t
+{
+	FLASH_ASYNC_PENDING = 0,
+	FLASH_ASYNC_DONE,
+	FLASH_ASYNC_ERROR, // Busy timeout
+};
+
+struct flash_request_t
+{
+	flash_async_op_t m_ubOp;
+	uint32_t m_ulAddress;
+	uint8_t* m_pubBuf;
+	uint16_t m_usCount;
+	void (*m_pfnDone)(flash_request_t* pRequest); // Optional, called from the ISR, may submit more requests but must not use the blocking API
+	volatile flash_async_status_t m_ubStatus;
+	flash_request_t* m_pNext;
+};
+#endif
+
+struct flash_erase_report_t
+{
+	uint16_t m_usSectorErases;
+	uint16_t m_usBlockErases;
+	uint16_t m_usBlankSectors; // Already erased, skipped
+	uint32_t m_ulEstimatedTime; // us, of the erases issued, from their measured average (nominal time until measured)
+	uint32_t m_ulActualTime; // us, blank checks included
+};
 
 namespace SPI_FLASH
 {	
+	extern flash_desc_t m_Desc;
+	extern uint8_t m_ubDevice; // SPI bus device, SPI_NO_DEVICE before Init
+	
 	extern uint8_t Init();
 	
-	extern void Read(uint32_t ulAddress, uint8_t* pubDest, uint16_t usCount);
-	extern void Write(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount);
-	extern void Modify(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount);
+	extern uint8_t Read(uint32_t ulAddress, uint8_t* pubDest, uint16_t usCount);
+	extern uint8_t Write(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount);
+	extern uint8_t Modify(uint32_t ulAddress, uint8_t* pubSrc, uint16_t usCount);
 	
 	inline uint8_t ReadByte(uint32_t ulAddress)
 	{
@@ -105,25 +289,65 @@ namespace SPI_FLASH
 		
 		return ret;
 	}
-	inline void WriteByte(uint32_t ulAddress, uint8_t ubData)
+	inline uint8_t WriteByte(uint32_t ulAddress, uint8_t ubData)
+	{
+		return Write(ulAddress, &ubData, 1);
+	}
+	inline uint8_t ModifyByte(uint32_t ulAddress, uint8_t ubData)
 	{
-		Write(ulAddress, &ubData, 1);
+		return Modify(ulAddress, &ubData, 1);
 	}
-	inline void ModifyByte(uint32_t ulAddress, uint8_t ubData)
+	
+	// Sequential reader, the chip is left selected between calls so only the first one pays for the command and address
+	// Nothing else may use the SPI bus while a stream is active, other SPI_FLASH calls suspend it
+	extern uint8_t StreamOpen(uint32_t ulAddress);
+	extern uint8_t StreamRead(uint8_t* pubDest, uint16_t usCount);
+	extern void StreamClose();
+	
+	inline uint8_t StreamReadByte()
 	{
-		Modify(ulAddress, &ubData, 1);
+		uint8_t ret = 0xFF;
+		
+		StreamRead(&ret, 1);
+		
+		return ret;
 	}
 	
-	extern void BusyWait();
-	extern void WriteStatusEnable();
-	extern void WriteEnable();
-	extern void WriteDisable();
-	extern void BlockErase(uint32_t ulAddress);
-	extern void SectorErase(uint32_t ulAddress);
-	extern void ChipErase();
+	extern uint8_t BusyWait(flash_op_t ubOp = FLASH_OP_NONE);
+	extern void GetStats(flash_op_t ubOp, flash_op_stats_t* pStats);
+	extern void ResetStats();
+	extern uint8_t WriteStatusEnable(); // The command functions return 0 if another device holds the bus, nothing is sent then
+	extern uint8_t WriteEnable();
+	extern uint8_t WriteDisable();
+	extern uint8_t BlockErase(uint32_t ulAddress);
+	extern uint8_t SectorErase(uint32_t ulAddress);
+	extern uint8_t ChipErase();
+	extern uint8_t EraseRange(uint32_t ulAddress, uint32_t ulLength, flash_erase_report_t* pReport = 0); // Sector aligned, blank sectors are skipped
+	extern uint8_t IsBlank(uint32_t ulAddress, uint32_t ulLength); // 1 if all 0xFF, 0xFF if the flash does not respond (closes the stream)
+#ifdef FLASH_ASYNC
+	// The blocking API holds the bus while it runs (and an open stream until StreamClose), requests submitted meanwhile start once it is released
+	// It waits for the running request first, so it must not be called from a callback, with interrupts off it fails instead of waiting
+	extern uint8_t AsyncSubmit(flash_request_t* pRequest);
+	extern uint8_t AsyncIdle();
+	extern uint8_t AsyncFlush(); // 0 if the queue cannot drain (interrupts off, or the bus is held)
+	extern uint8_t AsyncWait(); // Until the running request is done, 0 with interrupts off
+	extern uint8_t AsyncAcquire(); // Nests, waits for the running request like AsyncWait
+	extern void AsyncRelease();
+	
+	inline uint8_t AsyncSubmit(flash_request_t* pRequest, flash_async_op_t ubOp, uint32_t ulAddress, uint8_t* pubBuf, uint16_t usCount, void (*pfnDone)(flash_request_t* pRequest) = 0)
+	{
+		pRequest->m_ubOp = ubOp;
+		pRequest->m_ulAddress = ulAddress;
+		pRequest->m_pubBuf = pubBuf;
+		pRequest->m_usCount = usCount;
+		pRequest->m_pfnDone = pfnDone;
+		
+		return AsyncSubmit(pRequest);
+	}
+#endif
 	extern uint8_t ReadDeviceID();
 	extern uint8_t ReadManufacturerID();
-	extern void ProtectSectors(uint8_t ubProtect);
+	extern uint8_t ProtectSectors(uint8_t ubProtect);
 }
 
 #endif /* SPI_FLASH_H_ */
\ No newline at end of file
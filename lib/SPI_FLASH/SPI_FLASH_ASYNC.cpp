@@ -0,0 +1,370 @@
+/*
+ * SPI_FLASH_ASYNC.cpp
+ *
+ * Created: 18/10/2026 19:05:12
+ * Author: joaob
+ */ 
+
+#include "SPI_FLASH.h"
+
+#ifdef FLASH_ASYNC
+
+#include <avr/interrupt.h>
+
+enum flash_async_phase_t
+{
+	FLASH_ASYNC_PHASE_IDLE = 0,
+	FLASH_ASYNC_PHASE_STATUS_CMD, // FLASH_CMD_READ_STATUS going out
+	FLASH_ASYNC_PHASE_STATUS, // Status byte coming in
+	FLASH_ASYNC_PHASE_ENABLE, // FLASH_CMD_WRITE_ENABLE going out
+	FLASH_ASYNC_PHASE_HEADER, // Command, address and dummy bytes
+	FLASH_ASYNC_PHASE_DATA,
+};
+
+static flash_request_t* volatile m_pHead = 0;
+static flash_request_t* m_pTail = 0;
+
+// Only touched by the ISRs once the head request started
+static flash_async_phase_t m_ubPhase = FLASH_ASYNC_PHASE_IDLE;
+static uint8_t m_ubHeader[6];
+static uint8_t m_ubHeaderLen = 0;
+static uint8_t m_ubHeaderPos = 0;
+static uint32_t m_ulAddress = 0;
+static uint8_t* m_pubData = 0;
+static uint16_t m_usChunk = 0; // Data bytes of the current command
+static uint16_t m_usPos = 0;
+static uint16_t m_usLeft = 0;
+static uint8_t m_ubIssued = 0; // The erase command went out
+static uint8_t m_ubCompleting = 0; // In a callback, requests submitted there are started once it returns
+static volatile uint8_t m_ubRunning = 0; // The head request started and owns the bus
+static uint8_t m_ubBusOwners = 0; // Blocking API calls (and an open stream) holding the bus, nothing is started meanwhile
+static uint32_t m_ulPollStart = 0;
+static uint32_t m_ulPollTimeout = 0;
+static uint16_t m_usPollInterval = 0;
+
+static void FLASH_AsyncSchedule(uint16_t usMicros) // The chip is deselected here, the bus is free for other devices until the timer fires
+{
+	m_ubPhase = FLASH_ASYNC_PHASE_IDLE;
+	
+	SPCR &= ~(1 << SPIE); // SPI::Select refuses every other device while it is set
+	
+	OCR1B = TCNT1 + usMicros * TIMER_TICKS_PER_US;
+	TIFR1 = (1 << OCF1B);
+	TIMSK1 |= (1 << OCIE1B);
+}
+static void FLASH_AsyncStatus()
+{
+	if(!FLASH_SELECT()) // Another device has the bus, try again later
+		return FLASH_AsyncSchedule(FLASH_ASYNC_PROGRAM_POLL_INTERVAL);
+	
+	SPCR |= (1 << SPIE); // Ours until the next FLASH_AsyncSchedule, or until the queue is empty
+	
+	m_ubPhase = FLASH_ASYNC_PHASE_STATUS_CMD;
+	
+	SPDR = FLASH_CMD_READ_STATUS;
+}
+static void FLASH_AsyncPoll(uint32_t ulTimeout, uint16_t usInterval)
+{
+	m_ulPollStart = TIMER::GetMicros();
+	m_ulPollTimeout = ulTimeout;
+	m_usPollInterval = usInterval;
+	
+	FLASH_AsyncStatus();
+}
+static void FLASH_AsyncHeader(uint8_t ubCommand, uint8_t ubDummy)
+{
+	m_ubHeaderLen = 0;
+	m_ubHeader[m_ubHeaderLen++] = ubCommand;
+	
+	if(SPI_FLASH::m_Desc.m_ubAddressBytes == 4)
+		m_ubHeader[m_ubHeaderLen++] = (m_ulAddress >> 24) & 0xFF;
+	
+	m_ubHeader[m_ubHeaderLen++] = (m_ulAddress >> 16) & 0xFF;
+	m_ubHeader[m_ubHeaderLen++] = (m_ulAddress >> 8) & 0xFF;
+	m_ubHeader[m_ubHeaderLen++] = m_ulAddress & 0xFF;
+	
+	if(ubDummy)
+		m_ubHeader[m_ubHeaderLen++] = 0x00;
+}
+static void FLASH_AsyncSend(uint8_t ubEnable)
+{
+	if(!FLASH_SELECT()) // Another device has the bus, the status poll sends the command again once the bus is back
+		return FLASH_AsyncSchedule(FLASH_ASYNC_PROGRAM_POLL_INTERVAL);
+	
+	if(ubEnable) // Write enable first, the header follows in a new transaction
+	{
+		m_ubPhase = FLASH_ASYNC_PHASE_ENABLE;
+		
+		SPDR = FLASH_CMD_WRITE_ENABLE;
+	}
+	else
+	{
+		m_ubPhase = FLASH_ASYNC_PHASE_HEADER;
+		m_ubHeaderPos = 1;
+		
+		SPDR = m_ubHeader[0];
+	}
+}
+static void FLASH_AsyncBegin()
+{
+	flash_request_t* pRequest = m_pHead;
+	
+	m_ulAddress = pRequest->m_ulAddress & FLASH_MAX_ADDRESS;
+	m_pubData = pRequest->m_pubBuf;
+	m_usLeft = pRequest->m_usCount;
+	m_ubIssued = 0;
+	m_ubRunning = 1;
+	
+	FLASH_AsyncPoll(SPI_FLASH::m_Desc.m_ulChipEraseTimeout, FLASH_ERASE_POLL_INTERVAL); // Whatever may still be running from the blocking API
+}
+static void FLASH_AsyncComplete(flash_async_status_t ubStatus)
+{
+	flash_request_t* pRequest = m_pHead;
+	
+	m_pHead = pRequest->m_pNext;
+	
+	if(!m_pHead)
+		m_pTail = 0;
+	
+	m_ubRunning = 0;
+	
+	pRequest->m_ubStatus = ubStatus;
+	
+	if(pRequest->m_pfnDone)
+	{
+		m_ubCompleting = 1;
+		
+		pRequest->m_pfnDone(pRequest);
+		
+		m_ubCompleting = 0;
+	}
+	
+	if(m_pHead && !m_ubBusOwners)
+	{
+		FLASH_AsyncBegin();
+	}
+	else // Empty, or the rest waits for AsyncRelease
+	{
+		m_ubPhase = FLASH_ASYNC_PHASE_IDLE;
+		
+		SPCR &= ~(1 << SPIE);
+	}
+}
+static void FLASH_AsyncNext()
+{
+	flash_request_t* pRequest = m_pHead;
+	
+	switch(pRequest->m_ubOp)
+	{
+		case FLASH_ASYNC_READ:
+		{
+			if(!m_usLeft)
+				return FLASH_AsyncComplete(FLASH_ASYNC_DONE);
+			
+			m_usChunk = m_usLeft;
+			
+			if(SPI_FLASH::m_Desc.m_ubFastRead)
+				FLASH_AsyncHeader(FLASH_CMD_READ_FAST, 1);
+			else
+				FLASH_AsyncHeader(FLASH_CMD_READ, 0);
+			
+			return FLASH_AsyncSend(0);
+		}
+		case FLASH_ASYNC_WRITE:
+		{
+			if(!m_usLeft)
+				return FLASH_AsyncComplete(FLASH_ASYNC_DONE);
+			
+			// Page program never crosses a page, AAI chips program one byte per command (AAI needs polling inside the sequence)
+			uint16_t pageSize = (SPI_FLASH::m_Desc.m_ubProgramMode == FLASH_PROGRAM_PAGE) ? SPI_FLASH::m_Desc.m_usPageSize : 1;
+			
+			m_usChunk = pageSize - (m_ulAddress & (pageSize - 1));
+			
+			if(m_usChunk > m_usLeft)
+				m_usChunk = m_usLeft;
+			
+			FLASH_AsyncHeader(FLASH_CMD_WRITE_BYTE, 0);
+			
+			return FLASH_AsyncSend(1);
+		}
+		default:
+		{
+			if(m_ubIssued)
+				return FLASH_AsyncComplete(FLASH_ASYNC_DONE);
+			
+			m_usChunk = 0;
+			
+			FLASH_AsyncHeader(pRequest->m_ubOp == FLASH_ASYNC_SECTOR_ERASE ? SPI_FLASH::m_Desc.m_ubSectorEraseCmd : SPI_FLASH::m_Desc.m_ubBlockEraseCmd, 0);
+			
+			return FLASH_AsyncSend(1);
+		}
+	}
+}
+
+ISR(SPI_STC_vect)
+{
+	uint8_t data = SPDR;
+	
+	switch(m_ubPhase)
+	{
+		case FLASH_ASYNC_PHASE_STATUS_CMD:
+		{
+			m_ubPhase = FLASH_ASYNC_PHASE_STATUS;
+			
+			SPDR = 0x00;
+		}
+		break;
+		case FLASH_ASYNC_PHASE_STATUS:
+		{
+			FLASH_UNSELECT();
+			
+			if(!(data & FLASH_STATUS_BUSY))
+				FLASH_AsyncNext();
+			else if(TIMER::GetMicros() - m_ulPollStart > m_ulPollTimeout)
+				FLASH_AsyncComplete(FLASH_ASYNC_ERROR);
+			else
+				FLASH_AsyncSchedule(m_usPollInterval);
+		}
+		break;
+		case FLASH_ASYNC_PHASE_ENABLE:
+		{
+			FLASH_UNSELECT();
+			
+			FLASH_AsyncSend(0);
+		}
+		break;
+		case FLASH_ASYNC_PHASE_HEADER:
+		{
+			if(m_ubHeaderPos < m_ubHeaderLen)
+			{
+				SPDR = m_ubHeader[m_ubHeaderPos++];
+				
+				break;
+			}
+			
+			if(!m_usChunk) // Erase, nothing follows the address
+			{
+				FLASH_UNSELECT();
+				
+				m_ubIssued = 1;
+				
+				FLASH_AsyncPoll(m_ubHeader[0] == SPI_FLASH::m_Desc.m_ubSectorEraseCmd ? SPI_FLASH::m_Desc.m_ulSectorEraseTimeout : SPI_FLASH::m_Desc.m_ulBlockEraseTimeout, FLASH_ERASE_POLL_INTERVAL);
+				
+				break;
+			}
+			
+			m_ubPhase = FLASH_ASYNC_PHASE_DATA;
+			m_usPos = 0;
+			
+			SPDR = (m_pHead->m_ubOp == FLASH_ASYNC_WRITE) ? m_pubData[0] : 0x00;
+		}
+		break;
+		case FLASH_ASYNC_PHASE_DATA:
+		{
+			if(m_pHead->m_ubOp == FLASH_ASYNC_READ)
+				m_pubData[m_usPos] = data;
+			
+			if(++m_usPos < m_usChunk)
+			{
+				SPDR = (m_pHead->m_ubOp == FLASH_ASYNC_WRITE) ? m_pubData[m_usPos] : 0x00;
+				
+				break;
+			}
+			
+			FLASH_UNSELECT();
+			
+			m_ulAddress += m_usChunk;
+			m_pubData += m_usChunk;
+			m_usLeft -= m_usChunk;
+			
+			if(m_pHead->m_ubOp == FLASH_ASYNC_READ)
+			{
+				FLASH_AsyncNext();
+				
+				break;
+			}
+			
+			m_ulPollStart = TIMER::GetMicros();
+			m_ulPollTimeout = SPI_FLASH::m_Desc.m_ulProgramTimeout;
+			m_usPollInterval = FLASH_ASYNC_PROGRAM_POLL_INTERVAL;
+			
+			FLASH_AsyncSchedule(FLASH_ASYNC_PROGRAM_POLL_INTERVAL); // Programming takes a while, the bus is left alone until then
+		}
+		break;
+		default:
+		break;
+	}
+}
+ISR(TIMER1_COMPB_vect)
+{
+	TIMSK1 &= ~(1 << OCIE1B);
+	
+	FLASH_AsyncStatus();
+}
+
+uint8_t SPI_FLASH::AsyncSubmit(flash_request_t* pRequest)
+{
+	if(pRequest->m_ubOp > FLASH_ASYNC_BLOCK_ERASE)
+		return 0;
+	
+	pRequest->m_ubStatus = FLASH_ASYNC_PENDING;
+	pRequest->m_pNext = 0;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) // Only the queue links, the transfer itself starts in the background
+	{
+		if(m_pHead)
+		{
+			m_pTail->m_pNext = pRequest;
+			m_pTail = pRequest;
+		}
+		else
+		{
+			m_pHead = pRequest;
+			m_pTail = pRequest;
+			
+			if(!m_ubCompleting && !m_ubBusOwners)
+				FLASH_AsyncBegin();
+		}
+	}
+	
+	return 1;
+}
+uint8_t SPI_FLASH::AsyncIdle()
+{
+	return !m_pHead;
+}
+uint8_t SPI_FLASH::AsyncFlush()
+{
+	while(m_pHead)
+		if(!(SREG & (1 << SREG_I)) || m_ubBusOwners) // Nothing would ever complete
+			return 0;
+	
+	return 1;
+}
+uint8_t SPI_FLASH::AsyncWait()
+{
+	while(m_ubRunning)
+		if(!(SREG & (1 << SREG_I)))
+			return 0;
+	
+	return 1;
+}
+uint8_t SPI_FLASH::AsyncAcquire()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		m_ubBusOwners++;
+	}
+	
+	return SPI_FLASH::AsyncWait(); // Held from here on, only the running request may still finish
+}
+void SPI_FLASH::AsyncRelease()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(!--m_ubBusOwners && m_pHead && !m_ubRunning && !m_ubCompleting) // Queued while the bus was held
+			FLASH_AsyncBegin();
+	}
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+/*
+ * TIMER.cpp
+ *
+ * Created: 18/10/2026 10:12:04
+ * Author: joaob
+ */ 
+
+#include "TIMER.h"
+
+volatile uint16_t TIMER::m_usOverflows __attribute__ ((section (".noinit"))); // Init runs in .init3, before .bss is cleared
+
+ISR(TIMER1_OVF_vect)
+{
+	TIMER::m_usOverflows++;
+}
+
+void TIMER::Init()
+{
+	TIMER::m_usOverflows = 0;
+	
+	TCCR1A = 0x00; // Normal mode, free running
+	TCCR1B = 0x00;
+	TCNT1 = 0;
+	TIFR1 = (1 << TOV1);
+	TIMSK1 = (1 << TOIE1);
+	TCCR1B = (1 << CS11); // Prescaler 8
+}
+void TIMER::Stop()
+{
+	// Leave Timer1 in its reset state for the application
+	TCCR1B = 0x00;
+	TIMSK1 = 0x00;
+	TCNT1 = 0;
+	TIFR1 = (1 << TOV1);
+}
+
+uint32_t TIMER::GetTicks()
+{
+	uint16_t overflows;
+	uint16_t ticks;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		overflows = TIMER::m_usOverflows;
+		ticks = TCNT1;
+		
+		if((TIFR1 & (1 << TOV1)) && ticks < 0x8000) // Overflow happened but the ISR did not run yet
+			overflows++;
+	}
+	
+	return ((uint32_t)overflows << 16) | ticks;
+}
\ No newline at end of file
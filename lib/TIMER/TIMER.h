@@ -0,0 +1,38 @@
+/*
+ * TIMER.h
+ *
+ * Created: 18/10/2026 10:12:04
+ * Author : joaob
+ */ 
+
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stdint.h>
+
+#define TIMER_PRESCALER 8UL
+#define TIMER_TICKS_PER_US (F_CPU / TIMER_PRESCALER / 1000000UL) // 1 tick = 1 us @ 8 MHz
+
+namespace TIMER
+{
+	extern volatile uint16_t m_usOverflows;
+	
+	extern void Init();
+	extern void Stop();
+	
+	extern uint32_t GetTicks();
+	inline uint32_t GetMicros()
+	{
+		return GetTicks() / TIMER_TICKS_PER_US;
+	}
+	inline uint32_t GetMillis()
+	{
+		return GetMicros() / 1000UL;
+	}
+}
+
+#endif /* TIMER_H_ */
\ No newline at end of file
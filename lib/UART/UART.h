@@ -9,7 +9,8 @@
 #ifndef UART_H_
 #define UART_H_
 
-#define UART_FIFO_SIZE 127
+#define UART_FIFO_SIZE 128 // Power of two up to 128
+#define UART_TX_FIFO_SIZE 64 // Power of two up to 128, 0 writes straight to the data register
 
 #include <avr/io.h>
 #include <avr/pgmspace.h>
@@ -18,88 +19,320 @@
 #include <stdio.h>
 #include <string.h>
 
-namespace UART0
+// Registers of each USART, resolved at compile time so every access is a direct load/store (bit positions are the same on all of them)
+template<uint8_t ubPort> struct uart_port_t;
+
+#define UART_PORT(N) \
+	template<> struct uart_port_t<N> \
+	{ \
+		static volatile uint8_t& UCSRA() { return UCSR##N##A; } \
+		static volatile uint8_t& UCSRB() { return UCSR##N##B; } \
+		static volatile uint8_t& UCSRC() { return UCSR##N##C; } \
+		static volatile uint16_t& UBRR() { return UBRR##N; } \
+		static volatile uint8_t& UDR() { return UDR##N; } \
+	};
+
+UART_PORT(0)
+UART_PORT(1)
+#ifdef UDR2
+UART_PORT(2)
+#endif
+#ifdef UDR3
+UART_PORT(3)
+#endif
+
+// What WriteByte does when the TX FIFO is full
+enum uart_tx_overflow_t
+{
+	UART_TX_OVERFLOW_BLOCK = 0, // Wait for room, nothing is lost
+	UART_TX_OVERFLOW_DROP, // Discard the byte
+	UART_TX_OVERFLOW_COUNT, // Discard the byte and count it in m_usTXDropped
+};
+
+// Interrupts of an instance, placed in exactly one translation unit, instances without them pull in no ISR and no buffer
+#define UART_RX_ISR(N, UART_T) UART_RX_ISR_(N, UART_T)
+#define UART_RX_ISR_(N, UART_T) ISR(USART##N##_RX_vect) { UART_T::Receive(); }
+#define UART_TX_ISR(N, UART_T) UART_TX_ISR_(N, UART_T)
+#define UART_TX_ISR_(N, UART_T) ISR(USART##N##_UDRE_vect) { UART_T::Transmit(); }
+
+template<uint8_t ubPort, uint32_t ulBaud, uint8_t ubDoubleSpeed = 1, uint8_t ubFIFOSize = UART_FIFO_SIZE, uint8_t ubTXFIFOSize = UART_TX_FIFO_SIZE, uint8_t ubTXOverflow = UART_TX_OVERFLOW_BLOCK>
+struct UART
 {
-	extern volatile uint8_t m_ubRXBuffer[UART_FIFO_SIZE + 1];
-	extern volatile uint16_t m_usRXBufferHead;
-	extern volatile uint16_t m_usRXBufferTail;
+	typedef uart_port_t<ubPort> port;
+	typedef char rx_fifo_size_check[(ubFIFOSize && ubFIFOSize <= 128 && !(ubFIFOSize & (ubFIFOSize - 1))) ? 1 : -1]; // Free running 8 bit indices
+	typedef char tx_fifo_size_check[(ubTXFIFOSize <= 128 && !(ubTXFIFOSize & (ubTXFIFOSize - 1))) ? 1 : -1];
+	
+	static const uint16_t m_usUBRR = (F_CPU + (ubDoubleSpeed ? 4UL : 8UL) * ulBaud) / ((ubDoubleSpeed ? 8UL : 16UL) * ulBaud) - 1UL;
+	
+	static volatile uint8_t m_ubRXBuffer[ubFIFOSize];
+	static volatile uint8_t m_ubRXBufferHead; // Only written by Receive
+	static volatile uint8_t m_ubRXBufferTail; // Only written by the reader, so neither side needs interrupts off
+	static volatile uint16_t m_usRXOverflows; // Bytes lost to a full FIFO or a data overrun (DOR)
+	static volatile uint16_t m_usRXFrameErrors; // Bytes dropped for a missing stop bit (FE)
 	
-	extern void Init(uint32_t ulBaud, uint8_t ubDoubleSpeed);
+	static volatile uint8_t m_ubTXBuffer[ubTXFIFOSize ? ubTXFIFOSize : 1];
+	static volatile uint8_t m_ubTXBufferHead; // Only written by WriteByte
+	static volatile uint8_t m_ubTXBufferTail; // Only written by Transmit
+	static volatile uint8_t m_ubTXWritten; // Something went out since Init, TXC is meaningful
+	static volatile uint16_t m_usTXDropped;
 	
-	inline uint16_t BytesAvailable()
+	static void Init()
 	{
-		return (UART_FIFO_SIZE + m_usRXBufferHead - m_usRXBufferTail) % UART_FIFO_SIZE;
+		m_ubRXBufferHead = 0;
+		m_ubRXBufferTail = 0;
+		m_usRXOverflows = 0;
+		m_usRXFrameErrors = 0;
+		
+		if(ubTXFIFOSize)
+		{
+			m_ubTXBufferHead = 0;
+			m_ubTXBufferTail = 0;
+		}
+		
+		m_ubTXWritten = 0;
+		
+		port::UBRR() = m_usUBRR;
+		port::UCSRA() = ubDoubleSpeed ? (1 << U2X0) : 0;
+		port::UCSRB() = (1 << RXCIE0) | (1 << TXEN0) | (1 << RXEN0);
+		port::UCSRC() = (1 << UCSZ01) | (1 << UCSZ00);
 	}
-	inline void Flush()
+	__attribute__ ((always_inline)) static void Receive()
 	{
-		m_usRXBufferTail = m_usRXBufferHead;
+		uint8_t status = port::UCSRA(); // Flags belong to the byte in UDR, read them first
+		uint8_t data = port::UDR();
+		uint8_t head = m_ubRXBufferHead;
+		
+		if(status & (1 << DOR0))
+			m_usRXOverflows++;
+		
+		if(status & (1 << FE0))
+		{
+			m_usRXFrameErrors++;
+			
+			return;
+		}
+		
+		if((uint8_t)(head - m_ubRXBufferTail) >= ubFIFOSize)
+		{
+			m_usRXOverflows++;
+			
+			return;
+		}
+		
+		m_ubRXBuffer[head & (ubFIFOSize - 1)] = data;
+		m_ubRXBufferHead = head + 1; // Published after the data
 	}
 	
-	extern uint8_t ReadByte();
-	inline void Read(uint8_t* pubDest, uint16_t usCount)
+	static uint8_t BytesAvailable()
 	{
-		while(usCount--)
-			*(pubDest++) = ReadByte();
+		return m_ubRXBufferHead - m_ubRXBufferTail;
 	}
-	inline void Read(void* pDest, uint16_t usCount)
+	static void Flush()
 	{
-		Read((uint8_t*)pDest, usCount);
+		m_ubRXBufferTail = m_ubRXBufferHead;
 	}
 	
-	extern void WriteByte(uint8_t ubData);
-	inline void Write(uint8_t* pubSrc, uint16_t usCount)
+	static uint8_t ReadByte() // Waits for a byte
 	{
-		while(usCount--)
-			WriteByte(*(pubSrc++));
+		uint8_t tail = m_ubRXBufferTail;
+		
+		while(m_ubRXBufferHead == tail);
+		
+		uint8_t b = m_ubRXBuffer[tail & (ubFIFOSize - 1)];
+		
+		m_ubRXBufferTail = tail + 1;
+		
+		return b;
 	}
-	inline void Write(void* pSrc, uint16_t usCount)
+	static uint8_t PeekByte(uint8_t ubOffset) // ubOffset must be below BytesAvailable
 	{
-		Write((uint8_t*)pSrc, usCount);
+		return m_ubRXBuffer[(uint8_t)(m_ubRXBufferTail + ubOffset) & (ubFIFOSize - 1)];
 	}
-	
-	extern void Printf(const char* pbFmt, ...);
-}
-
-namespace UART1
-{
-	extern volatile uint8_t m_ubRXBuffer[UART_FIFO_SIZE + 1];
-	extern volatile uint16_t m_usRXBufferHead;
-	extern volatile uint16_t m_usRXBufferTail;
-	
-	extern void Init(uint32_t ulBaud, uint8_t ubDoubleSpeed);
-	
-	inline uint16_t BytesAvailable()
+	static uint8_t Peek(const uint8_t** ppubData) // Contiguous bytes at the read position, parse them in place and Consume
 	{
-		return (UART_FIFO_SIZE + m_usRXBufferHead - m_usRXBufferTail) % UART_FIFO_SIZE;
+		uint8_t tail = m_ubRXBufferTail;
+		uint8_t count = m_ubRXBufferHead - tail;
+		uint8_t offset = tail & (ubFIFOSize - 1);
+		
+		if(count > ubFIFOSize - offset) // The rest wrapped to the start of the buffer
+			count = ubFIFOSize - offset;
+		
+		asm volatile("" ::: "memory"); // The caller reads the data only after the head
+		
+		*ppubData = (const uint8_t*)m_ubRXBuffer + offset;
+		
+		return count;
 	}
-	inline void Flush()
+	static void Consume(uint8_t ubCount)
 	{
-		m_usRXBufferTail = m_usRXBufferHead;
+		asm volatile("" ::: "memory"); // Done with the data before the slots are handed back to Receive
+		
+		m_ubRXBufferTail += ubCount;
 	}
-	
-	extern uint8_t ReadByte();
-	inline void Read(uint8_t* pubDest, uint16_t usCount)
+	static uint8_t ReadAvailable(uint8_t* pubDest, uint8_t ubMax) // Copies up to ubMax of the bytes already received, returns how many
+	{
+		uint8_t total = 0;
+		
+		while(total < ubMax) // At most twice, before and after the wrap
+		{
+			const uint8_t* src;
+			uint8_t count = Peek(&src);
+			
+			if(!count)
+				break;
+			
+			if(count > ubMax - total)
+				count = ubMax - total;
+			
+			memcpy(pubDest + total, src, count);
+			
+			Consume(count);
+			
+			total += count;
+		}
+		
+		return total;
+	}
+	static void Read(uint8_t* pubDest, uint16_t usCount)
 	{
 		while(usCount--)
 			*(pubDest++) = ReadByte();
 	}
-	inline void Read(void* pDest, uint16_t usCount)
+	static void Read(void* pDest, uint16_t usCount)
 	{
 		Read((uint8_t*)pDest, usCount);
 	}
 	
-	extern void WriteByte(uint8_t ubData);
-	inline void Write(uint8_t* pubSrc, uint16_t usCount)
+	static void Send(uint8_t ubData)
+	{
+		port::UCSRA() = (ubDoubleSpeed ? (1 << U2X0) : 0) | (1 << TXC0); // Clear TXC, FlushTX waits for it
+		port::UDR() = ubData;
+		
+		m_ubTXWritten = 1;
+	}
+	__attribute__ ((always_inline)) static void Transmit()
+	{
+		uint8_t tail = m_ubTXBufferTail;
+		
+		if(tail != m_ubTXBufferHead) // WriteByte may set UDRIE again right after the FIFO was drained
+		{
+			Send(m_ubTXBuffer[tail & (ubTXFIFOSize - 1)]);
+			
+			m_ubTXBufferTail = ++tail;
+		}
+		
+		if(tail == m_ubTXBufferHead)
+			port::UCSRB() &= ~(1 << UDRIE0);
+	}
+	static void Poll() // Does the interrupt's job while interrupts are off (before sei, in an ATOMIC_BLOCK)
+	{
+		if(port::UCSRA() & (1 << UDRE0))
+			Transmit();
+	}
+	
+	static void WriteByte(uint8_t ubData)
+	{
+		if(!ubTXFIFOSize)
+		{
+			while(!(port::UCSRA() & (1 << UDRE0)));
+			
+			Send(ubData);
+			
+			return;
+		}
+		
+		uint8_t head = m_ubTXBufferHead;
+		
+		if(head == m_ubTXBufferTail && (port::UCSRA() & (1 << UDRE0))) // Nothing queued and the data register is free, skip the FIFO
+		{
+			Send(ubData);
+			
+			return;
+		}
+		
+		while((uint8_t)(head - m_ubTXBufferTail) >= ubTXFIFOSize)
+		{
+			if(ubTXOverflow == UART_TX_OVERFLOW_COUNT)
+				m_usTXDropped++;
+			
+			if(ubTXOverflow != UART_TX_OVERFLOW_BLOCK)
+				return;
+			
+			if(!(SREG & (1 << SREG_I)))
+				Poll();
+		}
+		
+		m_ubTXBuffer[head & (ubTXFIFOSize - 1)] = ubData;
+		m_ubTXBufferHead = head + 1;
+		
+		port::UCSRB() |= (1 << UDRIE0);
+	}
+	static void Write(uint8_t* pubSrc, uint16_t usCount)
 	{
 		while(usCount--)
 			WriteByte(*(pubSrc++));
 	}
-	inline void Write(void* pSrc, uint16_t usCount)
+	static void Write(void* pSrc, uint16_t usCount)
 	{
 		Write((uint8_t*)pSrc, usCount);
 	}
 	
-	extern void Printf(const char* pbFmt, ...);
-}
+	static void FlushTX() // Everything queued is on the wire, call before a reset or handing the USART over
+	{
+		if(ubTXFIFOSize)
+			while(m_ubTXBufferHead != m_ubTXBufferTail)
+				if(!(SREG & (1 << SREG_I)))
+					Poll();
+		
+		if(m_ubTXWritten)
+			while(!(port::UCSRA() & (1 << TXC0)));
+	}
+	
+	static void Stop() // Queued output sent, then the USART is left as after a reset
+	{
+		FlushTX();
+		
+		port::UCSRB() = 0;
+		port::UCSRA() = 0;
+		port::UCSRC() = (1 << UCSZ01) | (1 << UCSZ00);
+		port::UBRR() = 0;
+	}
+	
+	static void Printf(const char* pbFmt, ...)
+	{
+		char msg[64];
+		
+		va_list args;
+		va_start(args, pbFmt);
+		int length = vsnprintf(msg, sizeof(msg), pbFmt, args); // Length of the whole message, more than msg holds if it was cut
+		va_end(args);
+		
+		if(length < 0)
+			return;
+		
+		Write((uint8_t*)msg, (length < (int)sizeof(msg)) ? length : sizeof(msg) - 1);
+	}
+};
+
+template<uint8_t ubPort, uint32_t ulBaud, uint8_t ubDoubleSpeed, uint8_t ubFIFOSize, uint8_t ubTXFIFOSize, uint8_t ubTXOverflow>
+volatile uint8_t UART<ubPort, ulBaud, ubDoubleSpeed, ubFIFOSize, ubTXFIFOSize, ubTXOverflow>::m_ubRXBuffer[ubFIFOSize];
+template<uint8_t ubPort, uint32_t ulBaud, uint8_t ubDoubleSpeed, uint8_t ubFIFOSize, uint8_t ubTXFIFOSize, uint8_t ubTXOverflow>
+volatile uint8_t UART<ubPort, ulBaud, ubDoubleSpeed, ubFIFOSize, ubTXFIFOSize, ubTXOverflow>::m_ubRXBufferHead = 0;
+template<uint8_t ubPort, uint32_t ulBaud, uint8_t ubDoubleSpeed, uint8_t ubFIFOSize, uint8_t ubTXFIFOSize, uint8_t ubTXOverflow>
+volatile uint8_t UART<ubPort, ulBaud, ubDoubleSpeed, ubFIFOSize, ubTXFIFOSize, ubTXOverflow>::m_ubRXBufferTail = 0;
+template<uint8_t ubPort, uint32_t ulBaud, uint8_t ubDoubleSpeed, uint8_t ubFIFOSize, uint8_t ubTXFIFOSize, uint8_t ubTXOverflow>
+volatile uint16_t UART<ubPort, ulBaud, ubDoubleSpeed, ubFIFOSize, ubTXFIFOSize, ubTXOverflow>::m_usRXOverflows = 0;
+template<uint8_t ubPort, uint32_t ulBaud, uint8_t ubDoubleSpeed, uint8_t ubFIFOSize, uint8_t ubTXFIFOSize, uint8_t ubTXOverflow>
+volatile uint16_t UART<ubPort, ulBaud, ubDoubleSpeed, ubFIFOSize, ubTXFIFOSize, ubTXOverflow>::m_usRXFrameErrors = 0;
+template<uint8_t ubPort, uint32_t ulBaud, uint8_t ubDoubleSpeed, uint8_t ubFIFOSize, uint8_t ubTXFIFOSize, uint8_t ubTXOverflow>
+volatile uint8_t UART<ubPort, ulBaud, ubDoubleSpeed, ubFIFOSize, ubTXFIFOSize, ubTXOverflow>::m_ubTXBuffer[ubTXFIFOSize ? ubTXFIFOSize : 1];
+template<uint8_t ubPort, uint32_t ulBaud, uint8_t ubDoubleSpeed, uint8_t ubFIFOSize, uint8_t ubTXFIFOSize, uint8_t ubTXOverflow>
+volatile uint8_t UART<ubPort, ulBaud, ubDoubleSpeed, ubFIFOSize, ubTXFIFOSize, ubTXOverflow>::m_ubTXBufferHead = 0;
+template<uint8_t ubPort, uint32_t ulBaud, uint8_t ubDoubleSpeed, uint8_t ubFIFOSize, uint8_t ubTXFIFOSize, uint8_t ubTXOverflow>
+volatile uint8_t UART<ubPort, ulBaud, ubDoubleSpeed, ubFIFOSize, ubTXFIFOSize, ubTXOverflow>::m_ubTXBufferTail = 0;
+template<uint8_t ubPort, uint32_t ulBaud, uint8_t ubDoubleSpeed, uint8_t ubFIFOSize, uint8_t ubTXFIFOSize, uint8_t ubTXOverflow>
+volatile uint8_t UART<ubPort, ulBaud, ubDoubleSpeed, ubFIFOSize, ubTXFIFOSize, ubTXOverflow>::m_ubTXWritten = 0;
+template<uint8_t ubPort, uint32_t ulBaud, uint8_t ubDoubleSpeed, uint8_t ubFIFOSize, uint8_t ubTXFIFOSize, uint8_t ubTXOverflow>
+volatile uint16_t UART<ubPort, ulBaud, ubDoubleSpeed, ubFIFOSize, ubTXFIFOSize, ubTXOverflow>::m_usTXDropped = 0;
 
 #endif /* UART_H_ */
\ No newline at end of file
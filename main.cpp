@@ -8,24 +8,34 @@
 #include <main.h>
 
 // Variables
-uint8_t g_ubMCUSR = 0;
+uint8_t g_ubMCUSR __attribute__ ((section (".noinit"))); // Set by init(), which runs before .data and .bss are initialised
 uint8_t g_ubSPIFlashOK = 0;
+uint32_t g_ulLoadSrcAddress = 0; // Internal flash address of the delta source ROM
+uint32_t g_ulLoadCRC = 0;
+uint32_t g_ulLoadRelocAddress = 0; // Next external flash address of the relocation table
+uint32_t g_ulLoadRelocCRC = 0;
+uint8_t g_ubLoadWritten = 0; // loadROM rewrote a page, a failed load left the ROM half written
+#ifndef BOOT_IVT_DISPATCH
+uint8_t g_ubLoadIVT[IVT_CACHE_DATA_SIZE]; // IVT of the image being loaded, patched and cached next to the ROM once verified
+#endif
+
+// Interrupts
+DISR() // Debug UART RX and TX, the other USARTs link in no ISR or buffer
+#ifdef BOOT_SERIAL
+UART_RX_ISR(SERIAL_PORT, SUART) // serialSession receives and replies through the FIFOs, without these its first byte would hit __bad_interrupt
+UART_TX_ISR(SERIAL_PORT, SUART)
+#endif
 
 // Functions
 void resetMCU()
 {
+	DFLUSH(); // The reset would cut off whatever is still queued
+	
 	wdt_enable(WDTO_15MS);
 	
 	while(1);
 }
 
-void calcCRC16(boot_cfg_t* pConfig)
-{
-	pConfig->m_usCRC = 0;
-	
-	for(uint16_t i = 0; i < sizeof(boot_cfg_t) - sizeof(uint16_t); i++)
-		pConfig->m_usCRC = _crc16_update(pConfig->m_usCRC, ((uint8_t*)pConfig)[i]);
-}
 uint8_t validateConfig(boot_cfg_t* pConfig)
 {	
 	if(pConfig->m_ubMagic != BOOT_MAGIC)
@@ -97,19 +107,27 @@ uint8_t validateConfig(boot_cfg_t* pConfig)
 }
 
 void flashProgramPage(uint32_t ulAddress, uint8_t *pubBuf, uint16_t uiSize)
+{
+	if(!flashStartPage(ulAddress, pubBuf, uiSize))
+		return;
+	
+	flashWaitPage();
+	DPRINTFLN_CTX("EEPROM & SPM not busy, OK!");
+}
+uint8_t flashStartPage(uint32_t ulAddress, uint8_t *pubBuf, uint16_t uiSize)
 {
 	if(!uiSize || !pubBuf)
 	{
 		DPRINTFLN_CTX("Buffer pointer or size invalid [0x%04X] [%d]", pubBuf, uiSize);
 		
-		return;
+		return 0;
 	}
 	
 	if(ulAddress + uiSize > FLASHEND)
 	{
 		DPRINTFLN_CTX("Data size exceeds flash size [0x%08X] [%d]", ulAddress, uiSize);
 		
-		return;
+		return 0;
 	}
 	
 	uiSize = (uiSize > SPM_PAGESIZE) ? SPM_PAGESIZE : uiSize;
@@ -120,52 +138,45 @@ void flashProgramPage(uint32_t ulAddress, uint8_t *pubBuf, uint16_t uiSize)
 	for(uint16_t i = 0; i < uiSize; i += 2)
 		boot_page_fill_safe(ulAddress + i, pubBuf[i] | (pubBuf[i + 1] << 8));
 	
-	boot_page_write_safe(ulAddress);
+	boot_page_write_safe(ulAddress); // Only starts the write, the CPU keeps running from the NRWW section meanwhile
 	DPRINTFLN_CTX("Written page at address [0x%08X]", ulAddress);
 	
+	return 1;
+}
+void flashWaitPage()
+{
 	boot_spm_busy_wait();
+	boot_rww_enable_safe(); // Make the RWW section readable again
 	eeprom_busy_wait();
-	DPRINTFLN_CTX("EEPROM & SPM not busy, OK!");
 }
-
-uint8_t bootROM(uint32_t ulAddress)
+uint8_t flashPageMatches(uint32_t ulAddress, uint8_t *pubBuf, uint16_t uiSize)
 {
-	if(ulAddress < (((_VECTORS_SIZE / SPM_PAGESIZE) * SPM_PAGESIZE) + SPM_PAGESIZE)) // The (original) page-boundary IVT space is required to be volatile (i.e. each firmware must have its own IVT copy, never flash to 0x00000)
-	{
-		DPRINTFLN_CTX("Address is lower than IVT size [0x%08X]", ulAddress);
-		
-		return 0;
-	}
-		
-	if(ulAddress + _VECTORS_SIZE > FLASHEND)
-	{
-		DPRINTFLN_CTX("Data size exceeds flash size [0x%08X]", ulAddress);
-		
-		return 0;
-	}
-	
-	// Live patch the interrupt vector table with one residing at the specified address
-	// The rest of the code can be run directly from that address
-	uint8_t ivtBuf[_VECTORS_SIZE]; // Interrupt vector table
-	uint16_t pageIndex = 0; // Pages written (in case the VTable is bigger than one flash page)
-	
-	memset(ivtBuf, 0, _VECTORS_SIZE); // Probably not needed
-	
-	DPRINTFLN_CTX("Loading IVT into internal buffer [0x%08X] [%u]", ulAddress, _VECTORS_SIZE);
+	uiSize = (uiSize > SPM_PAGESIZE) ? SPM_PAGESIZE : uiSize;
 	
-	// Load the IVT from the desired address
-	if(ulAddress > 0xFFFF) // If the address is larger than 2 bytes we need a ELPM instead of a LPM
-		memcpy_PF(ivtBuf, ulAddress, _VECTORS_SIZE);
-	else
-		memcpy_P(ivtBuf, (void*)ulAddress, _VECTORS_SIZE);
-		
-	DPRINTFLN_CTX("IVT Loaded into internal buffer");
+	for(uint16_t i = 0; i < uiSize; i++)
+		if(pgm_read_byte_far(ulAddress + i) != pubBuf[i]) // ELPM, the RWW section must be readable (see flashWaitPage)
+			return 0;
 	
+	return 1;
+}
+
+void encodeJMP(uint8_t *pubDest, uint32_t ulAddress)
+{
+	// JMP to the absolute destination address (implicit byte-address to word-address conversion)
+	pubDest[0] = (ulAddress & 0x780000) >> 15;
+	pubDest[0] |= 0x0C | ((ulAddress & 0x040000) >> 18);
+	pubDest[1] = 0x94 | ((ulAddress & 0x020000) >> 17);
+	pubDest[2] = (ulAddress & 0x0001FE) >> 1;
+	pubDest[3] = (ulAddress & 0x01FE00) >> 9;
+}
+
+void patchIVT(uint8_t *pubIVT, uint32_t ulAddress)
+{
 	for(uint16_t i = 0; i < _VECTORS_SIZE; i += 4) // Each vector is 4 bytes in size (2 words)
 	{
-		uint32_t op = ((uint32_t)ivtBuf[i] << 24) | ((uint32_t)ivtBuf[i + 1] << 16) | ((uint32_t)ivtBuf[i + 2] << 8) | ivtBuf[i + 3];
+		uint32_t op = ((uint32_t)pubIVT[i] << 24) | ((uint32_t)pubIVT[i + 1] << 16) | ((uint32_t)pubIVT[i + 2] << 8) | pubIVT[i + 3];
 
-		DPRINTFLN_CTX("Original bytecode [%02X %02X %02X %02X]", ivtBuf[i], ivtBuf[i + 1], ivtBuf[i + 2], ivtBuf[i + 3]);
+		DPRINTFLN_CTX("Original bytecode [%02X %02X %02X %02X]", pubIVT[i], pubIVT[i + 1], pubIVT[i + 2], pubIVT[i + 3]);
 
 		op >>= 16; // Lower byte would be masked anyways, so discard it
 		op &= 0x00F0; // Mask the offset and leave only the OP code
@@ -180,8 +191,8 @@ uint8_t bootROM(uint32_t ulAddress)
 			int16_t diffAddr = 0; // Difference (word) address
 			
 			// Get the destination address from the RJMP instruction
-			diffAddr |= ivtBuf[i];
-			diffAddr |= (ivtBuf[i + 1] & 0x0F) << 8;
+			diffAddr |= pubIVT[i];
+			diffAddr |= (pubIVT[i + 1] & 0x0F) << 8;
 			diffAddr |= (diffAddr & 0x0800) << 1; // Propagate the last bit for signed operations (2's complement)
 			diffAddr |= (diffAddr & 0x0800) << 2;
 			diffAddr |= (diffAddr & 0x0800) << 3;
@@ -193,75 +204,509 @@ uint8_t bootROM(uint32_t ulAddress)
 			
 			DPRINTFLN_CTX("JMP absolute byte address [0x%08X]", destAddr);
 			
-			// Convert the RJMP into a JMP to the absolute destination address (implicit byte-address to word-address conversion)
-			ivtBuf[i] = (destAddr & 0x780000) >> 15;
-			ivtBuf[i] |= 0x0C | ((destAddr & 0x040000) >> 18);
-			ivtBuf[i + 1] = 0x94 | ((destAddr & 0x020000) >> 17);
-			ivtBuf[i + 2] = (destAddr & 0x0001FE) >> 1;
-			ivtBuf[i + 3] = (destAddr & 0x01FE00) >> 9;
+			// Convert the RJMP into a JMP to the absolute destination address
+			encodeJMP(pubIVT + i, destAddr);
 			
-			DPRINTFLN_CTX("Patched bytecode [%02X %02X %02X %02X]", ivtBuf[i], ivtBuf[i + 1], ivtBuf[i + 2], ivtBuf[i + 3]);
+			DPRINTFLN_CTX("Patched bytecode [%02X %02X %02X %02X]", pubIVT[i], pubIVT[i + 1], pubIVT[i + 2], pubIVT[i + 3]);
 		}
+	}
+}
+uint16_t ivtFingerprint(uint32_t ulAddress)
+{
+	uint16_t crc = 0;
+	
+	for(uint16_t i = 0; i < _VECTORS_SIZE; i++)
+		crc = _crc16_update(crc, pgm_read_byte_far(ulAddress + i));
+	
+	return crc;
+}
+uint8_t ivtCacheValid(uint32_t ulAddress)
+{
+	uint32_t cacheAddress = IVT_CACHE_ADDRESS(ulAddress);
+	
+	for(uint16_t i = 0; i < _VECTORS_SIZE; i += 4)
+		if((pgm_read_word_far(cacheAddress + i) & 0xFE0E) != 0x940C) // A patched IVT only holds JMPs, an erased or foreign page does not
+			return 0;
+	
+	return pgm_read_word_far(cacheAddress + _VECTORS_SIZE) == ivtFingerprint(ulAddress); // Made from the image in the ROM now, not one flashed over it since (e.g. ISP)
+}
+uint8_t ivtCacheWrite(uint32_t ulAddress, uint8_t *pubIVT)
+{
+	uint32_t cacheAddress = IVT_CACHE_ADDRESS(ulAddress);
+	uint16_t fingerprint = ivtFingerprint(ulAddress);
+	
+	patchIVT(pubIVT, ulAddress);
+	
+	pubIVT[_VECTORS_SIZE] = fingerprint & 0xFF;
+	pubIVT[_VECTORS_SIZE + 1] = fingerprint >> 8;
+	
+	for(uint16_t i = 0; i < IVT_CACHE_DATA_SIZE; i += SPM_PAGESIZE)
+	{
+		uint16_t size = (IVT_CACHE_DATA_SIZE - i > SPM_PAGESIZE) ? SPM_PAGESIZE : IVT_CACHE_DATA_SIZE - i;
+		
+		if(!flashPageMatches(cacheAddress + i, pubIVT + i, size))
+			flashProgramPage(cacheAddress + i, pubIVT + i, size);
+	}
+	
+	DPRINTFLN_CTX("Cached patched IVT [0x%08X] [0x%08lX] [0x%04X]", ulAddress, cacheAddress, fingerprint);
+	
+	return ivtCacheValid(ulAddress);
+}
+void flashCopyPage(uint32_t ulDestAddress, uint32_t ulSrcAddress, uint16_t uiSize)
+{
+	uiSize = (uiSize > SPM_PAGESIZE) ? SPM_PAGESIZE : uiSize;
+	
+	flashWaitPage();
+	
+	// The page buffer may be filled before the erase, so the source is read while the RWW section is still readable
+	for(uint16_t i = 0; i < uiSize; i += 2)
+		boot_page_fill_safe(ulDestAddress + i, pgm_read_word_far(ulSrcAddress + i));
+	
+	boot_page_erase_safe(ulDestAddress);
+	boot_page_write_safe(ulDestAddress);
+	
+	flashWaitPage();
+}
+uint8_t flashPagesMatch(uint32_t ulAddress1, uint32_t ulAddress2, uint16_t uiSize)
+{
+	for(uint16_t i = 0; i < uiSize; i += 2)
+		if(pgm_read_word_far(ulAddress1 + i) != pgm_read_word_far(ulAddress2 + i))
+			return 0;
+	
+	return 1;
+}
+
+uint8_t romValid(uint32_t ulAddress)
+{
+	return (pgm_read_word_far(ulAddress) & 0xFE0E) == 0x940C; // Every image starts with the JMP of its reset vector, romInvalidate erases it
+}
+void romInvalidate(uint32_t ulAddress)
+{
+	DPRINTFLN_CTX("Invalidating ROM [0x%08X]", ulAddress);
+	
+	uint32_t pageAddress = ulAddress & ~(uint32_t)(SPM_PAGESIZE - 1);
+	
+	flashWaitPage();
+	
+	// Only the reset vector is erased, the rest of the page may belong to the ROM below
+	for(uint16_t i = 0; i < SPM_PAGESIZE; i += 2)
+		boot_page_fill_safe(pageAddress + i, (pageAddress + i == ulAddress) ? 0xFFFF : pgm_read_word_far(pageAddress + i));
+	
+	boot_page_erase_safe(pageAddress);
+	boot_page_write_safe(pageAddress);
+	
+	flashWaitPage();
+	
+#ifndef BOOT_IVT_DISPATCH
+	if(ulAddress < ROM_MIN_ADDRESS || (ulAddress & (SPM_PAGESIZE - 1))) // No IVT cache, see loadROM
+		return;
+	
+	for(uint16_t i = 0; i < IVT_CACHE_DATA_SIZE; i += SPM_PAGESIZE) // bootROM must not find the cached IVT of the old image either
+	{
+		boot_page_erase_safe(IVT_CACHE_ADDRESS(ulAddress) + i);
+		flashWaitPage();
+	}
+#endif
+}
+uint8_t romFallback(boot_cfg_t* pConfig, uint8_t ubROM)
+{
+	for(uint8_t i = 0; i < pConfig->m_ubROMCount; i++)
+		if(i != ubROM && romValid(pConfig->m_ulROMAddress[i]))
+			return i;
+	
+	return ubROM;
+}
+uint8_t romFits(boot_cfg_t* pConfig, uint32_t ulAddress, uint32_t ulSize)
+{
+	if(ulAddress + ulSize > FLASHEND)
+		return 0;
+	
+	for(uint8_t i = 0; i < pConfig->m_ubROMCount; i++)
+	{
+		uint32_t nextAddress = pConfig->m_ulROMAddress[i];
+		
+		if(nextAddress <= ulAddress)
+			continue;
+		
+#ifndef BOOT_IVT_DISPATCH
+		nextAddress = IVT_CACHE_ADDRESS(nextAddress); // The ROM above keeps its cached IVT right before it
+#endif
+		
+		if(ulAddress + ulSize > nextAddress)
+			return 0;
+	}
+	
+	return 1;
+}
+
+uint8_t bootROM(uint32_t ulAddress)
+{
+	if(ulAddress < ROM_MIN_ADDRESS) // The (original) page-boundary IVT space is required to be volatile (i.e. each firmware must have its own IVT copy, never flash to 0x00000)
+	{
+		DPRINTFLN_CTX("Address is lower than IVT size [0x%08X]", ulAddress);
+		
+		return 0;
+	}
+		
+	if(ulAddress + _VECTORS_SIZE > FLASHEND)
+	{
+		DPRINTFLN_CTX("Data size exceeds flash size [0x%08X]", ulAddress);
 		
-		if((i / SPM_PAGESIZE) > pageIndex) // If we have already modified one flash page, write it and increment the counter
-		{			
-			flashProgramPage(pageIndex * SPM_PAGESIZE, ivtBuf + pageIndex * SPM_PAGESIZE);
+		return 0;
+	}
+	
+	if(ulAddress & (SPM_PAGESIZE - 1))
+	{
+		DPRINTFLN_CTX("Address is not page aligned [0x%08X]", ulAddress);
+		
+		return 0;
+	}
+	
+	if(!romValid(ulAddress))
+	{
+		DPRINTFLN_CTX("No image in the ROM [0x%08X]", ulAddress);
+		
+		return 0;
+	}
+	
+#ifdef BOOT_IVT_DISPATCH
+	// The IVT at 0x00000 points to the dispatcher, switching only changes the ROM it jumps to (see dispatchSetROM)
+	return dispatchInstall();
+#else
+	uint32_t cacheAddress = IVT_CACHE_ADDRESS(ulAddress);
+	
+	if(!ivtCacheValid(ulAddress)) // ROM was not flashed by loadROM (e.g. ISP), patch it once and keep the result
+	{
+		uint8_t ivtBuf[IVT_CACHE_DATA_SIZE]; // Interrupt vector table and room for its fingerprint
+		
+		DPRINTFLN_CTX("No patched IVT cached, loading IVT into internal buffer [0x%08X] [%u]", ulAddress, _VECTORS_SIZE);
+		
+		memcpy_PF(ivtBuf, ulAddress, _VECTORS_SIZE);
+		
+		if(!ivtCacheWrite(ulAddress, ivtBuf))
+		{
+			DPRINTFLN_CTX("Failed to cache the patched IVT [0x%08lX]", cacheAddress);
 			
-			DPRINTFLN_CTX("Wrote flash page at [0x%08X] [%u]", pageIndex * SPM_PAGESIZE, SPM_PAGESIZE);
+			return 0;
+		}
+	}
+	
+	// Copy the cached IVT to 0x00000 page for page, straight from flash
+	for(uint16_t i = 0; i < _VECTORS_SIZE; i += SPM_PAGESIZE)
+	{
+		uint16_t size = (_VECTORS_SIZE - i > SPM_PAGESIZE) ? SPM_PAGESIZE : _VECTORS_SIZE - i;
+		
+		if(flashPagesMatch(i, cacheAddress + i, size))
+		{
+			DPRINTFLN_CTX("IVT page already up to date [0x%08X]", i);
 			
-			pageIndex++;
+			continue;
 		}
+		
+		flashCopyPage(i, cacheAddress + i, size);
+		
+		DPRINTFLN_CTX("Wrote flash page at [0x%08X] [%u]", i, size);
 	}
 	
-	// Write the remaining bytes from the patched IVT
-	flashProgramPage(pageIndex * SPM_PAGESIZE, ivtBuf + pageIndex * SPM_PAGESIZE, _VECTORS_SIZE - pageIndex * SPM_PAGESIZE);
+	return flashPagesMatch(0x00000, cacheAddress, _VECTORS_SIZE);
+#endif
+}
+uint8_t loadReadByte()
+{
+	return SPI_FLASH::StreamReadByte(); // Served from the stream read-ahead, the decompressor does not pay the SPI command overhead per byte
+}
+uint8_t loadFillRaw(uint8_t *pubBuf, uint16_t usSize)
+{
+	return SPI_FLASH::StreamRead(pubBuf, usSize); // Fails if the flash is stuck busy
+}
+uint8_t loadReadSource(uint32_t ulOffset)
+{
+	if(boot_rww_busy()) // The previous page is still being written, the RWW section can't be read yet
+		flashWaitPage();
 	
-	DPRINTFLN_CTX("Wrote flash page at [0x%08X] [%d]", pageIndex * SPM_PAGESIZE, _VECTORS_SIZE - pageIndex * SPM_PAGESIZE);
+	return pgm_read_byte_far(g_ulLoadSrcAddress + ulOffset);
+}
+uint8_t loadFillLZ4(uint8_t *pubBuf, uint16_t usSize)
+{
+	return LZ4::Decode(pubBuf, usSize);
+}
+uint8_t loadFillDelta(uint8_t *pubBuf, uint16_t usSize)
+{
+	return DELTA::Decode(pubBuf, usSize);
+}
+uint8_t loadReadReloc(uint8_t *pubBuf, uint16_t usSize)
+{
+	if(!SPI_FLASH::Read(g_ulLoadRelocAddress, pubBuf, usSize))
+		return 0;
+	
+	g_ulLoadRelocAddress += usSize;
+	g_ulLoadRelocCRC = CRC32::Update(g_ulLoadRelocCRC, pubBuf, usSize);
 	
 	return 1;
 }
-uint8_t loadROM(uint32_t ulIntAddress, uint32_t ulExtAddress, uint32_t ulSize)
+uint8_t loadProcessPage(uint32_t ulOffset, uint8_t *pubBuf, uint16_t usSize)
 {
-	if(ulIntAddress + ulSize > FLASHEND)
+	g_ulLoadCRC = CRC32::Update(g_ulLoadCRC, pubBuf, usSize); // Computed over the page buffers as they stream through, no extra pass over SPI
+	
+	if(!RELOC::Apply(ulOffset, pubBuf, usSize)) // The CRC covers the image as linked, the relocated bytes differ per ROM
 	{
-		DPRINTFLN_CTX("Data size exceeds internal flash size [0x%08X] [%lu]", ulIntAddress, ulSize);
+		DPRINTFLN_CTX("Relocation failed [%lu]", ulOffset);
 		
 		return 0;
 	}
 	
-	if(ulExtAddress + ulSize > FLASH_MAX_ADDRESS)
+#ifndef BOOT_IVT_DISPATCH
+	if(ulOffset < _VECTORS_SIZE)
+		memcpy(g_ubLoadIVT + ulOffset, pubBuf, (_VECTORS_SIZE - ulOffset > usSize) ? usSize : _VECTORS_SIZE - ulOffset);
+#endif
+	
+	return 1;
+}
+uint8_t loadROM(boot_cfg_t* pConfig)
+{
+	uint32_t intAddress = pConfig->m_ulROMAddress[pConfig->m_ubLoadROM];
+	uint32_t extAddress = pConfig->m_ulLoadROMFlashAddress;
+	uint32_t size = pConfig->m_ulLoadROMSize;
+	
+	g_ubLoadWritten = 0;
+	
+	if(!g_ubSPIFlashOK)
 	{
-		DPRINTFLN_CTX("Data size exceeds external flash size [0x%08X] [%lu]", ulIntAddress, ulSize);
+		DPRINTFLN_CTX("SPI Flash init NOK");
 		
 		return 0;
 	}
 	
-	if(!g_ubSPIFlashOK)
+	image_header_t header;
+	load_fill_t fill = loadFillRaw;
+	
+	if(!SPI_FLASH::Read(extAddress, (uint8_t*)&header, sizeof(image_header_t)))
 	{
-		DPRINTFLN_CTX("SPI Flash init NOK");
+		DPRINTFLN_CTX("SPI Flash not responding");
 		
 		return 0;
 	}
+	
+	if(header.m_usMagic == IMAGE_MAGIC) // Headered image, otherwise a raw copy of size bytes
+	{
+		DPRINTFLN_CTX("Found image header [%u] [%u] [%lu] [%lu] [0x%08lX]", header.m_ubFormat, header.m_ubTargetROM, header.m_ulSize, header.m_ulPayloadSize, header.m_ulCRC32);
+		
+		if(header.m_ubTargetROM != pConfig->m_ubLoadROM && header.m_ubTargetROM != IMAGE_TARGET_ANY)
+		{
+			DPRINTFLN_CTX("Image was built for another ROM [%u] [%u]", header.m_ubTargetROM, pConfig->m_ubLoadROM);
+			
+			pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+			
+			return 0;
+		}
 		
-	_delay_ms(10);
+		if(header.m_ubFormat == IMAGE_FORMAT_LZ4)
+		{
+			fill = loadFillLZ4;
+		}
+		else if(header.m_ubFormat == IMAGE_FORMAT_DELTA)
+		{
+			if(header.m_ubSourceROM >= pConfig->m_ubROMCount || header.m_ubSourceROM == pConfig->m_ubLoadROM) // Rebuilding a ROM in place would overwrite the source while it is read
+			{
+				DPRINTFLN_CTX("Delta source ROM invalid [%u] [%u]", header.m_ubSourceROM, pConfig->m_ubLoadROM);
+				
+				pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+				
+				return 0;
+			}
+			
+			if(header.m_usRelocCount) // The source ROM holds bytes relocated for its own address
+			{
+				DPRINTFLN_CTX("Delta images can't be relocated");
+				
+				pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+				
+				return 0;
+			}
+			
+			fill = loadFillDelta;
+		}
+		else if(header.m_ubFormat != IMAGE_FORMAT_RAW)
+		{
+			DPRINTFLN_CTX("Unknown image format [%u]", header.m_ubFormat);
+			
+			pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+			
+			return 0;
+		}
 		
-	while(ulSize > 0)
+		extAddress += sizeof(image_header_t);
+		size = header.m_ulSize;
+	}
+	else
+	{
+		header.m_ubFormat = IMAGE_FORMAT_RAW;
+		header.m_ulPayloadSize = size;
+		header.m_usRelocCount = 0;
+	}
+	
+	if(!romFits(pConfig, intAddress, size))
 	{
-		static uint16_t currentPage;
-		static uint8_t buf[SPM_PAGESIZE];
+		DPRINTFLN_CTX("Data size exceeds internal flash size or the next ROM [0x%08X] [%lu]", intAddress, size);
+		
+		pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+		
+		return 0;
+	}
+	
+	if(extAddress + header.m_ulPayloadSize + (uint32_t)header.m_usRelocCount * sizeof(reloc_entry_t) > FLASH_MAX_ADDRESS)
+	{
+		DPRINTFLN_CTX("Data size exceeds external flash size [0x%08X] [%lu] [%u]", extAddress, header.m_ulPayloadSize, header.m_usRelocCount);
+		
+		pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+		
+		return 0;
+	}
+	
+	if(!size)
+	{
+		pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+		
+		return 0;
+	}
+	
+	if(!SPI_FLASH::StreamOpen(extAddress))
+	{
+		DPRINTFLN_CTX("SPI Flash not responding");
+		
+		return 0;
+	}
+	
+	if(header.m_ubFormat == IMAGE_FORMAT_LZ4)
+	{
+		LZ4::Init(header.m_ulPayloadSize, loadReadByte);
+	}
+	else if(header.m_ubFormat == IMAGE_FORMAT_DELTA)
+	{
+		g_ulLoadSrcAddress = pConfig->m_ulROMAddress[header.m_ubSourceROM];
+		
+		// The source may be read up to the start of the destination ROM (or the end of the flash if it sits above it)
+		uint32_t sourceSize = (g_ulLoadSrcAddress < intAddress) ? intAddress - g_ulLoadSrcAddress : FLASHEND + 1 - g_ulLoadSrcAddress;
+		
+		DPRINTFLN_CTX("Applying delta to ROM [%u] [0x%08X]", header.m_ubSourceROM, g_ulLoadSrcAddress);
+		
+		DELTA::Init(header.m_ulPayloadSize, loadReadByte, loadReadSource, sourceSize);
+	}
+	
+	g_ulLoadRelocAddress = extAddress + header.m_ulPayloadSize;
+	g_ulLoadRelocCRC = CRC32_INIT;
+	
+	if(header.m_usRelocCount)
+		DPRINTFLN_CTX("Relocating image to [0x%08X] [%u]", intAddress, header.m_usRelocCount);
+	
+	if(!RELOC::Init(header.m_usRelocCount, loadReadReloc, intAddress, size))
+	{
+		DPRINTFLN_CTX("Relocation table invalid");
+		
+		pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+		
+		return 0;
+	}
+	
+	BOOT_DELAY_MS(10);
+	
+	// Double buffered copy, the next page is produced (read or decompressed) while the SPM write of the current one runs
+	static uint8_t pageBuf[2][SPM_PAGESIZE];
+	uint8_t currentBuf = 0;
+	uint32_t offset = 0;
+	uint32_t remaining = size;
+	uint16_t skippedPages = 0;
+	uint32_t startTime = TIMER::GetMicros();
+	
+	g_ulLoadCRC = CRC32_INIT;
+	
+	uint16_t dataSize = (remaining > SPM_PAGESIZE) ? SPM_PAGESIZE : remaining;
+	
+	if(!fill(pageBuf[currentBuf], dataSize) || !loadProcessPage(offset, pageBuf[currentBuf], dataSize))
+	{
+		SPI_FLASH::StreamClose();
+		
+		DPRINTFLN_CTX("Failed to read image data [%lu]", offset);
+		
+		pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+		
+		return 0;
+	}
+	
+	while(remaining > 0)
+	{
+		if(flashPageMatches(intAddress + offset, pageBuf[currentBuf], dataSize)) // Page already holds this data, skip the erase/write
+			skippedPages++;
+		else if(!flashStartPage(intAddress + offset, pageBuf[currentBuf], dataSize)) // flashStartPage logs why
+		{
+			SPI_FLASH::StreamClose();
 			
-		uint16_t dataSize = (ulSize > SPM_PAGESIZE) ? SPM_PAGESIZE : ulSize;
+			pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
 			
-		SPI_FLASH::Read(ulExtAddress + currentPage, buf, dataSize);
-		flashProgramPage(ulIntAddress + currentPage, buf, dataSize);
+			return 0;
+		}
+		else
+			g_ubLoadWritten = 1;
+		
+		offset += dataSize;
+		remaining -= dataSize;
+		
+		uint16_t nextSize = (remaining > SPM_PAGESIZE) ? SPM_PAGESIZE : remaining;
 		
-		currentPage += dataSize;
-		ulSize -= dataSize;
+		if(nextSize)
+		{
+			if(!fill(pageBuf[currentBuf ^ 1], nextSize) || !loadProcessPage(offset, pageBuf[currentBuf ^ 1], nextSize))
+			{
+				flashWaitPage();
+				SPI_FLASH::StreamClose();
+				
+				DPRINTFLN_CTX("Failed to read image data [%lu]", offset);
+				
+				pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+				
+				return 0;
+			}
+		}
 		
-		_delay_ms(5);
+		flashWaitPage();
+		
+		currentBuf ^= 1;
+		dataSize = nextSize;
+	}
+	
+	SPI_FLASH::StreamClose();
+	
+	g_ulLoadCRC = CRC32::Final(g_ulLoadCRC);
+	
+	if(header.m_usMagic == IMAGE_MAGIC && g_ulLoadCRC != header.m_ulCRC32)
+	{
+		DPRINTFLN_CTX("Image CRC does not match [0x%08lX] [0x%08lX]", g_ulLoadCRC, header.m_ulCRC32);
+		
+		pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+		
+		return 0;
 	}
 	
-	DPRINTFLN_CTX("Copied firmware from external flash to internal flash [0x%08X] [0x%08X] [%lu]", ulExtAddress, ulIntAddress, ulSize);
+	if(header.m_usMagic == IMAGE_MAGIC && (!RELOC::Done() || CRC32::Final(g_ulLoadRelocCRC) != header.m_ulRelocCRC32))
+	{
+		DPRINTFLN_CTX("Relocation table CRC does not match or entries left [0x%08lX] [0x%08lX]", CRC32::Final(g_ulLoadRelocCRC), header.m_ulRelocCRC32);
+		
+		pConfig->m_ubLoadStatus = BOOT_LOAD_STATUS_ERROR;
+		
+		return 0;
+	}
+	
+#ifndef BOOT_IVT_DISPATCH
+	if(size >= _VECTORS_SIZE && intAddress >= ROM_MIN_ADDRESS && !(intAddress & (SPM_PAGESIZE - 1))) // bootROM only copies this, the RJMP patching is done once here
+		ivtCacheWrite(intAddress, g_ubLoadIVT);
+#endif
+	
+	uint32_t elapsedTime = (TIMER::GetMicros() - startTime) / 1000UL;
+	uint32_t byteRate = elapsedTime ? (size * 1000UL) / elapsedTime : 0;
+	
+	DPRINTFLN_CTX("Copied firmware from external flash to internal flash [0x%08X] [0x%08X] [%lu]", extAddress, intAddress, size);
+	DPRINTFLN_CTX("Skipped %u unchanged pages out of %lu", skippedPages, (size + SPM_PAGESIZE - 1) / SPM_PAGESIZE);
+	DPRINTFLN_CTX("Copy took %lu ms [%lu.%02lu KB/s]", elapsedTime, byteRate / 1024, ((byteRate % 1024) * 100) / 1024);
 
 	return 1;
 }
@@ -275,8 +720,10 @@ void init()
 	MCUSR = 0x00;
 	 
 	wdt_disable(); // Disable the watchdog to prevent unwanted resets
+	
+	TIMER::Init(); // Free running time base, started first so the boot profile covers init() too
 	 
-	 _delay_ms(10);
+	 BOOT_DELAY_MS(10);
 	 
 	// Move the IVT to the Bootloader section
 	MCUCR |= (1 << IVCE);
@@ -284,24 +731,39 @@ void init()
 	
 	DINIT(); // Debug init
 	SPI::Init(0, 0, 0, 1); // MSB First, Mode 0, 4 MHz, 2x speed
-	//g_ubSPIFlashOK = SPI_FLASH::Init();
 	
 	sei(); // Enable interrupts now that the IVT is in a safe place
 	
-	_delay_ms(100);
+	BOOT_DELAY_MS(100);
 	
 	DPRINTFLN("\r\n\r\n> MultiBoot v1.0");
+	DFLUSH(); // .init4 clears the debug UART FIFO indices next, the banner must be out before
 }
 int main()
 {	
 	boot_cfg_t bootConfig;
 	
+	g_ubSPIFlashOK = SPI_FLASH::Init(); // Not in init(), the device table and descriptor it fills live in .data and .bss
+	
+	PROFILE_STAMP(PROFILE_PHASE_INIT);
+	
+#ifdef BENCHMARK
+	runBenchmarks();
+#endif
+	
 	memset(&bootConfig, 0, sizeof(boot_cfg_t));
 	
-	DPRINTFLN_CTX("Reading boot config at EEPROM address [0x%04X]", BOOT_CONFIG_EE_ADDRESS);
-
-	eeprom_busy_wait();
-	eeprom_read_block(&bootConfig, BOOT_CONFIG_EE_ADDRESS, sizeof(boot_cfg_t));
+	DPRINTFLN_CTX("Reading boot config journal at EEPROM address [0x%04X] [%u]", JOURNAL_EE_ADDRESS, JOURNAL_RECORDS);
+	
+	if(!journalLoad(&bootConfig))
+	{
+		DPRINTFLN_CTX("No valid journal record, reading boot config at EEPROM address [0x%04X]", BOOT_CONFIG_EE_ADDRESS);
+		
+		eeprom_busy_wait();
+		eeprom_read_block(&bootConfig, BOOT_CONFIG_EE_ADDRESS, sizeof(boot_cfg_t));
+	}
+	
+	PROFILE_STAMP(PROFILE_PHASE_CONFIG_READ);
 	
 	DPRINTFLN_CTX("Validating boot config");
 	
@@ -316,6 +778,8 @@ int main()
 	
 	DPRINTFLN_CTX("Boot config valid!");
 	
+	PROFILE_STAMP(PROFILE_PHASE_VALIDATE);
+	
 	DPRINTFLN_CTX("  Magic: 0x%02X!", bootConfig.m_ubMagic);
 	DPRINTFLN_CTX("  Version: 0x%02X!", bootConfig.m_ubVersion);
 	DPRINTFLN_CTX("  Mode: %u!", bootConfig.m_ubMode);
@@ -334,6 +798,36 @@ int main()
 	DPRINTFLN_CTX("  CRC16: 0x%04X!", bootConfig.m_usCRC);
 	
 	uint8_t resetNeeded = 0;
+	uint8_t ivtStale = 0;
+	
+#ifdef BOOT_SERIAL
+	uint8_t serialPartial = 0;
+	uint8_t serialROM = serialSession(&bootConfig, &serialPartial); // May also change the normal ROM
+	
+	if(serialROM != SERIAL_NO_ROM)
+	{
+		resetNeeded = 1;
+		
+		if(serialROM == bootConfig.m_ubCurrentROM) // The running ROM was replaced, its IVT at 0x00000 is stale
+			ivtStale = 1;
+	}
+	
+	if(serialPartial) // Like a failed loadROM, the first page may already hold the new JMP so romValid would pass
+	{
+		resetNeeded = 1;
+		
+		for(uint8_t i = 0; i < bootConfig.m_ubROMCount; i++)
+			if(serialPartial & (1 << i))
+				romInvalidate(bootConfig.m_ulROMAddress[i]);
+		
+		if(serialPartial & (1 << bootConfig.m_ubNormalROM))
+		{
+			bootConfig.m_ubNormalROM = romFallback(&bootConfig, bootConfig.m_ubNormalROM);
+			
+			DPRINTFLN_CTX("Falling back to ROM [%u]", bootConfig.m_ubNormalROM);
+		}
+	}
+#endif
 	
 	if(bootConfig.m_ubLoadStatus == BOOT_LOAD_STATUS_ON)
 	{
@@ -341,11 +835,29 @@ int main()
 		
 		resetNeeded = 1;
 		
-		if(loadROM(bootConfig.m_ulROMAddress[bootConfig.m_ubLoadROM], bootConfig.m_ulLoadROMFlashAddress, bootConfig.m_ulLoadROMSize))
+		if(loadROM(&bootConfig))
+		{
 			bootConfig.m_ubLoadStatus = BOOT_LOAD_STATUS_OFF;
+			
+			if(bootConfig.m_ubLoadROM == bootConfig.m_ubCurrentROM) // The running ROM was replaced, its IVT at 0x00000 is stale
+				ivtStale = 1;
+		}
+		else if(g_ubLoadWritten) // Image only verified once written, a CRC or read failure leaves the ROM half written (a verify pass first would read it twice)
+		{
+			romInvalidate(bootConfig.m_ulROMAddress[bootConfig.m_ubLoadROM]);
+			
+			if(bootConfig.m_ubNormalROM == bootConfig.m_ubLoadROM)
+			{
+				bootConfig.m_ubNormalROM = romFallback(&bootConfig, bootConfig.m_ubLoadROM);
+				
+				DPRINTFLN_CTX("Falling back to ROM [%u]", bootConfig.m_ubNormalROM);
+			}
+		}
 	}
 	
-	if(bootConfig.m_ubMode == BOOT_MODE_NORMAL && bootConfig.m_ubNormalROM != bootConfig.m_ubCurrentROM)
+	PROFILE_STAMP(PROFILE_PHASE_LOAD);
+	
+	if(bootConfig.m_ubMode == BOOT_MODE_NORMAL && (bootConfig.m_ubNormalROM != bootConfig.m_ubCurrentROM || ivtStale))
 	{
 		DPRINTFLN_CTX("Going to boot ROM [%u]", bootConfig.m_ubNormalROM);
 		
@@ -355,11 +867,23 @@ int main()
 			bootConfig.m_ubCurrentROM = bootConfig.m_ubNormalROM;
 	}
 	
+	PROFILE_STAMP(PROFILE_PHASE_IVT);
+	
 	calcCRC16(&bootConfig);
 	
 	DPRINTFLN_CTX("Updating boot config");
-	eeprom_busy_wait();
-	eeprom_update_block(&bootConfig, BOOT_CONFIG_EE_ADDRESS, sizeof(boot_cfg_t));
+	journalSave(&bootConfig); // Appends a record only if something changed
+	
+	PROFILE_STAMP(PROFILE_PHASE_CONFIG_WRITE);
+	
+	if(bootConfig.m_ubCurrentROM >= bootConfig.m_ubROMCount || !romValid(bootConfig.m_ulROMAddress[bootConfig.m_ubCurrentROM])) // Also on every boot after, until an image is loaded again
+	{
+		DPRINTFLN_CTX("Current ROM [%u] holds no valid image, staying in the bootloader", bootConfig.m_ubCurrentROM);
+		
+		_delay_ms(5000); // BOOT_SERIAL gets its listen window again after the reset
+		
+		resetMCU();
+	}
 	
 	if(resetNeeded)
 	{
@@ -369,6 +893,19 @@ int main()
 	
 	DPRINTFLN_CTX("Booting the application");
 	
+#ifdef BOOT_IVT_DISPATCH
+	if(!dispatchInstall())
+	{
+		DPRINTFLN_CTX("Dispatcher IVT not installed, waiting 5 seconds before rebooting");
+		
+		_delay_ms(5000);
+		
+		resetMCU();
+	}
+	
+	dispatchSetROM(bootConfig.m_ulROMAddress[bootConfig.m_ubCurrentROM]);
+#endif
+	
 	/*	
 	if(g_ubMCUSR & ((1 << EXTRF) | (1 << PORF))) // External & POR Reset
 	{
@@ -384,10 +921,19 @@ int main()
 }
 void quit()
 {
+#ifdef BOOT_PROFILE
+	PROFILE_STAMP(PROFILE_PHASE_QUIT);
+	profileFinish(g_ubMCUSR);
+#endif
+	
+	DFLUSH(); // The UDRE interrupt must be off before the IVT goes back to the application
+	
 	cli(); // Disable interrupts
 	
 	boot_rww_enable(); // Re-enable the RWW flash sectors
 	
+	TIMER::Stop(); // Hand Timer1 to the application in its reset state
+	
 	 // Move the IVT back to the Application section
 	MCUCR |= (1 << IVCE);
 	MCUCR &= ~((1 << IVCE) | (1 << IVSEL));
@@ -22,55 +22,102 @@
 #include <debug_macros.h>
 #include <SPI/SPI.h>
 #include <SPI_FLASH/SPI_FLASH.h>
+#include <TIMER/TIMER.h>
+#include <LZ4/LZ4.h>
+#include <DELTA/DELTA.h>
+#include <CRC32/CRC32.h>
+#include <RELOC/RELOC.h>
+#include <dispatch.h>
+#include <profile.h>
+#include <config.h>
+#include <journal.h>
+#ifdef BOOT_SERIAL
+	#include <serial.h>
+#endif
+#ifdef BENCHMARK
+	#include <benchmark.h>
+#endif
 
-#define MAX_ROMS 5
-#define BOOT_MAGIC 0x5B
+#define IVT_CACHE_DATA_SIZE (_VECTORS_SIZE + sizeof(uint16_t)) // Patched IVT, then the CRC16 of the IVT in the ROM it was made from
+#define IVT_CACHE_SIZE (((IVT_CACHE_DATA_SIZE + SPM_PAGESIZE - 1) / SPM_PAGESIZE) * SPM_PAGESIZE)
+#define IVT_CACHE_ADDRESS(ROM_ADDRESS) ((ROM_ADDRESS) - IVT_CACHE_SIZE) // Patched IVT of each ROM, in the page(s) right before it
 
-#define BOOT_CONFIG_EE_ADDRESS ((void*)0xC00)
+#ifdef BOOT_IVT_DISPATCH
+	#define ROM_MIN_ADDRESS (((_VECTORS_SIZE / SPM_PAGESIZE) * SPM_PAGESIZE) + SPM_PAGESIZE)
+#else
+	#define ROM_MIN_ADDRESS (IVT_CACHE_SIZE * 2)
+#endif
+
+#ifdef BOOT_FAST
+	#define BOOT_DELAY_MS(MS) // Fast boot profile, none of the settle delays
+#else
+	#define BOOT_DELAY_MS(MS) _delay_ms(MS)
+#endif
+
+#define IMAGE_MAGIC 0x424D // "MB", optional header at the start of a staged image
+#define IMAGE_TARGET_ANY 0xFF // Relocatable image, may be loaded to any ROM
 
 // Structs & Enums
-enum boot_mode_t
+enum image_format_t
 {
-	BOOT_MODE_NORMAL = 0,
-	BOOT_MODE_PIN,
-	BOOT_MODE_PIN_RESET,
-};
-enum boot_load_status_t
-{
-	BOOT_LOAD_STATUS_OFF = 0,
-	BOOT_LOAD_STATUS_ON,
+	IMAGE_FORMAT_RAW = 0,
+	IMAGE_FORMAT_LZ4,
+	IMAGE_FORMAT_DELTA,
 };
 
-struct boot_cfg_t
+struct image_header_t
 {
-	uint8_t m_ubMagic;
-	uint8_t m_ubVersion;
-	boot_mode_t m_ubMode;
-	boot_load_status_t m_ubLoadStatus;
-	uint8_t m_ubCurrentROM;
-	uint8_t m_ubNormalROM;
-	uint8_t m_ubPinROM;
-	uint8_t m_ubLoadROM;
-	uint8_t m_ubROMCount;
-	uint32_t m_ulROMAddress[MAX_ROMS];
-	uint32_t m_ulLoadROMFlashAddress;
-	uint32_t m_ulLoadROMSize;
-	uint16_t m_usCRC;
+	uint16_t m_usMagic;
+	image_format_t m_ubFormat;
+	uint8_t m_ubSourceROM; // ROM the delta is applied to (IMAGE_FORMAT_DELTA only)
+	uint8_t m_ubTargetROM; // ROM the image was built for
+	uint32_t m_ulSize; // Size of the image once written to the internal flash
+	uint32_t m_ulPayloadSize; // Size of the data following the header in the external flash
+	uint32_t m_ulCRC32; // CRC-32 of the m_ulSize bytes of the image, before relocation
+	uint16_t m_usRelocCount; // Entries of the relocation table following the payload (see RELOC.h)
+	uint32_t m_ulRelocCRC32; // CRC-32 of the relocation table
 };
 
+typedef uint8_t (*load_fill_t)(uint8_t *pubBuf, uint16_t usSize);
+
+
 // Functions
 inline void resetMCU() __attribute__ ((__noreturn__));
 
-void calcCRC16(boot_cfg_t* pConfig);
 uint8_t validateConfig(boot_cfg_t* pConfig);
 
 void flashProgramPage(uint32_t ulAddress, uint8_t *pubBuf, uint16_t uiSize = SPM_PAGESIZE);
+uint8_t flashStartPage(uint32_t ulAddress, uint8_t *pubBuf, uint16_t uiSize = SPM_PAGESIZE);
+void flashWaitPage();
+uint8_t flashPageMatches(uint32_t ulAddress, uint8_t *pubBuf, uint16_t uiSize = SPM_PAGESIZE);
+
+uint8_t flashPagesMatch(uint32_t ulAddress1, uint32_t ulAddress2, uint16_t uiSize = SPM_PAGESIZE);
+void flashCopyPage(uint32_t ulDestAddress, uint32_t ulSrcAddress, uint16_t uiSize = SPM_PAGESIZE);
+
+void encodeJMP(uint8_t *pubDest, uint32_t ulAddress);
+void patchIVT(uint8_t *pubIVT, uint32_t ulAddress);
+uint16_t ivtFingerprint(uint32_t ulAddress);
+uint8_t ivtCacheValid(uint32_t ulAddress);
+uint8_t ivtCacheWrite(uint32_t ulAddress, uint8_t *pubIVT);
+
+uint8_t romValid(uint32_t ulAddress);
+void romInvalidate(uint32_t ulAddress);
+uint8_t romFallback(boot_cfg_t* pConfig, uint8_t ubROM);
+uint8_t romFits(boot_cfg_t* pConfig, uint32_t ulAddress, uint32_t ulSize);
 
 uint8_t bootROM(uint32_t ulAddress);
-uint8_t loadROM(uint32_t ulIntAddress, uint32_t ulExtAddress, uint32_t ulSize);
+uint8_t loadReadByte();
+uint8_t loadFillRaw(uint8_t *pubBuf, uint16_t usSize);
+uint8_t loadReadSource(uint32_t ulOffset);
+uint8_t loadFillLZ4(uint8_t *pubBuf, uint16_t usSize);
+uint8_t loadFillDelta(uint8_t *pubBuf, uint16_t usSize);
+uint8_t loadReadReloc(uint8_t *pubBuf, uint16_t usSize);
+uint8_t loadProcessPage(uint32_t ulOffset, uint8_t *pubBuf, uint16_t usSize);
+uint8_t loadROM(boot_cfg_t* pConfig);
+
 
+void init()	__attribute__ ((naked)) __attribute__ ((section (".init3"))); // Runs before .data and .bss are initialised, the state it sets up must live in .noinit
 
-void init()	__attribute__ ((naked)) __attribute__ ((section (".init3")));
 int main();
 void quit()	__attribute__ ((naked)) __attribute__ ((section (".fini8")));
 
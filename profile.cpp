@@ -0,0 +1,42 @@
+/*
+ * profile.cpp
+ *
+ * Created: 18/10/2026 15:41:09
+ * Author : joaob
+ */ 
+
+#include <main.h>
+
+#ifdef BOOT_PROFILE
+
+// Variables
+boot_profile_t g_bootProfile __attribute__ ((section (".noinit"))); // The INIT stamp is taken before .bss is cleared
+
+// Functions
+void profileStamp(profile_phase_t ubPhase)
+{
+	g_bootProfile.m_ulStamp[ubPhase] = TIMER::GetTicks();
+}
+void profileFinish(uint8_t ubMCUSR)
+{
+	g_bootProfile.m_usMagic = PROFILE_MAGIC;
+	g_bootProfile.m_ubMCUSR = ubMCUSR;
+#ifdef BOOT_FAST
+	g_bootProfile.m_ubFastBoot = 1;
+#else
+	g_bootProfile.m_ubFastBoot = 0;
+#endif
+	
+	uint32_t lastStamp = 0;
+	
+	for(uint8_t i = 0; i < PROFILE_PHASE_COUNT; i++)
+	{
+		DPRINTFLN_CTX("Phase %u ended at %lu us [+%lu us]", i, g_bootProfile.m_ulStamp[i] / TIMER_TICKS_PER_US, (g_bootProfile.m_ulStamp[i] - lastStamp) / TIMER_TICKS_PER_US);
+		
+		lastStamp = g_bootProfile.m_ulStamp[i];
+	}
+	
+	memcpy(PROFILE_RAM_ADDRESS, &g_bootProfile, sizeof(boot_profile_t)); // Printing is done, the stack is back at the top of RAM
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,56 @@
+/*
+ * profile.h
+ *
+ * Created: 18/10/2026 15:41:09
+ *  Author: joaob
+ */ 
+
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <avr/io.h>
+#include <stdint.h>
+
+// Build with BOOT_PROFILE to timestamp each boot phase with Timer1 (1 tick = 1 us @ 8 MHz, counted from the start of init())
+// The result is printed with SOFTDEBUG and left at PROFILE_RAM_ADDRESS when jumping to the application
+// The application must copy it before its stack grows past PROFILE_RAM_MARGIN bytes (e.g. first thing in main())
+#define PROFILE_MAGIC 0x5042 // "BP"
+
+#ifndef PROFILE_RAM_MARGIN
+#define PROFILE_RAM_MARGIN 32 // Stack bytes the application may use before reading the profile
+#endif
+
+#define PROFILE_RAM_ADDRESS ((boot_profile_t*)(RAMEND + 1 - PROFILE_RAM_MARGIN - sizeof(boot_profile_t)))
+
+enum profile_phase_t
+{
+	PROFILE_PHASE_INIT = 0,
+	PROFILE_PHASE_CONFIG_READ,
+	PROFILE_PHASE_VALIDATE,
+	PROFILE_PHASE_LOAD,
+	PROFILE_PHASE_IVT,
+	PROFILE_PHASE_CONFIG_WRITE,
+	PROFILE_PHASE_QUIT,
+	PROFILE_PHASE_COUNT,
+};
+
+struct boot_profile_t
+{
+	uint16_t m_usMagic;
+	uint8_t m_ubMCUSR; // Reset flags of this boot
+	uint8_t m_ubFastBoot; // Built with BOOT_FAST
+	uint32_t m_ulStamp[PROFILE_PHASE_COUNT]; // Timer ticks at the end of each phase
+};
+
+#ifdef BOOT_PROFILE
+	#define PROFILE_STAMP(PHASE) profileStamp(PHASE)
+#else
+	#define PROFILE_STAMP(PHASE)
+#endif
+
+// Functions
+void profileStamp(profile_phase_t ubPhase);
+void profileFinish(uint8_t ubMCUSR);
+
+#endif /* PROFILE_H_ */
\ No newline at end of file
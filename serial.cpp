@@ -0,0 +1,465 @@
+/*
+ * serial.cpp
+ *
+ * Created: 18/10/2026 21:14:37
+ * Author : joaob
+ */ 
+
+#include <main.h>
+
+#ifdef BOOT_SERIAL
+
+// Variables
+uint8_t g_ubSerialPage[SERIAL_WINDOW][SPM_PAGESIZE]; // Page N goes to buffer N % SERIAL_WINDOW
+uint8_t g_ubSerialPageReady[SERIAL_WINDOW]; // Received with a valid CRC, not programmed yet
+uint8_t g_ubSerialActive = 0; // BEGIN accepted, pages expected
+uint8_t g_ubSerialSession = 0; // A valid frame was received, the listen window is over
+uint8_t g_ubSerialDone = 0; // BOOT received
+uint8_t g_ubSerialEnded = 0; // END accepted, a repeated END (its OK got lost) is answered again
+uint8_t g_ubSerialLoadROM = SERIAL_NO_ROM;
+uint8_t g_ubSerialWrittenROM = SERIAL_NO_ROM; // ROM completely written and verified this session
+uint8_t g_ubSerialPartialROMs = 0; // Bit per ROM with a page rewritten by a transfer that did not complete (aborted or timed out)
+uint32_t g_ulSerialAddress = 0; // Internal flash address of the ROM being written
+uint32_t g_ulSerialSize = 0;
+uint32_t g_ulSerialCRC = 0; // Image CRC-32 sent with BEGIN
+uint16_t g_usSerialPages = 0;
+uint16_t g_usSerialNext = 0; // Next page to program, the window starts here
+uint16_t g_usSerialSkipped = 0;
+uint32_t g_ulSerialLastFrame = 0;
+
+serial_parse_t g_ubSerialParse = SERIAL_PARSE_SYNC;
+serial_program_t g_ubSerialProgram = SERIAL_PROGRAM_IDLE;
+uint8_t g_ubSerialType = 0;
+uint8_t g_ubSerialHeader[9];
+uint8_t g_ubSerialHeaderSize = 0;
+uint8_t g_ubSerialPos = 0; // Header or CRC byte being received
+uint16_t g_usSerialDataPos = 0;
+uint8_t* g_pubSerialData = 0; // Buffer of the page being received, 0 discards the data
+uint16_t g_usSerialFramePage = 0;
+uint16_t g_usSerialFrameCRC = 0; // Computed
+uint16_t g_usSerialRxCRC = 0; // Received
+
+extern uint32_t g_ulLoadCRC;
+#ifndef BOOT_IVT_DISPATCH
+extern uint8_t g_ubLoadIVT[IVT_CACHE_DATA_SIZE];
+#endif
+
+// Functions
+uint8_t serialHeaderSize(uint8_t ubType)
+{
+	switch(ubType)
+	{
+		case SERIAL_FRAME_HELLO:
+		case SERIAL_FRAME_END:
+			return 0;
+		case SERIAL_FRAME_BEGIN:
+			return 9;
+		case SERIAL_FRAME_PAGE:
+			return 2;
+		case SERIAL_FRAME_BOOT:
+			return 1;
+		default:
+			return 0xFF;
+	}
+}
+void serialReply(serial_reply_t ubType, uint16_t usArg)
+{
+	SUART::WriteByte(SERIAL_REPLY_SYNC);
+	SUART::WriteByte(ubType);
+	SUART::WriteByte(usArg & 0xFF);
+	SUART::WriteByte(usArg >> 8);
+}
+void serialAbort(serial_error_t ubError)
+{
+	DPRINTFLN_CTX("Transfer aborted [%u] [%u]", ubError, g_usSerialNext);
+	
+	g_ubSerialActive = 0;
+	
+	serialReply(SERIAL_REPLY_ERROR, ubError);
+}
+void serialPageStart()
+{
+	uint16_t page = g_ubSerialHeader[0] | (g_ubSerialHeader[1] << 8);
+	uint8_t slot = page % SERIAL_WINDOW;
+	
+	g_usSerialFramePage = page;
+	g_usSerialDataPos = 0;
+	g_pubSerialData = 0;
+	
+	// Pages already held (a retransmission) or outside the window are read past, not stored
+	if(g_ubSerialActive && page >= g_usSerialNext && page - g_usSerialNext < SERIAL_WINDOW && page < g_usSerialPages && !g_ubSerialPageReady[slot])
+		g_pubSerialData = g_ubSerialPage[slot];
+}
+void serialFrame(boot_cfg_t* pConfig)
+{
+	if(g_usSerialRxCRC != g_usSerialFrameCRC)
+	{
+		uint8_t trusted = (g_ubSerialType == SERIAL_FRAME_PAGE && g_usSerialFramePage >= g_usSerialNext && g_usSerialFramePage - g_usSerialNext < SERIAL_WINDOW); // Only NAK a page number inside the window
+		
+		serialReply(SERIAL_REPLY_NAK, trusted ? g_usSerialFramePage : SERIAL_NO_PAGE);
+		
+		return;
+	}
+	
+	g_ubSerialSession = 1;
+	g_ulSerialLastFrame = TIMER::GetTicks();
+	
+	switch(g_ubSerialType)
+	{
+		case SERIAL_FRAME_HELLO:
+		{
+			serialReply(SERIAL_REPLY_INFO, SERIAL_WINDOW | (pConfig->m_ubROMCount << 8));
+		}
+		break;
+		case SERIAL_FRAME_BEGIN:
+		{
+			uint8_t rom = g_ubSerialHeader[0];
+			
+			g_ubSerialEnded = 0;
+			
+			if(g_ubSerialProgram != SERIAL_PROGRAM_IDLE) // Previous transfer still writing its last page
+			{
+				serialAbort(SERIAL_ERROR_STATE);
+				
+				break;
+			}
+			
+			memcpy(&g_ulSerialSize, g_ubSerialHeader + 1, sizeof(uint32_t));
+			memcpy(&g_ulSerialCRC, g_ubSerialHeader + 5, sizeof(uint32_t));
+			
+			g_ulSerialAddress = (rom < pConfig->m_ubROMCount) ? pConfig->m_ulROMAddress[rom] : 0;
+			
+			if(rom >= pConfig->m_ubROMCount || !g_ulSerialSize || g_ulSerialAddress < ROM_MIN_ADDRESS || (g_ulSerialAddress & (SPM_PAGESIZE - 1)) || !romFits(pConfig, g_ulSerialAddress, g_ulSerialSize))
+			{
+				DPRINTFLN_CTX("ROM or image size invalid [%u] [0x%08lX] [%lu]", rom, g_ulSerialAddress, g_ulSerialSize);
+				
+				serialAbort(SERIAL_ERROR_ROM);
+				
+				break;
+			}
+			
+			g_ubSerialLoadROM = rom;
+			g_usSerialPages = (g_ulSerialSize + SPM_PAGESIZE - 1) / SPM_PAGESIZE;
+			g_usSerialNext = 0;
+			g_usSerialSkipped = 0;
+			g_ulLoadCRC = CRC32_INIT;
+			
+			memset(g_ubSerialPageReady, 0, SERIAL_WINDOW);
+			
+			RELOC::Init(0, 0, g_ulSerialAddress, g_ulSerialSize); // Raw images only, loadProcessPage then just does the CRC and the IVT copy
+			
+			g_ubSerialActive = 1;
+			
+			DPRINTFLN_CTX("Receiving ROM [%u] [0x%08lX] [%lu]", rom, g_ulSerialAddress, g_ulSerialSize);
+			
+			serialReply(SERIAL_REPLY_OK, g_usSerialPages);
+		}
+		break;
+		case SERIAL_FRAME_PAGE:
+		{
+			uint16_t page = g_usSerialFramePage;
+			
+			if(g_pubSerialData)
+			{
+				g_ubSerialPageReady[page % SERIAL_WINDOW] = 1;
+				
+				serialReply(SERIAL_REPLY_ACK, page);
+			}
+			else if(g_ubSerialActive && page < g_usSerialNext) // Already programmed, its PROGRAMMED may have got lost, report the latest one
+			{
+				serialReply(SERIAL_REPLY_PROGRAMMED, g_usSerialNext - 1);
+			}
+			else if(g_ubSerialActive && page - g_usSerialNext < SERIAL_WINDOW && page < g_usSerialPages) // Already held, the ACK got lost
+			{
+				serialReply(SERIAL_REPLY_ACK, page);
+			}
+			else
+			{
+				serialReply(SERIAL_REPLY_NAK, page);
+			}
+		}
+		break;
+		case SERIAL_FRAME_END:
+		{
+			if(g_ubSerialEnded)
+			{
+				serialReply(SERIAL_REPLY_OK, 0);
+				
+				break;
+			}
+			
+			if(!g_ubSerialActive || g_usSerialNext != g_usSerialPages || g_ubSerialProgram != SERIAL_PROGRAM_IDLE)
+			{
+				serialAbort(SERIAL_ERROR_STATE);
+				
+				break;
+			}
+			
+			g_ubSerialActive = 0;
+			g_ulLoadCRC = CRC32::Final(g_ulLoadCRC);
+			
+			if(g_ulLoadCRC != g_ulSerialCRC)
+			{
+				DPRINTFLN_CTX("Image CRC does not match [0x%08lX] [0x%08lX]", g_ulLoadCRC, g_ulSerialCRC);
+				
+				serialAbort(SERIAL_ERROR_CRC);
+				
+				break;
+			}
+			
+#ifndef BOOT_IVT_DISPATCH
+			if(g_ulSerialSize >= _VECTORS_SIZE)
+				ivtCacheWrite(g_ulSerialAddress, g_ubLoadIVT);
+#endif
+			
+			g_ubSerialWrittenROM = g_ubSerialLoadROM;
+			g_ubSerialPartialROMs &= ~(1 << g_ubSerialLoadROM);
+			g_ubSerialEnded = 1;
+			
+			DPRINTFLN_CTX("ROM [%u] written, skipped %u unchanged pages out of %u", g_ubSerialLoadROM, g_usSerialSkipped, g_usSerialPages);
+			
+			serialReply(SERIAL_REPLY_OK, 0);
+		}
+		break;
+		case SERIAL_FRAME_BOOT:
+		{
+			uint8_t rom = g_ubSerialHeader[0];
+			
+			if(rom >= pConfig->m_ubROMCount || g_ubSerialActive)
+			{
+				serialAbort(rom >= pConfig->m_ubROMCount ? SERIAL_ERROR_ROM : SERIAL_ERROR_STATE);
+				
+				break;
+			}
+			
+			pConfig->m_ubNormalROM = rom;
+			g_ubSerialDone = 1;
+			
+			serialReply(SERIAL_REPLY_OK, 0);
+		}
+		break;
+	}
+}
+void serialParse(boot_cfg_t* pConfig)
+{
+	const uint8_t* data;
+	uint8_t count;
+	
+	// Parsed in place from the RX FIFO, page data is copied once, straight into its page buffer
+	while((count = SUART::Peek(&data)))
+	{
+		uint8_t used = 0;
+		
+		while(used < count)
+		{
+			uint8_t b = data[used];
+			
+			switch(g_ubSerialParse)
+			{
+				case SERIAL_PARSE_SYNC:
+				{
+					used++;
+					
+					if(b == SERIAL_SYNC)
+						g_ubSerialParse = SERIAL_PARSE_TYPE;
+				}
+				break;
+				case SERIAL_PARSE_TYPE:
+				{
+					used++;
+					
+					g_ubSerialHeaderSize = serialHeaderSize(b);
+					
+					if(g_ubSerialHeaderSize == 0xFF) // Not a frame, hunt for the next sync
+					{
+						g_ubSerialParse = (b == SERIAL_SYNC) ? SERIAL_PARSE_TYPE : SERIAL_PARSE_SYNC;
+						
+						break;
+					}
+					
+					g_ubSerialType = b;
+					g_ubSerialPos = 0;
+					g_usSerialFrameCRC = _crc_ccitt_update(0xFFFF, b);
+					g_pubSerialData = 0;
+					g_ubSerialParse = g_ubSerialHeaderSize ? SERIAL_PARSE_HEADER : SERIAL_PARSE_CRC;
+				}
+				break;
+				case SERIAL_PARSE_HEADER:
+				{
+					used++;
+					
+					g_ubSerialHeader[g_ubSerialPos++] = b;
+					g_usSerialFrameCRC = _crc_ccitt_update(g_usSerialFrameCRC, b);
+					
+					if(g_ubSerialPos < g_ubSerialHeaderSize)
+						break;
+					
+					g_ubSerialPos = 0;
+					
+					if(g_ubSerialType == SERIAL_FRAME_PAGE)
+					{
+						serialPageStart();
+						
+						g_ubSerialParse = SERIAL_PARSE_DATA;
+					}
+					else
+					{
+						g_ubSerialParse = SERIAL_PARSE_CRC;
+					}
+				}
+				break;
+				case SERIAL_PARSE_DATA:
+				{
+					uint16_t chunk = SPM_PAGESIZE - g_usSerialDataPos;
+					
+					if(chunk > count - used)
+						chunk = count - used;
+					
+					if(g_pubSerialData)
+						memcpy(g_pubSerialData + g_usSerialDataPos, data + used, chunk);
+					
+					for(uint8_t i = 0; i < chunk; i++)
+						g_usSerialFrameCRC = _crc_ccitt_update(g_usSerialFrameCRC, data[used + i]);
+					
+					used += chunk;
+					g_usSerialDataPos += chunk;
+					
+					if(g_usSerialDataPos == SPM_PAGESIZE)
+						g_ubSerialParse = SERIAL_PARSE_CRC;
+				}
+				break;
+				case SERIAL_PARSE_CRC:
+				{
+					used++;
+					
+					if(!g_ubSerialPos++)
+					{
+						g_usSerialRxCRC = b;
+						
+						break;
+					}
+					
+					g_usSerialRxCRC |= b << 8;
+					g_ubSerialParse = SERIAL_PARSE_SYNC;
+					
+					serialFrame(pConfig);
+				}
+				break;
+			}
+		}
+		
+		SUART::Consume(count);
+	}
+}
+void serialPageDone()
+{
+	g_ubSerialPageReady[g_usSerialNext % SERIAL_WINDOW] = 0;
+	
+	serialReply(SERIAL_REPLY_PROGRAMMED, g_usSerialNext);
+	
+	g_usSerialNext++;
+}
+void serialProgram()
+{
+	if(!g_ubSerialActive || boot_spm_busy()) // The CPU keeps running from the NRWW section while the SPM erase/write runs
+		return;
+	
+	uint8_t* buf = g_ubSerialPage[g_usSerialNext % SERIAL_WINDOW];
+	uint32_t offset = (uint32_t)g_usSerialNext * SPM_PAGESIZE;
+	uint32_t address = g_ulSerialAddress + offset;
+	uint16_t size = (g_ulSerialSize - offset > SPM_PAGESIZE) ? SPM_PAGESIZE : g_ulSerialSize - offset;
+	
+	switch(g_ubSerialProgram)
+	{
+		case SERIAL_PROGRAM_IDLE:
+		{
+			if(g_usSerialNext >= g_usSerialPages || !g_ubSerialPageReady[g_usSerialNext % SERIAL_WINDOW])
+				break;
+			
+			loadProcessPage(offset, buf, size); // Pages are processed in order, as loadROM does
+			
+			if(flashPageMatches(address, buf, size)) // Page already holds this data, skip the erase/write
+			{
+				g_usSerialSkipped++;
+				
+				serialPageDone();
+				
+				break;
+			}
+			
+			g_ubSerialPartialROMs |= 1 << g_ubSerialLoadROM; // From now on only a complete transfer leaves the ROM bootable
+			
+			if(g_ubSerialWrittenROM == g_ubSerialLoadROM)
+				g_ubSerialWrittenROM = SERIAL_NO_ROM;
+			
+			boot_page_erase_safe(address);
+			
+			g_ubSerialProgram = SERIAL_PROGRAM_ERASE;
+		}
+		break;
+		case SERIAL_PROGRAM_ERASE:
+		{
+			for(uint16_t i = 0; i < size; i += 2)
+				boot_page_fill_safe(address + i, buf[i] | (buf[i + 1] << 8));
+			
+			boot_page_write_safe(address);
+			
+			g_ubSerialProgram = SERIAL_PROGRAM_WRITE;
+		}
+		break;
+		case SERIAL_PROGRAM_WRITE:
+		{
+			boot_rww_enable_safe(); // Make the RWW section readable again
+			
+			g_ubSerialProgram = SERIAL_PROGRAM_IDLE;
+			
+			if(!flashPageMatches(address, buf, size))
+			{
+				serialAbort(SERIAL_ERROR_VERIFY);
+				
+				break;
+			}
+			
+			serialPageDone();
+		}
+		break;
+	}
+}
+uint8_t serialSession(boot_cfg_t* pConfig, uint8_t* pubPartialROMs)
+{
+	SUART::Init();
+	
+	g_ulSerialLastFrame = TIMER::GetTicks();
+	
+	DPRINTFLN_CTX("Listening for a serial session [%lu baud] [%u ms]", SERIAL_BAUD, SERIAL_LISTEN_MS);
+	
+	while(!g_ubSerialDone)
+	{
+		serialParse(pConfig);
+		serialProgram();
+		
+		uint32_t timeout = g_ubSerialSession ? SERIAL_TIMEOUT_MS : SERIAL_LISTEN_MS;
+		
+		if(TIMER::GetTicks() - g_ulSerialLastFrame > timeout * 1000UL * TIMER_TICKS_PER_US)
+			break;
+	}
+	
+	if(g_ubSerialSession)
+		DPRINTFLN_CTX("Serial session ended [%u] [%u overflows] [%u framing errors]", g_ubSerialWrittenROM, SUART::m_usRXOverflows, SUART::m_usRXFrameErrors);
+	
+	if(g_ubSerialActive)
+		DPRINTFLN_CTX("Transfer left incomplete [%u]", g_ubSerialLoadROM);
+	
+	if(g_ubSerialPartialROMs)
+		DPRINTFLN_CTX("ROMs left partly written [%02X]", g_ubSerialPartialROMs);
+	
+	flashWaitPage(); // A timed out transfer may have left a page write running
+	
+	SUART::Stop(); // Replies flushed, the USART goes back to its reset state for the application
+	
+	*pubPartialROMs = g_ubSerialPartialROMs;
+	
+	return g_ubSerialWrittenROM;
+}
+
+#endif
\ No newline at end of file
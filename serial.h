@@ -0,0 +1,104 @@
+/*
+ * serial.h
+ *
+ * Created: 18/10/2026 21:14:37
+ *  Author: joaob
+ */ 
+
+
+#ifndef SERIAL_H_
+#define SERIAL_H_
+
+#include <avr/io.h>
+#include <stdint.h>
+#include <UART/UART.h>
+
+struct boot_cfg_t;
+
+// Build with BOOT_SERIAL to accept firmware straight into a ROM slot over SERIAL_PORT (host side: tools/mbflash.py)
+// The bootloader listens for SERIAL_LISTEN_MS after validating the boot config, a HELLO frame in that time starts a session
+// Pages are sent windowed (up to SERIAL_WINDOW in flight), each is acknowledged on arrival and reported again once programmed,
+// frames failing their CRC are NAKed and only those are sent again, the next page keeps arriving while the current one is written
+#ifndef SERIAL_PORT
+#define SERIAL_PORT 1
+#endif
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD 500000UL // 500 kbaud and 1 Mbaud are exact @ 8 MHz with U2X
+#endif
+#ifndef SERIAL_LISTEN_MS
+#define SERIAL_LISTEN_MS 100 // Added to every boot, the host keeps sending HELLO until it is answered
+#endif
+#ifndef SERIAL_TIMEOUT_MS
+#define SERIAL_TIMEOUT_MS 2000 // Session ends after this long without a valid frame
+#endif
+#ifndef SERIAL_WINDOW
+#define SERIAL_WINDOW 4 // Page buffers, SPM_PAGESIZE bytes of SRAM each
+#endif
+
+#if defined(SOFTDEBUG) && DUART_PORT == SERIAL_PORT
+	#error "The debug output needs its own USART with BOOT_SERIAL, build with DUART_PORT set to another port"
+#endif
+#if defined(SPI_USART_MSPIM) && SERIAL_PORT == 0
+	#error "USART0 runs the SPI bus with SPI_USART_MSPIM"
+#endif
+
+#define SERIAL_SYNC 0xA5 // Starts every host frame
+#define SERIAL_REPLY_SYNC 0x5A // Starts every reply
+#define SERIAL_NO_ROM 0xFF
+#define SERIAL_NO_PAGE 0xFFFF // NAK of a frame whose page number can't be trusted
+
+typedef UART<SERIAL_PORT, SERIAL_BAUD> SUART;
+
+// Host frames: SERIAL_SYNC, type, fixed size body, CRC-16 (_crc_ccitt_update from 0xFFFF) over the type and body
+enum serial_frame_t
+{
+	SERIAL_FRAME_HELLO = 'H', // No body
+	SERIAL_FRAME_BEGIN = 'B', // ROM index (1), image size (4), image CRC-32 (4)
+	SERIAL_FRAME_PAGE = 'D', // Page number (2), SPM_PAGESIZE bytes (the last page padded with 0xFF)
+	SERIAL_FRAME_END = 'E', // No body, sent once every page was reported programmed
+	SERIAL_FRAME_BOOT = 'R', // ROM index (1), made the normal ROM, ends the session
+};
+
+// Replies: SERIAL_REPLY_SYNC, type, 16 bit argument (little endian)
+enum serial_reply_t
+{
+	SERIAL_REPLY_INFO = 'I', // SERIAL_WINDOW, ROM count
+	SERIAL_REPLY_OK = 'K', // BEGIN (page count), END, BOOT
+	SERIAL_REPLY_ACK = 'A', // Page received (or already had)
+	SERIAL_REPLY_NAK = 'N', // Page (or SERIAL_NO_PAGE) failed its CRC or is outside the window
+	SERIAL_REPLY_PROGRAMMED = 'P', // Page written and verified (every page before it too), also the answer to a page sent again after that
+	SERIAL_REPLY_ERROR = 'X', // serial_error_t, the transfer is aborted
+};
+
+enum serial_error_t
+{
+	SERIAL_ERROR_ROM = 1, // ROM index or image size invalid
+	SERIAL_ERROR_STATE, // Frame not expected now
+	SERIAL_ERROR_VERIFY, // Page read back different
+	SERIAL_ERROR_CRC, // Image CRC-32 does not match
+};
+
+enum serial_parse_t
+{
+	SERIAL_PARSE_SYNC = 0,
+	SERIAL_PARSE_TYPE,
+	SERIAL_PARSE_HEADER,
+	SERIAL_PARSE_DATA,
+	SERIAL_PARSE_CRC,
+};
+
+enum serial_program_t
+{
+	SERIAL_PROGRAM_IDLE = 0,
+	SERIAL_PROGRAM_ERASE, // Page erase running
+	SERIAL_PROGRAM_WRITE, // Page write running
+};
+
+// Functions
+void serialReply(serial_reply_t ubType, uint16_t usArg);
+void serialFrame(boot_cfg_t* pConfig);
+void serialParse(boot_cfg_t* pConfig);
+void serialProgram();
+uint8_t serialSession(boot_cfg_t* pConfig, uint8_t* pubPartialROMs); // ROM written this session or SERIAL_NO_ROM, bit per ROM a failed transfer left half written
+
+#endif /* SERIAL_H_ */
\ No newline at end of file
@@ -0,0 +1,151 @@
+/*
+ * dlog_test.cpp
+ *
+ * Created: 18/10/2026 02:20:47
+ * Author : joaob
+ */ 
+
+// Host test of lib/DLOG against tools/mblog.py: every call logs through DLOG_WRITE into the capture and writes the text
+// DPRINTF would have printed into the expected file, the Makefile decodes the capture with the ELF of this test and compares
+// Linked with DLOG.ld like the bootloader so .dlog is laid out the same way
+//
+//   dlog_test <capture> <expected text>
+
+#include <DLOG/DLOG.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <string>
+
+static std::vector<uint8_t> m_Capture;
+static std::string m_Expected;
+
+struct SINK
+{
+	static void WriteByte(uint8_t ubData)
+	{
+		m_Capture.push_back(ubData);
+	}
+	static void Write(uint8_t* pubData, uint16_t usSize)
+	{
+		while(usSize--)
+			WriteByte(*(pubData++));
+	}
+	static void Print(const char* pszText) // Plain text between frames, like the application on the same USART
+	{
+		m_Expected += pszText;
+		
+		while(*pszText)
+			WriteByte(*(pszText++));
+	}
+};
+
+__attribute__ ((format (printf, 3, 4))) static void Expect(const char* pszFlags, const char* pszFunction, const char* pszFormat, ...)
+{
+	char buf[256];
+	uint8_t flags = pszFlags[0] - '0';
+	
+	if(flags & 1)
+		m_Expected += std::string("[") + pszFunction + "] - ";
+	
+	va_list args;
+	va_start(args, pszFormat);
+	vsnprintf(buf, sizeof(buf), pszFormat, args);
+	va_end(args);
+	
+	m_Expected += buf;
+	
+	if(flags & 2)
+		m_Expected += "\n";
+}
+
+#define LOG(FLAGS, FORMAT, ...) \
+	do \
+	{ \
+		DLOG_WRITE(SINK, FLAGS, FORMAT, ##__VA_ARGS__); \
+		Expect(FLAGS, __FUNCTION__, FORMAT, ##__VA_ARGS__); \
+	} while(0)
+
+static void LogSizes()
+{
+	uint8_t ub = 200;
+	int8_t b = -5;
+	uint16_t us = 0xBEEF;
+	int16_t s = -1234;
+	uint32_t ul = 0xDEADBEEF; // unsigned int on the host, long on the AVR
+	long l = -100000;
+	char c = 'M';
+	
+	LOG(DLOG_FLAGS_CTX_LN, "ub=%u b=%d us=0x%04X s=%d", ub, b, us, s);
+	LOG(DLOG_FLAGS_CTX_LN, "ul=0x%08X l=%ld c=%c", ul, l, c);
+	LOG(DLOG_FLAGS_LN, "%d%%", (int8_t)100);
+}
+
+static void LogStrings()
+{
+	char name[] = "ROM1";
+	const char* empty = "";
+	
+	LOG(DLOG_FLAGS_CTX, "loading %s", name);
+	LOG(DLOG_FLAGS_NONE, " [%s] %-6s|", empty, "ok");
+	LOG(DLOG_FLAGS_LN, "!");
+}
+
+struct LOADER
+{
+	static void Progress(uint8_t ubROM, uint32_t ulDone, uint32_t ulTotal);
+};
+
+void LOADER::Progress(uint8_t ubROM, uint32_t ulDone, uint32_t ulTotal) // Defined out of the class, inline functions cannot log (see DLOG_WRITE)
+{
+	LOG(DLOG_FLAGS_CTX_LN, "ROM %hhu: %u/%u", ubROM, ulDone, ulTotal);
+}
+
+static void LogArguments() // One to eight arguments, two size code bytes past four
+{
+	LOG(DLOG_FLAGS_LN, "%u", (uint8_t)1);
+	LOG(DLOG_FLAGS_LN, "%u %u %u %u", (uint8_t)1, (uint16_t)2, 3u, (uint8_t)4);
+	LOG(DLOG_FLAGS_LN, "%u %u %u %u %s", (uint8_t)1, (uint16_t)2, 3u, (uint8_t)4, "five");
+	LOG(DLOG_FLAGS_LN, "%u %u %u %u %s %d %d %c", (uint8_t)1, (uint16_t)2, 3u, (uint8_t)4, "five", (int16_t)-6, -7, 'h');
+}
+
+int main(int argc, char** argv)
+{
+	if(argc != 3)
+	{
+		printf("usage: %s <capture> <expected text>\n", argv[0]);
+		
+		return 2;
+	}
+	
+	SINK::Print("MultiBoot\n");
+	
+	LogSizes();
+	LogStrings();
+	
+	SINK::Print("app text\n");
+	
+	LOADER::Progress(2, 4096, 65536);
+	LogArguments();
+	
+	LOG(DLOG_FLAGS_CTX_LN, "done");
+	
+	FILE* capture = fopen(argv[1], "wb");
+	FILE* expected = fopen(argv[2], "wb");
+	
+	if(!capture || !expected)
+	{
+		printf("cannot write the output files\n");
+		
+		return 2;
+	}
+	
+	fwrite(&m_Capture[0], 1, m_Capture.size(), capture);
+	fwrite(m_Expected.data(), 1, m_Expected.size(), expected);
+	fclose(capture);
+	fclose(expected);
+	
+	printf("dlog_test: %u bytes captured, %u bytes of text\n", (unsigned int)m_Capture.size(), (unsigned int)m_Expected.size());
+	
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,91 @@
+/*
+ * flash_model.cpp
+ *
+ * Created: 18/10/2026 10:41:09
+ * Author : joaob
+ */ 
+
+#include "flash_model.h"
+
+// The flash is device 0 of the bus, SPI_BUS.cpp has its own test, here Select and Deselect only frame the model's transactions
+// The SPI transfers go straight to the model, TIMER moves 16 ticks per read so timeouts still expire
+
+flash_model_t* g_pFlashModel = 0;
+int g_iFlashSelectsLeft = -1; // Flash selects granted before another device takes the bus, -1 never
+
+uint8_t SPI::m_ubActiveDevice = SPI_NO_DEVICE;
+volatile uint8_t SPI::m_ubSelectedDevice = SPI_NO_DEVICE;
+
+uint8_t SPI::AddDevice(volatile uint8_t* pubCSPort, uint8_t ubCSBit, uint8_t ubLSBFirst, uint8_t ubMode, uint32_t ulMaxClock)
+{
+	return (pubCSPort == &FLASH_CS_PORT && ubCSBit == FLASH_CS_BIT && !ubLSBFirst && !ubMode) ? 0 : SPI_NO_DEVICE;
+}
+uint8_t SPI::Select(uint8_t ubDevice)
+{
+	if(!ubDevice && !g_iFlashSelectsLeft)
+		SPI::m_ubSelectedDevice = 1;
+	
+	if(SPI::m_ubSelectedDevice != SPI_NO_DEVICE && SPI::m_ubSelectedDevice != ubDevice)
+		return 0;
+	
+	if(!ubDevice && g_iFlashSelectsLeft > 0)
+		g_iFlashSelectsLeft--;
+	
+	SPI::m_ubSelectedDevice = ubDevice;
+	
+	if(!ubDevice)
+		g_pFlashModel->Select();
+	
+	return 1;
+}
+void SPI::Deselect(uint8_t ubDevice)
+{
+	if(SPI::m_ubSelectedDevice == ubDevice)
+		SPI::m_ubSelectedDevice = SPI_NO_DEVICE;
+	
+	if(!ubDevice)
+		g_pFlashModel->Deselect();
+}
+uint8_t SPI::TransferByte(uint8_t ubData)
+{
+	return g_pFlashModel->Transfer(ubData);
+}
+void SPI::ReadBlock(uint8_t* pubDest, uint16_t usCount)
+{
+	while(usCount--)
+		*(pubDest++) = g_pFlashModel->Transfer(0x00);
+}
+void SPI::WriteBlock(uint8_t* pubSrc, uint16_t usCount)
+{
+	while(usCount--)
+		g_pFlashModel->Transfer(*(pubSrc++));
+}
+void SPI::ExchangeBlock(uint8_t* pubSrc, uint8_t* pubDest, uint16_t usCount)
+{
+	while(usCount--)
+		*(pubDest++) = g_pFlashModel->Transfer(*(pubSrc++));
+}
+
+uint32_t TIMER::GetTicks()
+{
+	static uint32_t ticks = 0;
+	
+	return ticks += 16;
+}
+
+std::vector<uint8_t> FlashModelSFDP(const std::vector<uint32_t>& BFPT)
+{
+	std::vector<uint8_t> sfdp(0x30 + 4 * BFPT.size(), 0xFF);
+	uint8_t header[] = {
+		'S', 'F', 'D', 'P', 0x06, 0x01, 0x00, 0xFF, // Signature, revision 1.6, 1 parameter header
+		0x00, 0x06, 0x01, (uint8_t)BFPT.size(), 0x30, 0x00, 0x00, 0xFF // BFPT, revision 1.6, length in DWORDs, pointer
+	};
+	
+	std::copy(header, header + sizeof(header), sfdp.begin());
+	
+	for(size_t i = 0; i < BFPT.size(); i++)
+		for(uint8_t j = 0; j < 4; j++)
+			sfdp[0x30 + 4 * i + j] = BFPT[i] >> (8 * j);
+	
+	return sfdp;
+}
\ No newline at end of file
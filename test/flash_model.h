@@ -0,0 +1,313 @@
+/*
+ * flash_model.h
+ *
+ * Created: 18/10/2026 10:20:18
+ * Author : joaob
+ */ 
+
+// Command level model of a SPI NOR flash for the host tests of lib/SPI_FLASH
+// It decodes each transaction at CS rise like the chip does and counts everything a real part would reject or do wrong (errors)
+
+
+#ifndef FLASH_MODEL_H_
+#define FLASH_MODEL_H_
+
+#include <SPI_FLASH/SPI_FLASH.h>
+#include <stdio.h>
+#include <vector>
+#include <map>
+
+struct flash_model_t
+{
+	// Part
+	std::vector<uint8_t> m_Mem;
+	std::vector<uint8_t> m_SFDP; // Empty if the part has none
+	std::map<uint8_t, uint32_t> m_EraseSizes; // Erase command -> bytes
+	uint8_t m_ubJEDEC[3];
+	uint8_t m_ubHasJEDEC;
+	uint8_t m_ubLegacyID[2]; // 0xAB manufacturer and device ID
+	uint8_t m_ubAddressBytes;
+	uint8_t m_ubCan4Byte; // Takes FLASH_CMD_ENTER_4BYTE
+	uint16_t m_usPageSize; // 0 if it has no page program
+	uint8_t m_ubAAIByte;
+	uint8_t m_ubAAIWord;
+	uint8_t m_ubLocked; // Block protection set at power up (SST26), cleared by global unlock
+	
+	// State
+	std::vector<uint8_t> m_Cmd; // Bytes of the transaction so far
+	uint8_t m_ubSelected;
+	uint8_t m_ubWEL;
+	uint8_t m_ubAAI; // Bytes per AAI command while in AAI mode
+	uint32_t m_ulAAIAddress;
+	uint8_t m_ubBusy; // Status polls left before the current operation is done
+	
+	// Counters
+	int m_iErrors;
+	int m_iSelects; // Transactions
+	int m_iPrograms; // Bytes
+	int m_iPageCmds;
+	int m_iAAICmds;
+	std::map<uint32_t, int> m_Erases; // Address -> count
+	
+	flash_model_t(uint32_t ulSize) : m_Mem(ulSize, 0xFF), m_ubHasJEDEC(0), m_ubAddressBytes(3), m_ubCan4Byte(0), m_usPageSize(0), m_ubAAIByte(0), m_ubAAIWord(0), m_ubLocked(0),
+		m_ubSelected(0), m_ubWEL(0), m_ubAAI(0), m_ulAAIAddress(0), m_ubBusy(0), m_iErrors(0), m_iSelects(0), m_iPrograms(0), m_iPageCmds(0), m_iAAICmds(0)
+	{
+		m_ubJEDEC[0] = m_ubJEDEC[1] = m_ubJEDEC[2] = 0xFF;
+		m_ubLegacyID[0] = m_ubLegacyID[1] = 0xFF;
+	}
+	
+	void Error(const char* pszWhat, uint32_t ulValue)
+	{
+		printf("  model: %s [0x%X]\n", pszWhat, ulValue);
+		
+		m_iErrors++;
+	}
+	uint32_t Address(size_t uPos)
+	{
+		uint32_t address = 0;
+		
+		for(uint8_t i = 0; i < m_ubAddressBytes; i++)
+			address = (address << 8) | m_Cmd[uPos + i];
+		
+		return address % m_Mem.size();
+	}
+	void Program(uint32_t ulAddress, uint8_t ubData)
+	{
+		if(m_ubLocked)
+			return Error("program while locked", ulAddress);
+		
+		ulAddress %= m_Mem.size();
+		
+		if((m_Mem[ulAddress] & ubData) != ubData)
+			Error("program over a byte that is not erased", ulAddress);
+		
+		m_Mem[ulAddress] &= ubData;
+		m_iPrograms++;
+	}
+	
+	void Select()
+	{
+		m_ubSelected = 1;
+		m_iSelects++;
+		
+		m_Cmd.clear();
+	}
+	uint8_t Transfer(uint8_t ubData)
+	{
+		if(!m_ubSelected)
+			return 0xFF;
+		
+		m_Cmd.push_back(ubData);
+		
+		size_t pos = m_Cmd.size() - 1;
+		
+		if(!pos)
+			return 0xFF;
+		
+		switch(m_Cmd[0])
+		{
+			case FLASH_CMD_READ_STATUS:
+			{
+				uint8_t status = (m_ubWEL ? 0x02 : 0x00) | (m_ubAAI ? 0x40 : 0x00) | (m_ubBusy ? FLASH_STATUS_BUSY : 0x00);
+				
+				if(m_ubBusy)
+					m_ubBusy--;
+				
+				return status;
+			}
+			case FLASH_CMD_READ_JEDEC_ID:
+				return (m_ubHasJEDEC && pos <= 3) ? m_ubJEDEC[pos - 1] : 0xFF;
+			case FLASH_CMD_READ_ID:
+				return (pos >= 4) ? m_ubLegacyID[m_Cmd[3] & 0x01] : 0xFF;
+			case FLASH_CMD_READ:
+				return (pos > m_ubAddressBytes) ? m_Mem[(Address(1) + pos - m_ubAddressBytes - 1) % m_Mem.size()] : 0xFF;
+			case FLASH_CMD_READ_FAST:
+				return (pos > m_ubAddressBytes + 1u) ? m_Mem[(Address(1) + pos - m_ubAddressBytes - 2) % m_Mem.size()] : 0xFF;
+			case FLASH_CMD_READ_SFDP: // Always 3 address bytes and a dummy
+			{
+				if(pos <= 4)
+					return 0xFF;
+				
+				uint32_t address = ((uint32_t)m_Cmd[1] << 16 | m_Cmd[2] << 8 | m_Cmd[3]) + pos - 5;
+				
+				return (address < m_SFDP.size()) ? m_SFDP[address] : 0xFF;
+			}
+			default:
+				return 0xFF;
+		}
+	}
+	void Deselect()
+	{
+		if(!m_ubSelected)
+			return;
+		
+		m_ubSelected = 0;
+		
+		if(m_Cmd.empty())
+			return;
+		
+		uint8_t cmd = m_Cmd[0];
+		
+		if(m_ubBusy && cmd != FLASH_CMD_READ_STATUS)
+			Error("command while busy", cmd);
+		
+		if(m_ubAAI && cmd != FLASH_CMD_WRITE_CONTINUOUS && cmd != FLASH_CMD_WRITE_AAI_WORD && cmd != FLASH_CMD_WRITE_DISABLE && cmd != FLASH_CMD_READ_STATUS && cmd != FLASH_CMD_ENABLE_SO_BUSY && cmd != FLASH_CMD_DISABLE_SO_BUSY)
+			Error("command during AAI", cmd);
+		
+		switch(cmd)
+		{
+			case FLASH_CMD_WRITE_ENABLE:
+				m_ubWEL = 1;
+			break;
+			case FLASH_CMD_WRITE_DISABLE:
+				m_ubWEL = 0;
+				m_ubAAI = 0;
+			break;
+			case FLASH_CMD_WRITE_ENABLE_STATUS:
+			case FLASH_CMD_WRITE_STATUS:
+			case FLASH_CMD_ENABLE_SO_BUSY:
+			case FLASH_CMD_DISABLE_SO_BUSY:
+			case FLASH_CMD_READ_STATUS:
+			case FLASH_CMD_READ_JEDEC_ID:
+			case FLASH_CMD_READ_ID:
+			case FLASH_CMD_READ:
+			case FLASH_CMD_READ_FAST:
+			case FLASH_CMD_READ_SFDP:
+			break;
+			case FLASH_CMD_ENTER_4BYTE:
+			{
+				if(!m_ubCan4Byte)
+					Error("4 byte mode not supported", cmd);
+				
+				m_ubAddressBytes = 4;
+			}
+			break;
+			case FLASH_CMD_GLOBAL_UNLOCK:
+			{
+				if(!m_ubWEL)
+					Error("global unlock without WEL", cmd);
+				
+				m_ubLocked = 0;
+				m_ubWEL = 0;
+			}
+			break;
+			case FLASH_CMD_WRITE_BYTE: // Page program
+			{
+				if(!m_ubWEL || !m_usPageSize)
+				{
+					Error("page program rejected", cmd);
+					
+					break;
+				}
+				
+				uint32_t address = Address(1);
+				size_t count = m_Cmd.size() - 1 - m_ubAddressBytes;
+				
+				if(count > m_usPageSize)
+					Error("page program longer than a page", count);
+				
+				if((address & (m_usPageSize - 1)) + count > m_usPageSize)
+					Error("page program wraps around its page", address);
+				
+				for(size_t i = 0; i < count; i++) // The chip wraps inside the page
+					Program((address & ~(uint32_t)(m_usPageSize - 1)) | ((address + i) & (m_usPageSize - 1)), m_Cmd[1 + m_ubAddressBytes + i]);
+				
+				m_iPageCmds++;
+				m_ubWEL = 0;
+				m_ubBusy = 2;
+			}
+			break;
+			case FLASH_CMD_WRITE_CONTINUOUS:
+			case FLASH_CMD_WRITE_AAI_WORD:
+			{
+				uint8_t width = (cmd == FLASH_CMD_WRITE_AAI_WORD) ? 2 : 1;
+				
+				if((width == 1 && !m_ubAAIByte) || (width == 2 && !m_ubAAIWord))
+				{
+					Error("AAI mode not supported", cmd);
+					
+					break;
+				}
+				
+				if(!m_ubAAI) // First command carries the address
+				{
+					if(!m_ubWEL)
+					{
+						Error("AAI without WEL", cmd);
+						
+						break;
+					}
+					
+					m_ulAAIAddress = Address(1);
+					m_ubAAI = width;
+					
+					if(width == 2 && (m_ulAAIAddress & 1))
+						Error("AAI word at an odd address", m_ulAAIAddress);
+					
+					if(m_Cmd.size() != 1u + m_ubAddressBytes + width)
+						Error("AAI first command length", m_Cmd.size());
+					
+					for(uint8_t i = 0; i < width; i++)
+						Program(m_ulAAIAddress++, m_Cmd[1 + m_ubAddressBytes + i]);
+				}
+				else
+				{
+					if(m_ubAAI != width || m_Cmd.size() != 1u + width)
+						Error("AAI command length", m_Cmd.size());
+					
+					for(uint8_t i = 0; i < width; i++)
+						Program(m_ulAAIAddress++, m_Cmd[1 + i]);
+				}
+				
+				m_iAAICmds++;
+				m_ubBusy = (width == 1); // Word AAI reports on SO instead
+			}
+			break;
+			case FLASH_CMD_CHIP_ERASE:
+			case 0x60: // Chip erase, second opcode
+			{
+				if(!m_ubWEL || m_ubLocked)
+					Error("chip erase rejected", cmd);
+				else
+					std::fill(m_Mem.begin(), m_Mem.end(), 0xFF);
+				
+				m_ubWEL = 0;
+			}
+			break;
+			default:
+			{
+				if(!m_EraseSizes.count(cmd))
+				{
+					Error("unknown command", cmd);
+					
+					break;
+				}
+				
+				if(!m_ubWEL || m_ubLocked)
+				{
+					Error("erase rejected", cmd);
+					
+					break;
+				}
+				
+				uint32_t size = m_EraseSizes[cmd];
+				uint32_t address = Address(1) & ~(size - 1);
+				
+				std::fill(m_Mem.begin() + address, m_Mem.begin() + address + size, 0xFF);
+				
+				m_Erases[address]++;
+				m_ubWEL = 0;
+				m_ubBusy = 5;
+			}
+			break;
+		}
+	}
+};
+
+extern flash_model_t* g_pFlashModel;
+extern int g_iFlashSelectsLeft;
+
+// Basic Flash Parameter Table in a minimal SFDP image (header, one parameter header, the table at 0x30)
+extern std::vector<uint8_t> FlashModelSFDP(const std::vector<uint32_t>& BFPT);
+
+#endif /* FLASH_MODEL_H_ */
\ No newline at end of file
@@ -0,0 +1,29 @@
+/*
+ * interrupt.h
+ *
+ * Created: 18/10/2026 10:05:37
+ * Author : joaob
+ */ 
+
+// Host stand-in for <avr/interrupt.h>, an ISR is a plain function the test calls when it models the interrupt firing
+
+
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(VECTOR, ...) extern "C" void VECTOR(void)
+
+#define SPI_STC_vect		__vector_24
+#define TIMER1_COMPB_vect	__vector_18
+#define TIMER1_OVF_vect		__vector_20
+
+extern "C" void SPI_STC_vect(void);
+extern "C" void TIMER1_COMPB_vect(void);
+extern "C" void TIMER1_OVF_vect(void);
+
+#define sei() (SREG |= (1 << SREG_I))
+#define cli() (SREG &= ~(1 << SREG_I))
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
\ No newline at end of file
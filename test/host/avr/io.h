@@ -0,0 +1,106 @@
+/*
+ * io.h
+ *
+ * Created: 18/10/2026 10:02:11
+ * Author : joaob
+ */ 
+
+// Host stand-in for the ATmega2561 part of <avr/io.h>, only what lib/ uses
+// The I/O space is a plain array at the real data space addresses, SPDR goes through a hook so a test can model the other end of the bus
+
+
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t g_ubHostIO[0x100];
+
+struct host_spdr_t
+{
+	host_spdr_t& operator=(uint8_t ubData);
+	operator uint8_t() const;
+};
+
+extern host_spdr_t g_HostSPDR;
+extern uint8_t (*g_pfnHostSPDR)(uint8_t ubData); // Byte clocked out, returns the one clocked in
+
+#define _SFR_MEM8(X)	(g_ubHostIO[X])
+#define _SFR_MEM16(X)	(*(volatile uint16_t*)&g_ubHostIO[X])
+#define _BV(B)			(1 << (B))
+
+#define FLASHEND		0x3FFFFUL
+#define RAMEND			0x21FF
+#define E2END			0xFFF
+#define SPM_PAGESIZE	256
+#define _VECTORS_SIZE	228
+
+#define PINB	_SFR_MEM8(0x23)
+#define DDRB	_SFR_MEM8(0x24)
+#define PORTB	_SFR_MEM8(0x25)
+#define PINC	_SFR_MEM8(0x26)
+#define DDRC	_SFR_MEM8(0x27)
+#define PORTC	_SFR_MEM8(0x28)
+#define PINE	_SFR_MEM8(0x2C)
+#define DDRE	_SFR_MEM8(0x2D)
+#define PORTE	_SFR_MEM8(0x2E)
+#define TIFR1	_SFR_MEM8(0x36)
+#define SPCR	_SFR_MEM8(0x4C)
+#define SPSR	_SFR_MEM8(0x4D)
+#define SPDR	g_HostSPDR
+#define SREG	_SFR_MEM8(0x5F)
+#define TIMSK1	_SFR_MEM8(0x6F)
+#define TCCR1A	_SFR_MEM8(0x80)
+#define TCCR1B	_SFR_MEM8(0x81)
+#define TCNT1	_SFR_MEM16(0x84)
+#define OCR1B	_SFR_MEM16(0x8A)
+#define UCSR0A	_SFR_MEM8(0xC0)
+#define UCSR0B	_SFR_MEM8(0xC1)
+#define UCSR0C	_SFR_MEM8(0xC2)
+#define UBRR0	_SFR_MEM16(0xC4)
+#define UDR0	_SFR_MEM8(0xC6)
+
+#define PB0		0
+#define PB1		1
+#define PB2		2
+#define PB3		3
+#define PC3		3
+#define PE0		0
+#define PE1		1
+#define PE2		2
+#define DDB0	0
+#define DDB1	1
+#define DDB2	2
+#define DDE1	1
+#define DDE2	2
+
+#define SPIE	7
+#define SPE		6
+#define DORD	5
+#define MSTR	4
+#define CPOL	3
+#define CPHA	2
+#define SPR1	1
+#define SPR0	0
+#define SPIF	7
+#define SPI2X	0
+
+#define OCIE1B	2
+#define OCF1B	2
+#define TOIE1	0
+#define CS11	1
+
+#define RXC0	7
+#define TXC0	6
+#define UDRE0	5
+#define RXEN0	4
+#define TXEN0	3
+#define UMSEL01	7
+#define UMSEL00	6
+#define UCSZ01	2
+#define UCSZ00	1
+#define UCPOL0	0
+
+#define SREG_I	7
+
+#endif /* HOST_AVR_IO_H_ */
\ No newline at end of file
@@ -0,0 +1,27 @@
+/*
+ * pgmspace.h
+ *
+ * Created: 18/10/2026 11:52:16
+ * Author : joaob
+ */ 
+
+// Host stand-in for <avr/pgmspace.h>, flash is ordinary memory
+// Far addresses are 32 bit like on the AVR, tests using them are linked with -no-pie so their data sits below 4 GB
+
+
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(S)	(S)
+
+#define pgm_read_byte(ADDRESS)			(*(const uint8_t*)(ADDRESS))
+#define pgm_read_word(ADDRESS)			(*(const uint16_t*)(ADDRESS))
+#define pgm_read_dword(ADDRESS)			(*(const uint32_t*)(ADDRESS))
+#define pgm_get_far_address(VAR)		((uint32_t)(uintptr_t)&(VAR))
+#define pgm_read_byte_far(ADDRESS)		(*(const uint8_t*)(uintptr_t)(ADDRESS))
+#define pgm_read_dword_far(ADDRESS)		(*(const uint32_t*)(uintptr_t)(ADDRESS))
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
\ No newline at end of file
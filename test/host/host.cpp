@@ -0,0 +1,36 @@
+/*
+ * host.cpp
+ *
+ * Created: 18/10/2026 10:11:45
+ * Author : joaob
+ */ 
+
+#include <avr/io.h>
+
+volatile uint8_t g_ubHostIO[0x100];
+
+host_spdr_t g_HostSPDR;
+uint8_t (*g_pfnHostSPDR)(uint8_t ubData) = 0;
+
+static uint8_t m_ubHostSPDR = 0xFF;
+
+host_spdr_t& host_spdr_t::operator=(uint8_t ubData)
+{
+	m_ubHostSPDR = g_pfnHostSPDR ? g_pfnHostSPDR(ubData) : 0xFF;
+	
+	return *this;
+}
+host_spdr_t::operator uint8_t() const
+{
+	return m_ubHostSPDR;
+}
+
+static struct host_reset_t
+{
+	host_reset_t()
+	{
+		PINB = 0xFF; // SO idles high
+		PINE = 0xFF;
+		SREG = (1 << SREG_I); // Interrupts on, like after init()
+	}
+} m_HostReset;
\ No newline at end of file
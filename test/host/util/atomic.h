@@ -0,0 +1,32 @@
+/*
+ * atomic.h
+ *
+ * Created: 18/10/2026 10:06:50
+ * Author : joaob
+ */ 
+
+// Host stand-in for <util/atomic.h>, only ATOMIC_RESTORESTATE, the I bit of SREG is cleared and put back like on the target
+
+
+#ifndef HOST_UTIL_ATOMIC_H_
+#define HOST_UTIL_ATOMIC_H_
+
+#include <avr/io.h>
+
+static inline uint8_t HostAtomicEnter()
+{
+	uint8_t sreg = SREG;
+	
+	SREG &= ~(1 << SREG_I);
+	
+	return sreg;
+}
+static inline void HostAtomicRestore(const uint8_t* pubSREG)
+{
+	SREG = *pubSREG;
+}
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(TYPE) for(uint8_t hostSREG __attribute__ ((cleanup(HostAtomicRestore))) = HostAtomicEnter(), hostOnce = 1; hostOnce; hostOnce = 0)
+
+#endif /* HOST_UTIL_ATOMIC_H_ */
\ No newline at end of file
@@ -0,0 +1,33 @@
+/*
+ * crc16.h
+ *
+ * Created: 18/10/2026 10:08:02
+ * Author : joaob
+ */ 
+
+// Host stand-in for <util/crc16.h>, the C equivalents avr-libc documents for its assembler versions
+
+
+#ifndef HOST_UTIL_CRC16_H_
+#define HOST_UTIL_CRC16_H_
+
+#include <stdint.h>
+
+static inline uint16_t _crc16_update(uint16_t usCRC, uint8_t ubData)
+{
+	usCRC ^= ubData;
+	
+	for(uint8_t i = 0; i < 8; i++)
+		usCRC = (usCRC & 1) ? (usCRC >> 1) ^ 0xA001 : (usCRC >> 1);
+	
+	return usCRC;
+}
+static inline uint16_t _crc_ccitt_update(uint16_t usCRC, uint8_t ubData)
+{
+	ubData ^= usCRC & 0xFF;
+	ubData ^= ubData << 4;
+	
+	return ((((uint16_t)ubData << 8) | (usCRC >> 8)) ^ (uint8_t)(ubData >> 4) ^ ((uint16_t)ubData << 3));
+}
+
+#endif /* HOST_UTIL_CRC16_H_ */
\ No newline at end of file
@@ -0,0 +1,21 @@
+/*
+ * delay.h
+ *
+ * Created: 18/10/2026 10:07:14
+ * Author : joaob
+ */ 
+
+// Host stand-in for <util/delay.h>, delays return at once (the flash model counts status polls instead)
+
+
+#ifndef HOST_UTIL_DELAY_H_
+#define HOST_UTIL_DELAY_H_
+
+static inline void _delay_us(double dMicros)
+{
+}
+static inline void _delay_ms(double dMillis)
+{
+}
+
+#endif /* HOST_UTIL_DELAY_H_ */
\ No newline at end of file
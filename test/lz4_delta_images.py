@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+#
+# lz4_delta_images.py
+#
+# Created: 18/10/2026 11:58:40
+# Author: joaob
+#
+# Writes the raw binaries lz4_delta_test decodes once tools/mbpack.py packed
+# them: a firmware like image (repeated instruction patterns, erased gaps,
+# tables, matches right at the window limit), a later build of it (bytes
+# patched, code inserted so the rest moves, grown tail), random data that
+# does not compress and a 3 byte image.
+#
+#   test/lz4_delta_images.py <output dir>
+#
+
+import os
+import random
+import sys
+
+def firmware(rng, size):
+	out = bytearray()
+	patterns = [bytes(rng.getrandbits(8) for _ in range(rng.randint(4, 24))) for _ in range(40)]
+	
+	while len(out) < size:
+		kind = rng.random()
+		
+		if kind < 0.6: # Code, built from a few recurring sequences with operands changed
+			block = bytearray(rng.choice(patterns))
+			block[rng.randrange(len(block))] = rng.getrandbits(8)
+			out += block
+		elif kind < 0.7: # Erased gap
+			out += b'\xFF' * rng.randint(1, 300)
+		elif kind < 0.85: # Table
+			out += bytes(rng.getrandbits(8) for _ in range(rng.randint(1, 64)))
+		elif len(out) > 1024: # Repeat from the edge of the window
+			start = len(out) - rng.choice([1024, 1023, 1000, 4, 1])
+			length = rng.randint(4, 600)
+			
+			for i in range(length): # Byte by byte, the match may overlap itself
+				out.append(out[start + i])
+	
+	return out[:size]
+
+def later_build(rng, data):
+	out = bytearray(data)
+	
+	for _ in range(60): # Changed constants and call targets
+		pos = rng.randrange(len(out))
+		out[pos] = rng.getrandbits(8)
+	
+	pos = len(out) // 3 # New function, everything after it moves
+	out[pos:pos] = bytes(rng.getrandbits(8) for _ in range(517))
+	del out[len(out) // 2:len(out) // 2 + 200]
+	out += firmware(rng, 3000)
+	
+	return out
+
+def main():
+	if len(sys.argv) != 2:
+		sys.exit('usage: %s <output dir>' % sys.argv[0])
+	
+	rng = random.Random(2026)
+	images = {}
+	images['firmware'] = firmware(rng, 48 * 1024 + 77)
+	images['firmware_next'] = later_build(rng, images['firmware'])
+	images['random'] = bytes(rng.getrandbits(8) for _ in range(5000))
+	images['tiny'] = b'\x0C\x94\x00'
+	
+	os.makedirs(sys.argv[1], exist_ok=True)
+	
+	for name, data in images.items():
+		with open(os.path.join(sys.argv[1], name + '.bin'), 'wb') as f:
+			f.write(data)
+
+if __name__ == '__main__':
+	main()
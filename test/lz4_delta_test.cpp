@@ -0,0 +1,183 @@
+/*
+ * lz4_delta_test.cpp
+ *
+ * Created: 18/10/2026 12:10:05
+ * Author : joaob
+ */ 
+
+// Host test of lib/LZ4, lib/DELTA and lib/CRC32 against tools/mbpack.py: each staged image is decoded like loadROM does
+// (page sized requests, then odd sizes to stop the decoders in every state) and must give back the packed binary byte for byte
+//
+//   lz4_delta_test <staged image> <binary it was packed from> [delta source binary]
+
+#include <avr/io.h>
+#include <LZ4/LZ4.h>
+#include <DELTA/DELTA.h>
+#include <CRC32/CRC32.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+// image_header_t (main.h, packed)
+#define IMAGE_MAGIC				0x424D
+#define IMAGE_FORMAT_LZ4		1
+#define IMAGE_FORMAT_DELTA		2
+#define IMAGE_HEADER_FORMAT		2
+#define IMAGE_HEADER_SIZE		5
+#define IMAGE_HEADER_PAYLOAD	9
+#define IMAGE_HEADER_CRC		13
+#define IMAGE_HEADER_LENGTH		23
+
+static std::vector<uint8_t> m_Image;
+static std::vector<uint8_t> m_Source;
+static uint32_t m_ulImagePos = 0;
+static uint32_t m_ulImageEnd = 0;
+static int m_iOverreads = 0;
+
+static uint8_t ReadByte()
+{
+	if(m_ulImagePos >= m_ulImageEnd)
+	{
+		m_iOverreads++;
+		
+		return 0xEE;
+	}
+	
+	return m_Image[m_ulImagePos++];
+}
+static uint8_t ReadSource(uint32_t ulOffset)
+{
+	if(ulOffset >= m_Source.size())
+	{
+		m_iOverreads++;
+		
+		return 0xEE;
+	}
+	
+	return m_Source[ulOffset];
+}
+static uint32_t Little(uint32_t ulOffset, uint8_t ubBytes)
+{
+	uint32_t value = 0;
+	
+	while(ubBytes--)
+		value = (value << 8) | m_Image[ulOffset + ubBytes];
+	
+	return value;
+}
+static uint8_t Load(const char* pszPath, std::vector<uint8_t>& Data)
+{
+	FILE* f = fopen(pszPath, "rb");
+	
+	if(!f)
+		return 0;
+	
+	int c;
+	
+	while((c = fgetc(f)) != EOF)
+		Data.push_back(c);
+	
+	fclose(f);
+	
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<uint8_t> expected;
+	
+	if(argc < 3 || !Load(argv[1], m_Image) || !Load(argv[2], expected) || (argc > 3 && !Load(argv[3], m_Source)))
+	{
+		printf("usage: %s <staged image> <binary> [delta source]\n", argv[0]);
+		
+		return 2;
+	}
+	
+	if(m_Image.size() < IMAGE_HEADER_LENGTH || Little(0, 2) != IMAGE_MAGIC)
+	{
+		printf("%s: not a staged image\n", argv[1]);
+		
+		return 1;
+	}
+	
+	uint8_t format = m_Image[IMAGE_HEADER_FORMAT];
+	uint32_t size = Little(IMAGE_HEADER_SIZE, 4);
+	uint32_t payloadSize = Little(IMAGE_HEADER_PAYLOAD, 4);
+	int fails = 0;
+	
+	if(size != expected.size() || IMAGE_HEADER_LENGTH + payloadSize > m_Image.size() || (format != IMAGE_FORMAT_LZ4 && format != IMAGE_FORMAT_DELTA))
+	{
+		printf("%s: bad header\n", argv[1]);
+		
+		return 1;
+	}
+	
+	static const uint16_t chunks[] = {SPM_PAGESIZE, 1, 37, 1000};
+	
+	for(uint8_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+	{
+		std::vector<uint8_t> out(size + 1, 0xA5);
+		uint32_t offset = 0;
+		uint32_t crc = CRC32_INIT;
+		
+		m_ulImagePos = IMAGE_HEADER_LENGTH;
+		m_ulImageEnd = IMAGE_HEADER_LENGTH + payloadSize;
+		m_iOverreads = 0;
+		
+		if(format == IMAGE_FORMAT_LZ4)
+			LZ4::Init(payloadSize, ReadByte);
+		else
+			DELTA::Init(payloadSize, ReadByte, ReadSource, m_Source.size());
+		
+		while(offset < size)
+		{
+			uint16_t count = (size - offset > chunks[i]) ? chunks[i] : size - offset;
+			
+			if(!(format == IMAGE_FORMAT_LZ4 ? LZ4::Decode(&out[offset], count) : DELTA::Decode(&out[offset], count)))
+				break;
+			
+			crc = CRC32::Update(crc, &out[offset], count);
+			offset += count;
+		}
+		
+		uint8_t ok = offset == size && std::equal(expected.begin(), expected.end(), out.begin()) && out[size] == 0xA5;
+		
+		ok = ok && m_ulImagePos == m_ulImageEnd && !m_iOverreads; // The whole payload, nothing past it
+		ok = ok && CRC32::Final(crc) == Little(IMAGE_HEADER_CRC, 4);
+		
+		if(!ok)
+		{
+			printf("  FAIL %s in %u byte requests: stopped at %lu of %lu, payload read %lu of %lu, %d overreads\n", argv[1], chunks[i], (unsigned long)offset, (unsigned long)size,
+				(unsigned long)(m_ulImagePos - IMAGE_HEADER_LENGTH), (unsigned long)payloadSize, m_iOverreads);
+			
+			fails++;
+		}
+	}
+	
+	// A truncated payload must make the decoder fail, never read past what it was given
+	std::vector<uint8_t> out(size);
+	uint32_t offset = 0;
+	
+	m_ulImagePos = IMAGE_HEADER_LENGTH;
+	m_ulImageEnd = IMAGE_HEADER_LENGTH + payloadSize - 1;
+	m_iOverreads = 0;
+	
+	if(format == IMAGE_FORMAT_LZ4)
+		LZ4::Init(payloadSize - 1, ReadByte);
+	else
+		DELTA::Init(payloadSize - 1, ReadByte, ReadSource, m_Source.size());
+	
+	while(offset < size && (format == IMAGE_FORMAT_LZ4 ? LZ4::Decode(&out[offset], 1) : DELTA::Decode(&out[offset], 1)))
+		offset++;
+	
+	if(offset == size || m_iOverreads)
+	{
+		printf("  FAIL %s truncated: decoded %lu of %lu, %d overreads\n", argv[1], (unsigned long)offset, (unsigned long)size, m_iOverreads);
+		
+		fails++;
+	}
+	
+	printf("%s: %s %lu -> %lu bytes, %s\n", argv[1], format == IMAGE_FORMAT_LZ4 ? "LZ4" : "delta", (unsigned long)size, (unsigned long)payloadSize, fails ? "FAILED" : "OK");
+	
+	return fails ? 1 : 0;
+}
\ No newline at end of file
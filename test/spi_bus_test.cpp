@@ -0,0 +1,86 @@
+/*
+ * spi_bus_test.cpp
+ *
+ * Created: 18/10/2026 11:31:08
+ * Author : joaob
+ */ 
+
+// Host test of lib/SPI/SPI_BUS.cpp: register setup per device (SPI peripheral, or USART0 with SPI_USART_MSPIM), CS handling
+// and the arbitration in Select (another device selected, an interrupt driven client holding the bus through SPIE)
+
+#include <SPI/SPI.h>
+#include <stdio.h>
+
+#define CHECK(COND, WHAT) \
+	do \
+	{ \
+		if(!(COND)) \
+		{ \
+			printf("  FAIL %s (line %u)\n", WHAT, __LINE__); \
+			fails++; \
+		} \
+	} while(0)
+
+int main()
+{
+	int fails = 0;
+	
+	PORTC = DDRC = PORTE = DDRE = 0x00;
+	
+	uint8_t a = SPI::AddDevice(&PORTC, PC3, 0, 0, F_CPU / 2);
+	uint8_t b = SPI::AddDevice(&PORTE, 5, 1, 3, 400000);
+	
+	CHECK(a == 0 && b == 1, "device numbers");
+	CHECK(PORTC == (1 << PC3) && DDRC == (1 << PC3) && PORTE == (1 << 5) && DDRE == (1 << 5), "CS not an output driven high");
+	CHECK(SPI::Select(a) && !(PORTC & (1 << PC3)), "select a");
+
+#ifdef SPI_USART_MSPIM
+	CHECK(UCSR0C == ((1 << UMSEL01) | (1 << UMSEL00)) && UBRR0 == 0, "a: mode 0, F_CPU / 2");
+#else
+	CHECK(SPCR == ((1 << SPE) | (1 << MSTR)) && SPSR == (1 << SPI2X), "a: mode 0, F_CPU / 2");
+#endif
+
+	CHECK(!SPI::Select(b) && (PORTE & (1 << 5)), "b selected while a is");
+	CHECK(SPI::Select(a), "a selected again");
+	
+	SPI::Deselect(b); // Not selected, must not free the bus
+	
+	CHECK(!SPI::Select(b), "b selected after deselecting b");
+	
+	SPI::Deselect(a);
+	
+	CHECK((PORTC & (1 << PC3)) && SPI::m_ubSelectedDevice == SPI_NO_DEVICE, "deselect a");
+
+#ifndef SPI_USART_MSPIM
+	SPCR |= (1 << SPIE); // a runs interrupt driven
+	
+	CHECK(!SPI::Select(b) && (PORTE & (1 << 5)), "b selected while a owns SPIE");
+	CHECK(SPI::Select(a), "a refused with its own SPIE");
+	
+	SPI::Deselect(a);
+	
+	SPCR &= ~(1 << SPIE);
+#endif
+
+	CHECK(SPI::Select(b) && !(PORTE & (1 << 5)), "select b on a free bus");
+
+#ifdef SPI_USART_MSPIM
+	CHECK(UCSR0C == ((1 << UMSEL01) | (1 << UMSEL00) | (1 << UCSZ01) | (1 << UCSZ00) | (1 << UCPOL0)) && UBRR0 == 9, "b: LSB first, mode 3, 400 kHz");
+#else
+	CHECK(SPCR == ((1 << SPE) | (1 << DORD) | (1 << MSTR) | (1 << CPOL) | (1 << CPHA) | (1 << SPR1)) && SPSR == (1 << SPI2X), "b: LSB first, mode 3, 250 kHz");
+#endif
+
+	SPI::Deselect(b);
+	
+	CHECK(!SPI::Select(SPI_MAX_DEVICES), "unknown device selected");
+	
+	while(SPI::AddDevice(&PORTB, PB0, 0, 0, 1) != SPI_NO_DEVICE);
+	
+	CHECK(SPI::Select(SPI_MAX_DEVICES - 1), "last device");
+	
+	SPI::Deselect(SPI_MAX_DEVICES - 1);
+	
+	printf(fails ? "FAILED (%d)\n" : "ALL OK\n", fails);
+	
+	return fails ? 1 : 0;
+}
\ No newline at end of file
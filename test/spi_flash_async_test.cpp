@@ -0,0 +1,219 @@
+/*
+ * spi_flash_async_test.cpp
+ *
+ * Created: 18/10/2026 11:20:44
+ * Author : joaob
+ */ 
+
+// Host test of lib/SPI_FLASH/SPI_FLASH_ASYNC.cpp against flash_model_t: the ISRs are called by Pump() whenever the hardware would raise them
+// (a SPDR transfer done with SPIE set, OCIE1B set), the queue, callbacks, the blocking API holding the bus and another device on the bus are checked,
+// and that the bus is released (deselected, SPIE off) while the engine waits for the next status poll
+
+#include "flash_model.h"
+#include <avr/interrupt.h>
+#include <stdlib.h>
+
+#define CHECK(COND, WHAT) \
+	do \
+	{ \
+		if(!(COND)) \
+		{ \
+			printf("  FAIL %s (line %u)\n", WHAT, __LINE__); \
+			fails++; \
+		} \
+	} while(0)
+
+static const flash_desc_t m_DefaultDesc = SPI_FLASH::m_Desc;
+
+static uint8_t m_ubPending = 0; // A SPDR transfer the ISR did not pick up yet
+static int m_iOverruns = 0;
+static int m_iSPIInterrupts = 0;
+static int m_iTimerInterrupts = 0;
+static int m_iBusHeld = 0; // Timer waits with SPIE set or the flash selected, other devices locked out
+static int m_iDone = 0;
+
+static uint8_t HostSPDR(uint8_t ubData)
+{
+	if(m_ubPending)
+		m_iOverruns++;
+	
+	m_ubPending = 1;
+	
+	return g_pFlashModel->Transfer(ubData);
+}
+static void Pump()
+{
+	for(uint32_t i = 0; i < 1000000; i++)
+	{
+		if(m_ubPending && (SPCR & (1 << SPIE)))
+		{
+			m_ubPending = 0;
+			m_iSPIInterrupts++;
+			
+			SPI_STC_vect();
+		}
+		else if(TIMSK1 & (1 << OCIE1B)) // The compare match always comes, only when does not matter here
+		{
+			m_iTimerInterrupts++;
+			
+			if((SPCR & (1 << SPIE)) || SPI::m_ubSelectedDevice != SPI_NO_DEVICE)
+				m_iBusHeld++;
+			
+			TIMER1_COMPB_vect();
+		}
+		else
+		{
+			return;
+		}
+	}
+}
+static void OnDone(flash_request_t* pRequest)
+{
+	static flash_request_t chained;
+	static uint8_t buf[10];
+	
+	if(pRequest->m_ubOp == FLASH_ASYNC_SECTOR_ERASE && ++m_iDone == 1) // Submitted from the callback
+		SPI_FLASH::AsyncSubmit(&chained, FLASH_ASYNC_READ, pRequest->m_ulAddress, buf, sizeof(buf), OnDone);
+	else if(pRequest->m_ubOp != FLASH_ASYNC_SECTOR_ERASE)
+		m_iDone++;
+}
+
+static int Run(const char* pszName, flash_model_t& Model)
+{
+	int fails = 0;
+	
+	g_pFlashModel = &Model;
+	SPI_FLASH::m_Desc = m_DefaultDesc;
+	m_iSPIInterrupts = m_iTimerInterrupts = m_iBusHeld = m_iDone = 0;
+	
+	CHECK(SPI_FLASH::Init(), "init");
+	
+	uint8_t data[1000];
+	uint8_t read[1000];
+	uint8_t check[1000];
+	uint32_t base = 0x3000;
+	
+	srand(3);
+	
+	for(uint16_t i = 0; i < sizeof(data); i++)
+		data[i] = rand();
+	
+	memset(&Model.m_Mem[base], 0, 16);
+	
+	// Erase, write and read queued at once, one more read submitted from the erase callback
+	flash_request_t erase, write, request;
+	
+	SPI_FLASH::AsyncSubmit(&erase, FLASH_ASYNC_SECTOR_ERASE, base, 0, 0, OnDone);
+	SPI_FLASH::AsyncSubmit(&write, FLASH_ASYNC_WRITE, base + 37, data, sizeof(data), OnDone);
+	SPI_FLASH::AsyncSubmit(&request, FLASH_ASYNC_READ, base + 37, read, sizeof(read), OnDone);
+	
+	CHECK(!SPI_FLASH::AsyncIdle() && write.m_ubStatus == FLASH_ASYNC_PENDING, "queue");
+	
+	Pump();
+	
+	CHECK(SPI_FLASH::AsyncIdle() && erase.m_ubStatus == FLASH_ASYNC_DONE && write.m_ubStatus == FLASH_ASYNC_DONE && request.m_ubStatus == FLASH_ASYNC_DONE, "status");
+	CHECK(m_iDone == 4, "callbacks");
+	CHECK(!memcmp(read, data, sizeof(data)) && !memcmp(&Model.m_Mem[base + 37], data, sizeof(data)), "data");
+	
+	// The blocking API right after, then a block erase and a read of it
+	CHECK(SPI_FLASH::Read(base + 37, check, sizeof(check)) && !memcmp(check, data, sizeof(data)), "blocking read");
+	
+	SPI_FLASH::AsyncSubmit(&erase, FLASH_ASYNC_BLOCK_ERASE, base, 0, 0);
+	SPI_FLASH::AsyncSubmit(&request, FLASH_ASYNC_READ, base + 37, read, 16);
+	
+	Pump();
+	
+	CHECK(request.m_ubStatus == FLASH_ASYNC_DONE && read[0] == 0xFF && !memcmp(read, read + 1, 15), "block erase");
+	
+	// An open stream holds the bus: the request waits for StreamClose and cannot be flushed
+	SPI_FLASH::StreamOpen(base + 37);
+	SPI_FLASH::StreamReadByte();
+	SPI_FLASH::AsyncSubmit(&request, FLASH_ASYNC_READ, base + 37, read, 16);
+	
+	Pump();
+	
+	CHECK(request.m_ubStatus == FLASH_ASYNC_PENDING && !SPI_FLASH::AsyncFlush(), "started while the stream holds the bus");
+	
+	SPI_FLASH::StreamClose();
+	
+	Pump();
+	
+	CHECK(request.m_ubStatus == FLASH_ASYNC_DONE, "not started by StreamClose");
+	
+	// Interrupts off: flushing and the blocking API fail instead of spinning
+	SPI_FLASH::AsyncSubmit(&request, FLASH_ASYNC_READ, base + 37, read, 16);
+	
+	SREG &= ~(1 << SREG_I);
+	
+	CHECK(!SPI_FLASH::AsyncFlush() && !SPI_FLASH::Read(base, check, 4), "waited with interrupts off");
+	
+	SREG |= (1 << SREG_I);
+	
+	Pump();
+	
+	CHECK(request.m_ubStatus == FLASH_ASYNC_DONE && SPI_FLASH::AsyncFlush(), "after interrupts on");
+	
+	// Another device selected: the engine leaves the bus alone and retries from the timer
+	SPI::m_ubSelectedDevice = 1;
+	
+	SPI_FLASH::AsyncSubmit(&request, FLASH_ASYNC_READ, base + 37, read, 16);
+	
+	for(uint8_t i = 0; i < 5 && (TIMSK1 & (1 << OCIE1B)); i++)
+		TIMER1_COMPB_vect();
+	
+	CHECK(request.m_ubStatus == FLASH_ASYNC_PENDING && !m_ubPending && !(SPCR & (1 << SPIE)), "took a bus selected by another device");
+	
+	SPI::m_ubSelectedDevice = SPI_NO_DEVICE;
+	
+	Pump();
+	
+	CHECK(request.m_ubStatus == FLASH_ASYNC_DONE, "no retry once the bus is free");
+	CHECK(!(SPCR & (1 << SPIE)), "SPIE left on");
+	CHECK(!m_iBusHeld, "bus held between status polls");
+	CHECK(!m_iOverruns, "SPDR written during a transfer");
+	CHECK(!Model.m_iErrors, "protocol errors");
+	
+	printf("%s: %d SPI interrupts, %d timer interrupts, %d page programs, %d AAI commands\n", pszName, m_iSPIInterrupts, m_iTimerInterrupts, Model.m_iPageCmds, Model.m_iAAICmds);
+	
+	return fails;
+}
+
+int main()
+{
+	int fails = 0;
+	
+	g_pfnHostSPDR = HostSPDR;
+	
+	{
+		uint32_t w25q128[] = {0xFFF920E5, 0x07FFFFFF, 0x6B08EB44, 0xBB42FF08, 0xFFFFFFFE, 0xFF00FFFF, 0xEB40FFFF, 0x520F200C, 0xFF00D810};
+		flash_model_t model(0x1000000);
+		
+		model.m_ubHasJEDEC = 1;
+		model.m_ubJEDEC[0] = 0xEF;
+		model.m_ubJEDEC[1] = 0x40;
+		model.m_ubJEDEC[2] = 0x18;
+		model.m_usPageSize = 256;
+		model.m_EraseSizes[0x20] = 0x1000;
+		model.m_EraseSizes[0x52] = 0x8000;
+		model.m_EraseSizes[0xD8] = 0x10000;
+		model.m_SFDP = FlashModelSFDP(std::vector<uint32_t>(w25q128, w25q128 + sizeof(w25q128) / sizeof(w25q128[0])));
+		
+		fails += Run("W25Q128 (page program)", model);
+	}
+	{
+		flash_model_t model(0x20000);
+		
+		model.m_ubLegacyID[0] = 0xBF;
+		model.m_ubLegacyID[1] = 0x49;
+		model.m_ubAAIByte = 1;
+		model.m_usPageSize = 1;
+		model.m_EraseSizes[0x20] = 0x1000;
+		model.m_EraseSizes[0x52] = 0x8000;
+		
+		fails += Run("SST25VF010A (byte program)", model);
+	}
+	
+	printf(fails ? "FAILED (%d)\n" : "ALL OK\n", fails);
+	
+	return fails ? 1 : 0;
+}
\ No newline at end of file
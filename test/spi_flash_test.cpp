@@ -0,0 +1,684 @@
+/*
+ * spi_flash_test.cpp
+ *
+ * Created: 18/10/2026 11:02:37
+ * Author : joaob
+ */ 
+
+// Host test of lib/SPI_FLASH against flash_model_t, once per part: detection (JEDEC, SFDP, 4 byte addressing),
+// writes in every program mode (page program never wraps), the stream (resume after other commands, read ahead dropped by writes),
+// Modify (in place, through the scratch pool, finished by Init after a reset), nothing clocked while another device holds the bus, EraseRange and the erase commands
+// Built twice, as spi_flash_log_test with FLASH_MODIFY_LOG and 4 scratch sectors for the log recovery
+
+#include "flash_model.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <util/crc16.h>
+
+#define CHECK(COND, WHAT) \
+	do \
+	{ \
+		if(!(COND)) \
+		{ \
+			printf("  FAIL %s (line %u)\n", WHAT, __LINE__); \
+			fails++; \
+		} \
+	} while(0)
+
+static const flash_desc_t m_DefaultDesc = SPI_FLASH::m_Desc;
+
+static uint8_t Reinit()
+{
+	SPI_FLASH::m_Desc = m_DefaultDesc; // As after a reset
+	
+	return SPI_FLASH::Init();
+}
+static void SyncScratch(std::vector<uint8_t>& Ref, flash_model_t& Model) // The log and scratch sectors are Modify's own, take them as they are
+{
+	std::copy(Model.m_Mem.begin() + FLASH_SCRATCH_BOTTOM, Model.m_Mem.begin() + FLASH_SECTOR_23 + FLASH_SECTOR_SIZE, Ref.begin() + FLASH_SCRATCH_BOTTOM);
+}
+
+static int TestWrite(flash_model_t& Model, std::vector<uint8_t>& Ref, uint32_t ulBase)
+{
+	int fails = 0;
+	uint8_t buf[700];
+	uint32_t offset = rand() % 7;
+	
+	CHECK(SPI_FLASH::SectorErase(ulBase), "sector erase");
+	
+	std::fill(Ref.begin() + ulBase, Ref.begin() + ulBase + FLASH_SECTOR_SIZE, 0xFF);
+	
+	while(offset < FLASH_SECTOR_SIZE) // Odd lengths at odd offsets, across pages
+	{
+		uint16_t count = 1 + rand() % sizeof(buf);
+		
+		if(offset + count > FLASH_SECTOR_SIZE)
+			count = FLASH_SECTOR_SIZE - offset;
+		
+		for(uint16_t i = 0; i < count; i++)
+			buf[i] = rand();
+		
+		CHECK(SPI_FLASH::Write(ulBase + offset, buf, count), "write");
+		
+		memcpy(&Ref[ulBase + offset], buf, count);
+		
+		offset += count + rand() % 3;
+	}
+	
+	uint8_t read[FLASH_SECTOR_SIZE];
+	
+	CHECK(SPI_FLASH::Read(ulBase, read, FLASH_SECTOR_SIZE), "read");
+	CHECK(!memcmp(read, &Ref[ulBase], FLASH_SECTOR_SIZE), "read back");
+	
+	if(SPI_FLASH::m_Desc.m_ubProgramMode == FLASH_PROGRAM_PAGE) // Two page programs for a write across a page boundary
+	{
+		uint32_t address = ulBase + SPI_FLASH::m_Desc.m_usPageSize - 3;
+		uint8_t data[6] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06};
+		int cmds = Model.m_iPageCmds;
+		
+		CHECK(SPI_FLASH::SectorErase(ulBase), "sector erase");
+		CHECK(SPI_FLASH::Write(address, data, sizeof(data)), "write across a page");
+		CHECK(Model.m_iPageCmds - cmds == 2, "page split");
+		CHECK(!memcmp(&Model.m_Mem[address], data, sizeof(data)), "data across a page");
+		
+		std::copy(Model.m_Mem.begin() + ulBase, Model.m_Mem.begin() + ulBase + FLASH_SECTOR_SIZE, Ref.begin() + ulBase);
+	}
+	
+	return fails;
+}
+static int TestStream(flash_model_t& Model, std::vector<uint8_t>& Ref, uint32_t ulBase)
+{
+	int fails = 0;
+	
+	for(uint8_t pass = 0; pass < 2; pass++) // Reads and other commands interleaved, writes ahead of the stream in the second pass
+	{
+		uint32_t pos = ulBase + rand() % 100;
+		
+		CHECK(SPI_FLASH::StreamOpen(pos), "stream open");
+		
+		while(pos < ulBase + FLASH_SECTOR_SIZE - 800)
+		{
+			uint8_t buf[300];
+			uint16_t count = (rand() % 4) ? 1 + rand() % 6 : 1 + rand() % sizeof(buf);
+			
+			if(!SPI_FLASH::StreamRead(buf, count))
+			{
+				CHECK(0, "stream read");
+				
+				break;
+			}
+			
+			if(memcmp(buf, &Ref[pos], count))
+			{
+				CHECK(0, "stream data");
+				
+				break;
+			}
+			
+			pos += count;
+			
+			uint8_t action = rand() % 50;
+			
+			if(action == 0) // The stream is suspended and resumed where it was
+			{
+				uint8_t other[6];
+				
+				CHECK(SPI_FLASH::Read(7, other, sizeof(other)) && !memcmp(other, &Ref[7], sizeof(other)), "read inside a stream");
+			}
+			else if(action == 1 && pass) // Lands in what the stream may have read ahead
+			{
+				uint32_t address = pos + rand() % 40;
+				uint8_t data = Ref[address] & rand();
+				
+				CHECK(SPI_FLASH::Write(address, &data, 1), "write inside a stream");
+				
+				Ref[address] = data;
+			}
+		}
+		
+		SPI_FLASH::StreamClose();
+		
+		uint8_t data;
+		
+		CHECK(!SPI_FLASH::StreamRead(&data, 1), "read on a closed stream");
+	}
+	
+	// The byte right after the one just read is rewritten, the next read must see it
+	uint8_t data;
+	
+	CHECK(SPI_FLASH::StreamOpen(ulBase), "stream open");
+	CHECK(SPI_FLASH::StreamRead(&data, 1), "stream read");
+	
+	data = Ref[ulBase + 1] & 0x0F;
+	
+	CHECK(SPI_FLASH::Write(ulBase + 1, &data, 1), "write");
+	
+	Ref[ulBase + 1] = data;
+	data = ~data;
+	
+	CHECK(SPI_FLASH::StreamRead(&data, 1) && data == Ref[ulBase + 1], "stream read ahead not dropped");
+	
+	SPI_FLASH::StreamClose();
+	
+	CHECK(Model.m_Mem == Ref, "model differs");
+	
+	return fails;
+}
+static int TestModify(flash_model_t& Model, std::vector<uint8_t>& Ref, uint32_t ulSector)
+{
+	int fails = 0;
+	uint32_t base = ulSector + FLASH_SECTOR_SIZE - 200;
+	uint8_t data[10];
+	uint8_t fill[256];
+	
+	CHECK(SPI_FLASH::SectorErase(ulSector), "sector erase");
+	
+	for(uint32_t address = ulSector; address < ulSector + FLASH_SECTOR_SIZE; address += sizeof(fill)) // Bits 0 and 7 clear, every rewrite below sets them
+	{
+		for(uint16_t i = 0; i < sizeof(fill); i++)
+			fill[i] = rand() & 0x7E;
+		
+		CHECK(SPI_FLASH::Write(address, fill, sizeof(fill)), "write");
+		
+		memcpy(&Ref[address], fill, sizeof(fill));
+	}
+	
+	int programs = Model.m_iPrograms;
+	
+	Model.m_Erases.clear();
+	
+	for(uint8_t i = 0; i < sizeof(data); i++)
+		data[i] = Ref[base + 100 + i] & 0x5A;
+	
+	CHECK(SPI_FLASH::Modify(base + 100, data, sizeof(data)), "modify in place");
+	CHECK(Model.m_Erases.empty() && Model.m_iPrograms - programs <= (int)sizeof(data), "modify in place erased or programmed too much");
+	CHECK(SPI_FLASH::Modify(base + 100, data, sizeof(data)) && Model.m_iPrograms - programs <= (int)sizeof(data), "modify with equal data");
+	
+	memcpy(&Ref[base + 100], data, sizeof(data));
+	
+	for(uint8_t i = 0; i < 6; i++) // Bits set, through the scratch pool
+	{
+		uint8_t buf[300];
+		uint32_t address = ulSector + rand() % (FLASH_SECTOR_SIZE - sizeof(buf));
+		uint16_t count = 1 + rand() % sizeof(buf);
+		
+		for(uint16_t j = 0; j < count; j++)
+			buf[j] = rand() | 0x81;
+		
+		CHECK(SPI_FLASH::Modify(address, buf, count), "modify rewrite");
+		
+		memcpy(&Ref[address], buf, count);
+	}
+	
+	CHECK(std::equal(Ref.begin() + ulSector, Ref.begin() + ulSector + FLASH_SECTOR_SIZE, Model.m_Mem.begin() + ulSector), "modify contents");
+	CHECK(Model.m_Erases.size() == 1u + FLASH_SCRATCH_SECTORS && Model.m_Erases[ulSector] == 6, "scratch rotation");
+	
+	CHECK(!SPI_FLASH::Modify(FLASH_SECTOR_SIZE * 2 - 1, data, 2), "modify across sectors accepted");
+	uint8_t zero = 0x00;
+	uint8_t set = 0xFF;
+	
+	SPI_FLASH::Write(FLASH_SECTOR_23 + 5, &zero, 1);
+	
+	CHECK(!SPI_FLASH::Modify(FLASH_SECTOR_23 + 5, &set, 1) && !SPI_FLASH::Modify(FLASH_SCRATCH_BOTTOM + 1, &set, 1), "modify of the scratch area accepted");
+	CHECK(Model.m_Erases.count(FLASH_SCRATCH_BOTTOM - FLASH_SECTOR_SIZE) == 0, "sector below the scratch area touched");
+	
+	SyncScratch(Ref, Model);
+	
+	CHECK(Model.m_Mem == Ref, "model differs");
+	
+	return fails;
+}
+#ifdef FLASH_MODIFY_LOG
+static flash_scratch_tag_t ScratchTag(uint32_t ulSector, uint8_t ubScratch, uint8_t ubDone)
+{
+	flash_scratch_tag_t tag;
+	uint16_t crc = 0xFFFF;
+	
+	tag.m_ulSector = ulSector;
+	tag.m_ubScratch = ubScratch;
+	tag.m_ubDone = ubDone;
+	
+	for(uint8_t i = 0; i < 4; i++)
+		crc = _crc_ccitt_update(crc, ulSector >> (8 * i));
+	
+	tag.m_usCRC = _crc_ccitt_update(crc, ubScratch);
+	
+	return tag;
+}
+static int TestModifyRecovery(flash_model_t& Model, std::vector<uint8_t>& Ref, uint32_t ulSector)
+{
+	int fails = 0;
+	uint16_t slot = 0;
+	flash_scratch_tag_t header = ScratchTag(FLASH_SCRATCH_MAGIC, FLASH_SCRATCH_SECTORS, FLASH_SCRATCH_DONE);
+	
+	CHECK(!memcmp(&Model.m_Mem[FLASH_SCRATCH_LOG], &header, sizeof(header)), "log header not written by the first rewrite");
+	
+	while(slot < FLASH_SCRATCH_LOG_RECORDS && Model.m_Mem[FLASH_SCRATCH_LOG + slot * sizeof(flash_scratch_tag_t) + offsetof(flash_scratch_tag_t, m_ubScratch)] != 0xFF)
+		slot++;
+	
+	// A reset between the log record and the end of the copy back: the scratch holds the new sector, the sector is half erased
+	flash_scratch_tag_t tag = ScratchTag(ulSector, 2 % FLASH_SCRATCH_SECTORS, 0xFF);
+	
+	uint32_t scratch = FLASH_SCRATCH_FIRST + FLASH_SECTOR_SIZE * tag.m_ubScratch;
+	
+	for(uint32_t i = 0; i < FLASH_SECTOR_SIZE; i++)
+		Model.m_Mem[scratch + i] = Ref[ulSector + i] = (rand() | 0x01) & 0x7F;
+	
+	for(int8_t torn = 1; torn >= 0; torn--) // A torn record first, which must be left alone
+	{
+		flash_scratch_tag_t record = tag;
+		
+		record.m_usCRC ^= torn;
+		
+		memcpy(&Model.m_Mem[FLASH_SCRATCH_LOG + (slot + 1 - torn) * sizeof(record)], &record, sizeof(record));
+		
+		std::fill(Model.m_Mem.begin() + ulSector, Model.m_Mem.begin() + ulSector + FLASH_SECTOR_SIZE / 2, 0xFF);
+		
+		std::vector<uint8_t> before(Model.m_Mem);
+		
+		Model.m_Erases.clear();
+		
+		CHECK(Reinit(), "init after a reset");
+		
+		if(torn)
+			CHECK(Model.m_Mem == before, "torn record acted on");
+	}
+	
+	uint32_t record = FLASH_SCRATCH_LOG + (slot + 1) * sizeof(tag);
+	
+	CHECK(std::equal(Ref.begin() + ulSector, Ref.begin() + ulSector + FLASH_SECTOR_SIZE, Model.m_Mem.begin() + ulSector), "rewrite not finished by Init");
+	CHECK(Model.m_Mem[record + offsetof(flash_scratch_tag_t, m_ubDone)] == FLASH_SCRATCH_DONE, "record not marked done");
+	
+	Model.m_Erases.clear();
+	
+	CHECK(Reinit() && Model.m_Erases.empty(), "finished rewrite redone");
+	
+	// The next rewrite takes the scratch sector after the newest record
+	uint8_t data = 0xFF;
+	
+	CHECK(SPI_FLASH::Modify(ulSector + 9, &data, 1), "modify");
+	CHECK(Model.m_Erases.count(FLASH_SCRATCH_FIRST + FLASH_SECTOR_SIZE * ((tag.m_ubScratch + 1) % FLASH_SCRATCH_SECTORS)), "rotation not taken from the log");
+	
+	Ref[ulSector + 9] = data;
+	
+	// Full log: erased before the next record, which lands in slot 1 after a new header
+	for(uint16_t i = 1; i < FLASH_SCRATCH_LOG_RECORDS; i++)
+	{
+		flash_scratch_tag_t done = tag;
+		
+		done.m_ubDone = FLASH_SCRATCH_DONE;
+		
+		memcpy(&Model.m_Mem[FLASH_SCRATCH_LOG + i * sizeof(done)], &done, sizeof(done));
+	}
+	
+	Model.m_Erases.clear();
+	
+	CHECK(Reinit() && Model.m_Erases.empty(), "init on a full log");
+	
+	uint8_t set[2] = {0xFF, 0xFF};
+	
+	CHECK(SPI_FLASH::Modify(ulSector + 20, set, sizeof(set)) && Model.m_Erases.count(FLASH_SCRATCH_LOG), "full log not erased");
+	CHECK(!memcmp(&Model.m_Mem[FLASH_SCRATCH_LOG], &header, sizeof(header)) && Model.m_Mem[FLASH_SCRATCH_LOG + sizeof(tag) + offsetof(flash_scratch_tag_t, m_ubDone)] == FLASH_SCRATCH_DONE &&
+		Model.m_Mem[FLASH_SCRATCH_LOG + 2 * sizeof(tag)] == 0xFF, "record after the log erase");
+	
+	memcpy(&Ref[ulSector + 20], set, sizeof(set));
+	
+	// A log sector without this layout's header (application data, another FLASH_SCRATCH_SECTORS) is never replayed, the next rewrite erases it
+	for(uint8_t layout = 0; layout < 2; layout++)
+	{
+		flash_scratch_tag_t foreign[2] = {ScratchTag(FLASH_SCRATCH_MAGIC, FLASH_SCRATCH_SECTORS + 1, FLASH_SCRATCH_DONE), tag};
+		
+		std::fill(Model.m_Mem.begin() + FLASH_SCRATCH_LOG, Model.m_Mem.begin() + FLASH_SCRATCH_LOG + FLASH_SECTOR_SIZE, 0xFF);
+		memcpy(&Model.m_Mem[FLASH_SCRATCH_LOG], &foreign[1 - layout], (1 + layout) * sizeof(tag));
+		
+		std::vector<uint8_t> before(Model.m_Mem);
+		
+		Model.m_Erases.clear();
+		
+		CHECK(Reinit() && Model.m_Mem == before, "record replayed from a log sector without a header");
+	}
+	
+	CHECK(SPI_FLASH::Modify(ulSector + 30, set, sizeof(set)) && Model.m_Erases.count(FLASH_SCRATCH_LOG), "foreign log sector not erased");
+	CHECK(!memcmp(&Model.m_Mem[FLASH_SCRATCH_LOG], &header, sizeof(header)) && Model.m_Mem[FLASH_SCRATCH_LOG + 2 * sizeof(tag)] == 0xFF, "log not set up again");
+	
+	memcpy(&Ref[ulSector + 30], set, sizeof(set));
+	
+	SyncScratch(Ref, Model);
+	
+	CHECK(Model.m_Mem == Ref, "model differs");
+	
+	return fails;
+}
+#endif
+static int TestEraseRange(flash_model_t& Model, std::vector<uint8_t>& Ref)
+{
+	int fails = 0;
+	flash_erase_report_t report;
+	uint32_t block = SPI_FLASH::m_Desc.m_ulBlockSize;
+	uint32_t base = block;
+	uint32_t length = 96 * 1024UL;
+	
+	CHECK(SPI_FLASH::EraseRange(base, length), "erase range");
+	
+	std::fill(Ref.begin() + base, Ref.begin() + base + length, 0xFF);
+	
+	Model.m_Erases.clear();
+	
+	CHECK(SPI_FLASH::EraseRange(base, length, &report) && Model.m_Erases.empty() && report.m_usBlankSectors == length / FLASH_SECTOR_SIZE, "blank range erased");
+	
+	for(uint32_t address = base; address < base + length; address += 2 * FLASH_SECTOR_SIZE) // Every other sector dirty, whole blocks are cheaper
+	{
+		uint8_t data = 0x12;
+		
+		SPI_FLASH::Write(address + 77, &data, 1);
+	}
+	
+	Model.m_Erases.clear();
+	
+	CHECK(SPI_FLASH::EraseRange(base, length, &report), "erase range");
+	CHECK(std::count(Model.m_Mem.begin() + base, Model.m_Mem.begin() + base + length, 0xFF) == (long)length, "range not erased");
+	
+	printf("  erase range: %u blocks %u sectors %u blank, %lu us estimated\n", report.m_usBlockErases, report.m_usSectorErases, report.m_usBlankSectors, (unsigned long)report.m_ulEstimatedTime);
+	
+	// A single dirty sector in an unaligned range
+	uint8_t data = 0x00;
+	
+	SPI_FLASH::Write(base + FLASH_SECTOR_SIZE * 3 + 5, &data, 1);
+	
+	Model.m_Erases.clear();
+	
+	CHECK(SPI_FLASH::EraseRange(base + FLASH_SECTOR_SIZE, block, &report) && Model.m_Erases.size() == 1 && Model.m_Erases.count(base + FLASH_SECTOR_SIZE * 3), "single dirty sector");
+	CHECK(!SPI_FLASH::EraseRange(base + 1, FLASH_SECTOR_SIZE, &report), "unaligned range accepted");
+	CHECK(!SPI_FLASH::EraseRange(SPI_FLASH::m_Desc.m_ulSize - FLASH_SECTOR_SIZE, 2 * FLASH_SECTOR_SIZE, &report), "range past the end accepted");
+	CHECK(Model.m_Mem == Ref, "erase range touched other data");
+	
+	// Block erase takes exactly its block, chip erase everything
+	uint32_t last = SPI_FLASH::m_Desc.m_ulSize - block;
+	
+	CHECK(SPI_FLASH::BlockErase(last + 5), "block erase");
+	
+	std::fill(Ref.begin() + last, Ref.end(), 0xFF);
+	
+	CHECK(Model.m_Mem == Ref, "block erase");
+	CHECK(SPI_FLASH::ChipErase() && std::count(Model.m_Mem.begin(), Model.m_Mem.end(), 0xFF) == (long)Model.m_Mem.size(), "chip erase");
+	
+	return fails;
+}
+
+static int TestBusTaken(flash_model_t& Model, std::vector<uint8_t>& Ref)
+{
+	int fails = 0;
+	uint8_t buf[16];
+	int selects = Model.m_iSelects;
+	
+	memset(buf, 0x5A, sizeof(buf));
+	
+	SPI::m_ubSelectedDevice = 1; // Another device of the bus left selected
+	
+	CHECK(!SPI_FLASH::Read(FLASH_SECTOR_SIZE * 5, buf, sizeof(buf)), "read with the bus taken");
+	CHECK(!SPI_FLASH::Write(FLASH_SECTOR_SIZE * 6, buf, sizeof(buf)), "write with the bus taken");
+	CHECK(!SPI_FLASH::Modify(FLASH_SECTOR_SIZE * 5, buf, sizeof(buf)), "modify with the bus taken");
+	CHECK(!SPI_FLASH::SectorErase(FLASH_SECTOR_SIZE * 5), "sector erase with the bus taken");
+	CHECK(!SPI_FLASH::BlockErase(0), "block erase with the bus taken");
+	CHECK(!SPI_FLASH::ChipErase(), "chip erase with the bus taken");
+	CHECK(!SPI_FLASH::WriteEnable(), "write enable with the bus taken");
+	CHECK(!SPI_FLASH::StreamOpen(FLASH_SECTOR_SIZE * 5) && !SPI_FLASH::StreamRead(buf, sizeof(buf)), "stream with the bus taken");
+	
+	SPI_FLASH::StreamClose();
+	
+	CHECK(SPI_FLASH::IsBlank(FLASH_SECTOR_SIZE * 5, FLASH_SECTOR_SIZE) == 0xFF, "blank check with the bus taken");
+	CHECK(Model.m_iSelects == selects, "flash selected while another device held the bus");
+	
+	SPI::m_ubSelectedDevice = SPI_NO_DEVICE;
+	
+	CHECK(Model.m_Mem == Ref, "flash changed while the bus was taken");
+	CHECK(SPI_FLASH::Read(FLASH_SECTOR_SIZE * 5, buf, sizeof(buf)) && !memcmp(buf, &Ref[FLASH_SECTOR_SIZE * 5], sizeof(buf)), "read once the bus is back");
+	
+	// Taken part way, after BusyWait found the bus free: a call may fail, but never reports data it did not move, and the chip is usable after
+	for(int selects = 0; selects < 24; selects++)
+	{
+		uint32_t address = FLASH_SECTOR_SIZE * 6 + selects * sizeof(buf);
+		uint8_t data[sizeof(buf)];
+		
+		for(uint8_t i = 0; i < sizeof(data); i++)
+			data[i] = rand() & 0x7F;
+		
+		g_iFlashSelectsLeft = selects;
+		
+		uint8_t read = SPI_FLASH::Read(FLASH_SECTOR_SIZE * 5, buf, sizeof(buf));
+		
+		SPI::m_ubSelectedDevice = SPI_NO_DEVICE;
+		
+		CHECK(!read || !memcmp(buf, &Ref[FLASH_SECTOR_SIZE * 5], sizeof(buf)), "read reported data it did not get");
+		
+		g_iFlashSelectsLeft = selects;
+		
+		uint8_t written = SPI_FLASH::Write(address, data, sizeof(data));
+		
+		g_iFlashSelectsLeft = -1;
+		SPI::m_ubSelectedDevice = SPI_NO_DEVICE;
+		
+		CHECK(!written || !memcmp(&Model.m_Mem[address], data, sizeof(data)), "write reported data it did not program");
+		
+		std::copy(Model.m_Mem.begin() + address, Model.m_Mem.begin() + address + sizeof(data), Ref.begin() + address); // Whatever got programmed
+		
+		CHECK(SPI_FLASH::Read(FLASH_SECTOR_SIZE * 5, buf, sizeof(buf)) && !memcmp(buf, &Ref[FLASH_SECTOR_SIZE * 5], sizeof(buf)), "read after a write cut short");
+	}
+	
+	CHECK(SPI_FLASH::SectorErase(FLASH_SECTOR_SIZE * 6), "erase after writes cut short");
+	
+	std::fill(Ref.begin() + FLASH_SECTOR_SIZE * 6, Ref.begin() + FLASH_SECTOR_SIZE * 7, 0xFF);
+	
+	CHECK(Model.m_Mem == Ref, "flash changed while the bus was taken");
+	
+	return fails;
+}
+
+static int Run(const char* pszName, flash_model_t& Model, uint8_t ubDetected, uint32_t ulSize, uint8_t ubAddressBytes, flash_program_t ubProgramMode, uint16_t usPageSize, uint32_t ulBlockSize)
+{
+	int fails = 0;
+	
+	g_pFlashModel = &Model;
+	
+	uint8_t detected = Reinit();
+	flash_desc_t& desc = SPI_FLASH::m_Desc;
+	
+	printf("%s: detected %u, %lu bytes, %u byte address, program mode %u, %u byte pages, block 0x%02X %lu bytes, timeouts %lu %lu %lu %lu us\n", pszName, detected,
+		(unsigned long)desc.m_ulSize, desc.m_ubAddressBytes, desc.m_ubProgramMode, desc.m_usPageSize, desc.m_ubBlockEraseCmd, (unsigned long)desc.m_ulBlockSize,
+		(unsigned long)desc.m_ulProgramTimeout, (unsigned long)desc.m_ulSectorEraseTimeout, (unsigned long)desc.m_ulBlockEraseTimeout, (unsigned long)desc.m_ulChipEraseTimeout);
+	
+	CHECK(detected == ubDetected, "detection");
+	
+	if(!detected) // The default (SST25VF010A) stays
+	{
+		CHECK(!memcmp(&desc, &m_DefaultDesc, sizeof(desc)), "descriptor changed");
+		
+		return fails;
+	}
+	
+	CHECK(desc.m_ulSize == ulSize && desc.m_ubAddressBytes == ubAddressBytes && desc.m_ubProgramMode == ubProgramMode && desc.m_usPageSize == usPageSize && desc.m_ulBlockSize == ulBlockSize, "descriptor");
+	CHECK(Model.m_ubAddressBytes == ubAddressBytes, "address mode");
+	
+	std::vector<uint8_t> ref(Model.m_Mem);
+	
+	srand(1);
+	
+	fails += TestWrite(Model, ref, 0);
+	fails += TestWrite(Model, ref, FLASH_SECTOR_SIZE * 5);
+	fails += TestWrite(Model, ref, desc.m_ulSize / 2 - FLASH_SECTOR_SIZE);
+	fails += TestWrite(Model, ref, desc.m_ulSize - FLASH_SECTOR_SIZE); // Top of a 4 byte part
+	fails += TestStream(Model, ref, FLASH_SECTOR_SIZE * 5);
+	fails += TestModify(Model, ref, desc.m_ulSize / 2 - FLASH_SECTOR_SIZE);
+#ifdef FLASH_MODIFY_LOG
+	fails += TestModifyRecovery(Model, ref, 0);
+#endif
+	fails += TestBusTaken(Model, ref);
+	fails += TestEraseRange(Model, ref);
+	
+	CHECK(!Model.m_iErrors, "protocol errors");
+	
+	printf("  %d page programs, %d AAI commands, %d bytes programmed\n", Model.m_iPageCmds, Model.m_iAAICmds, Model.m_iPrograms);
+	
+	return fails;
+}
+
+int main()
+{
+	int fails = 0;
+	
+	{
+		flash_model_t model(0x20000);
+		
+		model.m_ubLegacyID[0] = 0xBF;
+		model.m_ubLegacyID[1] = 0x49;
+		model.m_ubAAIByte = 1;
+		model.m_usPageSize = 1;
+		model.m_EraseSizes[0x20] = 0x1000;
+		model.m_EraseSizes[0x52] = 0x8000;
+		
+		fails += Run("SST25VF010A (0xAB ID only)", model, 1, 0x20000, 3, FLASH_PROGRAM_AAI_BYTE, 1, 0x8000);
+	}
+	{
+		flash_model_t model(0x200000);
+		
+		model.m_ubHasJEDEC = 1;
+		model.m_ubJEDEC[0] = 0xBF;
+		model.m_ubJEDEC[1] = 0x25;
+		model.m_ubJEDEC[2] = 0x41;
+		model.m_ubAAIWord = 1;
+		model.m_usPageSize = 1;
+		model.m_EraseSizes[0x20] = 0x1000;
+		model.m_EraseSizes[0x52] = 0x8000;
+		model.m_EraseSizes[0xD8] = 0x10000;
+		
+		fails += Run("SST25VF016B (word AAI)", model, 1, 0x200000, 3, FLASH_PROGRAM_AAI_WORD, 1, 0x8000);
+	}
+	
+	// W25Q128 Basic Flash Parameter Table (JESD216B, 16 DWORDs cut to 11)
+	std::vector<uint32_t> bfpt;
+	uint32_t w25q128[] = {0xFFF920E5, 0x07FFFFFF, 0x6B08EB44, 0xBB42FF08, 0xFFFFFFFE, 0xFF00FFFF, 0xEB40FFFF, 0x520F200C, 0xFF00D810, 0x00A60221, 0x2ED12381};
+	
+	bfpt.assign(w25q128, w25q128 + sizeof(w25q128) / sizeof(w25q128[0]));
+	
+	{
+		flash_model_t model(0x1000000);
+		
+		model.m_ubHasJEDEC = 1;
+		model.m_ubJEDEC[0] = 0xEF;
+		model.m_ubJEDEC[1] = 0x40;
+		model.m_ubJEDEC[2] = 0x18;
+		model.m_usPageSize = 256;
+		model.m_EraseSizes[0x20] = 0x1000;
+		model.m_EraseSizes[0x52] = 0x8000;
+		model.m_EraseSizes[0xD8] = 0x10000;
+		model.m_SFDP = FlashModelSFDP(bfpt);
+		
+		fails += Run("W25Q128 (SFDP)", model, 1, 0x1000000, 3, FLASH_PROGRAM_PAGE, 256, 0x10000);
+	}
+	{
+		std::vector<uint32_t> table(bfpt);
+		
+		table[0] = (table[0] & ~(3UL << 17)) | (1UL << 17); // 3 or 4 byte addressing
+		table[1] = 0x0FFFFFFF; // 256 Mbit
+		table[9] = (table[9] & ~0x0FUL) | 0x03; // Erase multiplier 8, the program one in DWORD11 stays 4
+		
+		flash_model_t model(0x2000000);
+		
+		model.m_ubHasJEDEC = 1;
+		model.m_ubJEDEC[0] = 0xEF;
+		model.m_ubJEDEC[1] = 0x40;
+		model.m_ubJEDEC[2] = 0x19;
+		model.m_usPageSize = 256;
+		model.m_ubCan4Byte = 1;
+		model.m_EraseSizes[0x20] = 0x1000;
+		model.m_EraseSizes[0x52] = 0x8000;
+		model.m_EraseSizes[0xD8] = 0x10000;
+		model.m_SFDP = FlashModelSFDP(table);
+		
+		fails += Run("W25Q256 (SFDP, 4 byte addressing)", model, 1, 0x2000000, 4, FLASH_PROGRAM_PAGE, 256, 0x10000);
+		
+		CHECK(SPI_FLASH::m_Desc.m_ulProgramTimeout == 256 * 4 && SPI_FLASH::m_Desc.m_ulSectorEraseTimeout == 48000UL * 8, "SFDP multipliers");
+	}
+	{
+		std::vector<uint32_t> table(bfpt.begin(), bfpt.begin() + 9); // JESD216 revision 0, no timings
+		
+		table[1] = 0x80000016; // 2^22 bits
+		
+		flash_model_t model(0x80000);
+		
+		model.m_ubHasJEDEC = 1;
+		model.m_ubJEDEC[0] = 0xC2;
+		model.m_ubJEDEC[1] = 0x20;
+		model.m_ubJEDEC[2] = 0x13;
+		model.m_usPageSize = 256;
+		model.m_EraseSizes[0x20] = 0x1000;
+		model.m_EraseSizes[0x52] = 0x8000;
+		model.m_EraseSizes[0xD8] = 0x10000;
+		model.m_SFDP = FlashModelSFDP(table);
+		
+		fails += Run("MX25L4006 (9 DWORD SFDP)", model, 1, 0x80000, 3, FLASH_PROGRAM_PAGE, 256, 0x10000);
+	}
+	{
+		flash_model_t model(0x800000);
+		
+		model.m_ubHasJEDEC = 1;
+		model.m_ubJEDEC[0] = 0x20;
+		model.m_ubJEDEC[1] = 0x20;
+		model.m_ubJEDEC[2] = 0x17;
+		model.m_usPageSize = 256;
+		model.m_EraseSizes[0x20] = 0x1000;
+		model.m_EraseSizes[0xD8] = 0x10000;
+		
+		fails += Run("M25PX64 (no SFDP)", model, 1, 0x800000, 3, FLASH_PROGRAM_PAGE, 256, 0x10000);
+	}
+	{
+		std::vector<uint32_t> table(bfpt);
+		
+		table[1] = 0x00FFFFFF; // 16 Mbit
+		
+		flash_model_t model(0x200000);
+		
+		model.m_ubHasJEDEC = 1;
+		model.m_ubJEDEC[0] = 0xBF;
+		model.m_ubJEDEC[1] = 0x26;
+		model.m_ubJEDEC[2] = 0x41;
+		model.m_usPageSize = 256;
+		model.m_ubLocked = 1;
+		model.m_EraseSizes[0x20] = 0x1000;
+		model.m_EraseSizes[0x52] = 0x8000;
+		model.m_EraseSizes[0xD8] = 0x10000;
+		model.m_SFDP = FlashModelSFDP(table);
+		
+		fails += Run("SST26VF016B (locked at power up)", model, 1, 0x200000, 3, FLASH_PROGRAM_PAGE, 256, 0x10000);
+	}
+	{
+		std::vector<uint32_t> table(bfpt);
+		
+		table[0] |= 3; // No 4 KB erase
+		
+		flash_model_t model(0x1000000);
+		
+		model.m_ubHasJEDEC = 1;
+		model.m_ubJEDEC[0] = 0xEF;
+		model.m_ubJEDEC[1] = 0x40;
+		model.m_ubJEDEC[2] = 0x38;
+		model.m_usPageSize = 256;
+		model.m_SFDP = FlashModelSFDP(table);
+		
+		fails += Run("No 4 KB erase", model, 0, 0, 0, FLASH_PROGRAM_PAGE, 0, 0);
+	}
+	{
+		flash_model_t model(0x20000);
+		
+		model.m_ubLegacyID[0] = 0x12;
+		model.m_ubLegacyID[1] = 0x34;
+		
+		fails += Run("Unknown part", model, 0, 0, 0, FLASH_PROGRAM_PAGE, 0, 0);
+	}
+	
+	printf(fails ? "FAILED (%d)\n" : "ALL OK\n", fails);
+	
+	return fails ? 1 : 0;
+}
\ No newline at end of file
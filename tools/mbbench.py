@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+#
+# mbbench.py
+#
+# Created: 18/10/2026 12:31:19
+# Author: joaob
+#
+# Collects the figures of a bootloader built with BENCHMARK and SOFTDEBUG (see
+# benchmark.cpp) and compares builds against each other.
+#
+# The benchmarks run on every reset before the boot config is read, run
+# captures the debug output until they are done (reset the board meanwhile),
+# with DLOG_TOKENS pass the ELF so the output can be decoded (see mblog.py).
+# benchmarkUART times a real transfer, run sends it the pattern it asks for.
+# report prints the benchmarkReport lines of one or more captures side by side,
+# the last column is how many times faster the last capture is than the first.
+#
+#   tools/mbbench.py run /dev/ttyUSB0 -o spi.txt [-b 19200] [-e MultiBoot.elf]
+#   tools/mbbench.py report spi.txt mspim.txt
+#
+
+import argparse
+import os
+import re
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+BENCH_DONE = 'Benchmarks done'
+BENCH_TIMEOUT = 120
+
+UART_PROMPT = re.compile(r'UART RX: send (\d+) bytes') # benchmarkUART waits for the pattern on the debug UART
+
+# "<name>: <cycles> cycles for <bytes> bytes [<x.yy> cycles/byte] [<rate> B/s]", see benchmarkReport
+REPORT = re.compile(r'(?:\[\w+\] - )?(.+?): (\d+) cycles for (\d+) bytes \[(\d+\.\d+) cycles/byte\] \[(\d+) B/s\]')
+
+def parse(text):
+	results = {}
+	
+	for match in REPORT.finditer(text):
+		name, cycles, size, per_byte, rate = match.groups()
+		results[name] = (int(cycles), int(size), float(per_byte), int(rate))
+	
+	return results
+
+def run(args):
+	from mbflash import Port
+	
+	decoder = None
+	
+	if args.elf:
+		from mblog import Decoder, table_load
+		
+		decoder = Decoder(table_load(args.elf))
+	
+	port = Port(args.port, args.baud)
+	text = ''
+	sent = 0
+	end = time.monotonic() + args.timeout
+	
+	try:
+		while BENCH_DONE not in text and time.monotonic() < end:
+			data = port.read(0.1)
+			chunk = decoder.feed(data) if decoder else data.decode('latin-1')
+			text += chunk
+			sys.stdout.write(chunk)
+			sys.stdout.flush()
+			
+			prompt = UART_PROMPT.search(text, sent)
+			
+			if prompt: # Same pattern benchmarkUARTReceive checks
+				port.write(bytes((i * 7 + 3) & 0xFF for i in range(int(prompt.group(1)))))
+				sent = prompt.end()
+	finally:
+		port.close()
+	
+	if BENCH_DONE not in text:
+		sys.exit('no "%s" within %u s' % (BENCH_DONE, args.timeout))
+	
+	if args.output:
+		open(args.output, 'w').write(text)
+
+def report(args):
+	captures = [parse(open(path, encoding='latin-1').read()) for path in args.captures]
+	names = []
+	
+	for capture in captures:
+		names += [name for name in capture if name not in names]
+	
+	width = max([len(name) for name in names] + [9])
+	print('%-*s' % (width, 'benchmark') + ''.join(' %14s' % os.path.basename(path)[:14] for path in args.captures) + (' %7s' % 'speedup' if len(captures) > 1 else ''))
+	
+	for name in names:
+		line = '%-*s' % (width, name)
+		
+		for capture in captures:
+			line += ' %10s B/s' % (int(args.f_cpu / capture[name][2]) if name in capture and capture[name][2] else '-') # The firmware's own rate is 0 under 100 us
+		
+		if len(captures) > 1 and name in captures[0] and name in captures[-1] and captures[0][name][2]:
+			line += ' %6.2fx' % (captures[0][name][2] / captures[-1][name][2])
+		
+		print(line)
+
+def main():
+	parser = argparse.ArgumentParser(description='Capture and compare the BENCHMARK figures of bootloader builds')
+	commands = parser.add_subparsers(dest='command')
+	commands.required = True
+	
+	capture = commands.add_parser('run', help='capture the benchmark output of one boot')
+	capture.add_argument('port', help='serial port of the debug UART (DUART_PORT)')
+	capture.add_argument('-o', '--output', help='capture file, the input of report')
+	capture.add_argument('-b', '--baud', type=int, default=19200, help='DUART baud rate (default 19200)')
+	capture.add_argument('-e', '--elf', help='bootloader ELF, for builds with DLOG_TOKENS')
+	capture.add_argument('-t', '--timeout', type=int, default=BENCH_TIMEOUT, help='seconds to wait for the benchmarks (default %u)' % BENCH_TIMEOUT)
+	
+	compare = commands.add_parser('report', help='print the figures of captures side by side')
+	compare.add_argument('captures', nargs='+', help='capture files of run (or any saved debug output)')
+	compare.add_argument('-f', '--f-cpu', type=int, default=8000000, help='F_CPU of the builds (default 8000000)')
+	args = parser.parse_args()
+	
+	if args.command == 'run':
+		run(args)
+	else:
+		report(args)
+
+if __name__ == '__main__':
+	main()
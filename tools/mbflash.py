@@ -0,0 +1,288 @@
+#!/usr/bin/env python3
+#
+# mbflash.py
+#
+# Created: 18/10/2026 21:52:10
+# Author: joaob
+#
+# Writes a raw firmware binary (avr-objcopy -O binary) straight into a ROM slot
+# of a bootloader built with BOOT_SERIAL (see serial.h), no external flash
+# staging involved.
+#
+# Pages are sent back to back, up to the window the bootloader reports, each
+# one is acknowledged when it arrives and reported again once it is written and
+# verified. Pages failing their CRC are NAKed and only those are sent again, if
+# the line goes quiet every unacknowledged page of the window is.
+#
+# The bootloader only listens for SERIAL_LISTEN_MS after a reset, HELLO is sent
+# until it is answered, reset the board (or let the port open do it) meanwhile.
+#
+
+import argparse
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+import zlib
+
+SERIAL_SYNC = 0xA5
+SERIAL_REPLY_SYNC = 0x5A
+SERIAL_NO_PAGE = 0xFFFF
+
+SERIAL_FRAME_HELLO = ord('H')
+SERIAL_FRAME_BEGIN = ord('B')
+SERIAL_FRAME_PAGE = ord('D')
+SERIAL_FRAME_END = ord('E')
+SERIAL_FRAME_BOOT = ord('R')
+
+SERIAL_REPLY_INFO = ord('I')
+SERIAL_REPLY_OK = ord('K')
+SERIAL_REPLY_ACK = ord('A')
+SERIAL_REPLY_NAK = ord('N')
+SERIAL_REPLY_PROGRAMMED = ord('P')
+SERIAL_REPLY_ERROR = ord('X')
+
+SERIAL_ERRORS = {
+	1: 'ROM index or image size invalid',
+	2: 'frame not expected now',
+	3: 'page read back different',
+	4: 'image CRC does not match',
+}
+
+SPM_PAGESIZE = 256
+
+HELLO_INTERVAL = 0.05
+REPLY_TIMEOUT = 0.5
+PAGE_RETRIES = 10
+
+class SerialError(Exception):
+	pass
+
+def crc16(data, crc=0xFFFF):
+	# _crc_ccitt_update() of avr-libc (util/crc16.h)
+	for b in data:
+		b ^= crc & 0xFF
+		b = (b ^ (b << 4)) & 0xFF
+		crc = ((b << 8) | (crc >> 8)) ^ (b >> 4) ^ (b << 3)
+		crc &= 0xFFFF
+	
+	return crc
+
+def frame(ftype, body=b''):
+	data = bytes([ftype]) + body
+	
+	return bytes([SERIAL_SYNC]) + data + struct.pack('<H', crc16(data))
+
+class Port:
+	def __init__(self, path, baud):
+		self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+		self.buf = b''
+		
+		if os.isatty(self.fd):
+			tty.setraw(self.fd)
+			
+			attr = termios.tcgetattr(self.fd)
+			speed = getattr(termios, 'B%u' % baud, None)
+			
+			if speed is None:
+				raise SerialError('baud rate %u not supported by termios' % baud)
+			
+			attr[4] = attr[5] = speed
+			attr[2] &= ~(termios.CSTOPB | termios.PARENB | termios.CRTSCTS)
+			attr[2] |= termios.CLOCAL | termios.CREAD
+			
+			termios.tcsetattr(self.fd, termios.TCSANOW, attr)
+			termios.tcflush(self.fd, termios.TCIOFLUSH)
+	
+	def write(self, data):
+		while data:
+			data = data[os.write(self.fd, data):]
+	
+	def read(self, timeout):
+		ready, _, _ = select.select([self.fd], [], [], timeout)
+		
+		if not ready:
+			return b''
+		
+		return os.read(self.fd, 4096)
+	
+	def reply(self, timeout):
+		# SERIAL_REPLY_SYNC, type, 16 bit argument, bytes before the sync are skipped
+		end = time.monotonic() + timeout
+		
+		while True:
+			start = self.buf.find(bytes([SERIAL_REPLY_SYNC]))
+			
+			if start < 0:
+				self.buf = b''
+			elif len(self.buf) - start >= 4:
+				rtype, arg = struct.unpack_from('<BH', self.buf, start + 1)
+				self.buf = self.buf[start + 4:]
+				
+				return rtype, arg
+			else:
+				self.buf = self.buf[start:]
+			
+			left = end - time.monotonic()
+			
+			if left <= 0:
+				return None
+			
+			self.buf += self.read(left)
+	
+	def close(self):
+		os.close(self.fd)
+
+def command(port, data, expect, timeout=REPLY_TIMEOUT, retries=5):
+	for _ in range(retries):
+		port.write(data)
+		
+		end = time.monotonic() + timeout
+		
+		while True:
+			reply = port.reply(max(end - time.monotonic(), 0))
+			
+			if reply is None:
+				break
+			
+			if reply[0] == SERIAL_REPLY_ERROR:
+				raise SerialError(SERIAL_ERRORS.get(reply[1], 'error %u' % reply[1]))
+			
+			if reply[0] == expect:
+				return reply[1]
+			
+			if reply[0] == SERIAL_REPLY_NAK: # Frame damaged on the way, send it again
+				break
+	
+	raise SerialError('no reply to frame 0x%02X' % data[1])
+
+def connect(port, wait):
+	end = time.monotonic() + wait
+	
+	while time.monotonic() < end:
+		port.write(frame(SERIAL_FRAME_HELLO))
+		
+		reply = port.reply(HELLO_INTERVAL)
+		
+		while reply is not None and reply[0] != SERIAL_REPLY_INFO:
+			reply = port.reply(HELLO_INTERVAL)
+		
+		if reply is not None:
+			time.sleep(HELLO_INTERVAL) # HELLOs sent meanwhile are answered too, drop those replies
+			port.buf = b''
+			port.read(0)
+			
+			return reply[1] & 0xFF, reply[1] >> 8
+	
+	raise SerialError('bootloader did not answer HELLO')
+
+def flash(port, data, rom, boot=False, wait=10.0, log=print):
+	stats = {'resent': 0, 'naks': 0, 'timeouts': 0}
+	
+	window, rom_count = connect(port, wait)
+	
+	log('bootloader: window %u pages, %u ROMs' % (window, rom_count))
+	
+	if rom >= rom_count:
+		raise SerialError('ROM %u does not exist' % rom)
+	
+	start = time.monotonic()
+	pages = command(port, frame(SERIAL_FRAME_BEGIN, struct.pack('<BII', rom, len(data), zlib.crc32(data) & 0xFFFFFFFF)), SERIAL_REPLY_OK)
+	
+	def page_frame(page):
+		chunk = data[page * SPM_PAGESIZE:(page + 1) * SPM_PAGESIZE]
+		
+		return frame(SERIAL_FRAME_PAGE, struct.pack('<H', page) + chunk + b'\xFF' * (SPM_PAGESIZE - len(chunk)))
+	
+	programmed = 0 # Pages reported written, the window starts here
+	sent = 0
+	acked = set()
+	retries = 0
+	
+	while programmed < pages:
+		while sent < min(programmed + window, pages):
+			port.write(page_frame(sent))
+			sent += 1
+		
+		reply = port.reply(REPLY_TIMEOUT)
+		
+		if reply is None:
+			# Frames or replies lost, everything in flight that was not acknowledged goes again, the oldest page
+			# always does, it is answered with PROGRAMMED if only that reply got lost
+			stats['timeouts'] += 1
+			retries += 1
+			
+			if retries > PAGE_RETRIES:
+				raise SerialError('no progress at page %u' % programmed)
+			
+			for page in range(programmed, sent):
+				if page not in acked or page == programmed:
+					port.write(page_frame(page))
+					stats['resent'] += 1
+			
+			continue
+		
+		rtype, arg = reply
+		
+		if rtype == SERIAL_REPLY_ACK:
+			acked.add(arg)
+		elif rtype == SERIAL_REPLY_NAK:
+			stats['naks'] += 1
+			
+			if programmed <= arg < sent:
+				acked.discard(arg)
+				port.write(page_frame(arg))
+				stats['resent'] += 1
+		elif rtype == SERIAL_REPLY_PROGRAMMED:
+			if programmed <= arg < sent: # Pages are written in order, every one before it is done too
+				acked.difference_update(range(programmed, arg + 1))
+				programmed = arg + 1
+				retries = 0
+		elif rtype == SERIAL_REPLY_ERROR:
+			raise SerialError(SERIAL_ERRORS.get(arg, 'error %u' % arg))
+	
+	command(port, frame(SERIAL_FRAME_END), SERIAL_REPLY_OK)
+	
+	elapsed = time.monotonic() - start
+	
+	log('ROM %u: %u bytes in %.2f s (%.1f KB/s), %u pages resent, %u NAKs, %u timeouts' % (rom, len(data), elapsed, len(data) / 1024.0 / max(elapsed, 1e-6), stats['resent'], stats['naks'], stats['timeouts']))
+	
+	if boot:
+		try:
+			command(port, frame(SERIAL_FRAME_BOOT, bytes([rom])), SERIAL_REPLY_OK)
+			log('ROM %u set as the normal ROM' % rom)
+		except SerialError:
+			# The session ends on BOOT, a lost OK is never answered again
+			log('no reply to BOOT, check ROM %u is the normal ROM' % rom)
+	
+	return stats
+
+def main():
+	parser = argparse.ArgumentParser(description='Write a firmware binary into a MultiBoot ROM over the serial bootloader protocol')
+	parser.add_argument('port', help='serial port of the bootloader USART (SERIAL_PORT)')
+	parser.add_argument('input', help='raw firmware binary, linked for the address of the ROM')
+	parser.add_argument('-r', '--rom', type=int, required=True, help='index of the ROM to write')
+	parser.add_argument('-b', '--baud', type=int, default=500000, help='SERIAL_BAUD of the bootloader build (default 500000)')
+	parser.add_argument('-w', '--wait', type=float, default=10.0, help='seconds to keep sending HELLO (default 10)')
+	parser.add_argument('--boot', action='store_true', help='make the ROM the normal ROM and end the session')
+	args = parser.parse_args()
+	
+	data = open(args.input, 'rb').read()
+	
+	if not data:
+		parser.error('input is empty')
+	
+	port = Port(args.port, args.baud)
+	
+	try:
+		flash(port, data, args.rom, args.boot, args.wait)
+	except SerialError as e:
+		sys.exit('%s: %s' % (args.port, e))
+	finally:
+		port.close()
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,301 @@
+#!/usr/bin/env python3
+#
+# mbflash_test.py
+#
+# Created: 18/10/2026 22:31:05
+# Author: joaob
+#
+# Runs mbflash.py against a model of the BOOT_SERIAL side of the bootloader
+# (serial.cpp: frame parser, page window, in order programming with a page
+# write time) over a pty, once on a clean line and then with bytes corrupted,
+# bytes dropped and replies lost, and checks the ROM ends up byte for byte equal
+# to the image every time.
+#
+# This only covers the protocol and mbflash.py: the model is Python, not the
+# firmware, so nothing in serial.cpp itself (its ISRs, the SPM timing, the
+# USART setup) is exercised here.
+#
+#   tools/mbflash_test.py [-s size] [-n runs] [--seed N]
+#
+
+import argparse
+import os
+import pty
+import random
+import struct
+import sys
+import threading
+import time
+import tty
+import zlib
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import mbflash
+from mbflash import *
+
+FLASH_SIZE = 0x40000
+ROM_ADDRESSES = [0x00400, 0x20000]
+PAGE_WRITE_TIME = 0.009 # Page erase + page write of the ATmega2561 (2 x 4.5 ms)
+
+HEADER_SIZES = {
+	SERIAL_FRAME_HELLO: 0,
+	SERIAL_FRAME_END: 0,
+	SERIAL_FRAME_BEGIN: 9,
+	SERIAL_FRAME_PAGE: 2,
+	SERIAL_FRAME_BOOT: 1,
+}
+
+class Device:
+	# Mirrors serial.cpp, the line in between is lossy on purpose
+	def __init__(self, fd, window, page_time, corrupt=0.0, drop=0.0, lose=0.0, rng=None):
+		self.fd = fd
+		self.window = window
+		self.page_time = page_time
+		self.corrupt = corrupt
+		self.drop = drop
+		self.lose = lose
+		self.rng = rng or random.Random()
+		self.flash = bytearray(b'\xFF' * FLASH_SIZE)
+		self.normal_rom = 0
+		self.active = False
+		self.done = False
+		self.ended = False
+		self.writing = False
+		self.ready = {}
+		self.next = 0
+		self.pages = 0
+		self.busy_until = 0
+		self.written = 0
+		self.skipped = 0
+		self.stop = False
+		self.state = 'sync'
+	
+	def reply(self, rtype, arg):
+		if self.rng.random() < self.lose:
+			return
+		
+		os.write(self.fd, struct.pack('<BBH', SERIAL_REPLY_SYNC, rtype, arg))
+	
+	def abort(self, error):
+		self.active = False
+		self.reply(SERIAL_REPLY_ERROR, error)
+	
+	def frame(self, ftype, body):
+		if ftype == SERIAL_FRAME_HELLO:
+			self.reply(SERIAL_REPLY_INFO, self.window | (len(ROM_ADDRESSES) << 8))
+		elif ftype == SERIAL_FRAME_BEGIN:
+			rom, self.size, self.crc = struct.unpack('<BII', body[:9])
+			
+			self.ended = False
+			
+			if self.writing:
+				return self.abort(2)
+			
+			if rom >= len(ROM_ADDRESSES) or not self.size or ROM_ADDRESSES[rom] + self.size > FLASH_SIZE - 1:
+				return self.abort(1)
+			
+			self.rom = rom
+			self.address = ROM_ADDRESSES[rom]
+			self.pages = (self.size + SPM_PAGESIZE - 1) // SPM_PAGESIZE
+			self.next = 0
+			self.ready = {}
+			self.image_crc = 0
+			self.active = True
+			self.reply(SERIAL_REPLY_OK, self.pages)
+		elif ftype == SERIAL_FRAME_PAGE:
+			page = struct.unpack('<H', body[:2])[0]
+			
+			if self.active and self.next <= page < self.next + self.window and page < self.pages and page not in self.ready:
+				self.ready[page] = body[2:]
+				self.reply(SERIAL_REPLY_ACK, page)
+			elif self.active and page < self.next:
+				self.reply(SERIAL_REPLY_PROGRAMMED, self.next - 1)
+			elif self.active and page < self.next + self.window and page < self.pages:
+				self.reply(SERIAL_REPLY_ACK, page)
+			else:
+				self.reply(SERIAL_REPLY_NAK, page)
+		elif ftype == SERIAL_FRAME_END:
+			if self.ended:
+				return self.reply(SERIAL_REPLY_OK, 0)
+			
+			if not self.active or self.next != self.pages or self.writing:
+				return self.abort(2)
+			
+			self.active = False
+			
+			if self.image_crc != self.crc:
+				return self.abort(4)
+			
+			self.ended = True
+			self.written += 1
+			self.reply(SERIAL_REPLY_OK, 0)
+		elif ftype == SERIAL_FRAME_BOOT:
+			if body[0] >= len(ROM_ADDRESSES) or self.active:
+				return self.abort(1 if body[0] >= len(ROM_ADDRESSES) else 2)
+			
+			self.normal_rom = body[0]
+			self.done = True
+			self.reply(SERIAL_REPLY_OK, 0)
+	
+	def parse(self, data):
+		for b in data:
+			if self.state == 'sync':
+				if b == SERIAL_SYNC:
+					self.state = 'type'
+			elif self.state == 'type':
+				if b not in HEADER_SIZES:
+					self.state = 'type' if b == SERIAL_SYNC else 'sync'
+					continue
+				
+				self.ftype = b
+				self.body = bytearray()
+				self.length = HEADER_SIZES[b] + (SPM_PAGESIZE if b == SERIAL_FRAME_PAGE else 0)
+				self.state = 'body' if self.length else 'crc'
+				self.crc_bytes = bytearray()
+			elif self.state == 'body':
+				self.body.append(b)
+				
+				if len(self.body) == self.length:
+					self.state = 'crc'
+			else:
+				self.crc_bytes.append(b)
+				
+				if len(self.crc_bytes) < 2:
+					continue
+				
+				self.state = 'sync'
+				
+				if struct.unpack('<H', self.crc_bytes)[0] != crc16(bytes([self.ftype]) + self.body):
+					page = SERIAL_NO_PAGE
+					
+					if self.ftype == SERIAL_FRAME_PAGE and len(self.body) >= 2:
+						page = struct.unpack_from('<H', self.body)[0]
+						
+						if not (self.next <= page < self.next + self.window):
+							page = SERIAL_NO_PAGE
+					
+					self.reply(SERIAL_REPLY_NAK, page)
+					continue
+				
+				self.frame(self.ftype, bytes(self.body))
+	
+	def page_done(self):
+		self.ready.pop(self.next)
+		self.reply(SERIAL_REPLY_PROGRAMMED, self.next)
+		self.next += 1
+	
+	def program(self):
+		# One page at a time, in order, reported once its write time is over, the next ones keep arriving meanwhile
+		if not self.active or time.monotonic() < self.busy_until:
+			return
+		
+		if self.writing:
+			self.writing = False
+			
+			return self.page_done()
+		
+		if self.next >= self.pages or self.next not in self.ready:
+			return
+		
+		offset = self.next * SPM_PAGESIZE
+		size = min(SPM_PAGESIZE, self.size - offset)
+		data = self.ready[self.next][:size]
+		address = self.address + offset
+		
+		self.image_crc = zlib.crc32(data, self.image_crc) & 0xFFFFFFFF
+		
+		if self.flash[address:address + size] == data:
+			self.skipped += 1
+			
+			return self.page_done()
+		
+		self.flash[address:address + size] = data
+		self.busy_until = time.monotonic() + self.page_time
+		self.writing = True
+	
+	def run(self):
+		while not self.stop and not self.done: # The session ends on BOOT
+			try:
+				data = mbflash.select.select([self.fd], [], [], 0.001)[0] and os.read(self.fd, 4096)
+			except OSError:
+				break
+			
+			if data:
+				line = bytearray()
+				
+				for b in data:
+					if self.rng.random() < self.drop:
+						continue
+					
+					if self.rng.random() < self.corrupt:
+						b ^= 1 << self.rng.randrange(8)
+					
+					line.append(b)
+				
+				self.parse(line)
+			
+			self.program()
+
+def run(image, rom, corrupt, drop, lose, seed, quiet):
+	master, slave = pty.openpty()
+	tty.setraw(master)
+	
+	device = Device(master, 4, PAGE_WRITE_TIME, corrupt, drop, lose, random.Random(seed))
+	thread = threading.Thread(target=device.run)
+	thread.start()
+	
+	port = Port(os.ttyname(slave), 500000)
+	
+	try:
+		stats = flash(port, image, rom, True, 5.0, (lambda s: None) if quiet else print)
+	finally:
+		device.stop = True
+		thread.join()
+		port.close()
+		os.close(slave)
+		os.close(master)
+	
+	address = ROM_ADDRESSES[rom]
+	
+	if bytes(device.flash[address:address + len(image)]) != image:
+		raise SerialError('ROM does not match the image')
+	
+	if device.normal_rom != rom:
+		raise SerialError('normal ROM not set')
+	
+	return stats
+
+def main():
+	parser = argparse.ArgumentParser(description='Test mbflash.py against a model of the bootloader serial protocol')
+	parser.add_argument('-s', '--size', type=int, default=32768, help='image size (default 32768)')
+	parser.add_argument('-n', '--runs', type=int, default=3, help='runs per line condition (default 3)')
+	parser.add_argument('--seed', type=int, default=1)
+	args = parser.parse_args()
+	
+	rng = random.Random(args.seed)
+	conditions = [
+		('clean', 0.0, 0.0, 0.0),
+		('corrupted bytes', 0.0002, 0.0, 0.0),
+		('dropped bytes', 0.0, 0.0002, 0.0),
+		('lost replies', 0.0, 0.0, 0.05),
+		('everything', 0.0002, 0.0002, 0.02),
+	]
+	failed = 0
+	
+	for name, corrupt, drop, lose in conditions:
+		for i in range(args.runs):
+			image = bytes(rng.randrange(256) for _ in range(args.size - rng.randrange(SPM_PAGESIZE)))
+			rom = i % len(ROM_ADDRESSES)
+			
+			try:
+				stats = run(image, rom, corrupt, drop, lose, rng.randrange(1 << 30), True)
+				print('%-16s run %u: OK, %u pages resent, %u NAKs, %u timeouts' % (name, i, stats['resent'], stats['naks'], stats['timeouts']))
+			except SerialError as e:
+				print('%-16s run %u: FAILED, %s' % (name, i, e))
+				failed += 1
+	
+	sys.exit(1 if failed else 0)
+
+if __name__ == '__main__':
+	main()
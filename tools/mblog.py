@@ -0,0 +1,377 @@
+#!/usr/bin/env python3
+#
+# mblog.py
+#
+# Created: 18/10/2026 23:40:26
+# Author: joaob
+#
+# Host side of the tokenized debug output (build with SOFTDEBUG and DLOG_TOKENS,
+# see lib/DLOG/DLOG.h).
+#
+# The string table is generated from the bootloader ELF: every log call site
+# leaves a record ("<flags><file>:<line>\0<format>") in the .dlog section,
+# which lib/DLOG/DLOG.ld links non loaded at address 0, its offset there is
+# the ID sent on the wire and the enclosing function is read from the mangled
+# name of the record symbol.
+#
+#   tools/mblog.py table MultiBoot.elf -o dlog.json
+#   tools/mblog.py decode MultiBoot.elf /dev/ttyUSB0 [-b 19200]
+#   tools/mblog.py decode dlog.json capture.bin
+#
+# The output is the same text DPRINTF/DPRINTFLN print without DLOG_TOKENS,
+# bytes outside frames (e.g. the application using the same USART after the
+# boot) are passed through.
+#
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+DLOG_SYNC = 0x1E
+DLOG_SECTION = '.dlog'
+
+DLOG_FLAG_CTX = 1
+DLOG_FLAG_LN = 2
+
+DLOG_ARG_8 = 0
+DLOG_ARG_16 = 1
+DLOG_ARG_32 = 2
+DLOG_ARG_STRING = 3
+
+DLOG_STRING_MAX = 255 # Longer strings mean the frame was lost, resync
+
+SHT_SYMTAB = 2
+
+CONVERSION = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|L|z|j|t)?([diouxXcspS%])')
+
+def elf_sections(elf):
+	if elf[:4] != b'\x7fELF' or elf[5] != 1:
+		raise ValueError('not a little endian ELF')
+	
+	if elf[4] == 1: # ELF32 (AVR)
+		e_shoff, = struct.unpack_from('<I', elf, 32)
+		e_shentsize, e_shnum, e_shstrndx = struct.unpack_from('<HHH', elf, 46)
+		shdr = '<IIIIIIIIII'
+		sym, sym_size = '<IIIBBH', 16
+	else: # ELF64, host builds of the same code
+		e_shoff, = struct.unpack_from('<Q', elf, 40)
+		e_shentsize, e_shnum, e_shstrndx = struct.unpack_from('<HHH', elf, 58)
+		shdr = '<IIQQQQIIQQ'
+		sym, sym_size = '<IBBHQQ', 24
+	
+	sections = [struct.unpack_from(shdr, elf, e_shoff + i * e_shentsize) for i in range(e_shnum)]
+	names = sections[e_shstrndx][4]
+	
+	def name(offset, table):
+		return elf[table + offset:elf.index(b'\0', table + offset)].decode('latin-1')
+	
+	def symbols(index):
+		_, _, _, _, sh_offset, sh_size, sh_link, _, _, _ = sections[index]
+		strtab = sections[sh_link][4]
+		
+		for pos in range(sh_offset, sh_offset + sh_size, sym_size):
+			fields = struct.unpack_from(sym, elf, pos)
+			
+			if elf[4] == 1:
+				st_name, st_value, st_size, st_info, _, st_shndx = fields
+			else:
+				st_name, st_info, _, st_shndx, st_value, st_size = fields
+			
+			yield name(st_name, strtab), st_value, st_shndx, st_size, st_info
+	
+	return [(name(s[0], names),) + s[1:] for s in sections], symbols
+
+def mangled_skip(symbol, pos):
+	# Past the E closing the I/N/X opened at pos, identifiers are skipped by their length
+	depth = 0
+	
+	while pos < len(symbol):
+		if symbol[pos].isdigit():
+			length = re.match(r'\d+', symbol[pos:]).group(0)
+			pos += len(length) + int(length)
+			
+			continue
+		
+		if symbol[pos] == 'L': # Literal (type, value)
+			pos = symbol.find('E', pos) + 1 or len(symbol)
+			
+			continue
+		
+		if symbol[pos] in 'INX':
+			depth += 1
+		elif symbol[pos] == 'E':
+			depth -= 1
+			
+			if not depth:
+				return pos + 1
+		
+		pos += 1
+	
+	return pos
+
+def mangled_function(symbol):
+	# _ZZ<function encoding>E<name>: the record is a static local of the function, keep its unqualified name like __FUNCTION__
+	match = re.match(r'_ZZ(N[rVK]*)?', symbol)
+	
+	if not match:
+		return None
+	
+	pos = match.end()
+	nested = match.group(1) is not None
+	name = None
+	
+	while pos < len(symbol):
+		if symbol[pos] == 'L': # Internal linkage
+			pos += 1
+			
+			continue
+		
+		if symbol[pos].isdigit():
+			length = re.match(r'\d+', symbol[pos:]).group(0)
+			pos += len(length)
+			name = symbol[pos:pos + int(length)]
+			pos += int(length)
+		elif symbol[pos:pos + 2] in ('C1', 'C2', 'C3'): # Constructor, named after its class
+			pos += 2
+		elif symbol[pos:pos + 2] in ('D0', 'D1', 'D2') and name:
+			name = '~' + name
+			pos += 2
+		elif symbol[pos] == 'I' and nested: # Template arguments of a class, the member name follows
+			pos = mangled_skip(symbol, pos)
+			
+			continue
+		else:
+			break
+		
+		if not nested:
+			break
+	
+	return name
+
+def table_from_elf(path):
+	elf = open(path, 'rb').read()
+	sections, symbols = elf_sections(elf)
+	index = [s[0] for s in sections].index(DLOG_SECTION) if DLOG_SECTION in [s[0] for s in sections] else None
+	
+	if index is None:
+		raise ValueError('%s has no %s section, build with SOFTDEBUG and DLOG_TOKENS' % (path, DLOG_SECTION))
+	
+	data = elf[sections[index][4]:sections[index][4] + sections[index][5]]
+	functions = {}
+	
+	for i, section in enumerate(sections):
+		if section[1] == SHT_SYMTAB:
+			for name, value, shndx, _, _ in symbols(i):
+				if shndx == index and mangled_function(name):
+					functions[value] = mangled_function(name)
+	
+	table = {}
+	pos = 0
+	
+	while pos < len(data):
+		if data[pos] == 0: # Alignment padding between records
+			pos += 1
+			
+			continue
+		
+		site_end = data.index(b'\0', pos)
+		format_end = data.index(b'\0', site_end + 1)
+		site = data[pos + 1:site_end].decode('latin-1')
+		
+		table[pos] = {
+			'flags': data[pos] - ord('0'),
+			'site': site,
+			'function': functions.get(pos, os.path.basename(site)),
+			'format': data[site_end + 1:format_end].decode('latin-1'),
+		}
+		pos = format_end + 1
+	
+	return table
+
+def table_load(path):
+	if path.endswith('.json'):
+		return {int(k): v for k, v in json.load(open(path)).items()}
+	
+	return table_from_elf(path)
+
+def conversions(fmt):
+	return [m for m in CONVERSION.finditer(fmt) if m.group(5) != '%']
+
+def format_arg(match, value):
+	flags, width, precision, _, conv = match.groups()
+	spec = '%' + flags + width + ('.' + precision if precision else '')
+	
+	if isinstance(value, bytes):
+		return (spec + 's') % value.decode('latin-1')
+	
+	value, size = value
+	
+	if conv in 'di' and value >= 1 << (size * 8 - 1):
+		value -= 1 << (size * 8)
+	
+	if conv == 'c':
+		return (spec + 'c') % chr(value & 0xFF)
+	
+	if conv in 'sS':
+		return (spec + 's') % value
+	
+	if conv == 'p':
+		return '0x%04X' % value
+	
+	return (spec + {'u': 'd', 'i': 'd'}.get(conv, conv)) % value
+
+def format_record(record, args):
+	out = []
+	last = 0
+	
+	for match, value in zip(conversions(record['format']), args):
+		out.append(record['format'][last:match.start()].replace('%%', '%'))
+		out.append(format_arg(match, value))
+		last = match.end()
+	
+	out.append(record['format'][last:].replace('%%', '%'))
+	text = ''.join(out)
+	
+	if record['flags'] & DLOG_FLAG_CTX:
+		text = '[%s] - %s' % (record['function'], text)
+	
+	if record['flags'] & DLOG_FLAG_LN:
+		text += '\n'
+	
+	return text
+
+class Decoder:
+	def __init__(self, table):
+		self.table = table
+		self.buf = bytearray()
+	
+	def frame(self):
+		# Returns (text, length), None if more bytes are needed, (None, 1) if this is no frame
+		if len(self.buf) < 3:
+			return None
+		
+		record = self.table.get(self.buf[1] | (self.buf[2] << 8))
+		
+		if record is None:
+			return None, 1
+		
+		count = len(conversions(record['format']))
+		pos = 3 + (count + 3) // 4
+		
+		if len(self.buf) < pos:
+			return None
+		
+		codes = [(self.buf[3 + i // 4] >> ((i % 4) * 2)) & 3 for i in range(count)]
+		args = []
+		
+		for code in codes:
+			if code == DLOG_ARG_STRING:
+				end = self.buf.find(b'\0', pos, pos + DLOG_STRING_MAX + 1)
+				
+				if end < 0:
+					return (None, 1) if len(self.buf) > pos + DLOG_STRING_MAX else None
+				
+				args.append(bytes(self.buf[pos:end]))
+				pos = end + 1
+			else:
+				size = 1 << code
+				
+				if len(self.buf) < pos + size:
+					return None
+				
+				args.append((int.from_bytes(self.buf[pos:pos + size], 'little'), size))
+				pos += size
+		
+		return format_record(record, args), pos
+	
+	def feed(self, data):
+		self.buf += data
+		out = []
+		
+		while self.buf:
+			sync = self.buf.find(bytes([DLOG_SYNC]))
+			
+			if sync < 0:
+				sync = len(self.buf)
+			
+			out.append(self.buf[:sync].decode('latin-1'))
+			del self.buf[:sync]
+			
+			if not self.buf:
+				break
+			
+			result = self.frame()
+			
+			if result is None:
+				break
+			
+			text, length = result
+			
+			if text is not None:
+				out.append(text)
+			
+			del self.buf[:length]
+		
+		return ''.join(out)
+
+def main():
+	parser = argparse.ArgumentParser(description='Generate the string table of the tokenized debug output and decode it')
+	commands = parser.add_subparsers(dest='command')
+	commands.required = True
+	
+	table = commands.add_parser('table', help='write the string table of an ELF as JSON')
+	table.add_argument('elf')
+	table.add_argument('-o', '--output', help='output file (default stdout)')
+	
+	decode = commands.add_parser('decode', help='decode a port, capture file or stdin')
+	decode.add_argument('table', help='bootloader ELF or a table written by the table command')
+	decode.add_argument('input', nargs='?', default='-', help='serial port or capture file (default stdin)')
+	decode.add_argument('-b', '--baud', type=int, default=19200, help='DUART baud rate (default 19200)')
+	args = parser.parse_args()
+	
+	try:
+		records = table_load(args.table if args.command == 'decode' else args.elf)
+	except (OSError, ValueError) as e:
+		sys.exit('%s' % e)
+	
+	if args.command == 'table':
+		out = open(args.output, 'w') if args.output else sys.stdout
+		json.dump({str(k): v for k, v in sorted(records.items())}, out, indent=1)
+		out.write('\n')
+		
+		return
+	
+	decoder = Decoder(records)
+	
+	if args.input == '-':
+		read, close = lambda: os.read(sys.stdin.fileno(), 4096), lambda: None
+	elif os.path.exists(args.input) and not os.path.isfile(args.input):
+		sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+		
+		from mbflash import Port
+		
+		port = Port(args.input, args.baud)
+		read, close = lambda: port.read(None), port.close
+	else:
+		f = open(args.input, 'rb')
+		read, close = lambda: f.read(4096), f.close
+	
+	try:
+		while True:
+			data = read()
+			
+			if not data:
+				break
+			
+			sys.stdout.write(decoder.feed(data))
+			sys.stdout.flush()
+	except KeyboardInterrupt:
+		pass
+	finally:
+		close()
+
+if __name__ == '__main__':
+	main()
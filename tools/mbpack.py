@@ -0,0 +1,556 @@
+#!/usr/bin/env python3
+#
+# mbpack.py
+#
+# Created: 18/10/2026 11:40:12
+# Author: joaob
+#
+# Packs a raw firmware binary (avr-objcopy -O binary) into a MultiBoot staged
+# image: image_header_t followed by the payload, ready to be written to the
+# external SPI flash at m_ulLoadROMFlashAddress.
+#
+# Delta images (-f delta) rebuild the new firmware from the ROM already in
+# another slot (--source / --source-rom) using COPY/ADD/RUN ops.
+#
+# Relocatable images (-e firmware.elf -t any) are linked at address 0x00000
+# with -Wl,--emit-relocs, every absolute reference into the flash found in the
+# ELF relocations (JMP/CALL, LDI lo8/hi8/hh8 and pm variants, 16-bit pointers
+# in .data) is listed in a table after the payload and fixed up by the
+# bootloader for the ROM the image is loaded to.
+#
+# Every packed image is decoded again with a model of the bootloader decoder
+# (page by page, same window limits) and compared byte for byte before it is
+# written out.
+#
+
+import argparse
+import struct
+import sys
+import zlib
+
+IMAGE_MAGIC = 0x424D
+IMAGE_FORMAT_RAW = 0
+IMAGE_FORMAT_LZ4 = 1
+IMAGE_FORMAT_DELTA = 2
+IMAGE_TARGET_ANY = 0xFF
+
+LZ4_MIN_MATCH = 4
+LZ4_LAST_LITERALS = 5 # The LZ4 block format ends with at least 5 literals
+LZ4_MATCH_LIMIT = 12 # and the last match must start at least 12 bytes before the end
+
+DELTA_OP_COPY = 0x00
+DELTA_OP_ADD = 0x40
+DELTA_OP_RUN = 0x80
+DELTA_OP_TYPE_MASK = 0xC0
+DELTA_OP_LENGTH_MASK = 0x3F
+DELTA_LENGTH_EXTENDED = 0x3F
+DELTA_BLOCK = 8 # Shortest COPY worth emitting, also the size of the source index keys
+DELTA_MIN_RUN = 4
+
+RELOC_TYPE_NONE = 0
+RELOC_TYPE_CALL = 1
+RELOC_TYPE_LDI_LO8 = 2
+RELOC_TYPE_LDI_HI8 = 3
+RELOC_TYPE_LDI_HH8 = 4
+RELOC_TYPE_LDI_PM_LO8 = 5
+RELOC_TYPE_LDI_PM_HI8 = 6
+RELOC_TYPE_LDI_PM_HH8 = 7
+RELOC_TYPE_WORD = 8
+RELOC_TYPE_WORD_PM = 9
+
+RELOC_ENTRY = '<HB3s'
+RELOC_ENTRY_SIZE = struct.calcsize(RELOC_ENTRY)
+
+# ELF relocation types (binutils include/elf/avr.h) and the table entry type they become
+R_AVR_7_PCREL = 2
+R_AVR_13_PCREL = 3
+R_AVR_DIFF8 = 30
+R_AVR_DIFF16 = 31
+R_AVR_DIFF32 = 32
+R_AVR_TYPES = {
+	4: RELOC_TYPE_WORD, # R_AVR_16
+	5: RELOC_TYPE_WORD_PM, # R_AVR_16_PM
+	6: RELOC_TYPE_LDI_LO8, # R_AVR_LO8_LDI
+	7: RELOC_TYPE_LDI_HI8, # R_AVR_HI8_LDI
+	8: RELOC_TYPE_LDI_HH8, # R_AVR_HH8_LDI
+	12: RELOC_TYPE_LDI_PM_LO8, # R_AVR_LO8_LDI_PM
+	13: RELOC_TYPE_LDI_PM_HI8, # R_AVR_HI8_LDI_PM
+	14: RELOC_TYPE_LDI_PM_HH8, # R_AVR_HH8_LDI_PM
+	18: RELOC_TYPE_CALL, # R_AVR_CALL
+	24: RELOC_TYPE_LDI_PM_LO8, # R_AVR_LO8_LDI_GS
+	25: RELOC_TYPE_LDI_PM_HI8, # R_AVR_HI8_LDI_GS
+}
+EM_AVR = 83
+AVR_DATA_START = 0x800000 # RAM and EEPROM addresses of the ELF are above this, they do not move with the ROM
+
+SPM_PAGESIZE = 256
+
+IMAGE_HEADER = '<HBBBIIIHI'
+IMAGE_HEADER_SIZE = struct.calcsize(IMAGE_HEADER)
+
+def header_pack(fmt, data, payload_size, target_rom, source_rom=0, relocs=b''):
+	return struct.pack(IMAGE_HEADER, IMAGE_MAGIC, fmt, source_rom, target_rom, len(data), payload_size, zlib.crc32(data) & 0xFFFFFFFF, len(relocs) // RELOC_ENTRY_SIZE, zlib.crc32(relocs) & 0xFFFFFFFF)
+
+def reloc_site(rtype, address):
+	# Mirrors RELOC_Prepare() in lib/RELOC/RELOC.cpp, returns the patched bits and the mask of the kept ones
+	if rtype == RELOC_TYPE_CALL:
+		patch = [((address & 0x780000) >> 15) | ((address & 0x040000) >> 18), (address & 0x020000) >> 17, (address & 0x0001FE) >> 1, (address & 0x01FE00) >> 9]
+		return patch, [0x0E, 0xFE, 0x00, 0x00]
+	
+	if RELOC_TYPE_LDI_LO8 <= rtype <= RELOC_TYPE_LDI_PM_HH8:
+		if rtype >= RELOC_TYPE_LDI_PM_LO8:
+			value = (address >> (1 + (rtype - RELOC_TYPE_LDI_PM_LO8) * 8)) & 0xFF
+		else:
+			value = (address >> ((rtype - RELOC_TYPE_LDI_LO8) * 8)) & 0xFF
+		return [value & 0x0F, value >> 4], [0xF0, 0xF0]
+	
+	if rtype in (RELOC_TYPE_WORD, RELOC_TYPE_WORD_PM):
+		if rtype == RELOC_TYPE_WORD_PM:
+			address >>= 1
+		if address > 0xFFFF:
+			raise ValueError('16-bit pointer overflows at this address')
+		return [address & 0xFF, address >> 8], [0x00, 0x00]
+	
+	raise ValueError('unknown relocation type %d' % rtype)
+
+def reloc_apply(data, relocs, base):
+	out = bytearray(data)
+	offset = 0
+	
+	for pos in range(0, len(relocs), RELOC_ENTRY_SIZE):
+		delta, rtype, address = struct.unpack_from(RELOC_ENTRY, relocs, pos)
+		offset += delta
+		
+		if rtype == RELOC_TYPE_NONE:
+			continue
+		
+		patch, keep = reloc_site(rtype, int.from_bytes(address, 'little') + base)
+		
+		for i in range(len(patch)):
+			out[offset + i] = (out[offset + i] & keep[i]) | patch[i]
+	
+	return bytes(out)
+
+def elf_relocs(path, data):
+	elf = open(path, 'rb').read()
+	
+	if elf[:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1:
+		raise ValueError('%s is not a 32-bit little endian ELF' % path)
+	
+	e_machine, = struct.unpack_from('<H', elf, 18)
+	e_phoff, e_shoff = struct.unpack_from('<II', elf, 28)
+	e_phentsize, e_phnum, e_shentsize, e_shnum = struct.unpack_from('<HHHH', elf, 42)
+	
+	if e_machine != EM_AVR:
+		raise ValueError('%s is not an AVR ELF' % path)
+	
+	segments = [struct.unpack_from('<IIIIIIII', elf, e_phoff + i * e_phentsize) for i in range(e_phnum)]
+	sections = [struct.unpack_from('<IIIIIIIIII', elf, e_shoff + i * e_shentsize) for i in range(e_shnum)]
+	
+	def load_offset(vaddr): # Position of a VMA in the flash image (.data is stored at its LMA)
+		for p_type, _, p_vaddr, p_paddr, p_filesz, _, _, _ in segments:
+			if p_type == 1 and p_vaddr <= vaddr < p_vaddr + p_filesz:
+				return p_paddr + vaddr - p_vaddr
+		return None
+	
+	sites = {}
+	
+	for sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size, sh_link, sh_info, _, sh_entsize in sections:
+		if sh_type != 4: # SHT_RELA
+			continue
+		
+		if not sections[sh_info][2] & 0x2: # Relocations of a section that is not loaded (debug info)
+			continue
+		
+		symtab = sections[sh_link]
+		
+		for pos in range(sh_offset, sh_offset + sh_size, sh_entsize):
+			r_offset, r_info, r_addend = struct.unpack_from('<IIi', elf, pos)
+			r_type = r_info & 0xFF
+			st_value, = struct.unpack_from('<I', elf, symtab[4] + (r_info >> 8) * symtab[9] + 4)
+			address = (st_value + r_addend) & 0xFFFFFFFF
+			
+			if r_type in (0, R_AVR_7_PCREL, R_AVR_13_PCREL, R_AVR_DIFF8, R_AVR_DIFF16, R_AVR_DIFF32) or address >= AVR_DATA_START:
+				continue # Relative or not pointing into the flash, valid at any ROM address
+			
+			if r_type not in R_AVR_TYPES:
+				raise ValueError('unsupported relocation %d at 0x%06X' % (r_type, r_offset))
+			
+			offset = load_offset(r_offset)
+			
+			if offset is None or offset >= AVR_DATA_START:
+				continue # Not part of the flash image (e.g. .eeprom)
+			
+			rtype = R_AVR_TYPES[r_type]
+			patch, keep = reloc_site(rtype, address)
+			
+			if offset + len(patch) > len(data):
+				raise ValueError('relocation at 0x%06X is outside of the image' % offset)
+			
+			if any(data[offset + i] & ~keep[i] & 0xFF != patch[i] for i in range(len(patch))):
+				continue # Site was relaxed (e.g. CALL -> RCALL) or resolved through a trampoline, nothing absolute is left there
+			
+			sites[offset] = (rtype, address)
+	
+	table = bytearray()
+	last = 0
+	end = 0
+	
+	for offset in sorted(sites):
+		rtype, address = sites[offset]
+		
+		if offset < end:
+			raise ValueError('overlapping relocations at 0x%06X' % offset)
+		
+		while offset - last > 0xFFFF: # Bridge large gaps with entries that patch nothing
+			table += struct.pack(RELOC_ENTRY, 0xFFFF, RELOC_TYPE_NONE, b'\0\0\0')
+			last += 0xFFFF
+		
+		table += struct.pack(RELOC_ENTRY, offset - last, rtype, address.to_bytes(3, 'little'))
+		last = offset
+		end = offset + len(reloc_site(rtype, address)[0])
+	
+	if len(table) // RELOC_ENTRY_SIZE > 0xFFFF:
+		raise ValueError('too many relocations')
+	
+	return bytes(table)
+
+def lz4_length(out, length):
+	while length >= 0xFF:
+		out.append(0xFF)
+		length -= 0xFF
+	out.append(length)
+
+def lz4_sequence(out, literals, match_len, offset):
+	lit_len = len(literals)
+	token = (min(lit_len, 15) << 4)
+	
+	if match_len:
+		token |= min(match_len - LZ4_MIN_MATCH, 15)
+	
+	out.append(token)
+	
+	if lit_len >= 15:
+		lz4_length(out, lit_len - 15)
+	
+	out += literals
+	
+	if match_len:
+		out += struct.pack('<H', offset)
+		
+		if match_len - LZ4_MIN_MATCH >= 15:
+			lz4_length(out, match_len - LZ4_MIN_MATCH - 15)
+
+def lz4_compress(data, window, chain_limit=64):
+	out = bytearray()
+	chains = {}
+	anchor = 0
+	pos = 0
+	end = len(data)
+	match_end = end - LZ4_MATCH_LIMIT
+	
+	while pos < match_end:
+		key = bytes(data[pos:pos + LZ4_MIN_MATCH])
+		candidates = chains.get(key, [])
+		best_len = 0
+		best_off = 0
+		
+		for cand in reversed(candidates[-chain_limit:]):
+			off = pos - cand
+			
+			if off > window:
+				break
+			
+			length = 0
+			limit = end - LZ4_LAST_LITERALS - pos
+			
+			while length < limit and data[cand + length] == data[pos + length]:
+				length += 1
+			
+			if length > best_len:
+				best_len = length
+				best_off = off
+		
+		if best_len >= LZ4_MIN_MATCH:
+			lz4_sequence(out, data[anchor:pos], best_len, best_off)
+			
+			for i in range(pos, pos + best_len):
+				chains.setdefault(bytes(data[i:i + LZ4_MIN_MATCH]), []).append(i)
+			
+			pos += best_len
+			anchor = pos
+		else:
+			chains.setdefault(key, []).append(pos)
+			pos += 1
+	
+	lz4_sequence(out, data[anchor:], 0, 0)
+	
+	return bytes(out)
+
+class LZ4Decoder:
+	# Mirrors lib/LZ4/LZ4.cpp, including the window checks and the resumable state
+	def __init__(self, payload, window):
+		self.data = payload
+		self.pos = 0
+		self.window_size = window
+		self.window = bytearray(window)
+		self.window_pos = 0
+		self.output_size = 0
+		self.state = 'token'
+		self.length = 0
+		self.nibble = 0
+		self.offset = 0
+	
+	def left(self):
+		return len(self.data) - self.pos
+	
+	def read(self):
+		b = self.data[self.pos]
+		self.pos += 1
+		return b
+	
+	def read_length(self):
+		while True:
+			if not self.left():
+				raise ValueError('truncated length')
+			b = self.read()
+			self.length += b
+			if b != 0xFF:
+				return
+	
+	def output(self, out, b):
+		out.append(b)
+		self.window[self.window_pos] = b
+		self.window_pos = (self.window_pos + 1) & (self.window_size - 1)
+		self.output_size += 1
+	
+	def decode(self, count):
+		out = bytearray()
+		
+		while count:
+			if self.state == 'token':
+				if not self.left():
+					raise ValueError('out of input')
+				token = self.read()
+				self.length = token >> 4
+				self.nibble = token & 0x0F
+				if self.length == 0x0F:
+					self.read_length()
+				self.state = 'literals' if self.length else 'offset'
+			elif self.state == 'literals':
+				while self.length and count:
+					if not self.left():
+						raise ValueError('out of input')
+					self.output(out, self.read())
+					self.length -= 1
+					count -= 1
+				if not self.length:
+					self.state = 'offset'
+			elif self.state == 'offset':
+				if self.left() < 2:
+					raise ValueError('stream ended early')
+				self.offset = self.read() | (self.read() << 8)
+				if not self.offset or self.offset > self.window_size or self.offset > self.output_size:
+					raise ValueError('offset %d outside of the window' % self.offset)
+				self.length = self.nibble
+				if self.length == 0x0F:
+					self.read_length()
+				self.length += LZ4_MIN_MATCH
+				self.state = 'match'
+			else:
+				while self.length and count:
+					self.output(out, self.window[(self.window_pos - self.offset) & (self.window_size - 1)])
+					self.length -= 1
+					count -= 1
+				if not self.length:
+					self.state = 'token'
+		
+		return bytes(out)
+
+def delta_op(out, op, length):
+	if length - 1 < DELTA_LENGTH_EXTENDED:
+		out.append(op | (length - 1))
+	else:
+		out.append(op | DELTA_LENGTH_EXTENDED)
+		out += struct.pack('<H', length)
+
+def delta_add(out, literals):
+	for i in range(0, len(literals), 0xFFFF):
+		chunk = literals[i:i + 0xFFFF]
+		delta_op(out, DELTA_OP_ADD, len(chunk))
+		out += chunk
+
+def delta_compress(data, source, chain_limit=32):
+	index = {}
+	
+	for i in range(len(source) - DELTA_BLOCK + 1):
+		index.setdefault(bytes(source[i:i + DELTA_BLOCK]), []).append(i)
+	
+	out = bytearray()
+	literals = bytearray()
+	pos = 0
+	last_src = -1 # Source offset following the previous COPY, code that did not move matches there
+	
+	while pos < len(data):
+		best_len = 0
+		best_src = 0
+		candidates = index.get(bytes(data[pos:pos + DELTA_BLOCK]), [])[:chain_limit]
+		
+		if 0 <= last_src < len(source) and last_src not in candidates:
+			candidates = [last_src] + candidates
+		
+		for cand in candidates:
+			length = 0
+			limit = min(len(source) - cand, len(data) - pos, 0xFFFF)
+			
+			while length < limit and source[cand + length] == data[pos + length]:
+				length += 1
+			
+			if length > best_len:
+				best_len = length
+				best_src = cand
+		
+		run = 1
+		
+		while pos + run < len(data) and run < 0xFFFF and data[pos + run] == data[pos]:
+			run += 1
+		
+		if best_len >= DELTA_BLOCK and best_len >= run:
+			delta_add(out, literals)
+			literals = bytearray()
+			delta_op(out, DELTA_OP_COPY, best_len)
+			out += struct.pack('<I', best_src)[:3]
+			pos += best_len
+			last_src = best_src + best_len
+		elif run >= DELTA_MIN_RUN:
+			delta_add(out, literals)
+			literals = bytearray()
+			delta_op(out, DELTA_OP_RUN, run)
+			out.append(data[pos])
+			pos += run
+		else:
+			literals.append(data[pos])
+			pos += 1
+			
+			if last_src >= 0:
+				last_src += 1
+	
+	delta_add(out, literals)
+	
+	return bytes(out)
+
+def delta_decode(payload, source, size):
+	# Mirrors lib/DELTA/DELTA.cpp, the bootloader bounds the source at the start of the destination ROM
+	out = bytearray()
+	pos = 0
+	
+	while len(out) < size:
+		op = payload[pos]
+		pos += 1
+		length = (op & DELTA_OP_LENGTH_MASK) + 1
+		
+		if op & DELTA_OP_LENGTH_MASK == DELTA_LENGTH_EXTENDED:
+			length = struct.unpack_from('<H', payload, pos)[0]
+			pos += 2
+		
+		if op & DELTA_OP_TYPE_MASK == DELTA_OP_COPY:
+			src = struct.unpack('<I', payload[pos:pos + 3] + b'\0')[0]
+			pos += 3
+			if src + length > len(source):
+				raise ValueError('copy outside of the source')
+			out += source[src:src + length]
+		elif op & DELTA_OP_TYPE_MASK == DELTA_OP_ADD:
+			out += payload[pos:pos + length]
+			pos += length
+		elif op & DELTA_OP_TYPE_MASK == DELTA_OP_RUN:
+			out += bytes([payload[pos]]) * length
+			pos += 1
+		else:
+			raise ValueError('invalid op 0x%02X' % op)
+	
+	return bytes(out[:size])
+
+def verify(image, data, window, source=None):
+	magic, fmt, _, _, size, payload_size, crc, reloc_count, reloc_crc = struct.unpack_from(IMAGE_HEADER, image)
+	payload = image[IMAGE_HEADER_SIZE:IMAGE_HEADER_SIZE + payload_size]
+	relocs = image[IMAGE_HEADER_SIZE + payload_size:]
+	
+	if magic != IMAGE_MAGIC or size != len(data) or payload_size != len(payload) or reloc_count * RELOC_ENTRY_SIZE != len(relocs):
+		raise ValueError('bad header')
+	
+	if zlib.crc32(relocs) & 0xFFFFFFFF != reloc_crc:
+		raise ValueError('relocation table CRC does not match')
+	
+	if reloc_apply(data, relocs, 0) != bytes(data): # At the address it was linked for the table must describe the image exactly
+		raise ValueError('relocation table does not match the image')
+	
+	out = bytearray()
+	
+	if fmt == IMAGE_FORMAT_LZ4:
+		dec = LZ4Decoder(payload, window)
+		
+		for offset in range(0, size, SPM_PAGESIZE): # Same page sized requests as loadROM
+			out += dec.decode(min(SPM_PAGESIZE, size - offset))
+	elif fmt == IMAGE_FORMAT_DELTA:
+		out += delta_decode(payload, source, size)
+	else:
+		out += payload
+	
+	if bytes(out) != bytes(data):
+		raise ValueError('decoded image does not match the input')
+	
+	if zlib.crc32(out) & 0xFFFFFFFF != crc:
+		raise ValueError('CRC does not match')
+
+def main():
+	parser = argparse.ArgumentParser(description='Pack a firmware binary into a MultiBoot staged image')
+	parser.add_argument('input', help='raw firmware binary')
+	parser.add_argument('output', help='staged image to be written to the external flash')
+	parser.add_argument('-f', '--format', choices=['raw', 'lz4', 'delta'], default='lz4')
+	parser.add_argument('-w', '--window', type=int, default=1024, help='LZ4_WINDOW_SIZE of the bootloader build (default 1024)')
+	parser.add_argument('-t', '--target-rom', type=lambda x: IMAGE_TARGET_ANY if x == 'any' else int(x), required=True, help='index of the ROM the image will be loaded to, or "any" for relocatable images')
+	parser.add_argument('-e', '--elf', help='ELF linked at 0x00000 with -Wl,--emit-relocs, makes the image relocatable')
+	parser.add_argument('-s', '--source', help='binary currently in the source ROM (delta only)')
+	parser.add_argument('-r', '--source-rom', type=int, default=0, help='index of the source ROM in the boot config (delta only)')
+	args = parser.parse_args()
+	
+	if args.window & (args.window - 1):
+		parser.error('window must be a power of 2')
+	
+	if args.format == 'delta' and not args.source:
+		parser.error('delta images need --source')
+	
+	if args.format == 'delta' and args.elf:
+		parser.error('delta images can not be relocated')
+	
+	if args.target_rom == IMAGE_TARGET_ANY and not args.elf:
+		parser.error('images for any ROM need --elf')
+	
+	data = open(args.input, 'rb').read()
+	source = None
+	relocs = elf_relocs(args.elf, data) if args.elf else b''
+	
+	if args.format == 'lz4':
+		payload = lz4_compress(data, args.window)
+		fmt = IMAGE_FORMAT_LZ4
+	elif args.format == 'delta':
+		source = open(args.source, 'rb').read()
+		payload = delta_compress(data, source)
+		fmt = IMAGE_FORMAT_DELTA
+	else:
+		payload = data
+		fmt = IMAGE_FORMAT_RAW
+	
+	image = header_pack(fmt, data, len(payload), args.target_rom, args.source_rom if source else 0, relocs) + payload + relocs
+	
+	verify(image, data, args.window, source)
+	
+	open(args.output, 'wb').write(image)
+	
+	print('%s: %u -> %u bytes (%.1f%%)' % (args.output, len(data), len(image), 100.0 * len(image) / max(len(data), 1)))
+	
+	if relocs:
+		print('%s: %u relocations' % (args.output, len(relocs) // RELOC_ENTRY_SIZE))
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+#
+# mbsize.py
+#
+# Created: 18/10/2026 12:48:03
+# Author: joaob
+#
+# Flash usage of a bootloader build, read straight from the ELF (what avr-size
+# -A reports for .text and .data) and split by module, optionally next to a
+# baseline build.
+#
+# Fails if the bootloader does not start at the boot section (.text=0x1F000 in
+# the project, a word address, 0x3E000 in bytes) or does not fit in it: the
+# 8 KB from there to the end of the ATmega2561 flash hold .text and the .data
+# initializers. The linker enforces the same limit through
+# __TEXT_REGION_LENGTH__ (see MultiBoot.cppproj).
+#
+#   tools/mbsize.py Release/MultiBoot.elf [-c baseline.elf]
+#
+
+import argparse
+import os
+import re
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from mblog import SHT_SYMTAB, elf_sections
+
+BOOT_START = 0x3E000
+FLASH_SIZE = 0x40000
+
+FLASH_SECTIONS = ('.text', '.data')
+STT_FILE = 4
+STB_LOCAL = 0
+
+LIBRARIES = ('CRC32', 'DELTA', 'DLOG', 'LZ4', 'RELOC', 'SPI_FLASH', 'SPI', 'TIMER', 'UART')
+SOURCES = ('serial', 'journal', 'dispatch', 'profile', 'benchmark') # Free functions are named after their file, the rest is main.cpp
+
+def module(symbol, source):
+	# Statics carry the file they came from, globals only their name (namespace, template or prefix)
+	if source:
+		name = os.path.splitext(os.path.basename(source))[0]
+		library = [l for l in LIBRARIES if name == l or name.startswith(l + '_')] # SPI_FLASH_ASYNC.cpp, SPI_BUS.cpp ...
+		
+		return 'lib/' + max(library, key=len) if library else name + '.cpp'
+	
+	match = re.match(r'_ZN?K?(\d+)', symbol)
+	
+	if match:
+		name = symbol[match.end():match.end() + int(match.group(1))]
+		
+		if name in LIBRARIES:
+			return 'lib/' + name
+		
+		for prefix in SOURCES:
+			if name.lower().startswith(prefix):
+				return prefix + '.cpp'
+		
+		return 'main.cpp'
+	
+	if symbol.startswith('__vector'):
+		return 'ISRs'
+	
+	return 'libc/libgcc' # memcpy, vfprintf, __udivmodsi4 ...
+
+def usage(path):
+	elf = open(path, 'rb').read()
+	sections, symbols = elf_sections(elf)
+	names = [s[0] for s in sections]
+	result = {'sections': {}, 'modules': {}}
+	
+	for name in FLASH_SECTIONS + ('.bss', '.noinit'):
+		if name in names:
+			section = sections[names.index(name)]
+			result['sections'][name] = (section[5], section[3])
+	
+	flash = [names.index(name) for name in FLASH_SECTIONS if name in names]
+	attributed = 0
+	
+	for i, section in enumerate(sections):
+		if section[1] != SHT_SYMTAB:
+			continue
+		
+		source = None
+		seen = set()
+		
+		for name, value, shndx, size, info in symbols(i):
+			if info & 0x0F == STT_FILE: # The locals of that file follow
+				source = name
+			elif shndx in flash and size and (shndx, value) not in seen: # Aliases (constructor variants) once
+				group = module(name, source if info >> 4 == STB_LOCAL else None)
+				result['modules'][group] = result['modules'].get(group, 0) + size
+				attributed += size
+				seen.add((shndx, value))
+	
+	used = sum(result['sections'].get(name, (0, 0))[0] for name in FLASH_SECTIONS)
+	result['modules']['(vectors, startup, padding)'] = used - attributed
+	result['used'] = used
+	
+	return result
+
+def main():
+	parser = argparse.ArgumentParser(description='Flash usage of a bootloader build and the boot section check')
+	parser.add_argument('elf', help='bootloader ELF')
+	parser.add_argument('-c', '--compare', help='baseline ELF, printed next to it with the difference')
+	args = parser.parse_args()
+	
+	builds = [usage(args.compare)] if args.compare else []
+	builds.append(usage(args.elf))
+	
+	def row(label, values):
+		line = '%-30s' % label + ''.join(' %8s' % v for v in values)
+		
+		if len(values) > 1 and all(isinstance(v, int) for v in values):
+			line += ' %+8d' % (values[-1] - values[0])
+		
+		print(line)
+	
+	row('', ['baseline', 'build', 'delta'] if args.compare else ['build'])
+	
+	for name in FLASH_SECTIONS + ('.bss', '.noinit'):
+		if any(name in b['sections'] for b in builds):
+			row(name, [b['sections'].get(name, (0, 0))[0] for b in builds])
+	
+	print()
+	
+	modules = sorted(set(m for b in builds for m in b['modules']), key=lambda m: -builds[-1]['modules'].get(m, 0))
+	
+	for name in modules:
+		row(name, [b['modules'].get(name, 0) for b in builds])
+	
+	print()
+	
+	build = builds[-1]
+	text = build['sections'].get('.text', (0, 0))
+	free = FLASH_SIZE - BOOT_START - build['used']
+	
+	row('boot section (8192 bytes)', [b['used'] for b in builds])
+	print('%u bytes free' % free if free >= 0 else '%u bytes over' % -free)
+	
+	if text[1] != BOOT_START:
+		sys.exit('.text starts at 0x%05X, not at the boot section (0x%05X)' % (text[1], BOOT_START))
+	
+	if free < 0:
+		sys.exit('the bootloader does not fit in the boot section')
+
+if __name__ == '__main__':
+	main()